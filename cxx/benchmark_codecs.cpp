@@ -0,0 +1,177 @@
+/**
+ * Compares the block codecs of CompressedColumnOrderDataset (see block_codec.h) on a dataset:
+ * for every configuration in `--configs`, the dataset is compressed with the codecs it allows,
+ * and the driver reports the size of every column, how many of its blocks each codec encoded,
+ * and the scan throughput of decoding, filtering and summing the column.
+ *  - for: frame-of-reference packing only, as before the codecs were added (and raw blocks for
+ *    values too far apart to pack).
+ *  - adaptive: every codec, traded off against its decode cost with the default weight.
+ *  - smallest: every codec, picking the smallest encoding of every block.
+ *
+ * With `--indexer-spec`, the data is first sorted by that index, as in the experiments, since
+ * how well columns compress depends on their order.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <sysexits.h>
+#include <vector>
+
+#include "types.h"
+#include "flags.h"
+#include "block_codec.h"
+#include "index_builder.h"
+#include "compressed_column_order_dataset.h"
+#include "utils.h"
+
+using namespace std;
+
+// Runs `scan` over the whole column `repeats` times and returns the throughput in million rows
+// per second. The scans return a checksum, so that the compiler can't drop them.
+template <typename F>
+double time_scan(size_t size, size_t repeats, Scalar* checksum, F scan) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < repeats; r++) {
+        for (size_t i = 0; i < size; i += 64) {
+            *checksum += scan(i, std::min(size, i + 64));
+        }
+    }
+    auto finish = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+    return repeats * size / (ns / 1e3);
+}
+
+void run_config(const std::string& config,
+        const std::vector<Point<DIM>>& data,
+        size_t repeats,
+        std::ofstream& savefile) {
+    if (config == "for") {
+        BlockCodecs::SetAllowed(1u << BLOCK_PACKED);
+        BlockCodecs::SetCostWeight(BlockCodecs::DEFAULT_COST_WEIGHT);
+    } else if (config == "adaptive") {
+        BlockCodecs::SetAllowed(BlockCodecs::ALL);
+        BlockCodecs::SetCostWeight(BlockCodecs::DEFAULT_COST_WEIGHT);
+    } else if (config == "smallest") {
+        BlockCodecs::SetAllowed(BlockCodecs::ALL);
+        BlockCodecs::SetCostWeight(0);
+    } else {
+        std::cerr << "Unknown config " << config << std::endl;
+        return;
+    }
+    cout << endl << "Config " << config << endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    CompressedColumnOrderDataset<DIM> dataset(data);
+    auto finish = std::chrono::high_resolution_clock::now();
+    long build_ms = std::chrono::duration_cast<std::chrono::milliseconds>(finish - start).count();
+
+    size_t size = dataset.Size();
+    // Every point has DIM values and a key.
+    double raw_bytes = (double) size * (DIM + 1) * sizeof(Scalar);
+    savefile << config << "_build_time_ms: " << build_ms << std::endl
+        << config << "_size_bytes: " << dataset.SizeInBytes() << std::endl
+        << config << "_compression_ratio: " << raw_bytes / dataset.SizeInBytes() << std::endl;
+    cout << "Built in " << build_ms << "ms, " << dataset.SizeInBytes() << " bytes, ratio "
+        << raw_bytes / dataset.SizeInBytes() << endl;
+
+    Scalar checksum = 0;
+    for (size_t d = 0; d < DIM; d++) {
+        std::string prefix = config + "_col" + std::to_string(d);
+        std::vector<size_t> encodings = dataset.ColumnEncodings(d);
+        savefile << prefix << "_bytes: " << dataset.ColumnSizeInBytes(d) << std::endl
+            << prefix << "_bits_per_value: " << dataset.ColumnSizeInBytes(d) * 8.0 / size
+            << std::endl;
+        cout << "Column " << d << ": " << dataset.ColumnSizeInBytes(d) * 8.0 / size
+            << " bits per value, blocks";
+        for (size_t e = 0; e < NUM_BLOCK_ENCODINGS; e++) {
+            const char* name = BlockCodecs::Get(e).Name();
+            savefile << prefix << "_" << name << "_blocks: " << encodings[e] << std::endl;
+            cout << " " << name << "=" << encodings[e];
+        }
+        cout << endl;
+
+        // The middle half of the column's values.
+        Scalar min = std::numeric_limits<Scalar>::max();
+        Scalar max = std::numeric_limits<Scalar>::lowest();
+        for (const auto& p : data) {
+            min = std::min(min, p[d]);
+            max = std::max(max, p[d]);
+        }
+        __int128 span = (__int128) max - min;
+        Scalar lower = min + (Scalar) (span / 4);
+        Scalar upper = min + (Scalar) (span / 4 * 3);
+
+        double decode = time_scan(size, repeats, &checksum, [&](size_t s, size_t e) {
+            Scalar vals[64];
+            dataset.DecodeRange(s, e, d, vals);
+            return vals[0];
+        });
+        double filter = time_scan(size, repeats, &checksum, [&](size_t s, size_t e) {
+            return (Scalar) dataset.GetCoordRange(s, e, d, lower, upper);
+        });
+        double sum = time_scan(size, repeats, &checksum, [&](size_t s, size_t e) {
+            return dataset.GetRangeSum(s, e, d, ~0UL);
+        });
+        savefile << prefix << "_decode_mrows_per_s: " << decode << std::endl
+            << prefix << "_filter_mrows_per_s: " << filter << std::endl
+            << prefix << "_sum_mrows_per_s: " << sum << std::endl;
+        cout << "Column " << d << " (M rows/s): decode " << decode << ", filter " << filter
+            << ", sum " << sum << endl;
+    }
+    cout << "Checksum " << checksum << endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Expected arguments: --dataset [--base-cols] [--indexer-spec] [--configs] "
+            << "[--repeats] [--save]" << std::endl;
+        return EX_USAGE;
+    }
+    auto flags = ParseFlags(argc, argv);
+
+    cout << "Dimension is " << DIM << endl;
+
+    std::string dataset_file = GetRequired(flags, "dataset");
+    std::vector<Point<DIM>> data;
+    size_t base_cols = std::stoi(GetWithDefault(flags, "base-cols", "0"));
+    if (base_cols > 0) {
+        data = load_binary_dataset_with_repl<DIM>(dataset_file, base_cols);
+    } else {
+        data = load_binary_file< Point<DIM> >(dataset_file);
+    }
+    std::cout << "Loaded dataset" << std::endl;
+
+    std::string spec = GetWithDefault(flags, "indexer-spec", "");
+    if (!spec.empty()) {
+        IndexBuilder<DIM> ix_builder;
+        auto indexer = ix_builder.Build(spec);
+        indexer->Init(data.begin(), data.end());
+    }
+
+    auto cur_timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    string filename = "default.out";
+    string save_file_base = GetWithDefault(flags, "save", "");
+    if (!save_file_base.empty()) {
+        filename = save_file_base + "_" + std::to_string(cur_timestamp);
+    }
+    std::ofstream results(filename);
+    assert (results.is_open());
+    results << "timestamp: " << cur_timestamp << std::endl
+        << "name: " << GetWithDefault(flags, "name", "") << std::endl
+        << "dataset: " << dataset_file << std::endl
+        << "index_spec: " << spec << std::endl
+        << "num_points: " << data.size() << std::endl;
+
+    size_t repeats = std::max<size_t>(1, std::stoul(GetWithDefault(flags, "repeats", "3")));
+    std::vector<std::string> configs = GetCommaSeparated(flags, "configs");
+    if (configs.empty()) {
+        configs = {"for", "adaptive", "smallest"};
+    }
+    for (const std::string& config : configs) {
+        run_config(config, data, repeats, results);
+    }
+    BlockCodecs::SetAllowed(BlockCodecs::ALL);
+    BlockCodecs::SetCostWeight(BlockCodecs::DEFAULT_COST_WEIGHT);
+    results.close();
+    std::cout << "Results written to " << filename << std::endl;
+}
@@ -0,0 +1,264 @@
+/**
+ * Measures the latency distribution and throughput of workloads, rather than the single average
+ * reported by run_correlation_index:
+ *  - Each workload is first run `--warmup` times without measuring, so that caches, the page
+ *    table and the indexer's lazily built structures are warm.
+ *  - It is then run `--repeats` times. Every query's latency goes into a histogram, reported as
+ *    p50/p90/p99/p99.9/max, and each repeat's wall time gives the throughput.
+ *  - With `--concurrency=1`, queries run one at a time and each scan uses `--threads` threads.
+ *    With more, that many queries run side by side (see QueryEngine::ExecuteBatch), each scanned
+ *    on a single thread, which measures throughput under a fixed concurrency.
+ *  - The time spent in each phase of a query (index probe, key lookup, merge, range and list
+ *    scans) comes from the engine's trace spans, for the queries picked by `--trace-sampling`.
+ *    Phase percentiles cover the last sampled queries each thread keeps per repeat.
+ *
+ * Results are written in the key-value format of run_correlation_index to the save file, and as
+ * JSON to the save file with a .json extension.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <sysexits.h>
+#include <vector>
+
+#include "types.h"
+#include "flags.h"
+#include "index_builder.h"
+#include "compressed_column_order_dataset.h"
+#include "latency_histogram.h"
+#include "query_engine.h"
+#include "trace.h"
+#include "visitor.h"
+#include "utils.h"
+
+using namespace std;
+
+std::unique_ptr<Visitor<DIM>> MakeVisitor(const std::string& visitor_type) {
+    if (visitor_type == "collect") {
+        return std::unique_ptr<Visitor<DIM>>(new CollectVisitor<DIM>());
+    } else if (visitor_type == "count") {
+        return std::unique_ptr<Visitor<DIM>>(new CountVisitor<DIM>());
+    } else if (visitor_type == "index") {
+        return std::unique_ptr<Visitor<DIM>>(new IndexVisitor<DIM>());
+    } else if (visitor_type == "sum") {
+        return std::unique_ptr<Visitor<DIM>>(new SumVisitor<DIM>(1));
+    }
+    return std::unique_ptr<Visitor<DIM>>(new DummyVisitor<DIM>());
+}
+
+// Runs the workload once and returns its wall time. Queries are copied, since the indexer may
+// rewrite them.
+long run_once(QueryEngine<DIM>& engine,
+        const std::vector<Query<DIM>>& workload,
+        const std::string& visitor_type,
+        size_t concurrency,
+        std::vector<long>* query_times) {
+    std::vector<Query<DIM>> queries = workload;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (concurrency > 1) {
+        engine.ExecuteBatch(queries,
+                [&visitor_type](size_t) { return MakeVisitor(visitor_type); }, query_times);
+    } else {
+        query_times->assign(queries.size(), 0);
+        for (size_t i = 0; i < queries.size(); i++) {
+            auto visitor = MakeVisitor(visitor_type);
+            auto query_start = std::chrono::high_resolution_clock::now();
+            engine.Execute(queries[i], *visitor);
+            auto query_end = std::chrono::high_resolution_clock::now();
+            (*query_times)[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    query_end - query_start).count();
+        }
+    }
+    auto finish = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+}
+
+void run_benchmark(QueryEngine<DIM>& engine,
+        const std::string& visitor_type,
+        const std::string& workload_file,
+        size_t warmup,
+        size_t repeats,
+        size_t concurrency,
+        std::ofstream& savefile,
+        std::ofstream& jsonfile) {
+
+    std::vector<Query<DIM>> workload = load_query_file<DIM>(workload_file);
+    size_t num_queries = workload.size();
+    cout << endl << "Starting workload " << workload_file << "(" << num_queries << " queries, "
+        << warmup << " warmup runs, " << repeats << " repeats)" << endl;
+
+    std::vector<long> query_times;
+    for (size_t i = 0; i < warmup; i++) {
+        run_once(engine, workload, visitor_type, concurrency, &query_times);
+    }
+    engine.Reset();
+    Trace::Reset();
+
+    LatencyHistogram latency;
+    LatencyHistogram phases[NUM_TRACE_SPANS];
+    uint64_t phase_ns[NUM_TRACE_SPANS] = {};
+    uint64_t phase_count[NUM_TRACE_SPANS] = {};
+    uint64_t sampled_queries = 0;
+    std::vector<double> throughputs;
+    long total_time = 0;
+    for (size_t r = 0; r < repeats; r++) {
+        long tt = run_once(engine, workload, visitor_type, concurrency, &query_times);
+        total_time += tt;
+        throughputs.push_back(num_queries / (tt / 1e9));
+        for (long t : query_times) {
+            latency.Record(t);
+        }
+        TraceSnapshot snapshot = Trace::Snapshot();
+        for (const QueryTrace& q : snapshot.recent) {
+            for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+                phases[s].Record(q.span_ns[s]);
+            }
+        }
+        for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+            phase_ns[s] += snapshot.span_ns[s];
+            phase_count[s] += snapshot.span_count[s];
+        }
+        sampled_queries += snapshot.Counter(TraceCounter::SampledQueries);
+        Trace::Reset();
+        std::cout << "Repeat " << r << ": " << tt / 1e6 << "ms, "
+            << throughputs.back() << " queries/s" << std::endl;
+    }
+    double throughput = repeats * num_queries / (total_time / 1e9);
+
+    std::cout << "Query time (ns): p50 " << latency.Percentile(50)
+        << ", p90 " << latency.Percentile(90)
+        << ", p99 " << latency.Percentile(99)
+        << ", p999 " << latency.Percentile(99.9)
+        << ", max " << latency.Max() << std::endl;
+    std::cout << "Throughput (queries/s): " << throughput << std::endl;
+    for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+        std::cout << "Avg " << Trace::Name(static_cast<TraceSpan>(s)) << " time (ns): "
+            << (sampled_queries == 0 ? 0 : phase_ns[s] / (double) sampled_queries) << std::endl;
+    }
+
+    savefile << "workload: " << workload_file << std::endl
+            << "num_queries: " << num_queries << std::endl
+            << "visitor: " << visitor_type << std::endl
+            << "warmup: " << warmup << std::endl
+            << "repeats: " << repeats << std::endl
+            << "concurrency: " << concurrency << std::endl;
+    engine.WriteStats(savefile);
+    savefile << "avg_query_time_ns: " << latency.Mean() << std::endl
+            << "p50_query_time_ns: " << latency.Percentile(50) << std::endl
+            << "p90_query_time_ns: " << latency.Percentile(90) << std::endl
+            << "p99_query_time_ns: " << latency.Percentile(99) << std::endl
+            << "p999_query_time_ns: " << latency.Percentile(99.9) << std::endl
+            << "max_query_time_ns: " << latency.Max() << std::endl
+            << "throughput_qps: " << throughput << std::endl;
+
+    jsonfile << "    {\n      \"workload\": \"" << workload_file << "\""
+        << ",\n      \"num_queries\": " << num_queries
+        << ",\n      \"visitor\": \"" << visitor_type << "\""
+        << ",\n      \"warmup\": " << warmup
+        << ",\n      \"repeats\": " << repeats
+        << ",\n      \"concurrency\": " << concurrency
+        << ",\n      \"scanned_points\": " << engine.ScannedPoints()
+        << ",\n      \"throughput_qps\": " << throughput
+        << ",\n      \"repeat_throughput_qps\": [";
+    for (size_t r = 0; r < throughputs.size(); r++) {
+        jsonfile << (r == 0 ? "" : ", ") << throughputs[r];
+    }
+    jsonfile << "],\n      \"query_time_ns\": ";
+    latency.WriteJson(jsonfile);
+    jsonfile << ",\n      \"sampled_queries\": " << sampled_queries
+        << ",\n      \"phases\": {";
+    for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+        jsonfile << (s == 0 ? "\n" : ",\n") << "        \""
+            << Trace::Name(static_cast<TraceSpan>(s)) << "\": {\"spans\": " << phase_count[s]
+            << ", \"total_ns\": " << phase_ns[s] << ", \"per_query_ns\": ";
+        phases[s].WriteJson(jsonfile);
+        jsonfile << "}";
+    }
+    jsonfile << "\n      }\n    }";
+    engine.Reset();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Expected arguments: --dataset --workload --visitor "
+            << "--indexer-spec --save [--base-cols] [--threads] [--concurrency] [--warmup] "
+            << "[--repeats] [--trace-sampling] [--dictionary-dims] [--sum-cubes]" << std::endl;
+        return EX_USAGE;
+    }
+    auto flags = ParseFlags(argc, argv);
+
+    cout << "Dimension is " << DIM << endl;
+
+    std::string dataset_file = GetRequired(flags, "dataset");
+    std::vector<Point<DIM>> data;
+    size_t base_cols = std::stoi(GetWithDefault(flags, "base-cols", "0"));
+    if (base_cols > 0) {
+        data = load_binary_dataset_with_repl<DIM>(dataset_file, base_cols);
+    } else {
+        data = load_binary_file< Point<DIM> >(dataset_file);
+    }
+    vector<string> workload_files = GetCommaSeparated(flags, "workload");
+    std::cout << "Loaded dataset and workload" << std::endl;
+
+    IndexBuilder<DIM> ix_builder;
+    auto indexer = ix_builder.Build(GetRequired(flags, "indexer-spec"));
+    if (indexer->Init(data.begin(), data.end())) {
+        std::cout << "Data was modified. Aborting..." << std::endl;
+        return 0;
+    }
+    std::vector<size_t> dictionary_dims;
+    for (const std::string& dim : GetCommaSeparated(flags, "dictionary-dims")) {
+        dictionary_dims.push_back(std::stoul(dim));
+    }
+    // Prefix sums of these columns let SUMs over exact index ranges skip the scan.
+    std::vector<Datacube<DIM>> cubes;
+    for (const std::string& dim : GetCommaSeparated(flags, "sum-cubes")) {
+        cubes.push_back(Datacube<DIM>::PrefixSum(std::stoul(dim)));
+    }
+    auto dataset = std::make_shared<CompressedColumnOrderDataset<DIM>>(data, std::vector<Scalar>(),
+            cubes, dictionary_dims);
+    indexer->SetDataset(dataset);
+    std::cout << "Indexer size (B): " << indexer->Size() << std::endl;
+
+    size_t concurrency = std::stoul(GetWithDefault(flags, "concurrency", "1"));
+    size_t warmup = std::stoul(GetWithDefault(flags, "warmup", "1"));
+    size_t repeats = std::max<size_t>(1, std::stoul(GetWithDefault(flags, "repeats", "5")));
+    QueryEngine<DIM> engine(dataset, indexer);
+    // Under concurrency, the engine's threads run whole queries side by side.
+    engine.SetNumThreads(concurrency > 1 ? concurrency
+            : std::stoul(GetWithDefault(flags, "threads", "1")));
+    Trace::SetSampling(std::stoul(GetWithDefault(flags, "trace-sampling", "1")));
+
+    auto cur_timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    string filename = "default.out";
+    string save_file_base = GetWithDefault(flags, "save", "");
+    if (!save_file_base.empty()) {
+        filename = save_file_base + "_" + std::to_string(cur_timestamp);
+    }
+    std::ofstream results(filename);
+    std::ofstream json(filename + ".json");
+    assert (results.is_open() && json.is_open());
+    results << "timestamp: " << cur_timestamp << std::endl
+        << "name: " << GetWithDefault(flags, "name", "") << std::endl
+        << "dataset: " << dataset_file << std::endl
+        << "index_spec: " << GetRequired(flags, "indexer-spec") << std::endl
+        << "index_size: " << indexer->Size() << std::endl;
+    json << "{\n  \"timestamp\": " << cur_timestamp
+        << ",\n  \"name\": \"" << GetWithDefault(flags, "name", "") << "\""
+        << ",\n  \"dataset\": \"" << dataset_file << "\""
+        << ",\n  \"index_spec\": \"" << GetRequired(flags, "indexer-spec") << "\""
+        << ",\n  \"index_size\": " << indexer->Size()
+        << ",\n  \"trace_sampling\": " << Trace::Sampling()
+        << ",\n  \"workloads\": [";
+
+    string visitor_type = GetRequired(flags, "visitor");
+    for (size_t work_ix = 0; work_ix < workload_files.size(); work_ix++) {
+        json << (work_ix == 0 ? "\n" : ",\n");
+        run_benchmark(engine, visitor_type, workload_files[work_ix], warmup, repeats,
+                concurrency, results, json);
+        cout << endl << "==========================" << endl;
+    }
+    json << "\n  ]\n}" << std::endl;
+}
@@ -0,0 +1,115 @@
+/**
+ * Compares the placement of the dataset's memory on NUMA machines, for parallel scans of a
+ * synthetic dataset:
+ *  - first_touch: the dataset is built by one thread, so all of it lands on that thread's node
+ *    (what every other driver does).
+ *  - interleaved: the dataset's pages are spread round-robin over all nodes.
+ *  - partitioned: a NumaPartitionedDataset, with one slice of rows per node and scans routed to
+ *    threads on the node that owns each slice.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+#include "flags.h"
+#include "compressed_column_order_dataset.h"
+#include "numa_partitioned_dataset.h"
+#include "numa_utils.h"
+#include "primary_btree_index.h"
+#include "query_engine.h"
+#include "visitor.h"
+
+using namespace std;
+
+const size_t BENCH_DIM = 4;
+
+// Builds the dataset with every page placed by `policy` (run on the builder thread).
+template <typename Policy>
+std::shared_ptr<Dataset<BENCH_DIM>> BuildOnThread(const vector<Point<BENCH_DIM>>& data,
+        Policy policy) {
+    std::shared_ptr<Dataset<BENCH_DIM>> dataset;
+    std::thread builder([&] {
+        policy();
+        dataset = std::make_shared<CompressedColumnOrderDataset<BENCH_DIM>>(
+                data, std::vector<Datacube<BENCH_DIM>>());
+    });
+    builder.join();
+    return dataset;
+}
+
+int main(int argc, char** argv) {
+    auto flags = ParseFlags(argc, argv);
+    size_t num_points = std::stoul(GetWithDefault(flags, "num_points", "50000000"));
+    size_t num_queries = std::stoul(GetWithDefault(flags, "num_queries", "50"));
+    size_t num_threads = std::stoul(GetWithDefault(flags, "threads",
+                std::to_string(std::thread::hardware_concurrency())));
+    // Fraction of the rows each query's range on dim 0 covers.
+    double selectivity = std::stod(GetWithDefault(flags, "selectivity", "0.5"));
+    std::vector<std::string> modes = GetCommaSeparated(flags, "modes");
+    if (modes.empty()) {
+        modes = {"first_touch", "interleaved", "partitioned"};
+    }
+    std::cout << "NUMA nodes: " << NumaUtils::NumNodes() << std::endl;
+
+    std::mt19937_64 gen(42);
+    const Scalar domain = 1000000;
+    std::uniform_int_distribution<Scalar> value(0, domain - 1);
+    vector<Point<BENCH_DIM>> data(num_points);
+    for (auto& p : data) {
+        for (size_t d = 0; d < BENCH_DIM; d++) {
+            p[d] = value(gen);
+        }
+    }
+    auto indexer = std::make_shared<PrimaryBTreeIndex<BENCH_DIM>>(0, 1024);
+    indexer->Init(data.begin(), data.end());
+
+    vector<Query<BENCH_DIM>> workload(num_queries);
+    Scalar width = (Scalar)(selectivity * domain);
+    std::uniform_int_distribution<Scalar> lo(0, std::max((Scalar)0, domain - width));
+    for (auto& q : workload) {
+        Scalar start = lo(gen);
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{start, start + width}}, .values = {}};
+        q.filters[1] = {.present = true, .is_range = true, .ranges = {{0, domain / 2}}, .values = {}};
+        for (size_t d = 2; d < BENCH_DIM; d++) {
+            q.filters[d] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        }
+    }
+
+    for (const std::string& mode : modes) {
+        std::shared_ptr<Dataset<BENCH_DIM>> dataset;
+        if (mode == "first_touch") {
+            dataset = BuildOnThread(data, [] {});
+        } else if (mode == "interleaved") {
+            dataset = BuildOnThread(data, [] { NumaUtils::InterleaveAllocations(); });
+        } else if (mode == "partitioned") {
+            dataset = std::make_shared<NumaPartitionedDataset<BENCH_DIM>>(data);
+        } else {
+            std::cerr << "Unknown mode " << mode << std::endl;
+            continue;
+        }
+        QueryEngine<BENCH_DIM> engine(dataset, indexer);
+        engine.SetNumThreads(num_threads);
+        size_t total = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& query : workload) {
+            Query<BENCH_DIM> q = query;
+            SumVisitor<BENCH_DIM> visitor(2);
+            engine.Execute(q, visitor);
+            total += visitor.sum != 0;
+        }
+        auto finish = std::chrono::high_resolution_clock::now();
+        double tt = std::chrono::duration_cast<std::chrono::nanoseconds>(finish-start).count();
+        std::cout << "mode: " << mode
+            << ", threads: " << num_threads
+            << ", avg query time (ms): " << tt / num_queries / 1e6
+            << ", scan rate (M rows/s): " << engine.ScannedPoints() / (tt / 1e3)
+            << ", nonempty: " << total << std::endl;
+    }
+    return 0;
+}
@@ -47,7 +47,10 @@ class BinarySearchIndex : public PrimaryIndexer<D> {
 
     bool Init(PointIterator<D> start, PointIterator<D> end) override;
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override; 
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override; 
+
+    // Runs the binary searches for one filter range (or value) at a time.
+    std::unique_ptr<RangeCursor> Cursor(Query<D>& q) const override;
 
     void SetDataset(std::shared_ptr<Dataset<D>> dataset) {
         dataset_ = dataset;
@@ -72,6 +75,8 @@ class BinarySearchIndex : public PrimaryIndexer<D> {
 
     void Load(const std::string& host_bucket_file);
 
+    class SearchCursor;
+
     // Used for internal purposes only.
     size_t column_;
     // True when the index has been initialized.
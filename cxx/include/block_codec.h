@@ -0,0 +1,348 @@
+/**
+ * Encodings for the compression blocks of CompressedColumnOrderDataset. Every block of a column is
+ * stored with whichever codec suits its values best (see BlockCodecs::Choose): the exact size of
+ * the block in each applicable encoding is traded off against how expensive that encoding is to
+ * decode. The dataset dispatches every access to a block through a table of codecs indexed by
+ * the block's CompressionBlock::encoding.
+ *
+ * Codecs append to and read from the column's bitstream, in which values are stored big-endian:
+ * a value of w bits at bit b is read by loading the 8 bytes at byte b / 8, swapping them and
+ * shifting out the value. Packed values are therefore at most 57 bits wide, and the stream is
+ * padded with 8 bytes past its last value.
+ *
+ * The methods that take `offset` and `n` work on rows [offset, offset + n) of a single block, for
+ * n <= 64. Their bitmasks have the first row in the highest bit, as with Dataset::GetCoordRange.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "range_set.h"
+#include "types.h"
+#include "value_set.h"
+
+// There are 2^9 = 512 values per compression block.
+// The block size should always be a power of 2 for fast computation.
+const char COLUMN_COMPRESSION_BLOCK_SIZE_POW = 9;
+const uint64_t COLUMN_COMPRESSION_BLOCK_SIZE_MASK = (1 << COLUMN_COMPRESSION_BLOCK_SIZE_POW) - 1;
+// Wide enough for any offset in a block, including the block size itself.
+const char COLUMN_RUN_END_BITS = COLUMN_COMPRESSION_BLOCK_SIZE_POW + 1;
+
+// How the values of a compression block are laid out, starting at its bit_offset.
+enum BlockEncoding : char {
+    // Every value minus the base value, in bit_width bits each (frame of reference).
+    BLOCK_PACKED = 0,
+    // The value of every run of equal values minus the base value, in bit_width bits each,
+    // followed by the offset in the block at which every run ends, in COLUMN_RUN_END_BITS bits
+    // each.
+    BLOCK_RLE = 1,
+    // Every value is the base value, and nothing is stored.
+    BLOCK_CONSTANT = 2,
+    // Every value in 64 bits, starting on a byte boundary. For values too far apart to pack.
+    BLOCK_RAW = 3,
+    // Non-decreasing values: the base value is the first one, followed by the difference of
+    // every other value to the one before it, in bit_width bits each.
+    BLOCK_DELTA = 4,
+    // The distinct values minus the base value, in bit_width bits each, followed by the position
+    // of every value among them, in as many bits as num_values - 1 takes.
+    BLOCK_DICTIONARY = 5,
+    NUM_BLOCK_ENCODINGS,
+};
+
+// Each compression block stores metadata for a fixed number of entries.
+struct CompressionBlock {
+    // The offset from the start of the data bitstream for this column where this block's data
+    // begins.
+    uint64_t bit_offset;
+    // A mask that is `bit_width' bits wide for packed blocks, and the difference between the
+    // largest and smallest value for all others. Either way, no value in the block exceeds
+    // base_value + bit_mask.
+    uint64_t bit_mask;
+    // The minimum value in the block (the first one for delta-encoded blocks).
+    Scalar base_value;
+    // The number of bits each delta is decoded to.
+    char bit_width;
+    // A BlockEncoding.
+    char encoding;
+    // The number of runs of run-length encoded blocks, and of values of dictionary blocks.
+    uint16_t num_values;
+    CompressionBlock() = default;
+};
+
+// What the codecs size a block from, gathered in a single pass over it.
+struct BlockStats {
+    size_t size;
+    Scalar min;
+    Scalar max;
+    // Bits needed for max - min.
+    char width;
+    size_t num_runs;
+    size_t num_distinct;
+    // Whether the values never decrease, and if so the bits needed for the largest step.
+    bool sorted;
+    char step_width;
+
+    static BlockStats Of(const std::vector<Scalar>& block);
+};
+
+// Appends values to a column's bitstream, keeping it padded for the readers.
+class BitWriter {
+  public:
+    BitWriter(std::vector<char>* data, uint64_t bit_offset);
+
+    // Append the low `bit_width` bits of `value`.
+    void Append(uint64_t value, char bit_width);
+    // Skip to the next byte boundary.
+    void AlignToByte();
+    uint64_t Offset() const {
+        return offset_;
+    }
+
+  private:
+    std::vector<char>* data_;
+    uint64_t offset_;
+};
+
+class BlockCodec {
+  public:
+    virtual ~BlockCodec() {}
+
+    virtual const char* Name() const = 0;
+    // The exact size of a block with these stats in this encoding, or NOT_APPLICABLE if the
+    // codec can't encode it.
+    virtual uint64_t EncodedBits(const BlockStats& stats) const = 0;
+    // The offset of the bit following a block with these stats that is written at `bit_offset`.
+    virtual uint64_t EncodedEnd(const BlockStats& stats, uint64_t bit_offset) const {
+        return bit_offset + EncodedBits(stats);
+    }
+    // What decoding a value costs, relative to unpacking a fixed-width one.
+    virtual double DecodeCost() const = 0;
+    // Fill in `cblk`, whose bit_offset is the writer's offset, and write the block.
+    virtual void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const = 0;
+
+    virtual Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const = 0;
+    virtual void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const = 0;
+    // The rows whose value lies in [lower, upper] (inclusive).
+    virtual uint64_t InRange(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, Scalar lower, Scalar upper) const;
+    // The rows whose value is in one of the ranges [first, last) of `rset`, which are the ones
+    // that overlap the block.
+    virtual uint64_t InRanges(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const RangeSet& rset, size_t first, size_t last) const;
+    virtual uint64_t InSet(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const ValueSet& vset) const;
+    // The sum and the list of the values of the rows set in `valids`. Values are translated
+    // through `dictionary` first, unless it is null.
+    virtual Scalar Sum(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary) const;
+    virtual void Values(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const;
+
+    static const uint64_t NOT_APPLICABLE = ~0UL;
+    // The widest values that can be packed (see the comment at the top).
+    static const char MAX_PACKED_WIDTH = 57;
+
+    // Read `bit_width` <= 64 bits at `bit_offset`; wider than 57 only on a byte boundary.
+    static uint64_t ReadBits(const char* data, uint64_t bit_offset, char bit_width);
+    // Bits needed for x.
+    static char BitsFor(uint64_t x) {
+        return x == 0 ? 0 : 64 - __builtin_clzl(x);
+    }
+    // The bits of rows [first, last) of a range of n rows, with the first row in the highest bit.
+    static uint64_t RowSpan(size_t n, size_t first, size_t last) {
+        size_t width = last - first;
+        return (width == 64 ? ~0UL : ((1UL << width) - 1)) << (n - last);
+    }
+};
+
+class PackedCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "packed";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override;
+    double DecodeCost() const override {
+        return 1;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const override;
+    // Decode and InRange use the vectorized kernels in simd_kernels.h.
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+    uint64_t InRange(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, Scalar lower, Scalar upper) const override;
+};
+
+// Predicates are tested, and sums multiplied out, once per run.
+class RleCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "rle";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override;
+    // Finding the run of a row is a binary search.
+    double DecodeCost() const override {
+        return 2;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const override;
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+    uint64_t InRange(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, Scalar lower, Scalar upper) const override;
+    uint64_t InRanges(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const RangeSet& rset, size_t first, size_t last) const override;
+    uint64_t InSet(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const ValueSet& vset) const override;
+    Scalar Sum(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary) const override;
+    void Values(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const override;
+
+  private:
+    // Call f(value, first, last) for every run that overlaps rows [offset, offset + n), where
+    // [first, last) is the overlap relative to `offset`.
+    template <typename F>
+    void ForEachRun(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            F f) const;
+};
+
+class ConstantCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "constant";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override {
+        return stats.min == stats.max ? 0 : NOT_APPLICABLE;
+    }
+    double DecodeCost() const override {
+        return 0;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char*, const CompressionBlock& cblk, size_t) const override {
+        return cblk.base_value;
+    }
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+    uint64_t InRange(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, Scalar lower, Scalar upper) const override;
+    uint64_t InRanges(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const RangeSet& rset, size_t first, size_t last) const override;
+    uint64_t InSet(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, const ValueSet& vset) const override;
+    Scalar Sum(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary) const override;
+    void Values(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const override;
+};
+
+// The fallback for blocks whose values span more than MAX_PACKED_WIDTH bits.
+class RawCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "raw";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override {
+        // Including the worst case of aligning to a byte.
+        return stats.size * 64 + 7;
+    }
+    uint64_t EncodedEnd(const BlockStats& stats, uint64_t bit_offset) const override {
+        return ((bit_offset + 7) & ~7UL) + stats.size * 64;
+    }
+    double DecodeCost() const override {
+        return 1;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const override {
+        return ReadBits(data, cblk.bit_offset + 64 * offset, 64);
+    }
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+};
+
+// Reaching a row means adding up the steps before it, so this is the most expensive to decode.
+class DeltaCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "delta";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override;
+    double DecodeCost() const override {
+        return 8;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const override;
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+};
+
+// A dictionary of the block's own distinct values. Range predicates become ranges of positions,
+// tested on the packed positions directly.
+class DictionaryCodec : public BlockCodec {
+  public:
+    const char* Name() const override {
+        return "dictionary";
+    }
+    uint64_t EncodedBits(const BlockStats& stats) const override;
+    double DecodeCost() const override {
+        return 2;
+    }
+    void Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+            CompressionBlock* cblk, BitWriter* writer) const override;
+    Scalar Get(const char* data, const CompressionBlock& cblk, size_t offset) const override;
+    void Decode(const char* data, const CompressionBlock& cblk, size_t offset, size_t n,
+            Scalar* out) const override;
+    uint64_t InRange(const char* data, const CompressionBlock& cblk, size_t offset,
+            size_t n, Scalar lower, Scalar upper) const override;
+
+  private:
+    static char CodeWidth(const CompressionBlock& cblk) {
+        return BitsFor(cblk.num_values - 1);
+    }
+    static uint64_t CodesOffset(const CompressionBlock& cblk) {
+        return cblk.bit_offset + (uint64_t) cblk.num_values * cblk.bit_width;
+    }
+    // The first position whose value is at least `value`.
+    static size_t LowerBound(const char* data, const CompressionBlock& cblk, Scalar value);
+};
+
+class BlockCodecs {
+  private:
+    BlockCodecs() {}
+
+  public:
+    static const BlockCodec& Get(char encoding) {
+        return *Table()[(size_t) encoding];
+    }
+    // The allowed codec that minimizes the size of the block in bits plus CostWeight() times the
+    // cost of decoding its values. Raw encoding is always allowed, as the last resort.
+    static BlockEncoding Choose(const BlockStats& stats);
+
+    // Restrict the codecs Choose() picks from to those with their bit (1 << BlockEncoding) set
+    // in `mask`, e.g. for benchmarking. Applies to datasets built afterwards.
+    static void SetAllowed(uint32_t mask);
+    static uint32_t Allowed();
+    // How many bits of block size a unit of decode cost per value is worth. 0 picks the smallest
+    // encoding regardless of decode cost.
+    static void SetCostWeight(double bits_per_value);
+    static double CostWeight();
+
+    static const uint32_t ALL = (1u << NUM_BLOCK_ENCODINGS) - 1;
+    static constexpr double DEFAULT_COST_WEIGHT = 4;
+
+  private:
+    static const BlockCodec* const* Table();
+    static uint32_t& AllowedMask();
+    static double& CurrentCostWeight();
+};
+
+#include "../src/block_codec.hpp"
@@ -0,0 +1,34 @@
+/**
+ * A fixed-capacity queue handing items from producer threads to consumer threads. Producers block
+ * while the queue is full, which bounds how far they can run ahead of the consumers.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template <typename T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity);
+
+    // Blocks while the queue is full. Must not be called after Close().
+    void Push(T item);
+    // Blocks until an item is available and moves it to *item. Returns false once the queue is
+    // closed and empty.
+    bool Pop(T* item);
+    // No more items will be pushed. Wakes up blocked consumers.
+    void Close();
+
+  private:
+    const size_t capacity_;
+    std::deque<T> items_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+#include "../src/bounded_queue.hpp"
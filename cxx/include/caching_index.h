@@ -0,0 +1,87 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "types.h"
+#include "primary_indexer.h"
+#include "query_cache.h"
+
+/*
+ * Caches the output of another index's IndexRanges, so that queries that repeat the filters of a
+ * recent query (e.g. dashboards refreshing every few seconds) skip index traversal, lookups and
+ * merging entirely. The cache is keyed by the query's filters on the dims the wrapped index reads,
+ * and also replays any rewriting the index did on the query. Inserts clear the cache.
+ */
+template <size_t D>
+class CachingIndex : public PrimaryIndexer<D> {
+  public:
+    // Cache up to about `budget_bytes` of results. The key covers the filters on the dims in the
+    // index's GetColumns(), plus `extra_key_dims`: indexes that read the filters of other dims
+    // (e.g. rewriters reading a source column) must list them there.
+    CachingIndex(std::unique_ptr<PrimaryIndexer<D>> index, size_t budget_bytes,
+            const std::unordered_set<size_t>& extra_key_dims = {});
+
+    void SetDataset(std::shared_ptr<Dataset<D>> dataset) override {
+        index_->SetDataset(dataset);
+    }
+
+    bool Init(PointIterator<D> start, PointIterator<D> end) override;
+
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override;
+
+    size_t Size() const override {
+        return index_->Size() + cache_.SizeInBytes();
+    }
+
+    std::unordered_set<size_t> GetColumns() const override {
+        return index_->GetColumns();
+    }
+
+    std::vector<InsertRecord<D>> Insert(const std::vector<Point<D>>& points) override {
+        cache_.Clear();
+        return index_->Insert(points);
+    }
+
+    std::vector<InsertRecord<D>> DummyInsert(const std::vector<Point<D>>& points,
+            const std::vector<size_t>& indexes) override {
+        cache_.Clear();
+        return index_->DummyInsert(points, indexes);
+    }
+
+    Ranges<Key> KeyRangesForBuckets(std::vector<int32_t> bucket_ids) override {
+        return index_->KeyRangesForBuckets(bucket_ids);
+    }
+
+    void WriteStats(std::ofstream& statsfile) override {
+        index_->WriteStats(statsfile);
+        statsfile << "index_cache_hits: " << cache_.Hits() << std::endl
+            << "index_cache_misses: " << cache_.Misses() << std::endl;
+    }
+
+    size_t Hits() const {
+        return cache_.Hits();
+    }
+
+    size_t Misses() const {
+        return cache_.Misses();
+    }
+
+  private:
+    struct Entry {
+        Set<PhysicalIndex> result;
+        // The filters the index replaced while answering the query.
+        std::vector<std::pair<size_t, QueryFilter>> rewrites;
+    };
+
+    std::unique_ptr<PrimaryIndexer<D>> index_;
+    std::unordered_set<size_t> extra_key_dims_;
+    // Sorted, set by Init.
+    std::vector<size_t> key_dims_;
+    // Filled in by IndexRanges, which is logically const.
+    mutable QueryCache<Entry> cache_;
+};
+
+#include "../src/caching_index.hpp"
@@ -67,13 +67,13 @@ class ClusteredColumnOrderDataset : public Dataset<D> {
         return Size() * NumDims() * sizeof(Scalar);
     }
 
-    Range<PhysicalIndex> LookupRange(Range<Key> range) {
+    Range<PhysicalIndex> LookupRange(Range<Key> range) const {
         auto startit = clustered_index_.lower_bound(range.start);
         auto endit = clustered_index_.lower_bound(range.end);
         return Range<PhysicalIndex>(startit->second, endit->second);
     }
 
-    Set<PhysicalIndex> Lookup(Set<Key> keys) override {
+    Set<PhysicalIndex> Lookup(Set<Key> keys) const override {
         Set<PhysicalIndex> results;
         results.ranges.reserve(keys.ranges.size());
         results.list.reserve(keys.list.size());
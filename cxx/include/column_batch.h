@@ -0,0 +1,73 @@
+/**
+ * A batch of consecutive rows handed to a visitor at once, in columnar form. The rows that
+ * matched the query are given as a selection vector of offsets from the first row of the batch.
+ * Columns are decoded the first time a visitor asks for them, once for the whole batch, so a
+ * visitor only pays for the columns it reads.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+#include "dataset.h"
+
+template <size_t D>
+class ColumnBatch {
+  public:
+    // Largest number of rows in a batch. The engine never lets a batch span dataset blocks.
+    static const size_t MAX_ROWS = 1024;
+
+    ColumnBatch();
+
+    // Start a new batch over the rows in [start, end), with no rows selected.
+    void Reset(const Dataset<D>* dataset, size_t start, size_t end);
+    // Select the rows among [ix, ix + n) that are set in `valids`, for n <= 64. As with
+    // Visitor::visitRange, row ix maps to bit n-1. Rows must be selected in increasing order.
+    void Select(size_t ix, size_t n, uint64_t valids);
+    // Select every row of the batch.
+    void SelectAll();
+
+    // Values of column `dim` for all rows of the batch (not only the selected ones), indexed by
+    // offset from Start().
+    const Scalar* Column(size_t dim);
+
+    const Dataset<D>* GetDataset() const {
+        return dataset_;
+    }
+
+    size_t Start() const {
+        return start_;
+    }
+
+    size_t End() const {
+        return end_;
+    }
+
+    // Offsets from Start() of the selected rows, in increasing order.
+    const uint16_t* Selection() const {
+        return sel_.data();
+    }
+
+    size_t Count() const {
+        return count_;
+    }
+
+    bool AllSelected() const {
+        return count_ == end_ - start_;
+    }
+
+  private:
+    const Dataset<D>* dataset_;
+    size_t start_;
+    size_t end_;
+    std::array<uint16_t, MAX_ROWS> sel_;
+    size_t count_;
+    // Buffers are allocated the first time a column is used and reused across batches.
+    std::array<std::vector<Scalar>, D> columns_;
+    std::array<bool, D> decoded_;
+};
+
+#include "../src/column_batch.hpp"
@@ -84,6 +84,18 @@ class CombinedCorrelationIndex : public CorrelationIndexer<D> {
     
     Set<Key> KeyRanges(const Query<D>& q) const;
 
+    size_t EstimateKeys(const Query<D>& q) const override {
+        size_t keys = mapped_index_->EstimateKeys(q);
+        if (outlier_index_) {
+            size_t outliers = outlier_index_->EstimateMatches(q);
+            if (outliers == this->UNKNOWN_ESTIMATE) {
+                return this->UNKNOWN_ESTIMATE;
+            }
+            keys += outliers;
+        }
+        return std::min(keys, data_size_);
+    }
+
     size_t Size() const override {
         size_t s = mapped_index_->Size();
         if (outlier_index_) {
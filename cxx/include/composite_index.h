@@ -3,6 +3,7 @@
 #include <vector>
 #include <memory>
 #include <fstream>
+#include <optional>
 
 #include "types.h"
 #include "primary_indexer.h"
@@ -11,14 +12,46 @@
 #include "rewriter.h"
 
 /*
- * An index that combines other indexes together. It allows at most one primary index and multiple
- * secondary indexes.
+ * An index that combines other indexes together. It allows at most one primary index and any
+ * number of correlation indexes, secondary indexes and rewriters.
+ *
+ * Rewriters always run. For the other indexes, a per-query plan decides which to use: the
+ * primary index's ranges (or a full scan), intersected with the matches of the correlation
+ * indexes, of the secondary indexes, or both. The plan with the lowest estimated cost wins, so
+ * e.g. a secondary index isn't consulted when the primary index already narrows the query down to
+ * fewer rows than the secondary index would match.
  */
 template <size_t D>
 class CompositeIndex : public PrimaryIndexer<D> {
   public:
+    // Weights of the planner's cost estimates, relative to scanning one row sequentially.
+    struct CostModel {
+        // Per range scanned, for seeking to it and for the partial blocks at its ends.
+        double range = 64;
+        // Per index looked up in a secondary index and then visited out of order.
+        double list_point = 16;
+        // Per auxiliary index consulted.
+        double index_lookup = 1000;
+    };
+
+    // The access paths a query uses, and their estimated cost.
+    struct Plan {
+        // Scan all rows instead of the primary index's ranges.
+        bool full_scan;
+        bool use_correlation;
+        bool use_secondary;
+        double cost;
+    };
+
     CompositeIndex(size_t gap_threshold);
 
+    void SetCostModel(const CostModel& model) {
+        cost_model_ = model;
+    }
+
+    // The plan IndexRanges would use for `q`.
+    Plan Explain(Query<D> q) const;
+
     bool SetPrimaryIndex(std::unique_ptr<PrimaryIndexer<D>> primary_index);
 
     bool AddCorrelationIndex(std::unique_ptr<CorrelationIndexer<D>> corr_index);
@@ -39,7 +72,11 @@ class CompositeIndex : public PrimaryIndexer<D> {
 
     virtual bool Init(PointIterator<D> start, PointIterator<D> end) override;
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override; 
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override; 
+
+    // Streams the primary index's ranges unless they have to be intersected with the matches of
+    // secondary or correlation indexes.
+    std::unique_ptr<RangeCursor> Cursor(Query<D>& q) const override;
     
     InsertRecord<D> Insert(std::vector<Point<D>> new_pts) {
         AssertWithMessage(primary_index_ != NULL, "No primary index to insert into");
@@ -91,10 +128,22 @@ class CompositeIndex : public PrimaryIndexer<D> {
 
 
   private:
-    Set<PhysicalIndex> RangesWithPrimary(Query<D>& q);
-    List<Key> RangesWithRewriter(Query<D>& q);
-    List<Key> RangesWithSecondary(Query<D>& q);
-    Set<Key> RangesWithCorrelation(Query<D>& q);
+    Set<PhysicalIndex> RangesWithPrimary(Query<D>& q) const;
+    List<Key> RangesWithRewriter(Query<D>& q) const;
+    // Lookups ChoosePlan ran because an index couldn't estimate their size, kept so that they
+    // aren't run again. Indexed like correlation_indexes_ and secondary_indexes_.
+    struct Lookups {
+        std::vector<std::optional<Set<Key>>> correlation;
+        std::vector<std::optional<List<Key>>> secondary;
+    };
+    List<Key> RangesWithSecondary(Query<D>& q, Lookups* lookups) const;
+    Set<Key> RangesWithCorrelation(Query<D>& q, Lookups* lookups) const;
+    // Pick the cheapest plan for `q`, whose rewriters have run, given the primary index's result.
+    Plan ChoosePlan(const Query<D>& q, const Set<PhysicalIndex>& primary, Lookups* lookups) const;
+    bool IsFullScan(const Set<PhysicalIndex>& indexes) const {
+        return indexes.ranges.size() == 1 && indexes.list.empty() && indexes.ranges[0].start == 0
+            && indexes.ranges[0].end == data_size_;
+    }
     
     // If consecutive matching indexes are at or below this gap threshold, includes them in a single
     // range. Otherwise, truncates the old range and starts a new one.
@@ -108,6 +157,7 @@ class CompositeIndex : public PrimaryIndexer<D> {
     std::vector<std::unique_ptr<SecondaryIndexer<D>>> secondary_indexes_;
     std::vector<std::unique_ptr<CorrelationIndexer<D>>> correlation_indexes_;
     std::vector<std::unique_ptr<Rewriter<D>>> rewriters_;
+    CostModel cost_model_;
 };
 
 #include "../src/composite_index.hpp"
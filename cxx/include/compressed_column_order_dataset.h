@@ -4,11 +4,24 @@
  * at fixed intervals, so to decode, one finds the appropriate checkpoint in constant time,
  * and then access the correct bit offsets to find the delta. A typical random access takes O(1)
  * time. There are optimizations to speed up iterations as opposed to random accesses.
+ *
+ * Columns with few distinct but widely spread values (e.g. categorical ids or hashes) can instead
+ * be dictionary-encoded: the column then stores the position of each value in a sorted array of
+ * its distinct values, and these codes are delta-encoded as above. Since the dictionary is sorted,
+ * range predicates translate to ranges of codes, and predicates are evaluated on the codes.
+ *
+ * Every block is stored with the codec that suits its values best, as chosen by
+ * BlockCodecs::Choose: e.g. blocks with few runs of equal values (typically those of columns the
+ * data is sorted by) are run-length encoded, and predicates and sums on them are evaluated once
+ * per run rather than once per row. See block_codec.h for the encodings.
  */
 
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "block_codec.h"
 #include "datacube.h"
 #include "dataset.h"
 #include "types.h"
@@ -18,24 +31,40 @@
 
 typedef unsigned __int128 uint128_t;
 
-// There are 2^7 = 128 values per compression block.
-// The block size should always be a power of 2 for fast computation.
-const char COLUMN_COMPRESSION_BLOCK_SIZE_POW = 9;
-const uint64_t COLUMN_COMPRESSION_BLOCK_SIZE_MASK = (1 << COLUMN_COMPRESSION_BLOCK_SIZE_POW) - 1;
-
-// Each compression block stores metadata for a fixed number of
-// entries, assuming that they all fit into 32 bits.
-struct CompressionBlock {
-    // The offset from the start of the data bitstream for this column where this block's data
-    // begins.
-    uint64_t bit_offset;
-    // A mask that is `bit_width' bits wide.
-    uint64_t bit_mask;
-    // The minimum value in the block.
-    Scalar base_value;
-    // The number of bits each delta is decoded to.
-    char bit_width;
-    CompressionBlock() = default;
+// Layout of the files written by CompressedColumnOrderDataset::Save. Every section starts on a
+// 64-byte boundary, so that a mapped file can be used in place:
+//   header | column table (offset and size of each column's bits) | compression blocks |
+//   prefix sum columns | dictionary table (offset and size of each column's dictionary, 0 if it
+//   has none) | column bits... | dictionaries... | clustered keys | their physical indexes |
+//   build info
+const char COMPRESSED_DATASET_MAGIC[8] = {'C', 'C', 'O', 'D', 'S', 'E', 'T', '\0'};
+// Bump whenever the layout below or that of CompressionBlock changes.
+const uint32_t COMPRESSED_DATASET_VERSION = 5;
+const uint32_t COMPRESSED_DATASET_BYTE_ORDER = 0x01020304;
+const uint64_t COMPRESSED_DATASET_ALIGNMENT = 64;
+
+struct CompressedDatasetFileHeader {
+    char magic[8];
+    uint32_t version;
+    // Files are only readable on machines that agree on these.
+    uint32_t byte_order;
+    uint32_t dims;
+    uint32_t block_size_pow;
+    uint64_t cblock_size;
+    uint64_t size;
+    uint64_t num_columns;
+    uint64_t blocks_per_column;
+    uint64_t num_keys;
+    uint64_t column_table_offset;
+    uint64_t cblocks_offset;
+    uint64_t prefix_sum_offset;
+    uint64_t dictionary_table_offset;
+    uint64_t keys_offset;
+    uint64_t indexes_offset;
+    // Free-form description of how the data was built, given to Save().
+    uint64_t build_info_offset;
+    uint64_t build_info_size;
+    uint64_t file_size;
 };
 
 // For decoding sequential values, we save intermediate state here.
@@ -57,11 +86,24 @@ class CompressedColumnOrderDataset : public Dataset<D> {
     explicit CompressedColumnOrderDataset(const std::vector<Point<D>>& data,
                                           const std::vector<Datacube<D>>& datacubes, bool data_only);
     explicit CompressedColumnOrderDataset(const std::vector<Point<D>>& data, bool data_only);
+    // The data columns in `dictionary_dims` are dictionary-encoded.
     explicit CompressedColumnOrderDataset(const std::vector<Point<D>>& data,
             const std::vector<Scalar>& row_ids=std::vector<Scalar>(),
-            const std::vector<Datacube<D>>& datacubes=std::vector<Datacube<D>>());
+            const std::vector<Datacube<D>>& datacubes=std::vector<Datacube<D>>(),
+            const std::vector<size_t>& dictionary_dims=std::vector<size_t>());
     ~CompressedColumnOrderDataset();
 
+    // Write the compressed columns, their compression blocks and the clustered index to
+    // `filename`, in a format that Open() maps into memory without copying or decoding. Cubes are
+    // saved as columns, but not their aggregators. `build_info` describes the input and
+    // parameters the dataset was built from, for Open() to check.
+    void Save(const std::string& filename, const std::string& build_info = "") const;
+    // Map a file written by Save(). The pages are shared with every other process that maps the
+    // same file. Returns nullptr if the file can't be read, was written by an incompatible
+    // version or build, or was saved with a different `build_info`.
+    static std::shared_ptr<CompressedColumnOrderDataset<D>> Open(const std::string& filename,
+            const std::string& build_info = "");
+
     // Access methods: Get the full point from all columns.
     Point<D> Get(size_t i) const override;
     // Get a single coordinate of a single point. This function
@@ -72,15 +114,44 @@ class CompressedColumnOrderDataset : public Dataset<D> {
 
 
 
-    Set<PhysicalIndex> Lookup(Set<Key> keys) override;
+    Set<PhysicalIndex> Lookup(Set<Key> keys) const override;
 
     // Optimize sequential scans over the dataset by storing intermediate
     // decoder state. This function may be slower for out of order scans since it incurs cost to
     // store decoder state, which is amortized only if subsequent calls are to immediately
     // following indices.
     uint64_t GetCoordRange(size_t start, size_t end, size_t dim, Scalar lower, Scalar upper) const override;
+    // Predicates are evaluated with the vectorized kernels in simd_kernels.h.
+    uint64_t GetCoordInRange(size_t start, size_t end, size_t dim, Scalar low, Scalar high) const override;
+    uint64_t GetCoordInRanges(size_t start, size_t end, size_t dim, const RangeSet& rset) const override;
+    uint64_t GetCoordInSet(size_t start, size_t end, size_t dim, const std::unordered_set<Scalar>& vset) const override;
+    uint64_t GetCoordInSet(size_t start, size_t end, size_t dim, const ValueSet& vset) const override;
+    // Decodes with the vectorized kernels, at most two compression blocks at a time.
+    void DecodeRange(size_t start, size_t end, size_t dim, Scalar* out) const override;
     void GetRangeValues(size_t start, size_t end, size_t dim, uint64_t valids, std::vector<Scalar> *results) const override;
     Scalar GetRangeSum(size_t start, size_t end, size_t dim, uint64_t valids) const override;
+    // Uses the prefix-sum cube of `dim`, if the dataset was built with one.
+    bool GetExactRangeSum(size_t start, size_t end, size_t dim, Scalar* sum) const override;
+
+    size_t BlockSize() const override {
+        return 1UL << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    }
+
+    // Read off the block's base value and bit width, without decoding anything.
+    bool BlockBounds(size_t ix, size_t dim, Scalar* min, Scalar* max) const override {
+        StoredBounds(ix, dim, min, max);
+        const ColumnDictionary& dictionary = dictionaries_[dim];
+        if (dictionary.values != nullptr) {
+            *min = dictionary.values[*min];
+            *max = dictionary.values[std::min(*max, (Scalar)dictionary.size - 1)];
+        }
+        return true;
+    }
+
+    const Scalar* Dictionary(size_t dim, size_t* size) const override {
+        *size = dictionaries_[dim].size;
+        return dictionaries_[dim].values;
+    }
 
     size_t Size() const override {
         return size_;
@@ -100,31 +171,79 @@ class CompressedColumnOrderDataset : public Dataset<D> {
             data_size += compressed_column_sizes_[i];
         }
         uint64_t cblocks_size = (uint64_t)sizeof(CompressionBlock) * num_columns_ * blocks_per_column_;
+        for (const auto& dictionary : dictionaries_) {
+            data_size += dictionary.size * sizeof(Scalar);
+        }
         return data_size + cblocks_size;
     }
 
+    // The size of the bits of column `dim`, without its compression blocks or dictionary.
+    uint64_t ColumnSizeInBytes(size_t dim) const {
+        return compressed_column_sizes_[dim];
+    }
+    // How many blocks of column `dim` use each BlockEncoding.
+    std::vector<size_t> ColumnEncodings(size_t dim) const {
+        std::vector<size_t> counts(NUM_BLOCK_ENCODINGS, 0);
+        for (size_t i = 0; i < blocks_per_column_; i++) {
+            counts[cblocks_[dim * blocks_per_column_ + i].encoding]++;
+        }
+        return counts;
+    }
+
     // Public only for testing reasons.
     CompressionBlock *cblocks_;
 
 private:
-    Range<PhysicalIndex> LookupRange(Range<Key> range);
-    // Compress the entire dataset.
-    void Compress(const std::vector<std::vector<Scalar>>& columns);
-    // Compress one particular column.
-    void CompressColumn(size_t dim_idx, const std::vector<Scalar>& column);
-    // Compress one particular compression block within a column, assuming the current offset is
-    // `offset` from the start of the array. Add the resulting compression
-    // block to `cblocks` and the resulting compressed bits to `data_bits`.
-    // Return the offset of the bit following the last one added (this is where the next value would
-    // go). 
-    uint64_t CompressBlock(const std::vector<Scalar>& block, std::vector<CompressionBlock>* cblocks, std::vector<char>* data_bits, uint64_t offset);
-    
-    
+    // Used by Open(), which fills in the members from the mapped file.
+    CompressedColumnOrderDataset() = default;
+
+    Range<PhysicalIndex> LookupRange(Range<Key> range) const;
+    // The stored values of a column are the values themselves, or their codes if the column is
+    // dictionary-encoded. These work on stored values, and the public methods translate.
+    Scalar FromStored(size_t dim, Scalar stored) const {
+        const Scalar* dictionary = dictionaries_[dim].values;
+        return dictionary == nullptr ? stored : dictionary[stored];
+    }
+    void StoredBounds(size_t ix, size_t dim, Scalar* min, Scalar* max) const {
+        const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + (ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW)];
+        *min = cblk.base_value;
+        *max = (Scalar)((uint64_t)cblk.base_value + cblk.bit_mask);
+    }
+    static const BlockCodec& Codec(const CompressionBlock& cblk) {
+        return BlockCodecs::Get(cblk.encoding);
+    }
+    // As GetCoordRange: lower and upper are inclusive.
+    uint64_t StoredInRange(size_t start, size_t end, size_t dim, Scalar lower, Scalar upper) const;
+    uint64_t StoredInRanges(size_t start, size_t end, size_t dim, const RangeSet& rset) const;
+    uint64_t StoredInSet(size_t start, size_t end, size_t dim, const ValueSet& vset) const;
+    void DecodeStored(size_t start, size_t end, size_t dim, Scalar* out) const;
+
+    // The first key in the clustered index that is at least `key`, and its physical index, or
+    // the largest Key and Size() if there is none.
+    std::pair<Key, PhysicalIndex> LowerBound(Key key) const;
+    // Set the column index of every cube, starting at column `first_column`.
+    void IndexCubes(size_t first_column);
+    // Compress the columns of `data`: its D data columns, then its keys if `with_keys`, then the
+    // cubes, dictionary-encoding the data columns in `dictionary_dims`. This takes two parallel
+    // passes over the blocks of every column, reading them straight from `data`: the first
+    // chooses the encoding of every block, which gives its size and so its offset, and the second
+    // writes the blocks at their offsets.
+    void Compress(const std::vector<Point<D>>& data, bool with_keys,
+            const std::vector<size_t>& dictionary_dims=std::vector<size_t>());
+    // Write the values of column `col` in rows [start, end) to `out`, computing keys and cubes
+    // from `data` (cubes follow the keys, if any, from column `first_cube`). `prefix_bases` holds
+    // the sum of every prefix sum column before each of its blocks, and start must begin a block.
+    void ColumnValues(const std::vector<Point<D>>& data, size_t first_cube,
+            const std::vector<std::vector<Scalar>>& prefix_bases, size_t col, size_t start,
+            size_t end, Scalar* out) const;
+
     // Since all columns use the same number of cblocks, we can represent all of cblocks_ as a
     // single array. cblocks_[dim][ix] = cblocks_[dim * size_ + ix].
     char **column_data_;
 
     std::vector<Datacube<D>> cubes_;
+    // For every column, the column of the cube holding its prefix sums, or -1 if there is none.
+    std::vector<int64_t> prefix_sum_column_;
     // Number of items in every column
     size_t size_;
     // // Number of total columns (data + cubes)
@@ -132,8 +251,24 @@ private:
     size_t blocks_per_column_;
     // Size of each column in bytes after compression
     std::vector<uint64_t> compressed_column_sizes_;
+    // The sorted distinct values of each dictionary-encoded column, or nullptr for other columns.
+    struct ColumnDictionary {
+        const Scalar* values = nullptr;
+        size_t size = 0;
+    };
+    std::vector<ColumnDictionary> dictionaries_;
+    // Holds the dictionaries, unless they were mapped from a file.
+    std::vector<std::vector<Scalar>> dictionary_storage_;
     const size_t primary_key_column_ = D;
     btree::btree_map<Key, PhysicalIndex> clustered_index_;
+
+    // Set if the dataset was opened from a file, in which case all of the arrays above point into
+    // the mapping, and the clustered index is kept as sorted arrays of keys and physical indexes.
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    const Key* mapped_keys_ = nullptr;
+    const PhysicalIndex* mapped_indexes_ = nullptr;
+    size_t num_mapped_keys_ = 0;
 };
 
 #include "../src/compressed_column_order_dataset.hpp"
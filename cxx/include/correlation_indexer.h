@@ -23,6 +23,13 @@ class CorrelationIndexer : public Indexer<D> {
     // ranges of VirtualIndices to check.
     virtual Set<Key> KeyRanges(const Query<D>& query) const = 0;
 
+    // Estimate of the number of keys KeyRanges(query) covers, used by the CompositeIndex to decide
+    // whether the lookup is worth it. By default UNKNOWN_ESTIMATE, which has the CompositeIndex
+    // run KeyRanges up front and reuse its result.
+    virtual size_t EstimateKeys(const Query<D>&) const {
+        return this->UNKNOWN_ESTIMATE;
+    }
+
     virtual void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) = 0;
 
     // Size of the indexer in bytes
@@ -7,53 +7,69 @@
  *   - When using the learned index, there may be Virtual index ranges that are "exact", i.e. all
  *   points in the range are known to match the query filter predicates. In these cases, keeping a
  *   datacube that encodes the running sum of points along the sort order allows us to obtain the
- *   sum over an entire range (start, end) by just computing dc(end) - dc(start).
+ *   sum over an entire range [start, end) by just computing dc(end - 1) - dc(start - 1).
  *
  * Datacubes need to be known in two places:
  *  - When constructing the dataset, the datacubes must also be constructed and compressed alongside
  *    the original data.
- *  - The visitor should be aware of which datacube it can harness.
+ *  - The visitor should be aware of which datacube it can harness. Sums over exact ranges go
+ *    through Dataset::GetExactRangeSum, which finds the prefix-sum cube of a column by itself.
  *
  * Note that the indexer, locator, and index itself do not need to know anything about the datacube,
  * since it's abstracted away as part of the dataset.
  */
 
+#include <functional>
+#include <memory>
+
 #include "types.h"
 
 #pragma once
 
-// Used to specify what type of aggregation the 
+// Used to specify what type of aggregation the datacube column holds.
 template <size_t D>
 struct Aggregator {
-    // Produce the next value for this datacube from the current point and the previous datacube
-    // value.
-    virtual Scalar operator() (const Point<D>& pt) = 0;
+    // Produce the value of this datacube for a point. Datasets are built in parallel, so this is
+    // called concurrently and for points in any order.
+    virtual Scalar operator() (const Point<D>& pt) const = 0;
+    virtual ~Aggregator() {}
 };
 
+// An expression over the columns of a point, e.g. pt[3] * pt[6].
 template <size_t D>
-struct Datacube {
-    // Every Datacube has a unique index representing the column it occupies in the dataset.
-    size_t index;
-    Aggregator<D> *agg;
-};
+using Expression = std::function<Scalar(const Point<D>&)>;
 
-// TODO(vikram): These should be declared by
+// Materializes an expression, so that SUM(expression) only reads a single column.
 template <size_t D>
 struct SumAggregator : public Aggregator<D> {
-    Scalar operator() (const Point<D>& pt) override {
-        return pt[3]*pt[6];
+    explicit SumAggregator(Expression<D> e) : expr(e) {}
+
+    Scalar operator() (const Point<D>& pt) const override {
+        return expr(pt);
     }
+
+    Expression<D> expr;
 };
 
 template <size_t D>
-struct CumulSumAggregator : public Aggregator<D> {
-    Scalar prev = 0;
-    Scalar operator() (const Point<D>& pt) override {
-        // We have to displace by 1 so that dc[i] has the cumulative sum of every point
-        // up to but NOT including i.
-        Scalar ret = prev;
-        prev += pt[3]*pt[6];
-        return ret;
+struct Datacube {
+    // Every Datacube has a unique index representing the column it occupies in the dataset. It is
+    // set by the dataset.
+    size_t index;
+    // Computes the value of the cube for every point. Not used by prefix-sum cubes.
+    std::shared_ptr<Aggregator<D>> agg;
+    // For prefix-sum cubes, the column whose running sum the cube holds: either a data column or
+    // a cube listed before this one. Value i of the cube is the sum of that column over the
+    // points up to and including i. -1 for other cubes.
+    int64_t prefix_sum_of = -1;
+
+    // A cube holding the value of `expr` for every point.
+    static Datacube<D> Materialize(Expression<D> expr) {
+        return {0, std::make_shared<SumAggregator<D>>(expr), -1};
     }
-};
 
+    // A cube holding the running sum of column `column`.
+    static Datacube<D> PrefixSum(size_t column) {
+        return {0, nullptr, (int64_t)column};
+    }
+};
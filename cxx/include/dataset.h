@@ -5,6 +5,8 @@
 #include <unordered_set>
 
 #include "types.h"
+#include "range_set.h"
+#include "value_set.h"
 
 #pragma once
 
@@ -17,7 +19,7 @@ class Dataset {
     virtual Scalar GetCoord(size_t id, size_t dim) const = 0;
 
     // Looks up the indexes for the corresponding primary keys.
-    virtual Set<PhysicalIndex> Lookup(Set<Key> keys) {
+    virtual Set<PhysicalIndex> Lookup(Set<Key> keys) const {
         Ranges<PhysicalIndex> ranges;
         List<PhysicalIndex> list;
         for (const auto& k : keys.ranges) {
@@ -42,6 +44,16 @@ class Dataset {
         return valid;
     }
     
+    // Same as above, with the membership test chosen by the ValueSet.
+    virtual uint64_t GetCoordInSet(size_t start, size_t end, size_t dim, const ValueSet& vset) const {
+        uint64_t valid = 0;
+        for (size_t i = start; i < end; i++) {
+            valid <<= 1;
+            valid |= vset.Contains(GetCoord(i, dim));
+        }
+        return valid;
+    }
+
     // Return a bitstring denoting all the indices between start (inclusive) and end (exclusive),
     // whose coordinate at dimension `dim` falls between low (inclusive) and high (exclusive)
     // Precondition: end - start <= 64. If end - start < 64, the remaining most significant bits should be 0.
@@ -55,6 +67,16 @@ class Dataset {
         return valid;
     }
     
+    // Same as above, for a coordinate that falls in any of the ranges of `rset`.
+    virtual uint64_t GetCoordInRanges(size_t start, size_t end, size_t dim, const RangeSet& rset) const {
+        uint64_t valid = 0;
+        for (size_t i = start; i < end; i++) {
+            valid <<= 1;
+            valid |= rset.Contains(GetCoord(i, dim));
+        }
+        return valid;
+    }
+    
     // Return a bitstring denoting all the indices between start (inclusive) and end (exclusive),
     // whose coordinate at dimension `dim` falls between `lower` and `upper` (inclusive).
     // Precondition: end - start <= 64. If end - start < 64, the remaining most significant bits should be 0.
@@ -68,6 +90,14 @@ class Dataset {
         return valid;
     }
     
+    // Write the coordinates at dimension `dim` of the points in [start, end) to `out`.
+    // Precondition: end - start <= 64.
+    virtual void DecodeRange(size_t start, size_t end, size_t dim, Scalar* out) const {
+        for (size_t i = start; i < end; i++) {
+            out[i - start] = GetCoord(i, dim);
+        }
+    }
+    
     virtual void GetRangeValues(size_t start, size_t end, size_t dim, uint64_t valids, std::vector<Scalar> *results) const {
         uint64_t mask = 1UL << (end - start - 1);
         for (size_t i = start; i < end; i++) {
@@ -90,12 +120,57 @@ class Dataset {
         return sum;
     }
     
+    // Sum of the coordinates at dimension `dim` of all the points in [start, end), if the dataset
+    // can compute it without a scan (e.g. from a prefix-sum datacube, see datacube.h). Returns
+    // false otherwise.
+    virtual bool GetExactRangeSum(size_t, size_t, size_t, Scalar*) const {
+        return false;
+    }
+
+    // Number of consecutive rows that share storage metadata (e.g. a compression block). Parallel
+    // scans split work on multiples of this so that no two threads decode the same block.
+    virtual size_t BlockSize() const {
+        return 64;
+    }
+
+    // Conservative bounds on the values of column `dim` in the block of BlockSize() rows that
+    // contains row `ix`: every value is in [*min, *max]. Returns false if the dataset keeps no
+    // such metadata.
+    virtual bool BlockBounds(size_t, size_t, Scalar*, Scalar*) const {
+        return false;
+    }
+
+    // If column `dim` is stored as positions ("codes") in a sorted array of its distinct values,
+    // returns that dictionary and sets *size to its length; nullptr otherwise. Every method of
+    // the dataset still takes and returns values, but the ValueSets and RangeSets passed to it
+    // can carry a translation of their values to codes (see RangeSet::Encoded), which saves
+    // translating them on every call.
+    virtual const Scalar* Dictionary(size_t, size_t*) const {
+        return nullptr;
+    }
+
+    // Datasets split over NUMA nodes (see NumaPartitionedDataset) keep the rows in
+    // [PartitionStart(p), PartitionStart(p + 1)) on node PartitionNode(p), and the QueryEngine
+    // scans them with threads on that node. Partition boundaries fall on block boundaries.
+    virtual size_t NumPartitions() const {
+        return 1;
+    }
+
+    virtual size_t PartitionStart(size_t partition) const {
+        return partition == 0 ? 0 : Size();
+    }
+
+    // -1 if the partition isn't placed on a particular node.
+    virtual int PartitionNode(size_t) const {
+        return -1;
+    }
+
     virtual size_t Size() const = 0;
     virtual size_t NumDims() const = 0;
     // size of the dataset in bytes
     virtual size_t SizeInBytes() const = 0;
 
-    virtual void Insert(InsertData<D>& raw_locs) {};
+    virtual void Insert(InsertData<D>&) {};
 };
 
 /*
@@ -17,7 +17,7 @@ class DummyIndex : public PrimaryIndexer<D> {
     // Given a query bounding box, specified by the bottom left point p1 and
     // bottom-right point p2, initialize an iterator, which successively returns
     // ranges of VirtualIndices to check.
-    virtual Set<PhysicalIndex> IndexRanges(Query<D>& q) override { 
+    virtual Set<PhysicalIndex> IndexRanges(Query<D>& q) const override { 
         return Set<PhysicalIndex>({{0, data_size_}}, List<PhysicalIndex> {});
     }
 
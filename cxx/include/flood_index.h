@@ -6,6 +6,7 @@
 
 #include "primary_indexer.h"
 #include "dataset.h"
+#include "range_set.h"
 #include "types.h"
 
 template <size_t D>
@@ -17,10 +18,14 @@ class FloodIndex : public PrimaryIndexer<D> {
     
   void SetDataset(std::shared_ptr<Dataset<D>> dataset) override;
 
-  Set<PhysicalIndex> IndexRanges(Query<D>& query) override;
+  Set<PhysicalIndex> IndexRanges(Query<D>& query) const override;
+  // Returns the ranges of one row of grid cells at a time.
+  std::unique_ptr<RangeCursor> Cursor(Query<D>& query) const override;
   size_t Size() const override;
 
 private:
+  class GridCursor;
+
   bool no_intersection(Scalar q_start, Scalar q_end, int dim) const;
   bool full_intersection(Scalar q_start, Scalar q_end, int dim) const;
   bool full_intersection(const Query<D>& query, int dim) const;
@@ -0,0 +1,103 @@
+/**
+ * GROUP BY aggregation over the points of a query, e.g.
+ *   SELECT A, B, COUNT(*), SUM(C), MAX(D) ... GROUP BY A, B
+ * Groups live in an open-addressing hash table. Rows arrive in columnar batches, and the group of
+ * every row is found before the aggregates are updated one column at a time. The bounds of the
+ * batch's compression block are used to avoid hashing:
+ *  - if every key column is constant in the block, the whole batch belongs to one group.
+ *  - if a single key column spans at most MAX_DIRECT_SPAN values, keys are mapped to groups
+ *    through a small array indexed by key - min, so only the first row of each key is hashed.
+ * Parallel scans aggregate into one table per thread, which are merged at the end.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "column_batch.h"
+#include "visitor.h"
+
+template <size_t D>
+class GroupByVisitor : public Visitor<D> {
+  public:
+    enum AggregateOp {
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+    };
+
+    struct Aggregate {
+        AggregateOp op;
+        // Ignored for COUNT.
+        size_t column;
+    };
+
+    // Largest max - min + 1 of a single key column for which keys are mapped through an array.
+    static const Scalar MAX_DIRECT_SPAN = 4096;
+
+    // All columns must be data columns (less than D).
+    GroupByVisitor(const std::vector<size_t>& key_columns, const std::vector<Aggregate>& aggregates);
+
+    void visit(const PointRef<D>& p) override;
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override;
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<GroupByVisitor<D>>(key_columns_, aggregates_);
+    }
+
+    void Merge(const Visitor<D>& other) override;
+
+    std::string CacheKey() const override;
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this) + keys_.capacity() * sizeof(Scalar) + values_.capacity() * sizeof(Scalar)
+            + slots_.capacity() * sizeof(uint32_t) + gids_.capacity() * sizeof(uint32_t)
+            + direct_.capacity() * sizeof(uint32_t);
+    }
+
+    size_t NumGroups() const {
+        return num_groups_;
+    }
+
+    // The aggregates of every group (in the order they were given), keyed by the values of the key
+    // columns.
+    std::map<std::vector<Scalar>, std::vector<Scalar>> Result() const;
+
+  private:
+    // The id of the group with the given key values, created if it doesn't exist yet.
+    uint32_t FindOrInsert(const Scalar* key);
+    void Grow();
+    static uint64_t Hash(const Scalar* key, size_t n);
+    // Fold aggregate `a` of `n` rows into their groups: the value of row i is vals[rows[i]] and
+    // its group gids[i], or `single_gid` for all of them if it isn't negative.
+    void Update(size_t a, const Scalar* vals, const uint16_t* rows, size_t n,
+            const uint32_t* gids, int64_t single_gid);
+
+    const std::vector<size_t> key_columns_;
+    const std::vector<Aggregate> aggregates_;
+
+    size_t num_groups_ = 0;
+    // key_columns_.size() values per group.
+    std::vector<Scalar> keys_;
+    // aggregates_.size() values per group.
+    std::vector<Scalar> values_;
+    // Group ids (+1, 0 is empty), linear probing. The size is a power of two.
+    std::vector<uint32_t> slots_;
+
+    // Scratch space for batches.
+    std::vector<uint32_t> gids_;
+    // For the direct path: the group id (+1) of every key - min, reset after each batch.
+    std::vector<uint32_t> direct_;
+};
+
+#include "../src/group_by_visitor.hpp"
@@ -23,7 +23,7 @@ class HermitRewriter : public Rewriter<D> {
 
     void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) override;
 
-    List<Key> Rewrite(Query<D>& q) override;
+    List<Key> Rewrite(Query<D>& q) const override;
 
     size_t Size() const override {
         return 3*sizeof(double) + 2*sizeof(size_t);
@@ -33,7 +33,7 @@ class HermitRewriter : public Rewriter<D> {
     void Load(const std::string& filename);
 
     // Return the target range for this value. Range bounds are inclusive.
-    ScalarRange RangeFor(Scalar val);
+    ScalarRange RangeFor(Scalar val) const;
 
   private:
     // The width around the line that's considered inlier territory. Everything outside of this
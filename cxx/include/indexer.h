@@ -2,6 +2,7 @@
 
 #include <iterator>
 #include <fstream>
+#include <limits>
 #include <algorithm>
 #include <vector>
 
@@ -20,6 +21,9 @@ class Indexer {
 
     virtual IndexerType Type() const = 0;
 
+    // What size estimates return when the index can't tell without doing the lookup.
+    static const size_t UNKNOWN_ESTIMATE = std::numeric_limits<size_t>::max();
+
     // Dummy implementation since only a few indexers will actually let us insert.
     std::vector<PhysicalIndex> Insert(std::vector<Point<D>> points) {
         AssertWithMessage(false, "Indexer does not allow inserts");
@@ -15,7 +15,7 @@ class JustSortIndex : public PrimaryIndexer<D> {
   public:
     JustSortIndex(size_t dim) : PrimaryIndexer<D>(dim), column_(dim) {}
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override {
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override {
         List<PhysicalIndex> lst;
         return Set<PhysicalIndex>({{0, data_size_}}, lst);
     }
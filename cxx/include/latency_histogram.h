@@ -0,0 +1,61 @@
+/**
+ * A histogram of latencies (or any non-negative integers) with log-linear buckets, in the style of
+ * HdrHistogram: values below 2^PRECISION_BITS get a bucket each, and every power of two above
+ * that is split into 2^PRECISION_BITS equal buckets. Percentiles are therefore within about
+ * 2^-PRECISION_BITS (under 1%) of the recorded values, over the full 64-bit range, in a fixed
+ * amount of memory and with O(1) recording.
+ *
+ * Not thread-safe: record into one histogram per thread and Merge() them.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void Record(uint64_t value);
+    void Merge(const LatencyHistogram& other);
+    void Reset();
+
+    uint64_t Count() const {
+        return count_;
+    }
+    // 0 if nothing was recorded.
+    uint64_t Min() const {
+        return count_ == 0 ? 0 : min_;
+    }
+    uint64_t Max() const {
+        return max_;
+    }
+    double Mean() const {
+        return count_ == 0 ? 0 : sum_ / (double) count_;
+    }
+    // The smallest recorded value that at least `percentile` percent (0 to 100) of the values are
+    // less than or equal to, rounded up to the top of its bucket (but never above Max()).
+    uint64_t Percentile(double percentile) const;
+
+    // Count, min, mean, max and the usual percentiles as a JSON object.
+    void WriteJson(std::ostream& out) const;
+
+    static const size_t PRECISION_BITS = 7;
+    static const uint64_t SUB_BUCKETS = 1UL << PRECISION_BITS;
+
+  private:
+    static size_t BucketOf(uint64_t value);
+    // The largest value that falls into `bucket`.
+    static uint64_t BucketTop(size_t bucket);
+
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t min_;
+    uint64_t max_;
+    // Kept as a double so that sums of long runs can't overflow.
+    double sum_;
+};
+
+#include "../src/latency_histogram.hpp"
@@ -23,7 +23,7 @@ class LinearModelRewriter : public Rewriter<D> {
 
     void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) override;
 
-    List<Key> Rewrite(Query<D>& q) override;
+    List<Key> Rewrite(Query<D>& q) const override;
 
     size_t Size() const override {
         size_t s = 3*sizeof(double) + 2*sizeof(size_t);
@@ -37,7 +37,7 @@ class LinearModelRewriter : public Rewriter<D> {
     void Load(const std::string& filename);
 
     // Return the target range for this value. Range bounds are inclusive.
-    ScalarRange RangeFor(Scalar val);
+    ScalarRange RangeFor(Scalar val) const;
 
   private:
     // The width around the line that's considered inlier territory. Everything outside of this
@@ -34,6 +34,10 @@ class MappedCorrelationIndex : public Indexer<D> {
     //std::vector<int32_t> HostBucketIds(const Query<D>& q) const ; 
     Ranges<Key> KeyRanges(const Query<D>& q) const;
 
+    // Estimate of the number of keys in KeyRanges(q), from the number of target buckets the mapped
+    // buckets point to, without merging them.
+    size_t EstimateKeys(const Query<D>& q) const;
+
     size_t Size() const  {
         // Computes size using the list mapping.
         size_t s = mapping_lst_.bytes_used();
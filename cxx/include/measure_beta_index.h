@@ -47,7 +47,7 @@ class MeasureBetaIndex : public PrimaryIndexer<D> {
         secondary_ = std::move(secondary);
     }
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override {
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override {
         auto ranges = primary_->IndexRanges(q);
         size_t range_size = 0;
         size_t nranges = ranges.ranges.size();
@@ -28,11 +28,15 @@ class MergeUtils {
 
     template <typename T>
     static Ranges<T> Intersect(const Ranges<T>&, const Ranges<T>&);
+    // An output range is exact if the ranges it came from are both exact. If `first_exact`
+    // (`second_exact`) is set, all ranges of the first (second) input count as exact.
+    template <typename T>
+    static Ranges<T> Intersect(const Ranges<T>&, const Ranges<T>&, bool first_exact, bool second_exact);
     
     //// Note: this does NOT deduplicate.
     template <typename T>
     static List<T> Union(const std::vector<const List<T> *> ix_lists);
-    //// Scalar ranges must be sorted.
+    //// Scalar ranges must be sorted. Empty ranges are dropped.
     template <class ForwardIterator>
     static std::vector<ScalarRange> Coalesce(ForwardIterator begin, ForwardIterator end);
 };
@@ -0,0 +1,92 @@
+/**
+ * A CompressedColumnOrderDataset split into contiguous slices of rows, one per NUMA node. Each
+ * slice, compressed columns and compression blocks included, is built by a thread bound to its
+ * node, so that its memory is allocated there, and the QueryEngine scans every slice with threads
+ * on the same node (see Dataset::NumPartitions). Slices hold whole compression blocks, so the
+ * block-level calls of a scan only ever touch one of them.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "compressed_column_order_dataset.h"
+#include "datacube.h"
+#include "dataset.h"
+#include "types.h"
+
+template <size_t D>
+class NumaPartitionedDataset : public Dataset<D> {
+  public:
+    // Split `data` into `num_nodes` slices, or one per node if 0. Slices go to the nodes
+    // round-robin. Primary keys are the positions of the points in `data`, as in
+    // CompressedColumnOrderDataset.
+    explicit NumaPartitionedDataset(const std::vector<Point<D>>& data,
+            const std::vector<Datacube<D>>& cubes = {}, size_t num_nodes = 0);
+
+    Point<D> Get(size_t i) const override;
+    Scalar GetCoord(size_t index, size_t dim) const override;
+
+    uint64_t GetCoordRange(size_t start, size_t end, size_t dim, Scalar lower, Scalar upper) const override;
+    uint64_t GetCoordInRange(size_t start, size_t end, size_t dim, Scalar low, Scalar high) const override;
+    uint64_t GetCoordInRanges(size_t start, size_t end, size_t dim, const RangeSet& rset) const override;
+    uint64_t GetCoordInSet(size_t start, size_t end, size_t dim, const std::unordered_set<Scalar>& vset) const override;
+    uint64_t GetCoordInSet(size_t start, size_t end, size_t dim, const ValueSet& vset) const override;
+
+    void DecodeRange(size_t start, size_t end, size_t dim, Scalar* out) const override;
+    void GetRangeValues(size_t start, size_t end, size_t dim, uint64_t valids, std::vector<Scalar> *results) const override;
+    Scalar GetRangeSum(size_t start, size_t end, size_t dim, uint64_t valids) const override;
+    bool GetExactRangeSum(size_t start, size_t end, size_t dim, Scalar* sum) const override;
+
+    size_t BlockSize() const override {
+        return slices_[0]->BlockSize();
+    }
+
+    bool BlockBounds(size_t ix, size_t dim, Scalar* min, Scalar* max) const override {
+        size_t s = SliceOf(ix);
+        return slices_[s]->BlockBounds(ix - starts_[s], dim, min, max);
+    }
+
+    size_t NumPartitions() const override {
+        return slices_.size();
+    }
+
+    size_t PartitionStart(size_t partition) const override {
+        return starts_[partition];
+    }
+
+    int PartitionNode(size_t partition) const override {
+        return nodes_[partition];
+    }
+
+    size_t Size() const override {
+        return starts_.back();
+    }
+
+    size_t NumDims() const override {
+        return D;
+    }
+
+    uint64_t SizeInBytes() const override;
+
+  private:
+    // The slice holding row `ix`.
+    size_t SliceOf(size_t ix) const {
+        return std::min(ix / slice_rows_, slices_.size() - 1);
+    }
+
+    // Run `f(slice, local_start, local_end)` on the (at most two) slices holding [start, end),
+    // end - start <= 64, and concatenate the bitmasks it returns.
+    template <typename F>
+    uint64_t SplitMask(size_t start, size_t end, F f) const;
+
+    std::vector<std::unique_ptr<CompressedColumnOrderDataset<D>>> slices_;
+    // The first row of every slice, then the number of rows.
+    std::vector<size_t> starts_;
+    std::vector<int> nodes_;
+    // Rows per slice (except maybe the last one), a multiple of the block size.
+    size_t slice_rows_;
+};
+
+#include "../src/numa_partitioned_dataset.hpp"
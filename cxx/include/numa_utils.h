@@ -0,0 +1,32 @@
+/**
+ * Placement of memory and threads on NUMA nodes, through libnuma. Without libnuma (when
+ * HAVE_LIBNUMA isn't defined) the machine is treated as a single node and placement is left to
+ * the OS.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+class NumaUtils {
+  private:
+    NumaUtils() {}
+
+  public:
+    // Number of nodes memory can be placed on.
+    static size_t NumNodes();
+    // Run the calling thread on the CPUs of `node` only, and place the memory it touches first on
+    // that node. A node of -1 undoes this (and InterleaveAllocations). Cheap if the thread is
+    // already bound that way.
+    static void BindToNode(int node);
+    // Spread the memory the calling thread touches first over all nodes, page by page.
+    static void InterleaveAllocations();
+    // The node the calling thread is currently running on.
+    static int CurrentNode();
+
+  private:
+    // The node the calling thread was last bound to, -1 for none.
+    static thread_local int bound_node_;
+};
+
+#include "../src/numa_utils.hpp"
@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "types.h"
+#include "range_set.h"
 #include "utils.h"
 #include "primary_indexer.h"
 
@@ -41,7 +42,9 @@ class OctreeIndex : public PrimaryIndexer<D> {
         OctreeIndex(std::vector<size_t>& index_dims, size_t page_size);
 
         virtual bool Init(PointIterator<D> start, PointIterator<D> end) override;
-        Set<PhysicalIndex> IndexRanges(Query<D>&) override;
+        Set<PhysicalIndex> IndexRanges(Query<D>&) const override;
+        // Walks the tree as the scan pulls ranges, one leaf (or fully matching node) at a time.
+        std::unique_ptr<RangeCursor> Cursor(Query<D>&) const override;
         size_t Size() const override;
 
         std::unordered_set<size_t> GetColumns() const override {
@@ -57,6 +60,8 @@ class OctreeIndex : public PrimaryIndexer<D> {
         } 
 
     private:
+        class TreeCursor;
+
         std::vector<size_t> index_dims_;
         size_t page_size_;
         std::shared_ptr<Node> root_node;
@@ -71,7 +76,13 @@ class OctreeIndex : public PrimaryIndexer<D> {
         int get_octant_containing_point(Point<D>& point, std::vector<Scalar>& center) const;
         bool divide_node(std::shared_ptr<Node> node, PointIterator<D> start, PointIterator<D> end, int depth);
         bool should_keep_dividing(std::shared_ptr<Node> node, int depth) const;
-        bool is_relevant_node(std::shared_ptr<Node> node, const Query<D>& query) const;
+        // `filters` holds the ranges of the query's filter on each of the index dims, in the order
+        // of index_dims_ (and is empty for dims the query doesn't filter on).
+        bool is_relevant_node(std::shared_ptr<Node> node, const Query<D>& query,
+                const std::vector<RangeSet>& filters) const;
+        // True if every point under the node matches the query on all indexed dims.
+        bool is_contained_node(std::shared_ptr<Node> node, const Query<D>& query,
+                const std::vector<RangeSet>& filters) const;
         size_t num_partitions_;
 
         static const size_t DEFAULT_PAGE_SIZE = 10000;
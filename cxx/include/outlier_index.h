@@ -18,7 +18,10 @@ class OutlierIndex : public PrimaryIndexer<D> {
 
     virtual bool Init(PointIterator<D> start, PointIterator<D> end) override;
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override; 
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override; 
+
+    // The union of the cursors of both indexes.
+    std::unique_ptr<RangeCursor> Cursor(Query<D>& q) const override;
    
     // Sets the indexer for the non-outliers, must be called *before* Init
     void SetIndexer(std::unique_ptr<PrimaryIndexer<D>> indexer);
@@ -23,7 +23,10 @@ class PrimaryBTreeIndex : public PrimaryIndexer<D> {
 
     virtual bool Init(PointIterator<D> start, PointIterator<D> end) override;
 
-    Set<PhysicalIndex> IndexRanges(Query<D>& q) override; 
+    Set<PhysicalIndex> IndexRanges(Query<D>& q) const override; 
+
+    // Looks up the pages of one filter range (or value) at a time.
+    std::unique_ptr<RangeCursor> Cursor(Query<D>& q) const override;
     
     size_t Size() const override {
         return (pages_.size() + 1) * sizeof(Page);
@@ -41,14 +44,23 @@ class PrimaryBTreeIndex : public PrimaryIndexer<D> {
     // the given range [start, end] (inclusive).
     // Note: public for testing.
     Range<PhysicalIndex> PageRangeFor(Scalar start, Scalar end) const;
+    // Returns the index range spanned by the pages whose values all lie in [start, end)
+    // (exclusive). May be empty.
+    Range<PhysicalIndex> ExactPageRangeFor(Scalar start, Scalar end) const;
 
   private:
+    class PageCursor;
+
     // Number of data points
     size_t data_size_;
     
     // When building the index, assuming a working page p, and new candidate points with the same
     // value, determines whether to truncate the page and add it to the index, or start a new one.
     void ExtendOrTruncPage(Page *p, Scalar val, size_t minix, size_t maxix); 
+    // Add the page range `pr` for the values in [start, end) to `ranges`, splitting off the pages
+    // that are fully inside as an exact range.
+    void AddRangesFor(const Range<PhysicalIndex>& pr, Scalar start, Scalar end,
+            Ranges<PhysicalIndex>* ranges) const;
 
     // Used for internal purposes only.
     size_t column_;    
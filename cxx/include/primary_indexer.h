@@ -7,6 +7,7 @@
 #include "types.h"
 #include "dataset.h"
 #include "indexer.h"
+#include "range_cursor.h"
 
 
 template <size_t D>
@@ -20,7 +21,14 @@ class PrimaryIndexer : public Indexer<D> {
     
     // Called during query execution to return the ranges of indexes that should be accessed for
     // this query. The set of indexes is a superset of the true matching records.
-    virtual Set<PhysicalIndex> IndexRanges(Query<D>& query) = 0;
+    virtual Set<PhysicalIndex> IndexRanges(Query<D>& query) const = 0;
+
+    // Like IndexRanges, but returns the ranges as the scan pulls them. Indexes that can find their
+    // ranges incrementally should override this. The cursor may refer to `query` and to the index,
+    // which must both outlive it.
+    virtual std::unique_ptr<RangeCursor> Cursor(Query<D>& query) const {
+        return std::make_unique<SetCursor>(IndexRanges(query));
+    }
 
     // Sorts the data according to this primary index. Returns true if the data was modified.
     virtual bool Init(PointIterator<D> start, PointIterator<D> end) = 0;
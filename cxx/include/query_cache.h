@@ -0,0 +1,67 @@
+/**
+ * A bounded cache of per-query results, keyed by a canonical form of the query's filters. Entries
+ * are evicted in least-recently-used order once their total size exceeds the memory budget.
+ * Lookups and insertions may come from concurrent queries (see QueryEngine::ExecuteBatch).
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+template <typename V>
+class QueryCache {
+  public:
+    explicit QueryCache(size_t budget_bytes);
+
+    // Copy the value cached under `key` into *value. Returns false on a miss.
+    bool Get(const std::string& key, V* value);
+    // Cache `value`, whose size is estimated at `bytes` (not counting the key), under `key`.
+    // Values larger than the whole budget are not cached.
+    void Put(const std::string& key, const V& value, size_t bytes);
+    void Clear();
+
+    // The filters of `q` on the given dims, in a canonical form: queries with the same filters on
+    // these dims get the same key, whatever their other filters. IN-lists may come in any order,
+    // but range filters must already be sorted and coalesced (see QueryEngine).
+    template <size_t D>
+    static std::string Key(const Query<D>& q, const std::vector<size_t>& dims);
+
+    size_t Hits() const {
+        return hits_;
+    }
+
+    size_t Misses() const {
+        return misses_;
+    }
+
+    // Estimated size of the cached entries, keys included.
+    size_t SizeInBytes() const {
+        return bytes_;
+    }
+
+  private:
+    struct Entry {
+        std::string key;
+        V value;
+        size_t bytes;
+    };
+
+    const size_t budget_;
+    size_t bytes_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    // Most recently used first.
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+    std::mutex mutex_;
+};
+
+#include "../src/query_cache.hpp"
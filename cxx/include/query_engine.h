@@ -7,11 +7,18 @@
 #include <vector>
 #include <memory>
 #include <fstream>
+#include <functional>
+#include <unordered_set>
 
 #include "types.h"
-#include "indexer.h"
+#include "bounded_queue.h"
+#include "column_batch.h"
+#include "primary_indexer.h"
+#include "query_cache.h"
 #include "rewriter.h"
 #include "dataset.h"
+#include "range_set.h"
+#include "value_set.h"
 #include "visitor.h"
 
 template <size_t D>
@@ -21,33 +28,95 @@ class QueryEngine {
             std::shared_ptr<PrimaryIndexer<D>> indexer);
     
     void Execute(Query<D>& q, Visitor<D>& visitor);
+    // Same as Execute, with the dataset and visitor types known at compile time: the scan calls
+    // into them directly, so decoding and the visitor's body can be inlined, and queries with up
+    // to 3 range filters and at most one IN-list filter get a kernel specialized for that shape.
+    // Falls back to Execute unless the dataset is exactly a DatasetT and `visitor` exactly a
+    // VisitorT, not of a type derived from them.
+    template <typename DatasetT, typename VisitorT>
+    void ExecuteTyped(Query<D>& q, VisitorT& visitor);
+
+    // Number of threads used to scan the ranges and list returned by the indexer. With more than
+    // one thread, the scan is split into morsels and the visitor must support Clone() and Merge();
+    // visitors that don't are scanned on a single thread.
+    void SetNumThreads(size_t num_threads);
+
+    // Creates the visitor for the query at the given position in a batch.
+    using VisitorFactory = std::function<std::unique_ptr<Visitor<D>>(size_t)>;
+    // Run many independent queries concurrently, one query per thread at a time, and return one
+    // visitor per query (in the order of `queries`). Queries are handed out dynamically, so a
+    // thread that finishes a cheap query immediately picks up the next one. Queries may be
+    // rewritten in place by the indexer, just as with Execute. If `query_times_ns` is given, it is
+    // filled with each query's latency, from when a thread picked it up to when it finished.
+    std::vector<std::unique_ptr<Visitor<D>>> ExecuteBatch(std::vector<Query<D>>& queries,
+            VisitorFactory factory, std::vector<long>* query_times_ns = nullptr);
+
+    // Same as ExecuteBatch, but overlaps indexing with scanning instead of running whole queries
+    // side by side: a producer thread runs the indexer on up to `depth` queries ahead of the one
+    // being scanned, while the scan of each query uses all the engine's threads. Suits
+    // configurations where indexing takes a large share of each query's latency. Queries are
+    // answered from the result cache as in Execute, and cache hits aren't indexed.
+    std::vector<std::unique_ptr<Visitor<D>>> ExecutePipelined(std::vector<Query<D>>& queries,
+            VisitorFactory factory, size_t depth = 2);
 
     long ScannedPoints() const {
-        return scanned_range_points_ + scanned_list_points_;
+        ScanStats t = TotalStats();
+        return t.scanned_range_points + t.scanned_list_points;
     }
     long ScannedRangePoints() const {
-        return scanned_range_points_;
+        return TotalStats().scanned_range_points;
     }
     long ScannedListPoints() const {
-        return scanned_list_points_;
+        return TotalStats().scanned_list_points;
+    }
+    // Points in scanned ranges that block bounds ruled out, or showed to match entirely.
+    long SkippedPoints() const {
+        return TotalStats().skipped_points;
+    }
+    long ExactPoints() const {
+        return TotalStats().exact_points;
     }
 
     void WriteStats(std::ofstream& statsfile) const {
         indexer_->WriteStats(statsfile);
-        statsfile << "avg_scanned_points_in_range: " << scanned_range_points_ / ((float)num_queries_) << std::endl
-            << "avg_scanned_points_in_list: " << scanned_list_points_ / ((float)num_queries_) << std::endl
-            << "avg_indexing_time_ns: " << indexing_time_ / ((float)num_queries_) << std::endl
-            << "avg_range_scan_time_ns: " << range_scan_time_ / ((float)num_queries_) << std::endl
-            << "avg_list_scan_time_ns: " << list_scan_time_ / ((float)num_queries_) << std::endl;
+        ScanStats t = TotalStats();
+        statsfile << "avg_scanned_points_in_range: " << t.scanned_range_points / ((float)t.num_queries) << std::endl
+            << "avg_scanned_points_in_list: " << t.scanned_list_points / ((float)t.num_queries) << std::endl
+            << "avg_indexing_time_ns: " << t.indexing_time / ((float)t.num_queries) << std::endl
+            << "avg_range_scan_time_ns: " << t.range_scan_time / ((float)t.num_queries) << std::endl
+            << "avg_list_scan_time_ns: " << t.list_scan_time / ((float)t.num_queries) << std::endl
+            << "avg_skipped_points_in_range: " << t.skipped_points / ((float)t.num_queries) << std::endl
+            << "avg_exact_points_in_range: " << t.exact_points / ((float)t.num_queries) << std::endl;
+        if (result_cache_ != nullptr) {
+            statsfile << "result_cache_hits: " << result_cache_->Hits() << std::endl
+                << "result_cache_misses: " << result_cache_->Misses() << std::endl;
+        }
     }
 
     void Reset() {
-        scanned_range_points_ = 0;
-        scanned_list_points_ = 0;
-        range_scan_time_ = 0;
-        indexing_time_ = 0;
-        list_scan_time_ = 0;
-        num_queries_ = 0;
+        for (auto& s : stats_) {
+            s = ScanStats();
+        }
+    }
+
+    // Cache the results of visitors that support it (see Visitor::CacheKey) for up to about
+    // `budget_bytes`, so that repeated queries skip indexing and scanning. Inserts through the
+    // engine clear the cache, and entries don't outlive a change in the dataset's size; call
+    // InvalidateResultCache() after changing the data in any other way.
+    void EnableResultCache(size_t budget_bytes);
+    void InvalidateResultCache();
+
+    // Insert through the indexer, like PrimaryIndexer::Insert and DummyInsert, and drop the
+    // cached results.
+    std::vector<InsertRecord<D>> Insert(const std::vector<Point<D>>& points) {
+        InvalidateResultCache();
+        return indexer_->Insert(points);
+    }
+
+    std::vector<InsertRecord<D>> DummyInsert(const std::vector<Point<D>>& points,
+            const std::vector<size_t>& indexes) {
+        InvalidateResultCache();
+        return indexer_->DummyInsert(points, indexes);
     }
 
     long IndexerSize() {
@@ -55,17 +124,143 @@ class QueryEngine {
     }
 
   private:
+    // Counters are kept per thread so that concurrent queries in a batch don't contend on them.
+    // Each shard sits on its own cache line.
+    struct alignas(64) ScanStats {
+        long scanned_range_points = 0;
+        long scanned_list_points = 0;
+        long range_scan_time = 0;
+        long indexing_time = 0;
+        long list_scan_time = 0;
+        // Points in ranges that were skipped or accepted whole based on block bounds.
+        long skipped_points = 0;
+        long exact_points = 0;
+        size_t num_queries = 0;
+    };
+
+    ScanStats TotalStats() const;
+    // The shard owned by the calling thread.
+    ScanStats& LocalStats();
+
+    // The predicates that have to be evaluated on every scanned point of a query.
+    struct ScanFilters {
+        // Bitmask of all the filtered dims.
+        uint64_t dims = 0;
+        std::vector<size_t> categorical_dims;
+        std::vector<ValueSet> value_sets;
+        std::vector<size_t> range_dims;
+        std::vector<RangeSet> range_sets;
+    };
+
+    // How the rows of a block relate to the query, judging only from the dataset's block bounds.
+    enum BlockMatch {
+        BLOCK_NONE,
+        BLOCK_SOME,
+        BLOCK_ALL,
+    };
+
+    // Sort and coalesce the ranges of every range filter, and sort and dedupe the values of every
+    // IN-list filter, so that indexes see disjoint ranges and distinct values in increasing order.
+    static void NormalizeFilters(Query<D>& q);
+    ScanFilters BuildFilters(const Query<D>& q) const;
+    // Compare the bounds of the block containing row `ix` against every filter, except those on
+    // `skip_dims` (a bitmask of dims the index already guarantees). For BLOCK_SOME, sets bit i of
+    // `cat_needed` (`range_needed`) if the i-th categorical (range) filter still has to be
+    // checked row by row.
+    BlockMatch MatchBlock(const ScanFilters& filters, PhysicalIndex ix, uint64_t skip_dims,
+            uint64_t* cat_needed, uint64_t* range_needed) const;
+    // Bitmask (as with Dataset::GetCoordRange) of the points in [start, end), end - start <= 64,
+    // that pass the filters selected by `cat_needed` and `range_needed`.
+    uint64_t ChunkMatches(const ScanFilters& filters, PhysicalIndex start, PhysicalIndex end,
+            uint64_t cat_needed, uint64_t range_needed) const;
+    // Scan the points in [start, end) and hand the matching ones to the visitor, in batches
+    // assembled in `batch` if it isn't null. Adds the number of points that were skipped or
+    // visited as an exact range without decoding.
+    void ScanRange(const ScanFilters& filters, PhysicalIndex start, PhysicalIndex end,
+            uint64_t skip_dims, Visitor<D>& visitor, ColumnBatch<D>* batch, long* skipped,
+            long* exact) const;
+    // Scans one range of the index output: ScanRange for Execute, a specialized kernel for
+    // ExecuteTyped.
+    using RangeScanner = std::function<void(const ScanFilters& filters, PhysicalIndex start,
+            PhysicalIndex end, uint64_t skip_dims, Visitor<D>& visitor, ColumnBatch<D>* batch,
+            long* skipped, long* exact)>;
+    // Scan the points in [begin, end) of an index list, which must be sorted and free of
+    // duplicates. Points are grouped by dataset block, so
+    // that block bounds are checked once per block and nearby points are decoded together, and
+    // the matches are handed to the visitor with visitRange or in batches. Long runs of
+    // consecutive points are scanned as ranges with `scan_range`.
+    void ScanList(const ScanFilters& filters,
+            List<PhysicalIndex>::const_iterator begin, List<PhysicalIndex>::const_iterator end,
+            uint64_t skip_dims, Visitor<D>& visitor, ColumnBatch<D>* batch,
+            const RangeScanner& scan_range, long* skipped, long* exact) const;
+    // The dims whose filters don't need to be checked for the points in `range`.
+    static uint64_t SkipDims(uint64_t guaranteed_dims, uint64_t exact_range_dims,
+            const Range<PhysicalIndex>& range) {
+        return guaranteed_dims | (range.exact ? exact_range_dims : 0);
+    }
+    static uint64_t SkipDims(const Set<PhysicalIndex>& indexes, const Range<PhysicalIndex>& range) {
+        return SkipDims(indexes.guaranteed_dims, indexes.exact_range_dims, range);
+    }
+    // Split the ranges into morsels of roughly equal size whose boundaries fall on dataset block
+    // boundaries (except at the ends of the original ranges). Morsels don't cross partition
+    // boundaries (see Dataset::NumPartitions).
+    Ranges<PhysicalIndex> MakeMorsels(const Ranges<PhysicalIndex>& ranges) const;
+    // Thread t of a parallel scan scans morsels [first[t], first[t + 1]), on NUMA node nodes[t]
+    // (-1 for any).
+    void ScheduleMorsels(const Ranges<PhysicalIndex>& morsels, std::vector<size_t>* first,
+            std::vector<int>* nodes) const;
+    template <typename DatasetT, typename VisitorT, int NR, int NC>
+    void ScanRangeTyped(const DatasetT& dataset, const ScanFilters& filters,
+            PhysicalIndex start, PhysicalIndex end, uint64_t skip_dims, VisitorT& visitor,
+            ColumnBatch<D>* batch, long* skipped, long* exact) const;
+    void ParallelScan(const ScanFilters& filters, const Set<PhysicalIndex>& indexes_to_scan,
+            Visitor<D>& visitor, const RangeScanner& scan_range, long* ranges_t, long* list_t,
+            long* skipped, long* exact) const;
+    // Answer the query from the result cache, or with Scan.
+    void Run(Query<D>& q, Visitor<D>& visitor, const RangeScanner& scan_range);
+    // The key of the visitor's result for the normalized query `q` in the result cache, or ""
+    // if it can't be cached.
+    std::string ResultCacheKey(const Query<D>& q, const Visitor<D>& visitor) const;
+    // Run `scan` on an empty copy of `visitor`, cache the result under `cache_key` and merge it
+    // into `visitor`, so that what's cached doesn't depend on the state of `visitor`.
+    void ScanAndCache(const std::string& cache_key, Visitor<D>& visitor,
+            const std::function<void(Visitor<D>&)>& scan);
+    // Index and scan the query, scanning ranges with `scan_range`, and record the stats.
+    void Scan(Query<D>& q, Visitor<D>& visitor, const RangeScanner& scan_range);
+    // Scan each range as soon as the indexer's cursor produces it.
+    void StreamScan(Query<D>& q, Visitor<D>& visitor, const RangeScanner& scan_range);
+    // True if the query should be scanned by several threads, with ParallelScan.
+    bool ScansInParallel(const Visitor<D>& visitor) const;
+    // Record the scan times as trace spans of the current query, and add them and the point
+    // counts to the stats of this thread.
+    void RecordScan(long index_t, long ranges_t, long list_t, long skipped, long exact);
+    // Run the indexer on the query and set *index_t to the time it took, in ns. The list of the
+    // result only holds the points outside its ranges, as with StreamScan.
+    Set<PhysicalIndex> Index(Query<D>& q, long* index_t) const;
+    // Sort and dedupe a list of the indexer, as ScanList needs.
+    static void SortList(List<PhysicalIndex>* list);
+    // Where `range` falls in a sorted list, walked from `pos` along with ranges in physical
+    // order: list[pos, *before) comes before the range, and list[*before, *inside) is inside it.
+    // Points inside a range are visited by its scan, so that's where every scan leaves them out
+    // of the list, and the serial scans visit the points before a range ahead of it, to keep
+    // physical order.
+    static void SplitList(const List<PhysicalIndex>& list, size_t pos,
+            const Range<PhysicalIndex>& range, size_t* before, size_t* inside);
+    // The scanning part of Scan, for indexes that took `index_t` ns to compute. `filters` must
+    // be built from the query before it was indexed.
+    void ScanIndexes(const ScanFilters& filters, const Set<PhysicalIndex>& indexes_to_scan,
+            long index_t, Visitor<D>& visitor, const RangeScanner& scan_range);
+
     std::shared_ptr<Dataset<D>> dataset_;
     std::shared_ptr<PrimaryIndexer<D>> indexer_;
     // The columns that are indexed by this indexer, saved for faster access.
     std::unordered_set<size_t> columns_;
 
-    long scanned_range_points_;
-    long scanned_list_points_; 
-    long range_scan_time_;
-    long indexing_time_;
-    long list_scan_time_;
-    size_t num_queries_;
+    std::vector<ScanStats> stats_;
+    size_t num_threads_;
+    // Final visitor states, keyed by the visitor's CacheKey() and the query.
+    using ResultCache = QueryCache<std::shared_ptr<const Visitor<D>>>;
+    std::unique_ptr<ResultCache> result_cache_;
 };
 
 #include "../src/query_engine.hpp"
@@ -0,0 +1,126 @@
+/**
+ * Pull-based access to the indexes an index lookup selects. Where IndexRanges materializes every
+ * range of the result before the scan starts, a cursor produces the ranges one at a time as the
+ * scan asks for them, so that the first points are visited before the index has finished (or
+ * without it finishing at all, once a LIMIT is reached) and only a few ranges are held at once.
+ *
+ * Ranges come out in the order the index finds them, which is increasing and non-overlapping for
+ * queries normalized by the QueryEngine. Lists (e.g. of secondary index matches or outliers) are
+ * small and computed eagerly, so they are available as soon as the cursor is created. A list may
+ * hold indexes that are also in one of the ranges; Drain() and the QueryEngine only return those
+ * once.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "types.h"
+
+class RangeCursor {
+  public:
+    RangeCursor() : guaranteed_dims_(0), exact_range_dims_(0), list_() {}
+    virtual ~RangeCursor() {}
+
+    // Store the next range in *range. Returns false once all ranges have been returned.
+    virtual bool Next(Range<PhysicalIndex>* range) = 0;
+
+    // Individual indexes to scan besides the ranges.
+    const List<PhysicalIndex>& GetList() const {
+        return list_;
+    }
+    // As in Set<PhysicalIndex>.
+    uint64_t GuaranteedDims() const {
+        return guaranteed_dims_;
+    }
+    uint64_t ExactRangeDims() const {
+        return exact_range_dims_;
+    }
+
+    // Pull all remaining ranges into a Set, whose list only holds the indexes outside of them.
+    Set<PhysicalIndex> Drain();
+
+  protected:
+    uint64_t guaranteed_dims_;
+    uint64_t exact_range_dims_;
+    List<PhysicalIndex> list_;
+};
+
+// Returns the ranges of an already materialized Set. This is what indexes that don't produce their
+// ranges lazily return.
+class SetCursor : public RangeCursor {
+  public:
+    explicit SetCursor(Set<PhysicalIndex> set);
+
+    bool Next(Range<PhysicalIndex>* range) override;
+
+  private:
+    Ranges<PhysicalIndex> ranges_;
+    size_t pos_;
+};
+
+// Base for cursors that find their ranges a few at a time. The last range found is only returned
+// after the next call to Refill, so that Refill can still extend or deduplicate against it.
+class BufferedRangeCursor : public RangeCursor {
+  public:
+    BufferedRangeCursor() : buffer_(), pos_(0), done_(false) {}
+
+    bool Next(Range<PhysicalIndex>* range) override;
+
+  protected:
+    // Append the next ranges to `ranges`, whose last element (if any) is the last range found so
+    // far and may be modified. Returns false once there are no more ranges to add.
+    virtual bool Refill(Ranges<PhysicalIndex>* ranges) = 0;
+
+  private:
+    Ranges<PhysicalIndex> buffer_;
+    size_t pos_;
+    bool done_;
+};
+
+// Shifts the ranges and list of another cursor by a fixed offset, e.g. for an index over the
+// tail of the data.
+class OffsetCursor : public RangeCursor {
+  public:
+    OffsetCursor(std::unique_ptr<RangeCursor> cursor, PhysicalIndex offset);
+
+    bool Next(Range<PhysicalIndex>* range) override;
+
+  private:
+    std::unique_ptr<RangeCursor> cursor_;
+    PhysicalIndex offset_;
+};
+
+// The indexes in either of two cursors. Overlapping ranges are merged, and the merged range is
+// only exact if all of its parts are. The lists are merged too.
+class UnionCursor : public RangeCursor {
+  public:
+    UnionCursor(std::unique_ptr<RangeCursor> first, std::unique_ptr<RangeCursor> second);
+
+    bool Next(Range<PhysicalIndex>* range) override;
+
+  private:
+    // Extend *range with the head of `cursor` if they overlap (or touch, and are equally exact).
+    bool Absorb(Range<PhysicalIndex>* range, int cursor);
+
+    std::unique_ptr<RangeCursor> cursors_[2];
+    // The next range of each cursor, valid if has_head_ is set.
+    Range<PhysicalIndex> heads_[2];
+    bool has_head_[2];
+};
+
+// The indexes in both of two cursors, neither of which may have a list. A range of the result is
+// exact if the ranges it came from are both exact.
+class IntersectCursor : public RangeCursor {
+  public:
+    IntersectCursor(std::unique_ptr<RangeCursor> first, std::unique_ptr<RangeCursor> second);
+
+    bool Next(Range<PhysicalIndex>* range) override;
+
+  private:
+    std::unique_ptr<RangeCursor> cursors_[2];
+    Range<PhysicalIndex> heads_[2];
+    bool has_head_[2];
+};
+
+#include "../src/range_cursor.hpp"
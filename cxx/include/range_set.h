@@ -0,0 +1,68 @@
+/**
+ * The ranges of a range filter (e.g. A in [a1, a2) OR A in [a3, a4) OR ...), sorted and coalesced
+ * so that they are disjoint. Rewriters often turn a single range into many. How a run of values is
+ * tested depends on how many ranges overlap the bounds of the run's block:
+ *  - at most MAX_LINEAR_RANGES: one vectorized range check per range, OR-ed together.
+ *  - more: the values are decoded once and each is looked up with a branchless binary search.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+
+class RangeSet {
+  public:
+    // Runs of values are checked against this many ranges one at a time.
+    static const size_t MAX_LINEAR_RANGES = 4;
+
+    // Ranges are half-open ([first, second)) and may be unsorted, overlapping or empty.
+    explicit RangeSet(const std::vector<ScalarRange>& ranges);
+    // Also translate the ranges to codes of a dictionary-encoded column (see
+    // Dataset::Dictionary), once rather than on every scan of the column.
+    RangeSet(const std::vector<ScalarRange>& ranges, const Scalar* dictionary,
+            size_t dictionary_size);
+
+    // The ranges of positions in `dictionary` (sorted, distinct values) whose values are in the
+    // set. Since the dictionary is sorted, each range maps to a single range of codes.
+    RangeSet Encode(const Scalar* dictionary, size_t dictionary_size) const;
+    // The set translated to the codes of `dictionary`, if it was built for it, or nullptr.
+    const RangeSet* Encoded(const Scalar* dictionary) const {
+        return dictionary == dictionary_ ? encoded_.get() : nullptr;
+    }
+
+    bool Contains(Scalar v) const;
+    // True if some range overlaps [lo, hi] (inclusive).
+    bool Intersects(Scalar lo, Scalar hi) const;
+    // True if a single range contains all of [lo, hi] (inclusive).
+    bool Covers(Scalar lo, Scalar hi) const;
+    // Set [*begin, *end) to the positions of the ranges that overlap [lo, hi] (inclusive).
+    void Overlapping(Scalar lo, Scalar hi, size_t* begin, size_t* end) const;
+    // Return a bitmask with bit i set if vals[i] lies in one of the ranges at positions
+    // [begin, end), for n <= 64. As with ValueSet::Matches, the first value maps to the least
+    // significant bit.
+    uint64_t Matches(const Scalar* vals, size_t n, size_t begin, size_t end) const;
+
+    const ScalarRange& At(size_t i) const {
+        return ranges_[i];
+    }
+
+    size_t Size() const {
+        return ranges_.size();
+    }
+
+  private:
+    // The last range in [begin, end) that starts at or before v, or the first one if there is
+    // none. Requires begin < end.
+    const ScalarRange* Floor(Scalar v, size_t begin, size_t end) const;
+
+    // Sorted, disjoint and non-empty.
+    std::vector<ScalarRange> ranges_;
+    const Scalar* dictionary_ = nullptr;
+    std::shared_ptr<const RangeSet> encoded_;
+};
+
+#include "../src/range_set.hpp"
@@ -11,7 +11,7 @@ class Rewriter : public Indexer<D> {
 
     // Rewrite the query for the primary index.
     // Returns any auxiliary indexes that have to be scanned as a result.
-    virtual List<Key> Rewrite(Query<D>& q) = 0;
+    virtual List<Key> Rewrite(Query<D>& q) const = 0;
 
     virtual void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) = 0;
 
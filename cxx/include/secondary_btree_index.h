@@ -22,6 +22,9 @@ class SecondaryBTreeIndex : public SecondaryIndexer<D> {
     void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) override;
 
     List<Key> Matches(const Query<D>& q) const override; 
+
+    // Counts the matches among a sample of the keys.
+    size_t EstimateMatches(const Query<D>& q) const override;
     
     size_t Size() const override {
         return btree_.bytes_used();
@@ -55,6 +58,9 @@ class SecondaryBTreeIndex : public SecondaryIndexer<D> {
     // A map from dimension value to index range where points with that dimension value that are
     // outliers can be found.
     btree::btree_multimap<Scalar, Key> btree_;
+    // Every SAMPLE_RATE-th value in the btree as of Init, in sorted order, for EstimateMatches.
+    static const size_t SAMPLE_RATE = 64;
+    std::vector<Scalar> sample_;
 };
 
 #include "../src/secondary_btree_index.hpp"
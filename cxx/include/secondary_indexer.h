@@ -24,6 +24,13 @@ class SecondaryIndexer : public Indexer<D> {
     // An optional without a value means this index cannot filter the query (all indexes are valid)
     virtual List<Key> Matches(const Query<D>& query) const = 0;
 
+    // Estimate of Matches(query).size(), used by the CompositeIndex to decide whether the lookup
+    // is worth it. By default UNKNOWN_ESTIMATE, which has the CompositeIndex run Matches up front
+    // and reuse its result.
+    virtual size_t EstimateMatches(const Query<D>&) const {
+        return this->UNKNOWN_ESTIMATE;
+    }
+
     virtual void Init(ConstPointIterator<D> start,
             ConstPointIterator<D> end) = 0;
 
@@ -0,0 +1,88 @@
+/**
+ * Vectorized kernels that work directly on the bit-packed columns of
+ * CompressedColumnOrderDataset. Each kernel handles a run of at most 64 values that share a
+ * compression block, i.e. a fixed base value and bit width. Values are stored big-endian, so
+ * value i of a run starting at bit `bit_offset` is found by loading the 8 bytes at byte
+ * (bit_offset + i * bit_width) / 8, swapping them, and shifting out the value.
+ *
+ * The AVX2 and AVX-512 versions are compiled with function-level target attributes and chosen at
+ * runtime based on the CPU, so the binary still runs on machines without them.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "types.h"
+
+enum class SimdLevel {
+    SCALAR = 0,
+    AVX2 = 1,
+    AVX512 = 2,
+};
+
+class SimdKernels {
+  private:
+    SimdKernels() {}
+
+  public:
+    // The best instruction set supported by this CPU.
+    static SimdLevel DetectLevel();
+    // The instruction set the kernels currently dispatch to.
+    static SimdLevel Level();
+    // Use at most the given instruction set (mostly for testing and benchmarking). Levels that
+    // the CPU does not support are lowered to the best supported one.
+    static void SetLevel(SimdLevel level);
+
+    // Decode `n` <= 64 consecutive packed values and add `base` to each of them.
+    static void Decode(const char* data, uint64_t bit_offset, char bit_width, Scalar base,
+            size_t n, Scalar* out);
+    // Return a bitmask with a 1 for every one of the `n` <= 64 packed values whose decoded value
+    // lies in [lower, upper] (inclusive). The first value maps to bit n-1, as with
+    // Dataset::GetCoordRange.
+    static uint64_t InRange(const char* data, uint64_t bit_offset, char bit_width, Scalar base,
+            size_t n, Scalar lower, Scalar upper);
+
+    // Return a bitmask with bit i set if vals[i] equals any of the `k` values in `list`, for
+    // n <= 64. Meant for short lists: every value is compared against the whole list.
+    static uint64_t InList(const Scalar* vals, size_t n, const Scalar* list, size_t k);
+
+    // Sum of the vals[i] with bit i set in `mask`, for n <= 64.
+    static Scalar MaskedSum(const Scalar* vals, size_t n, uint64_t mask);
+
+    // Reverse the order of the bits in x.
+    static uint64_t ReverseBits(uint64_t x);
+
+  private:
+    // Widest bit width the kernels handle: a value plus its offset into the first byte must fit
+    // in a single 64-bit load.
+    static const char MAX_BIT_WIDTH = 56;
+
+    static void DecodeScalar(const char* data, uint64_t bit_offset, char bit_width, Scalar base,
+            size_t n, Scalar* out);
+    // Kernels below take the bounds relative to the block's base value, already clamped to
+    // [0, INT64_MAX], and return the mask in row order (first value in bit 0).
+    static uint64_t InRangeScalar(const char* data, uint64_t bit_offset, char bit_width,
+            size_t n, int64_t lo, int64_t hi);
+    static uint64_t InListScalar(const Scalar* vals, size_t n, const Scalar* list, size_t k);
+    static Scalar MaskedSumScalar(const Scalar* vals, size_t n, uint64_t mask);
+#if defined(__x86_64__)
+    static void DecodeAVX2(const char* data, uint64_t bit_offset, char bit_width, Scalar base,
+            size_t n, Scalar* out);
+    static uint64_t InRangeAVX2(const char* data, uint64_t bit_offset, char bit_width,
+            size_t n, int64_t lo, int64_t hi);
+    static uint64_t InListAVX2(const Scalar* vals, size_t n, const Scalar* list, size_t k);
+    static Scalar MaskedSumAVX2(const Scalar* vals, size_t n, uint64_t mask);
+    static void DecodeAVX512(const char* data, uint64_t bit_offset, char bit_width, Scalar base,
+            size_t n, Scalar* out);
+    static uint64_t InRangeAVX512(const char* data, uint64_t bit_offset, char bit_width,
+            size_t n, int64_t lo, int64_t hi);
+    static uint64_t InListAVX512(const Scalar* vals, size_t n, const Scalar* list, size_t k);
+    static Scalar MaskedSumAVX512(const Scalar* vals, size_t n, uint64_t mask);
+#endif
+
+    static SimdLevel& CurrentLevel();
+};
+
+#include "../src/simd_kernels.hpp"
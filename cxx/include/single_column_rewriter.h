@@ -42,7 +42,7 @@ class SingleColumnRewriter : public Rewriter<D> {
         return s;
     }
 
-    List<Key> Rewrite(Query<D>& q) override;
+    List<Key> Rewrite(Query<D>& q) const override;
 
     void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) override {}
         
@@ -0,0 +1,192 @@
+/**
+ * Instrumentation for the query path, in place of printing to stdout on every query.
+ *
+ * Counters (e.g. how many matches a secondary index returned) are kept per thread, each written
+ * only by its own thread with relaxed atomics, so bumping one costs about as much as a plain
+ * increment. Spans time the phases of a query (index probe, key to physical index lookup, merging
+ * index results, and the range and list scans) and are only recorded for sampled queries: with
+ * SetSampling(n), one in every n queries is timed, which keeps the cost of the clock reads
+ * negligible when tracing is left on in production. Sampled queries are also kept individually,
+ * the last few per thread, for latency distributions.
+ *
+ * Snapshots of all threads can be exported as JSON or CSV. Building with -D TRACING=0 removes all
+ * trace points.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#ifndef TRACING
+#define TRACING 1
+#endif
+
+enum class TraceSpan {
+    // Everything the indexer does for a query, including the spans below it that it triggers.
+    IndexProbe,
+    // Mapping keys from secondary or correlation indexes to physical indexes.
+    KeyLookup,
+    // Intersecting or unioning the results of several indexes.
+    Merge,
+    RangeScan,
+    ListScan,
+    NUM_SPANS,
+};
+
+enum class TraceCounter {
+    Queries,
+    SampledQueries,
+    // What the indexer asked the engine to scan.
+    IndexRanges,
+    IndexListPoints,
+    // Queries on which an index found none of its columns filtered and fell back to a full scan.
+    FullScanFallbacks,
+    SecondaryMatches,
+    // Target buckets the mapped buckets of a query pointed to, before merging.
+    MappedTargetBuckets,
+    CorrelationRanges,
+    CorrelationListPoints,
+    RewrittenRanges,
+    // The access paths chosen by the CompositeIndex planner.
+    PlannedFullScans,
+    PlannedCorrelationLookups,
+    PlannedSecondaryLookups,
+    NUM_COUNTERS,
+};
+
+const size_t NUM_TRACE_SPANS = static_cast<size_t>(TraceSpan::NUM_SPANS);
+const size_t NUM_TRACE_COUNTERS = static_cast<size_t>(TraceCounter::NUM_COUNTERS);
+
+// The spans of one query.
+struct QueryTrace {
+    uint64_t id = 0;
+    bool sampled = false;
+    uint64_t span_ns[NUM_TRACE_SPANS] = {};
+};
+
+struct TraceSnapshot {
+    size_t sampling = 0;
+    uint64_t counters[NUM_TRACE_COUNTERS] = {};
+    uint64_t span_count[NUM_TRACE_SPANS] = {};
+    uint64_t span_ns[NUM_TRACE_SPANS] = {};
+    uint64_t span_max_ns[NUM_TRACE_SPANS] = {};
+    // Recently sampled queries, by id.
+    std::vector<QueryTrace> recent;
+
+    uint64_t Counter(TraceCounter c) const {
+        return counters[static_cast<size_t>(c)];
+    }
+};
+
+class Trace {
+  public:
+    // Record the spans of one in every `every` queries, or of none if 0. Counters are always kept.
+    static void SetSampling(size_t every);
+    static size_t Sampling();
+
+    // Start and finish a query on the calling thread. Spans are attributed to the query that is
+    // open on the thread they run on.
+    static void BeginQuery();
+    static void EndQuery();
+    // Move the open query to another thread (e.g. from the thread that indexes it to the one
+    // that scans it): Suspend closes it here, and Resume reopens it on the calling thread.
+    static QueryTrace Suspend();
+    static void Resume(const QueryTrace& query);
+    // Whether spans on this thread are being recorded.
+    static bool Sampled();
+
+    static void Count(TraceCounter counter, uint64_t n = 1);
+    // Add a span that was timed by the caller.
+    static void RecordSpan(TraceSpan span, uint64_t ns);
+
+    // Totals over all threads, including ones that have exited.
+    static TraceSnapshot Snapshot();
+    // Clear all counters and spans. Queries running meanwhile may keep some of their counts.
+    static void Reset();
+
+    static void WriteJson(std::ostream& out);
+    // One line per recently sampled query, with the time spent in each span.
+    static void WriteCsv(std::ostream& out);
+
+    static const char* Name(TraceSpan span);
+    static const char* Name(TraceCounter counter);
+
+  private:
+    // Each thread's share of the stats. Only the owner writes the atomics, so updates are a
+    // relaxed load and store rather than a locked read-modify-write.
+    struct alignas(64) ThreadTrace {
+        std::atomic<uint64_t> counters[NUM_TRACE_COUNTERS] = {};
+        std::atomic<uint64_t> span_count[NUM_TRACE_SPANS] = {};
+        std::atomic<uint64_t> span_ns[NUM_TRACE_SPANS] = {};
+        std::atomic<uint64_t> span_max_ns[NUM_TRACE_SPANS] = {};
+        // The query open on this thread; only touched by the owner.
+        QueryTrace current;
+        bool open = false;
+        // Set while a thread owns this shard. Shards of exited threads are reused.
+        bool in_use = false;
+        std::mutex recent_mutex;
+        std::deque<QueryTrace> recent;
+    };
+
+    // Releases the calling thread's shard when the thread exits.
+    struct ShardHandle {
+        ThreadTrace* shard = nullptr;
+        ~ShardHandle();
+    };
+
+    static ThreadTrace& Local();
+    static void Add(std::atomic<uint64_t>& a, uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // Sampled queries kept per thread.
+    static const size_t MAX_RECENT = 1024;
+
+    static std::mutex registry_mutex_;
+    static std::vector<std::unique_ptr<ThreadTrace>> registry_;
+    static std::atomic<size_t> sampling_;
+    static std::atomic<uint64_t> next_query_;
+    static thread_local ShardHandle local_;
+};
+
+// Times the enclosing scope as `span`, if the query open on this thread is sampled.
+class ScopedSpan {
+  public:
+    explicit ScopedSpan(TraceSpan span);
+    ~ScopedSpan();
+
+  private:
+    TraceSpan span_;
+    bool active_;
+    uint64_t start_ns_;
+};
+
+// Opens a query on the calling thread for the lifetime of the object.
+class TracedQuery {
+  public:
+    TracedQuery() {
+        Trace::BeginQuery();
+    }
+    ~TracedQuery() {
+        Trace::EndQuery();
+    }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if TRACING
+#define TRACE_SPAN(span) ScopedSpan TRACE_CONCAT(trace_span_, __LINE__)(TraceSpan::span)
+#define TRACE_COUNT(counter, n) Trace::Count(TraceCounter::counter, (n))
+#else
+#define TRACE_SPAN(span)
+#define TRACE_COUNT(counter, n)
+#endif
+
+#include "../src/trace.hpp"
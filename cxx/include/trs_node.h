@@ -8,6 +8,7 @@
 #include "types.h"
 #include "math_utils.h"
 #include "merge_utils.h"
+#include "trace.h"
 
 const Scalar NINF = -(1LL << 45);
 
@@ -120,7 +121,7 @@ struct TRSNode {
         return outlier_indexes;
     }
 
-    void Lookup(ScalarRange query_range, std::vector<ScalarRange>* ranges) {
+    void Lookup(ScalarRange query_range, std::vector<ScalarRange>* ranges) const {
         if (query_range.first > bounds.second || query_range.second < bounds.first) {
             // Nothing to do here.
             return;
@@ -144,10 +145,9 @@ struct TRSNode {
         }
         // Otherwise, this is the root and we need to sort and merge them.
         std::sort(ranges->begin(), ranges->end(), ScalarRangeStartComp{});
-        std::cout << "Merge ranges begin" << std::endl;
         auto merged = MergeUtils::Coalesce(ranges->begin(), ranges->end());
-        std::cout << "Merge ranges end" << std::endl;
         ranges->assign(merged.begin(), merged.end());
+        TRACE_COUNT(RewrittenRanges, ranges->size());
     }
 
     size_t Size() {
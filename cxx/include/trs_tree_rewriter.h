@@ -23,7 +23,7 @@ class TRSTreeRewriter : public Rewriter<D> {
 
     void Init(ConstPointIterator<D> start, ConstPointIterator<D> end) override;
 
-    List<Key> Rewrite(Query<D>& q) override;
+    List<Key> Rewrite(Query<D>& q) const override;
 
     void WriteOutliers(const List<Key>& outliers);
 
@@ -3,6 +3,7 @@
  */
 
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <array>
 #include <cmath>
@@ -68,7 +69,7 @@ struct QueryFilter {
     // ... WHERE ranges[0].first <= attr <= ranges[0].second
     //     OR ranges[1].first <= attr <= ranges[1].second
     //     OR ...
-    // Ranges may not always be sorted.
+    // Ranges may not always be sorted; QueryEngine sorts and coalesces them before indexing.
     // Queries may not be specified in this way, but after rewriting, they often are.
     std::vector<ScalarRange> ranges;
     // values in an IN clause.
@@ -110,10 +111,13 @@ template <typename T>
 struct Range {
     T start;
     T end;  // exclusive
+    // Set by indexes when every point in the range is known to match the query on some of its
+    // dimensions (see Set::exact_range_dims). Ignored when comparing ranges.
+    bool exact;
 
-    Range() : start(0), end(0) {}
-    Range(T s, T e)
-        : start(s), end(e) {}
+    Range() : start(0), end(0), exact(false) {}
+    Range(T s, T e, bool ex = false)
+        : start(s), end(e), exact(ex) {}
     bool operator==(const Range<T>& other) const {
         return (start == other.start) && (end == other.end);
     }
@@ -171,12 +175,19 @@ using PointIterator = typename std::vector<Point<D>>::iterator;
 
 // The output of indexes - secondary indexes usually report lists, while clustered indexes report
 // ranges. The true physical index set is a union of teh ranges and the lists.
+//
+// Indexes can also report what they already know about the query's filters, so that the scan
+// doesn't have to check them again. Both fields are bitmasks over the dimensions of the query.
 template <typename T>
 struct Set {
     Ranges<T> ranges;
     List<T> list;
-    Set(Ranges<T> rgs, List<T> lst) : ranges(rgs), list(lst) {}
-    Set() : ranges(), list() {}
+    // Every point in the set matches the filters on these dimensions.
+    uint64_t guaranteed_dims;
+    // Every point in a range marked exact also matches the filters on these dimensions.
+    uint64_t exact_range_dims;
+    Set(Ranges<T> rgs, List<T> lst) : ranges(rgs), list(lst), guaranteed_dims(0), exact_range_dims(0) {}
+    Set() : ranges(), list(), guaranteed_dims(0), exact_range_dims(0) {}
 };
 
 
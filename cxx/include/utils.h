@@ -163,10 +163,13 @@ std::vector<Query<D>> load_query_file(const std::string& filename) {
                 sf.values = vals;
                 sf.present = true;
             } else if (type == "ranges") {
+                // Any number of [first, second) pairs, OR-ed together.
                 sf.is_range = true;
                 ScalarRange range;
-                iss >> range.first >> range.second;    
-                sf.ranges = { range };
+                while (iss >> range.first >> range.second) {
+                    sf.ranges.push_back(range);
+                }
+                assert (!sf.ranges.empty());
                 sf.present = true;
             } else {
                 assert (type == "none");
@@ -0,0 +1,72 @@
+/**
+ * A set of values from an IN-list filter (e.g. A IN (a1, a2, a3)), with a membership test chosen
+ * when the query is planned based on the number and spread of the values:
+ *  - LINEAR: a handful of values, compared against whole runs of decoded values with SIMD.
+ *  - BITMAP: values from a compact domain, looked up in a bitmap over [min, max].
+ *  - SORTED: everything else, looked up with a branchless binary search.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+
+class ValueSet {
+  public:
+    enum Strategy {
+        LINEAR,
+        BITMAP,
+        SORTED,
+    };
+
+    // Lists with at most this many values are compared linearly.
+    static const size_t MAX_LINEAR_VALUES = 8;
+    // Largest max - min + 1 for which a bitmap is built (8KB).
+    static const Scalar MAX_BITMAP_SPAN = 1 << 16;
+
+    // The values don't need to be sorted or unique.
+    explicit ValueSet(const std::vector<Scalar>& values);
+    // Also translate the values to codes of a dictionary-encoded column (see
+    // Dataset::Dictionary), once rather than on every scan of the column.
+    ValueSet(const std::vector<Scalar>& values, const Scalar* dictionary, size_t dictionary_size);
+
+    // The positions in `dictionary` (sorted, distinct values) of the values in the set.
+    ValueSet Encode(const Scalar* dictionary, size_t dictionary_size) const;
+    // The set translated to the codes of `dictionary`, if it was built for it, or nullptr.
+    const ValueSet* Encoded(const Scalar* dictionary) const {
+        return dictionary == dictionary_ ? encoded_.get() : nullptr;
+    }
+
+    bool Contains(Scalar v) const;
+    // True if some value of the set lies in [lo, hi].
+    bool Intersects(Scalar lo, Scalar hi) const;
+    // Return a bitmask with bit i set if vals[i] is in the set, for n <= 64. Note that, unlike
+    // Dataset::GetCoordInSet, the first value maps to the least significant bit.
+    uint64_t Matches(const Scalar* vals, size_t n) const;
+
+    Strategy GetStrategy() const {
+        return strategy_;
+    }
+
+    size_t Size() const {
+        return values_.size();
+    }
+
+  private:
+    bool SortedContains(Scalar v) const;
+
+    // Sorted, without duplicates.
+    std::vector<Scalar> values_;
+    Scalar min_;
+    Scalar max_;
+    // Bit v - min_ is set if v is in the set.
+    std::vector<uint64_t> bitmap_;
+    Strategy strategy_;
+    const Scalar* dictionary_ = nullptr;
+    std::shared_ptr<const ValueSet> encoded_;
+};
+
+#include "../src/value_set.hpp"
@@ -8,9 +8,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <string>
 
 #include "types.h"
+#include "column_batch.h"
 #include "dataset.h"
 
 /**
@@ -23,6 +27,18 @@ class Visitor {
   public:
 
     long ScannedPoints() { return scanned_points_; }
+
+    // Parallel scans give every worker thread its own visitor and fold the partial results back
+    // together once the scan is done. Clone() returns a visitor of the same type with empty
+    // state, or nullptr if the visitor cannot be split (the scan then runs on a single thread).
+    virtual std::unique_ptr<Visitor<D>> Clone() const {
+        return nullptr;
+    }
+    // Fold the state of a visitor returned by Clone() into this one. Partial visitors are merged in
+    // physical index order, so order-sensitive visitors can simply append.
+    virtual void Merge(const Visitor<D>& other) {
+        scanned_points_ += other.scanned_points_;
+    }
     // Aggregate the given point as part of the result set.
     virtual void visit(const PointRef<D>& p) = 0;
     // A way to batch process many results. `valids` tells us which indices between `start_ix`
@@ -45,6 +61,47 @@ class Visitor {
            visit(PointRef<D>(dataset, i));
        }
     };
+    // Aggregate all the points in [start_ix, end_ix) at once, without looking at them one by one
+    // (e.g. by reading a prefix-sum datacube, see Dataset::GetExactRangeSum). Returns false if
+    // that isn't possible, in which case the range is scanned as usual.
+    virtual bool tryVisitExactRange(const Dataset<D>*, size_t, size_t) {
+        return false;
+    }
+    // True once further points can't change the result (e.g. a LIMIT is reached). The engine
+    // then stops scanning, at the latest after the block it is in.
+    virtual bool IsSaturated() const {
+        return false;
+    }
+    // True if no point in the dataset block containing row `ix` (see Dataset::BlockSize) can
+    // change the result, whether it matches the query or not. Checked before each block is
+    // scanned, so a visitor can prune with what it has seen so far.
+    virtual bool CanSkipBlock(const Dataset<D>*, size_t) const {
+        return false;
+    }
+    // Identifies what the visitor computes (its type and parameters), for QueryEngine's result
+    // cache: two fresh visitors with the same key end up in the same state after the same query.
+    // Empty if results can't be cached.
+    virtual std::string CacheKey() const {
+        return "";
+    }
+    // Estimated size of the visitor's state in bytes, which the result cache charges for keeping
+    // it. Visitors holding results outside the object itself must count them.
+    virtual size_t MemoryBytes() const {
+        return sizeof(Visitor<D>);
+    }
+    // Visitors that return true get matching rows in columnar batches through visitBatch()
+    // instead of visitRange() and visitExactRange(), for index ranges and lists alike.
+    virtual bool UsesBatches() const {
+        return false;
+    }
+    // Aggregate the selected rows of the batch. Read columns with batch.Column(dim); columns
+    // that are never asked for are never decoded.
+    virtual void visitBatch(ColumnBatch<D>& batch) {
+        scanned_points_ += batch.End() - batch.Start();
+        for (size_t i = 0; i < batch.Count(); i++) {
+            visit(PointRef<D>(batch.GetDataset(), batch.Start() + batch.Selection()[i]));
+        }
+    }
 };
 
 /**
@@ -78,6 +135,10 @@ public:
     void visitExactRange(const Dataset<D> *, size_t, size_t) override {
 
     }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<DummyVisitor<D>>();
+    }
 };
 
 template <size_t D>
@@ -97,7 +158,30 @@ public:
 
     void visitExactRange(const Dataset<D>*, size_t start, size_t end) override {
         count += end - start;
-        this->scanned_points_ += count;
+        this->scanned_points_ += end - start;
+    }
+
+    bool tryVisitExactRange(const Dataset<D>*, size_t start, size_t end) override {
+        count += end - start;
+        this->scanned_points_ += end - start;
+        return true;
+    }
+
+    std::string CacheKey() const override {
+        return "count";
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this);
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<CountVisitor<D>>();
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        count += static_cast<const CountVisitor<D>&>(other).count;
     }
 };
 
@@ -112,6 +196,37 @@ public:
     void visit(const PointRef<D>& p) override {
         result_set.push_back(p.dataset->Get(p.idx));
     }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        size_t first = result_set.size();
+        result_set.resize(first + batch.Count());
+        const uint16_t* sel = batch.Selection();
+        for (size_t d = 0; d < D; d++) {
+            const Scalar* col = batch.Column(d);
+            for (size_t i = 0; i < batch.Count(); i++) {
+                result_set[first + i][d] = col[sel[i]];
+            }
+        }
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<CollectVisitor<D>>();
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this) + result_set.capacity() * sizeof(Point<D>);
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        const auto& o = static_cast<const CollectVisitor<D>&>(other);
+        result_set.insert(result_set.end(), o.result_set.begin(), o.result_set.end());
+    }
 };
 
 // Gather the indices of all the resulting points.
@@ -124,6 +239,165 @@ class IndexVisitor : public Visitor<D> {
     void visit(const PointRef<D>& p) override {
         indexes.push_back(p.idx);
     }
+
+    // Needs no columns at all, only the selection.
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const uint16_t* sel = batch.Selection();
+        for (size_t i = 0; i < batch.Count(); i++) {
+            indexes.push_back(batch.Start() + sel[i]);
+        }
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<IndexVisitor<D>>();
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this) + indexes.capacity() * sizeof(size_t);
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        const auto& o = static_cast<const IndexVisitor<D>&>(other);
+        indexes.insert(indexes.end(), o.indexes.begin(), o.indexes.end());
+    }
+};
+
+// Gather the indices of the first `limit` resulting points, in physical order. Indexes that
+// cluster the data on a column return ranges in that column's order, so this answers
+// ... ORDER BY <column> LIMIT n while scanning only a prefix of the ranges.
+template <size_t D>
+class LimitVisitor : public Visitor<D> {
+  public:
+    std::vector<size_t> indexes;
+    explicit LimitVisitor(size_t limit) : limit_(limit) {}
+
+    void visit(const PointRef<D>& p) override {
+        if (indexes.size() < limit_) {
+            indexes.push_back(p.idx);
+        }
+    }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const uint16_t* sel = batch.Selection();
+        size_t n = std::min(batch.Count(), limit_ - indexes.size());
+        for (size_t i = 0; i < n; i++) {
+            indexes.push_back(batch.Start() + sel[i]);
+        }
+    }
+
+    bool IsSaturated() const override {
+        return indexes.size() >= limit_;
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this) + indexes.capacity() * sizeof(size_t);
+    }
+
+    // Not cloned: the first points are only known once everything before them is scanned.
+
+  private:
+    const size_t limit_;
+};
+
+// Keep the `k` points with the largest (or smallest) values of `column`. Once k points are
+// kept, blocks whose bounds show that none of their values can displace one are skipped.
+template <size_t D>
+class TopKVisitor : public Visitor<D> {
+  public:
+    TopKVisitor(size_t column, size_t k, bool largest = true)
+        : column_(column), k_(k), largest_(largest) {}
+
+    void visit(const PointRef<D>& p) override {
+        Offer(p.dataset->GetCoord(p.idx, column_), p.idx);
+    }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const Scalar* col = batch.Column(column_);
+        const uint16_t* sel = batch.Selection();
+        for (size_t i = 0; i < batch.Count(); i++) {
+            Offer(col[sel[i]], batch.Start() + sel[i]);
+        }
+    }
+
+    bool CanSkipBlock(const Dataset<D>* dataset, size_t ix) const override {
+        Scalar min, max;
+        if (heap_.size() < k_ || !dataset->BlockBounds(ix, column_, &min, &max)) {
+            return false;
+        }
+        return !Beats(largest_ ? max : min, heap_.front().first);
+    }
+
+    // The kept (value, index) pairs, best first.
+    std::vector<std::pair<Scalar, size_t>> Result() const {
+        std::vector<std::pair<Scalar, size_t>> result(heap_);
+        std::sort_heap(result.begin(), result.end(), HeapComp{largest_});
+        return result;
+    }
+
+    std::string CacheKey() const override {
+        return "topk:" + std::to_string(column_) + ":" + std::to_string(k_) + ":"
+            + std::to_string(largest_);
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this) + heap_.capacity() * sizeof(heap_[0]);
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<TopKVisitor<D>>(column_, k_, largest_);
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        for (const auto& e : static_cast<const TopKVisitor<D>&>(other).heap_) {
+            Offer(e.first, e.second);
+        }
+    }
+
+  private:
+    // Orders the heap so that the worst kept value is at the front.
+    struct HeapComp {
+        bool largest;
+        bool operator()(const std::pair<Scalar, size_t>& a, const std::pair<Scalar, size_t>& b) const {
+            return largest ? a.first > b.first : a.first < b.first;
+        }
+    };
+
+    bool Beats(Scalar v, Scalar worst) const {
+        return largest_ ? v > worst : v < worst;
+    }
+
+    void Offer(Scalar v, size_t ix) {
+        if (heap_.size() < k_) {
+            heap_.emplace_back(v, ix);
+            std::push_heap(heap_.begin(), heap_.end(), HeapComp{largest_});
+        } else if (k_ > 0 && Beats(v, heap_.front().first)) {
+            std::pop_heap(heap_.begin(), heap_.end(), HeapComp{largest_});
+            heap_.back() = {v, ix};
+            std::push_heap(heap_.begin(), heap_.end(), HeapComp{largest_});
+        }
+    }
+
+    const size_t column_;
+    const size_t k_;
+    const bool largest_;
+    std::vector<std::pair<Scalar, size_t>> heap_;
 };
 
 template <size_t D>
@@ -136,6 +410,54 @@ public:
     void visit(const PointRef<D>& p) override {
         sum += p.dataset->GetCoord(p.idx, column);
     }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const Scalar* col = batch.Column(column);
+        const uint16_t* sel = batch.Selection();
+        Scalar s = 0;
+        if (batch.AllSelected()) {
+            for (size_t i = 0; i < batch.Count(); i++) {
+                s += col[i];
+            }
+        } else {
+            for (size_t i = 0; i < batch.Count(); i++) {
+                s += col[sel[i]];
+            }
+        }
+        sum += s;
+    }
+
+    bool tryVisitExactRange(const Dataset<D>* dataset, size_t start, size_t end) override {
+        Scalar s;
+        if (!dataset->GetExactRangeSum(start, end, column, &s)) {
+            return false;
+        }
+        sum += s;
+        this->scanned_points_ += end - start;
+        return true;
+    }
+
+    std::string CacheKey() const override {
+        return "sum:" + std::to_string(column);
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this);
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<SumVisitor<D>>(column);
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        sum += static_cast<const SumVisitor<D>&>(other).sum;
+    }
 };
 
 template <size_t D>
@@ -148,6 +470,37 @@ public:
     void visit(const PointRef<D>& p) override {
         sum += p.dataset->GetCoord(p.idx, column1) * p.dataset->GetCoord(p.idx, column2);
     }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const Scalar* col1 = batch.Column(column1);
+        const Scalar* col2 = batch.Column(column2);
+        const uint16_t* sel = batch.Selection();
+        for (size_t i = 0; i < batch.Count(); i++) {
+            sum += col1[sel[i]] * col2[sel[i]];
+        }
+    }
+
+    std::string CacheKey() const override {
+        return "sumproduct:" + std::to_string(column1) + ":" + std::to_string(column2);
+    }
+
+    size_t MemoryBytes() const override {
+        return sizeof(*this);
+    }
+
+    std::unique_ptr<Visitor<D>> Clone() const override {
+        return std::make_unique<SumProductVisitor<D>>(column1, column2);
+    }
+
+    void Merge(const Visitor<D>& other) override {
+        Visitor<D>::Merge(other);
+        sum += static_cast<const SumProductVisitor<D>&>(other).sum;
+    }
 };
 
 // Hard-coded for TPC-H Q6 for now
@@ -160,30 +513,67 @@ public:
     void visit(const PointRef<D>& p) override {
         aggregate += p.dataset->GetCoord(p.idx, 3) * p.dataset->GetCoord(p.idx, 6);
     }
+
+    bool UsesBatches() const override {
+        return true;
+    }
+
+    void visitBatch(ColumnBatch<D>& batch) override {
+        this->scanned_points_ += batch.End() - batch.Start();
+        const Scalar* col3 = batch.Column(3);
+        const Scalar* col6 = batch.Column(6);
+        const uint16_t* sel = batch.Selection();
+        for (size_t i = 0; i < batch.Count(); i++) {
+            aggregate += col3[sel[i]] * col6[sel[i]];
+        }
+    }
 };
 
+// Same as AggregateVisitor, but reads the products from a datacube materialized at column
+// `sum_cube_dim` (see Datacube::Materialize). If the dataset also has a prefix-sum cube over that
+// column, exact ranges are answered with two lookups.
 template <size_t D>
 class AggregateWithCubesVisitor : public AggregateVisitor<D> {
 
   public:
-    AggregateWithCubesVisitor(size_t sum_cube_dim, size_t cumsum_cube_dim)
-        : AggregateVisitor<D>(), sum_cube_dim_(sum_cube_dim), cumsum_cube_dim_(cumsum_cube_dim) {}
+    AggregateWithCubesVisitor(size_t sum_cube_dim)
+        : AggregateVisitor<D>(), sum_cube_dim_(sum_cube_dim) {}
 
-    /*void visitRange(const Dataset<D>* dset, size_t start, size_t end, uint64_t valids) {
-        this->aggregate.fetch_add(dset->GetRangeSum(start, end, sum_cube_dim_, valids), std::memory_order_relaxed);
+    void visit(const PointRef<D>& p) override {
+        this->aggregate += p.dataset->GetCoord(p.idx, sum_cube_dim_);
+    }
+
+    // Batches only decode the first D columns, which don't include the cubes.
+    bool UsesBatches() const override {
+        return false;
     }
 
-    void visitExactRange(const Dataset<D>* dset, size_t start, size_t end) {
-        // Access datacube in the last dimension.
-        Scalar delta = 0;
-        for (size_t i = start; i < end; i++) {
-            delta += dset->GetCoord(i, sum_cube_dim_);
+    void visitRange(const Dataset<D>* dset, size_t start, size_t end, uint64_t valids) override {
+        this->scanned_points_ += end - start;
+        this->aggregate += dset->GetRangeSum(start, end, sum_cube_dim_, valids);
+    }
+
+    void visitExactRange(const Dataset<D>* dset, size_t start, size_t end) override {
+        if (tryVisitExactRange(dset, start, end)) {
+            return;
+        }
+        this->scanned_points_ += end - start;
+        for (size_t s = start; s < end; s += 64) {
+            size_t e = std::min(end, s + 64);
+            this->aggregate += dset->GetRangeSum(s, e, sum_cube_dim_, ~0UL >> (64 - (e - s)));
         }
-        //Scalar delta = dset->GetCoord(end, cumsum_cube_dim_) - dset->GetCoord(start, cumsum_cube_dim_);
-        this->aggregate.fetch_add(delta, std::memory_order_relaxed);
-    }*/
-  
+    }
+
+    bool tryVisitExactRange(const Dataset<D>* dset, size_t start, size_t end) override {
+        Scalar delta;
+        if (!dset->GetExactRangeSum(start, end, sum_cube_dim_, &delta)) {
+            return false;
+        }
+        this->aggregate += delta;
+        this->scanned_points_ += end - start;
+        return true;
+    }
+
   private:
     const size_t sum_cube_dim_;
-    const size_t cumsum_cube_dim_;
 };
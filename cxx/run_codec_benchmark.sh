@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Compares the block codecs on the datasets of the run_*_experiments.sh scripts.
+# Usage: run_codec_benchmark.sh [indexer spec file to sort the data by]
+
+SPEC=$1
+DATA=/home/ubuntu/correlations/continuous
+
+run() {
+    DIM=$1
+    NAME=$2
+    DATASET=$3
+
+    savefile=results/codecs_$NAME
+    set -x
+    /home/ubuntu/correlations/cxx/build${DIM}/benchmark_codecs \
+        --name=$NAME \
+        --dataset=$DATASET \
+        --indexer-spec=$SPEC \
+        --configs=for,adaptive,smallest \
+        --save=$savefile
+    set +x
+}
+
+mkdir -p results
+run 5 stocks_a1_linear.k1.5_4.uniform $DATA/stocks/stocks_a1_linear.k1.5_4.uniform
+run 5 chicago_taxi_a1_linear.k1.5_3.uniform $DATA/chicago_taxi/chicago_taxi_a1_linear.k1.5_3.uniform
+run 3 airline_a1_linear.k1.3_0.uniform $DATA/airline/airline_a1_linear.k1.3_0.uniform
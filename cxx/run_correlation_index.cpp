@@ -1,17 +1,21 @@
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <filesystem>
+#include <sstream>
 #include <sysexits.h>
 #include <vector>
 
 #include "types.h"
 #include "flags.h"
 #include "index_builder.h"
+#include "latency_histogram.h"
 #include "row_order_dataset.h"
 #include "inmemory_column_order_dataset.h"
 #include "compressed_column_order_dataset.h"
 #include "clustered_column_order_dataset.h"
 #include "query_engine.h"
+#include "trace.h"
 #include "visitor.h"
 #include "utils.h"
 #include "datacube.h"
@@ -116,6 +120,13 @@ void run_workload(QueryEngine<DIM>& engine,
     }
     std::cout << "Total queries: " << num_queries << std::endl;
     std::cout << "Avg range query time (ns): " << tt / ((double) num_queries) << std::endl;
+    LatencyHistogram latency;
+    for (double t : query_times) {
+        latency.Record(t);
+    }
+    std::cout << "Query time (ns): p50 " << latency.Percentile(50)
+        << ", p99 " << latency.Percentile(99)
+        << ", max " << latency.Max() << std::endl;
     std::cout << "Total points scanned: " << engine.ScannedRangePoints() << " (range), "
         << engine.ScannedListPoints() << " (list)" << std::endl;    
 
@@ -125,14 +136,83 @@ void run_workload(QueryEngine<DIM>& engine,
             << "total_pts: " << total << std::endl
             << "aggregate: " << aggregate << std::endl;
     engine.WriteStats(savefile);
-    savefile << "avg_query_time_ns: " << (tt/(double)num_queries) << std::endl;
+    savefile << "avg_query_time_ns: " << (tt/(double)num_queries) << std::endl
+            << "p50_query_time_ns: " << latency.Percentile(50) << std::endl
+            << "p90_query_time_ns: " << latency.Percentile(90) << std::endl
+            << "p99_query_time_ns: " << latency.Percentile(99) << std::endl
+            << "max_query_time_ns: " << latency.Max() << std::endl;
+    engine.Reset();
+}
+
+// Runs the whole workload as one batch, with queries executing concurrently. Only the total time
+// is meaningful here, so per-query times are not recorded.
+void run_batch_workload(QueryEngine<DIM>& engine,
+        const std::string& visitor_type,
+        const std::string& workload_file,
+        std::ofstream& savefile) {
+
+    std::vector<Query<DIM>> workload = load_query_file<DIM>(workload_file);
+    size_t num_queries = workload.size();
+    cout << endl << "Starting batch workload " << workload_file << "(" << num_queries << " queries)" << endl;
+
+    QueryEngine<DIM>::VisitorFactory factory = [&visitor_type](size_t) -> std::unique_ptr<Visitor<DIM>> {
+        if (visitor_type == "collect") {
+            return std::unique_ptr<Visitor<DIM>>(new CollectVisitor<DIM>());
+        } else if (visitor_type == "count") {
+            return std::unique_ptr<Visitor<DIM>>(new CountVisitor<DIM>());
+        } else if (visitor_type == "index") {
+            return std::unique_ptr<Visitor<DIM>>(new IndexVisitor<DIM>());
+        } else if (visitor_type == "sum") {
+            return std::unique_ptr<Visitor<DIM>>(new SumVisitor<DIM>(1));
+        }
+        return std::unique_ptr<Visitor<DIM>>(new DummyVisitor<DIM>());
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto visitors = engine.ExecuteBatch(workload, factory);
+    auto finish = std::chrono::high_resolution_clock::now();
+    auto tt = std::chrono::duration_cast<std::chrono::nanoseconds>(finish-start).count();
+
+    size_t total = 0;
+    Scalar aggregate = 0;
+    for (const auto& v : visitors) {
+        if (visitor_type == "collect") {
+            total += static_cast<CollectVisitor<DIM>*>(v.get())->result_set.size();
+        } else if (visitor_type == "count") {
+            total += static_cast<CountVisitor<DIM>*>(v.get())->count;
+        } else if (visitor_type == "index") {
+            total += static_cast<IndexVisitor<DIM>*>(v.get())->indexes.size();
+        } else if (visitor_type == "sum") {
+            aggregate += static_cast<SumVisitor<DIM>*>(v.get())->sum;
+        }
+    }
+    if (visitor_type == "sum") {
+        std::cout << "Sum returned by queries: " << aggregate << std::endl;
+    } else {
+        std::cout << "Total points returned by queries: " << total << std::endl;
+    }
+    std::cout << "Total queries: " << num_queries << std::endl;
+    std::cout << "Throughput (queries/s): " << num_queries / (tt / 1e9) << std::endl;
+    std::cout << "Total points scanned: " << engine.ScannedRangePoints() << " (range), "
+        << engine.ScannedListPoints() << " (list)" << std::endl;
+
+    savefile << "workload: " << workload_file << std::endl
+            << "num_queries: " << num_queries << std::endl
+            << "visitor: " << visitor_type << std::endl
+            << "batch: 1" << std::endl
+            << "total_pts: " << total << std::endl
+            << "aggregate: " << aggregate << std::endl;
+    engine.WriteStats(savefile);
+    savefile << "batch_time_ns: " << tt << std::endl
+            << "avg_query_time_ns: " << (tt/(double)num_queries) << std::endl;
     engine.Reset();
 }
 
 int main(int argc, char** argv) {
     if (argc < 4) {
         std::cerr << "Expected arguments: --dataset --workload --visitor "
-            << "--indexer-spec --save [--base-cols]" << std::endl;
+            << "--indexer-spec --save [--base-cols] [--threads] [--batch] [--trace=json|csv] "
+            << "[--trace-sampling] [--dataset-cache] [--dictionary-dims] [--sum-cubes]" << std::endl;
         return EX_USAGE;
     }
     auto flags = ParseFlags(argc, argv);
@@ -170,11 +250,42 @@ int main(int argc, char** argv) {
     std::cout << "Time to sort and finalize data: " << tt_sort / 1e9 << "s" << std::endl;
 
     auto compression_start = std::chrono::high_resolution_clock::now();
+    // Prefix sums of these columns let SUMs over exact index ranges skip the scan.
     std::vector<Datacube<DIM>> cubes;
-    std::cout << "Not using datacubes" << std::endl;
-    bool use_datacubes = false;
+    for (const std::string& dim : GetCommaSeparated(flags, "sum-cubes")) {
+        cubes.push_back(Datacube<DIM>::PrefixSum(std::stoul(dim)));
+    }
+    std::cout << "Using " << cubes.size() << " datacubes" << std::endl;
 
-    auto dataset = std::make_shared<CompressedColumnOrderDataset<DIM>>(data);
+    // Map the compressed columns from a previous run if there are any, instead of compressing.
+    // They are only reused if they were built from the same dataset file with the same flags.
+    std::string dataset_cache = GetWithDefault(flags, "dataset-cache", "");
+    std::shared_ptr<CompressedColumnOrderDataset<DIM>> dataset;
+    std::ostringstream build_info;
+    build_info << "dataset=" << std::filesystem::absolute(dataset_file).string()
+        << " bytes=" << std::filesystem::file_size(dataset_file)
+        << " modified=" << std::filesystem::last_write_time(dataset_file).time_since_epoch().count()
+        << " base-cols=" << base_cols
+        << " indexer-spec=" << GetRequired(flags, "indexer-spec")
+        << " dictionary-dims=" << GetWithDefault(flags, "dictionary-dims", "")
+        << " sum-cubes=" << GetWithDefault(flags, "sum-cubes", "");
+    if (!dataset_cache.empty()) {
+        dataset = CompressedColumnOrderDataset<DIM>::Open(dataset_cache, build_info.str());
+        if (dataset == nullptr) {
+            std::cout << "No usable cached dataset, rebuilding" << std::endl;
+        }
+    }
+    if (dataset == nullptr) {
+        std::vector<size_t> dictionary_dims;
+        for (const std::string& dim : GetCommaSeparated(flags, "dictionary-dims")) {
+            dictionary_dims.push_back(std::stoul(dim));
+        }
+        dataset = std::make_shared<CompressedColumnOrderDataset<DIM>>(data, std::vector<Scalar>(),
+                cubes, dictionary_dims);
+        if (!dataset_cache.empty()) {
+            dataset->Save(dataset_cache, build_info.str());
+        }
+    }
     //auto dataset = std::make_shared<ClusteredColumnOrderDataset<DIM>>(data);
     indexer->SetDataset(dataset);
     auto compression_finish = std::chrono::high_resolution_clock::now();
@@ -184,30 +295,47 @@ int main(int argc, char** argv) {
     std::cout << "Indexer sizei (B): " << indexer_size_bytes << std::endl;
 
     QueryEngine<DIM> engine(dataset, indexer);
+    engine.SetNumThreads(std::stoi(GetWithDefault(flags, "threads", "1")));
     auto index_creation_finish = std::chrono::high_resolution_clock::now();
     auto index_creation_time = std::chrono::duration_cast<std::chrono::nanoseconds>(index_creation_finish-index_creation_start).count();
     std::cout << "Index creation time: " << index_creation_time / 1e9 << "s" << std::endl;
 
 
     string visitor_type = std::string(GetRequired(flags, "visitor"));
+    bool batch = GetWithDefault(flags, "batch", "0") != "0";
+    // Write a snapshot of the trace counters and spans next to each results file.
+    std::string trace_format = GetWithDefault(flags, "trace", "");
+    Trace::SetSampling(std::stoul(GetWithDefault(flags, "trace-sampling", "1")));
     for (size_t work_ix = 0; work_ix < workload_files.size(); work_ix++) {
         auto cur_timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::system_clock::now().time_since_epoch()).count();
         std::ofstream results;
+        string filename = "default.out";
         if (!save_file_base.empty()) {
-            string filename = save_file_base + "_" + std::to_string(cur_timestamp);
-            results.open(filename);
-        } else {
-            results.open("default.out");
+            filename = save_file_base + "_" + std::to_string(cur_timestamp);
         }
+        results.open(filename);
         assert (results.is_open());
         results << "timestamp: " << cur_timestamp << std::endl
             << "name: " << GetWithDefault(flags, "name", "") << std::endl
             << "dataset: " << GetRequired(flags, "dataset") << std::endl
             << "index_spec: " << GetRequired(flags, "indexer-spec") << std::endl
             << "index_size: " << indexer->Size() << std::endl;
-        run_workload(engine, visitor_type, workload_files[work_ix], results); 
+        if (batch) {
+            run_batch_workload(engine, visitor_type, workload_files[work_ix], results);
+        } else {
+            run_workload(engine, visitor_type, workload_files[work_ix], results);
+        }
         results.close();
+        if (!trace_format.empty()) {
+            std::ofstream trace_file(filename + ".trace." + trace_format);
+            if (trace_format == "csv") {
+                Trace::WriteCsv(trace_file);
+            } else {
+                Trace::WriteJson(trace_file);
+            }
+        }
+        Trace::Reset();
         cout << endl << "==========================" << endl;
     }
 }
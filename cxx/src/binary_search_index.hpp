@@ -50,41 +50,57 @@ size_t BinarySearchIndex<D>::LocateRight(Scalar val) const {
 }
 
 template <size_t D>
-Set<PhysicalIndex> BinarySearchIndex<D>::IndexRanges(Query<D>& q) {
-    // Querying 
-    auto accessed = q.filters[column_];
-    if (!accessed.present) {
-        return {.ranges = {{0, dataset_->Size()}}, .list = List<PhysicalIndex>()};
-    }
-    Ranges<PhysicalIndex> ranges;
-    if (accessed.is_range) {
-        ranges.reserve(accessed.ranges.size());
-        size_t added = 0;
-        for (ScalarRange r : accessed.ranges) {
-            size_t lix = LocateLeft(r.first);
-            size_t rix = LocateRight(r.second);
-            if (added > 0 && lix == ranges[added-1].end) {
-                ranges[added-1].end = rix;
-            } else if (rix > lix) {
-                ranges.emplace_back(lix, rix);
-                added++;
+class BinarySearchIndex<D>::SearchCursor : public BufferedRangeCursor {
+  public:
+    SearchCursor(const BinarySearchIndex<D>* index, const QueryFilter* filter)
+        : BufferedRangeCursor(), index_(index), filter_(filter), next_(0) {}
+
+  protected:
+    bool Refill(Ranges<PhysicalIndex>* ranges) override {
+        size_t lix, rix;
+        if (filter_->is_range) {
+            if (next_ == filter_->ranges.size()) {
+                return false;
             }
-        }
-    } else {
-        ranges.reserve(accessed.values.size());
-        size_t added = 0;
-        for (Scalar val : accessed.values) {
-            size_t lix = LocateLeft(val);
-            size_t rix = LocateRight(val);
-            if (added > 0 && lix == ranges[added-1].end) {
-                ranges[added-1].end = rix;
-            } else if (rix > lix) {
-                ranges.emplace_back(lix, rix);
-                added++;
+            const ScalarRange& r = filter_->ranges[next_++];
+            lix = index_->LocateLeft(r.first);
+            rix = index_->LocateRight(r.second);
+        } else {
+            if (next_ == filter_->values.size()) {
+                return false;
             }
+            Scalar val = filter_->values[next_++];
+            lix = index_->LocateLeft(val);
+            rix = index_->LocateRight(val);
         }
+        if (!ranges->empty() && lix == ranges->back().end) {
+            ranges->back().end = rix;
+        } else if (rix > lix) {
+            ranges->emplace_back(lix, rix);
+        }
+        return true;
     }
-    return Set<PhysicalIndex>(ranges, List<PhysicalIndex>());
+
+  private:
+    const BinarySearchIndex<D>* index_;
+    const QueryFilter* filter_;
+    // The position of the next filter range (or value) to look up.
+    size_t next_;
+};
+
+template <size_t D>
+std::unique_ptr<RangeCursor> BinarySearchIndex<D>::Cursor(Query<D>& q) const {
+    const QueryFilter& accessed = q.filters[column_];
+    if (!accessed.present) {
+        return std::make_unique<SetCursor>(
+                Set<PhysicalIndex>({{0, dataset_->Size()}}, List<PhysicalIndex>()));
+    }
+    return std::make_unique<SearchCursor>(this, &accessed);
+}
+
+template <size_t D>
+Set<PhysicalIndex> BinarySearchIndex<D>::IndexRanges(Query<D>& q) const {
+    return Cursor(q)->Drain();
 }
 
 template <size_t D>
@@ -0,0 +1,531 @@
+#include "block_codec.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "simd_kernels.h"
+
+inline BlockStats BlockStats::Of(const std::vector<Scalar>& block) {
+    BlockStats stats;
+    stats.size = block.size();
+    stats.min = std::numeric_limits<Scalar>::max();
+    stats.max = std::numeric_limits<Scalar>::lowest();
+    stats.num_runs = block.empty() ? 0 : 1;
+    stats.sorted = true;
+    uint64_t max_step = 0;
+    for (size_t i = 0; i < block.size(); i++) {
+        stats.min = std::min(stats.min, block[i]);
+        stats.max = std::max(stats.max, block[i]);
+        if (i > 0) {
+            stats.num_runs += block[i] != block[i - 1];
+            stats.sorted = stats.sorted && block[i] >= block[i - 1];
+            max_step = std::max(max_step, (uint64_t) block[i] - (uint64_t) block[i - 1]);
+        }
+    }
+    // Computed unsigned, since the difference may not fit in a Scalar.
+    stats.width = block.empty() ? 0 : BlockCodec::BitsFor((uint64_t) stats.max - (uint64_t) stats.min);
+    stats.step_width = stats.sorted ? BlockCodec::BitsFor(max_step) : 64;
+    std::vector<Scalar> distinct(block);
+    std::sort(distinct.begin(), distinct.end());
+    stats.num_distinct = std::unique(distinct.begin(), distinct.end()) - distinct.begin();
+    return stats;
+}
+
+inline BitWriter::BitWriter(std::vector<char>* data, uint64_t bit_offset)
+    : data_(data), offset_(bit_offset) {
+    // Always make sure there's at least 64 bits of space after the last value.
+    data_->resize(std::max(data_->size(), (size_t) (offset_ >> 3) + 1 + 8));
+}
+
+inline void BitWriter::Append(uint64_t value, char bit_width) {
+    if (bit_width == 0) {
+        return;
+    }
+    data_->resize(std::max(data_->size(), (size_t) ((offset_ + bit_width) >> 3) + 1 + 8));
+    size_t byte_ix = offset_ >> 3;
+    uint64_t *bits = (uint64_t *)(data_->data() + byte_ix);
+    char bit_offset = offset_ - (byte_ix << 3);
+
+    uint64_t holder = *bits;
+#ifdef LITTLE_ENDIAN_ORDER
+    holder = __builtin_bswap64(holder);
+#endif
+    holder |= (value << ((sizeof(uint64_t) << 3) - bit_width - bit_offset));
+#ifdef LITTLE_ENDIAN_ORDER
+    holder = __builtin_bswap64(holder);
+#endif
+    *bits = holder;
+    offset_ += bit_width;
+}
+
+inline void BitWriter::AlignToByte() {
+    offset_ = (offset_ + 7) & ~7UL;
+    data_->resize(std::max(data_->size(), (size_t) (offset_ >> 3) + 1 + 8));
+}
+
+inline uint64_t BlockCodec::ReadBits(const char* data, uint64_t bit_offset, char bit_width) {
+    if (bit_width == 0) {
+        return 0;
+    }
+    uint64_t byte_block = *(const uint64_t *)(data + (bit_offset >> 3));
+#ifdef LITTLE_ENDIAN_ORDER
+    byte_block = __builtin_bswap64(byte_block);
+#endif
+    return (byte_block >> (64 - bit_width - (bit_offset & 0b111))) & (~0UL >> (64 - bit_width));
+}
+
+inline uint64_t BlockCodec::InRange(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, Scalar lower, Scalar upper) const {
+    Scalar vals[64];
+    Decode(data, cblk, offset, n, vals);
+    uint64_t valids = 0;
+    for (size_t i = 0; i < n; i++) {
+        valids = (valids << 1) | (lower <= vals[i] && vals[i] <= upper);
+    }
+    return valids;
+}
+
+inline uint64_t BlockCodec::InRanges(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, const RangeSet& rset, size_t first, size_t last) const {
+    if (last - first <= RangeSet::MAX_LINEAR_RANGES) {
+        uint64_t valids = 0;
+        for (size_t r = first; r < last; r++) {
+            if (rset.At(r).first < rset.At(r).second) {
+                valids |= InRange(data, cblk, offset, n, rset.At(r).first, rset.At(r).second - 1);
+            }
+        }
+        return valids;
+    }
+    Scalar vals[64];
+    Decode(data, cblk, offset, n, vals);
+    // Matches puts the first value in the lowest bit; we need it in the highest.
+    return SimdKernels::ReverseBits(rset.Matches(vals, n, first, last)) >> (64 - n);
+}
+
+inline uint64_t BlockCodec::InSet(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, const ValueSet& vset) const {
+    Scalar vals[64];
+    Decode(data, cblk, offset, n, vals);
+    return SimdKernels::ReverseBits(vset.Matches(vals, n)) >> (64 - n);
+}
+
+inline Scalar BlockCodec::Sum(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, uint64_t valids, const Scalar* dictionary) const {
+    Scalar vals[64];
+    Decode(data, cblk, offset, n, vals);
+    if (dictionary != nullptr) {
+        for (size_t i = 0; i < n; i++) {
+            vals[i] = dictionary[vals[i]];
+        }
+    }
+    // MaskedSum wants the first value in the lowest bit.
+    return SimdKernels::MaskedSum(vals, n, SimdKernels::ReverseBits(valids) >> (64 - n));
+}
+
+inline void BlockCodec::Values(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const {
+    Scalar vals[64];
+    Decode(data, cblk, offset, n, vals);
+    for (size_t i = 0; i < n; i++) {
+        if (valids & (1UL << (n - 1 - i))) {
+            results->push_back(dictionary == nullptr ? vals[i] : dictionary[vals[i]]);
+        }
+    }
+}
+
+inline uint64_t PackedCodec::EncodedBits(const BlockStats& stats) const {
+    return stats.width <= MAX_PACKED_WIDTH ? stats.size * stats.width : NOT_APPLICABLE;
+}
+
+inline void PackedCodec::Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter* writer) const {
+    cblk->base_value = stats.min;
+    cblk->bit_width = stats.width;
+    cblk->bit_mask = ((1UL << stats.width) - 1UL);
+    cblk->num_values = 0;
+    for (Scalar s : block) {
+        // Guaranteed to be at most bit_width bits.
+        writer->Append(s - stats.min, stats.width);
+    }
+}
+
+inline Scalar PackedCodec::Get(const char* data, const CompressionBlock& cblk,
+        size_t offset) const {
+    return cblk.base_value + ReadBits(data, cblk.bit_offset + cblk.bit_width * offset, cblk.bit_width);
+}
+
+inline void PackedCodec::Decode(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, Scalar* out) const {
+    SimdKernels::Decode(data, cblk.bit_offset + cblk.bit_width * offset, cblk.bit_width,
+            cblk.base_value, n, out);
+}
+
+inline uint64_t PackedCodec::InRange(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, Scalar lower, Scalar upper) const {
+    return SimdKernels::InRange(data, cblk.bit_offset + cblk.bit_width * offset, cblk.bit_width,
+            cblk.base_value, n, lower, upper);
+}
+
+inline uint64_t RleCodec::EncodedBits(const BlockStats& stats) const {
+    if (stats.width > MAX_PACKED_WIDTH) {
+        return NOT_APPLICABLE;
+    }
+    return stats.num_runs * (stats.width + COLUMN_RUN_END_BITS);
+}
+
+inline void RleCodec::Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter* writer) const {
+    cblk->base_value = stats.min;
+    cblk->bit_width = stats.width;
+    cblk->bit_mask = (uint64_t) stats.max - (uint64_t) stats.min;
+    cblk->num_values = stats.num_runs;
+    for (size_t i = 0; i < block.size(); i++) {
+        if (i == 0 || block[i] != block[i - 1]) {
+            writer->Append(block[i] - stats.min, stats.width);
+        }
+    }
+    for (size_t i = 1; i <= block.size(); i++) {
+        if (i == block.size() || block[i] != block[i - 1]) {
+            writer->Append(i, COLUMN_RUN_END_BITS);
+        }
+    }
+}
+
+template <typename F>
+void RleCodec::ForEachRun(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, F f) const {
+    const uint64_t ends = cblk.bit_offset + (uint64_t) cblk.num_values * cblk.bit_width;
+    auto run_end = [&](size_t run) {
+        return ReadBits(data, ends + run * COLUMN_RUN_END_BITS, COLUMN_RUN_END_BITS);
+    };
+    // Binary search for the run that holds `offset`.
+    size_t run = 0;
+    size_t last_run = cblk.num_values - 1;
+    while (run < last_run) {
+        size_t mid = (run + last_run) / 2;
+        if (run_end(mid) <= offset) {
+            run = mid + 1;
+        } else {
+            last_run = mid;
+        }
+    }
+    size_t first = 0;
+    while (first < n) {
+        size_t last = std::min<size_t>(run_end(run) - offset, n);
+        f(cblk.base_value + (Scalar) ReadBits(data, cblk.bit_offset + run * cblk.bit_width,
+                cblk.bit_width), first, last);
+        first = last;
+        run++;
+    }
+}
+
+inline Scalar RleCodec::Get(const char* data, const CompressionBlock& cblk, size_t offset) const {
+    Scalar value;
+    ForEachRun(data, cblk, offset, 1, [&value](Scalar v, size_t, size_t) {
+        value = v;
+    });
+    return value;
+}
+
+inline void RleCodec::Decode(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, Scalar* out) const {
+    ForEachRun(data, cblk, offset, n, [out](Scalar v, size_t first, size_t last) {
+        std::fill(out + first, out + last, v);
+    });
+}
+
+inline uint64_t RleCodec::InRange(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, Scalar lower, Scalar upper) const {
+    uint64_t valids = 0;
+    ForEachRun(data, cblk, offset, n, [&](Scalar v, size_t first, size_t last) {
+        if (lower <= v && v <= upper) {
+            valids |= RowSpan(n, first, last);
+        }
+    });
+    return valids;
+}
+
+inline uint64_t RleCodec::InRanges(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, const RangeSet& rset, size_t, size_t) const {
+    uint64_t valids = 0;
+    ForEachRun(data, cblk, offset, n, [&](Scalar v, size_t first, size_t last) {
+        if (rset.Contains(v)) {
+            valids |= RowSpan(n, first, last);
+        }
+    });
+    return valids;
+}
+
+inline uint64_t RleCodec::InSet(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, const ValueSet& vset) const {
+    uint64_t valids = 0;
+    ForEachRun(data, cblk, offset, n, [&](Scalar v, size_t first, size_t last) {
+        if (vset.Contains(v)) {
+            valids |= RowSpan(n, first, last);
+        }
+    });
+    return valids;
+}
+
+inline Scalar RleCodec::Sum(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, uint64_t valids, const Scalar* dictionary) const {
+    // One multiply per run.
+    Scalar sum = 0;
+    ForEachRun(data, cblk, offset, n, [&](Scalar v, size_t first, size_t last) {
+        sum += (dictionary == nullptr ? v : dictionary[v])
+            * __builtin_popcountll(valids & RowSpan(n, first, last));
+    });
+    return sum;
+}
+
+inline void RleCodec::Values(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const {
+    ForEachRun(data, cblk, offset, n, [&](Scalar v, size_t first, size_t last) {
+        results->insert(results->end(), __builtin_popcountll(valids & RowSpan(n, first, last)),
+                dictionary == nullptr ? v : dictionary[v]);
+    });
+}
+
+inline void ConstantCodec::Encode(const std::vector<Scalar>&, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter*) const {
+    cblk->base_value = stats.min;
+    cblk->bit_width = 0;
+    cblk->bit_mask = 0;
+    cblk->num_values = 0;
+}
+
+inline void ConstantCodec::Decode(const char*, const CompressionBlock& cblk, size_t,
+        size_t n, Scalar* out) const {
+    std::fill(out, out + n, cblk.base_value);
+}
+
+inline uint64_t ConstantCodec::InRange(const char*, const CompressionBlock& cblk, size_t,
+        size_t n, Scalar lower, Scalar upper) const {
+    return lower <= cblk.base_value && cblk.base_value <= upper ? RowSpan(n, 0, n) : 0;
+}
+
+inline uint64_t ConstantCodec::InRanges(const char*, const CompressionBlock& cblk, size_t,
+        size_t n, const RangeSet& rset, size_t, size_t) const {
+    return rset.Contains(cblk.base_value) ? RowSpan(n, 0, n) : 0;
+}
+
+inline uint64_t ConstantCodec::InSet(const char*, const CompressionBlock& cblk, size_t,
+        size_t n, const ValueSet& vset) const {
+    return vset.Contains(cblk.base_value) ? RowSpan(n, 0, n) : 0;
+}
+
+inline Scalar ConstantCodec::Sum(const char*, const CompressionBlock& cblk, size_t, size_t n,
+        uint64_t valids, const Scalar* dictionary) const {
+    Scalar v = dictionary == nullptr ? cblk.base_value : dictionary[cblk.base_value];
+    return v * __builtin_popcountll(valids & RowSpan(n, 0, n));
+}
+
+inline void ConstantCodec::Values(const char*, const CompressionBlock& cblk, size_t, size_t n,
+        uint64_t valids, const Scalar* dictionary, std::vector<Scalar>* results) const {
+    results->insert(results->end(), __builtin_popcountll(valids & RowSpan(n, 0, n)),
+            dictionary == nullptr ? cblk.base_value : dictionary[cblk.base_value]);
+}
+
+inline void RawCodec::Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter* writer) const {
+    writer->AlignToByte();
+    cblk->bit_offset = writer->Offset();
+    cblk->base_value = stats.min;
+    cblk->bit_width = 64;
+    cblk->bit_mask = (uint64_t) stats.max - (uint64_t) stats.min;
+    cblk->num_values = 0;
+    for (Scalar s : block) {
+        writer->Append(s, 64);
+    }
+}
+
+inline void RawCodec::Decode(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, Scalar* out) const {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = ReadBits(data, cblk.bit_offset + 64 * (offset + i), 64);
+    }
+}
+
+inline uint64_t DeltaCodec::EncodedBits(const BlockStats& stats) const {
+    if (!stats.sorted || stats.step_width > MAX_PACKED_WIDTH) {
+        return NOT_APPLICABLE;
+    }
+    return (stats.size - 1) * stats.step_width;
+}
+
+inline void DeltaCodec::Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter* writer) const {
+    cblk->base_value = block[0];
+    cblk->bit_width = stats.step_width;
+    cblk->bit_mask = (uint64_t) stats.max - (uint64_t) stats.min;
+    cblk->num_values = 0;
+    for (size_t i = 1; i < block.size(); i++) {
+        writer->Append(block[i] - block[i - 1], stats.step_width);
+    }
+}
+
+inline Scalar DeltaCodec::Get(const char* data, const CompressionBlock& cblk,
+        size_t offset) const {
+    // The step to row i is the (i - 1)th value.
+    Scalar value = cblk.base_value;
+    Scalar steps[64];
+    for (size_t i = 0; i < offset; i += 64) {
+        size_t m = std::min<size_t>(64, offset - i);
+        SimdKernels::Decode(data, cblk.bit_offset + i * cblk.bit_width, cblk.bit_width, 0, m,
+                steps);
+        for (size_t j = 0; j < m; j++) {
+            value += steps[j];
+        }
+    }
+    return value;
+}
+
+inline void DeltaCodec::Decode(const char* data, const CompressionBlock& cblk, size_t offset,
+        size_t n, Scalar* out) const {
+    out[0] = Get(data, cblk, offset);
+    if (n > 1) {
+        SimdKernels::Decode(data, cblk.bit_offset + offset * cblk.bit_width, cblk.bit_width, 0,
+                n - 1, out + 1);
+        for (size_t i = 1; i < n; i++) {
+            out[i] += out[i - 1];
+        }
+    }
+}
+
+inline uint64_t DictionaryCodec::EncodedBits(const BlockStats& stats) const {
+    if (stats.width > MAX_PACKED_WIDTH) {
+        return NOT_APPLICABLE;
+    }
+    return stats.num_distinct * stats.width + stats.size * BitsFor(stats.num_distinct - 1);
+}
+
+inline void DictionaryCodec::Encode(const std::vector<Scalar>& block, const BlockStats& stats,
+        CompressionBlock* cblk, BitWriter* writer) const {
+    std::vector<Scalar> values(block);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    cblk->base_value = stats.min;
+    cblk->bit_width = stats.width;
+    cblk->bit_mask = (uint64_t) stats.max - (uint64_t) stats.min;
+    cblk->num_values = values.size();
+    for (Scalar v : values) {
+        writer->Append(v - stats.min, stats.width);
+    }
+    char code_width = CodeWidth(*cblk);
+    for (Scalar s : block) {
+        writer->Append(std::lower_bound(values.begin(), values.end(), s) - values.begin(),
+                code_width);
+    }
+}
+
+inline Scalar DictionaryCodec::Get(const char* data, const CompressionBlock& cblk,
+        size_t offset) const {
+    char code_width = CodeWidth(cblk);
+    uint64_t code = ReadBits(data, CodesOffset(cblk) + offset * code_width, code_width);
+    return cblk.base_value + ReadBits(data, cblk.bit_offset + code * cblk.bit_width, cblk.bit_width);
+}
+
+inline void DictionaryCodec::Decode(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, Scalar* out) const {
+    char code_width = CodeWidth(cblk);
+    SimdKernels::Decode(data, CodesOffset(cblk) + offset * code_width, code_width, 0, n, out);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = cblk.base_value + ReadBits(data, cblk.bit_offset + out[i] * cblk.bit_width,
+                cblk.bit_width);
+    }
+}
+
+inline size_t DictionaryCodec::LowerBound(const char* data, const CompressionBlock& cblk,
+        Scalar value) {
+    size_t lo = 0;
+    size_t hi = cblk.num_values;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cblk.base_value + (Scalar) ReadBits(data, cblk.bit_offset + mid * cblk.bit_width,
+                    cblk.bit_width) < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+inline uint64_t DictionaryCodec::InRange(const char* data, const CompressionBlock& cblk,
+        size_t offset, size_t n, Scalar lower, Scalar upper) const {
+    if (upper < lower) {
+        return 0;
+    }
+    // The values are sorted, so the range is a range of positions.
+    size_t first = LowerBound(data, cblk, lower);
+    size_t last = upper == std::numeric_limits<Scalar>::max() ? cblk.num_values
+        : LowerBound(data, cblk, upper + 1);
+    if (last <= first) {
+        return 0;
+    }
+    char code_width = CodeWidth(cblk);
+    return SimdKernels::InRange(data, CodesOffset(cblk) + offset * code_width, code_width, 0, n,
+            first, last - 1);
+}
+
+inline const BlockCodec* const* BlockCodecs::Table() {
+    static const PackedCodec packed;
+    static const RleCodec rle;
+    static const ConstantCodec constant;
+    static const RawCodec raw;
+    static const DeltaCodec delta;
+    static const DictionaryCodec dictionary;
+    // In BlockEncoding order.
+    static const BlockCodec* const table[NUM_BLOCK_ENCODINGS] = {
+        &packed, &rle, &constant, &raw, &delta, &dictionary,
+    };
+    return table;
+}
+
+inline uint32_t& BlockCodecs::AllowedMask() {
+    static uint32_t mask = ALL;
+    return mask;
+}
+
+inline double& BlockCodecs::CurrentCostWeight() {
+    static double weight = DEFAULT_COST_WEIGHT;
+    return weight;
+}
+
+inline void BlockCodecs::SetAllowed(uint32_t mask) {
+    AllowedMask() = mask & ALL;
+}
+
+inline uint32_t BlockCodecs::Allowed() {
+    return AllowedMask();
+}
+
+inline void BlockCodecs::SetCostWeight(double bits_per_value) {
+    CurrentCostWeight() = bits_per_value;
+}
+
+inline double BlockCodecs::CostWeight() {
+    return CurrentCostWeight();
+}
+
+inline BlockEncoding BlockCodecs::Choose(const BlockStats& stats) {
+    BlockEncoding best = BLOCK_RAW;
+    double best_cost = std::numeric_limits<double>::infinity();
+    for (size_t e = 0; e < NUM_BLOCK_ENCODINGS; e++) {
+        if (!(Allowed() & (1u << e)) && e != BLOCK_RAW) {
+            continue;
+        }
+        const BlockCodec& codec = Get(e);
+        uint64_t bits = codec.EncodedBits(stats);
+        if (bits == BlockCodec::NOT_APPLICABLE) {
+            continue;
+        }
+        double cost = bits + CostWeight() * stats.size * codec.DecodeCost();
+        // Ties go to the earlier encoding.
+        if (cost < best_cost) {
+            best = (BlockEncoding) e;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
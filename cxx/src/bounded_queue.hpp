@@ -0,0 +1,37 @@
+#include "bounded_queue.h"
+
+#include "utils.h"
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : capacity_(capacity), items_(), closed_(false) {
+    AssertWithMessage(capacity_ > 0, "Queue capacity must be positive");
+}
+
+template <typename T>
+void BoundedQueue<T>::Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    AssertWithMessage(!closed_, "Push to a closed queue");
+    not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+}
+
+template <typename T>
+bool BoundedQueue<T>::Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+    if (items_.empty()) {
+        return false;
+    }
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+}
+
+template <typename T>
+void BoundedQueue<T>::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+}
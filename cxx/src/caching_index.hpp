@@ -0,0 +1,54 @@
+#include "caching_index.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+template <size_t D>
+CachingIndex<D>::CachingIndex(std::unique_ptr<PrimaryIndexer<D>> index, size_t budget_bytes,
+        const std::unordered_set<size_t>& extra_key_dims)
+    : PrimaryIndexer<D>(), index_(std::move(index)), extra_key_dims_(extra_key_dims),
+      cache_(budget_bytes) {
+    AssertWithMessage(index_ != nullptr, "Tried to cache a NULL index");
+}
+
+template <size_t D>
+bool CachingIndex<D>::Init(PointIterator<D> start, PointIterator<D> end) {
+    bool modified = index_->Init(start, end);
+    this->columns_ = index_->GetColumns();
+    std::unordered_set<size_t> dims = this->columns_;
+    dims.insert(extra_key_dims_.begin(), extra_key_dims_.end());
+    key_dims_.assign(dims.begin(), dims.end());
+    std::sort(key_dims_.begin(), key_dims_.end());
+    cache_.Clear();
+    return modified;
+}
+
+template <size_t D>
+Set<PhysicalIndex> CachingIndex<D>::IndexRanges(Query<D>& q) const {
+    const std::string key = QueryCache<Entry>::Key(q, key_dims_);
+    Entry entry;
+    if (cache_.Get(key, &entry)) {
+        for (const auto& rw : entry.rewrites) {
+            q.filters[rw.first] = rw.second;
+        }
+        return entry.result;
+    }
+
+    const Query<D> original = q;
+    entry.result = index_->IndexRanges(q);
+    size_t bytes = entry.result.ranges.size() * sizeof(Range<PhysicalIndex>)
+        + entry.result.list.size() * sizeof(PhysicalIndex);
+    for (size_t d = 0; d < D; d++) {
+        const QueryFilter& before = original.filters[d];
+        const QueryFilter& after = q.filters[d];
+        if (before.present != after.present || before.is_range != after.is_range
+                || before.ranges != after.ranges || before.values != after.values) {
+            entry.rewrites.emplace_back(d, after);
+            bytes += sizeof(QueryFilter) + after.ranges.size() * sizeof(ScalarRange)
+                + after.values.size() * sizeof(Scalar);
+        }
+    }
+    cache_.Put(key, entry, bytes);
+    return entry.result;
+}
@@ -0,0 +1,52 @@
+#include "column_batch.h"
+
+#include <algorithm>
+
+#include "simd_kernels.h"
+#include "utils.h"
+
+template <size_t D>
+ColumnBatch<D>::ColumnBatch()
+    : dataset_(nullptr), start_(0), end_(0), sel_(), count_(0), columns_(), decoded_() {}
+
+template <size_t D>
+void ColumnBatch<D>::Reset(const Dataset<D>* dataset, size_t start, size_t end) {
+    AssertWithMessage(end - start <= MAX_ROWS, "Batch too large");
+    dataset_ = dataset;
+    start_ = start;
+    end_ = end;
+    count_ = 0;
+    decoded_.fill(false);
+}
+
+template <size_t D>
+void ColumnBatch<D>::Select(size_t ix, size_t n, uint64_t valids) {
+    // Put row ix in bit 0, so rows come out in order.
+    uint64_t rows = SimdKernels::ReverseBits(valids) >> (64 - n);
+    uint16_t offset = ix - start_;
+    while (rows) {
+        sel_[count_++] = offset + __builtin_ctzll(rows);
+        rows &= rows - 1;
+    }
+}
+
+template <size_t D>
+void ColumnBatch<D>::SelectAll() {
+    for (size_t i = 0; i < end_ - start_; i++) {
+        sel_[i] = i;
+    }
+    count_ = end_ - start_;
+}
+
+template <size_t D>
+const Scalar* ColumnBatch<D>::Column(size_t dim) {
+    std::vector<Scalar>& values = columns_[dim];
+    if (!decoded_[dim]) {
+        values.resize(MAX_ROWS);
+        for (size_t s = start_; s < end_; s += 64) {
+            dataset_->DecodeRange(s, std::min(end_, s + 64), dim, values.data() + (s - start_));
+        }
+        decoded_[dim] = true;
+    }
+    return values.data();
+}
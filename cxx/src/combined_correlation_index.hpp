@@ -1,5 +1,6 @@
 #include "combined_correlation_index.h"
 
+#include <algorithm>
 #include <vector>
 #include <fstream>
 #include <iostream>
@@ -7,36 +8,26 @@
 
 #include "utils.h"
 #include "file_utils.h"
+#include "merge_utils.h"
+#include "trace.h"
 #include "types.h"
 
 template <size_t D>
 Set<Key> CombinedCorrelationIndex<D>::KeyRanges(const Query<D>& q) const {
-    auto start = std::chrono::high_resolution_clock::now();
     Ranges<Key> mapped_ranges = mapped_index_->KeyRanges(q);
-    auto mid = std::chrono::high_resolution_clock::now();
-    auto mid2 = mid;
-    std::cout << "## forcing time: " << mapped_ranges.size() << std::endl;
     Set<Key> ret;
     if (outlier_index_) {
         List<Key> lst = outlier_index_->Matches(q);
+        TRACE_SPAN(Merge);
         // TODO(vikram): whether this is sorted depends on if we're using
         // bucketedSecondaryIndexer.
         std::sort(lst.begin(), lst.end());
-        std::cout << "## forcing time: " << (lst.empty() || lst[0] > 1000) << std::endl;
-        mid2 = std::chrono::high_resolution_clock::now();
         ret = MergeUtils::Union(mapped_ranges, lst);
     } else {
         ret = Set<Key>(mapped_ranges, {});
     }
-    std::cout << "After merging with outlier index, have " << ret.ranges.size()
-        << " ranges and " << ret.list.size() << " items " << std::endl;
-    auto end = std::chrono::high_resolution_clock::now();
-    auto range_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid-start).count();
-    auto match_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid2-mid).count();
-    auto merge_t = std::chrono::duration_cast<std::chrono::nanoseconds>(end-mid2).count();
-    std::cout << "Range time (us): " << range_t / 1e3 << std::endl;
-    std::cout << "Outlier match time (us): " << match_t / 1e3 << std::endl;
-    std::cout << "Merge time (us): " << merge_t / 1e3 << std::endl;
+    TRACE_COUNT(CorrelationRanges, ret.ranges.size());
+    TRACE_COUNT(CorrelationListPoints, ret.list.size());
     return ret;
 }
 
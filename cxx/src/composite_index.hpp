@@ -1,11 +1,14 @@
 #include "composite_index.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <cassert>
 #include <chrono>
+#include <limits>
 
 #include "merge_utils.h"
+#include "trace.h"
 
 template <size_t D>
 CompositeIndex<D>::CompositeIndex(size_t gap)
@@ -22,8 +25,6 @@ bool CompositeIndex<D>::SetPrimaryIndex(std::unique_ptr<PrimaryIndexer<D>> index
 template <size_t D>
 bool CompositeIndex<D>::AddSecondaryIndex(std::unique_ptr<SecondaryIndexer<D>> index) {
     AssertWithMessage(index != NULL, "Tried to add NULL secondary index");
-    AssertWithMessage(correlation_indexes_.empty(), "Cannot use secondary index with correlation index"); 
-    AssertWithMessage(rewriters_.empty(), "Cannot use secondary index with rewriters"); 
     secondary_indexes_.push_back(std::move(index));
     return true;
 }
@@ -31,8 +32,6 @@ bool CompositeIndex<D>::AddSecondaryIndex(std::unique_ptr<SecondaryIndexer<D>> i
 template <size_t D>
 bool CompositeIndex<D>::AddCorrelationIndex(std::unique_ptr<CorrelationIndexer<D>> index) {
     AssertWithMessage(index != NULL, "Tried to add NULL correlation index");
-    AssertWithMessage(secondary_indexes_.empty(), "Cannot use correlation index with secondary index"); 
-    AssertWithMessage(rewriters_.empty(), "Cannot use correlation index with rewriters");
     correlation_indexes_.push_back(std::move(index));
     return true;
 }
@@ -40,8 +39,6 @@ bool CompositeIndex<D>::AddCorrelationIndex(std::unique_ptr<CorrelationIndexer<D
 template <size_t D>
 bool CompositeIndex<D>::AddRewriter(std::unique_ptr<Rewriter<D>> rewriter) {
     AssertWithMessage(rewriter != NULL, "Tried to add NULL rewriter");
-    AssertWithMessage(secondary_indexes_.empty(), "Cannot use rewriters with secondary index"); 
-    AssertWithMessage(correlation_indexes_.empty(), "Cannot use rewriters with correlation index"); 
     rewriters_.push_back(std::move(rewriter));
     return true;
 }
@@ -68,7 +65,7 @@ bool CompositeIndex<D>::Init(PointIterator<D> start, PointIterator<D> end) {
 }
 
 template <size_t D>
-List<Key> CompositeIndex<D>::RangesWithRewriter(Query<D>& q) {
+List<Key> CompositeIndex<D>::RangesWithRewriter(Query<D>& q) const {
     List<Key> auxiliary_indexes;
     // Assumes all the indexes from rewriters are unsorted.
     for (auto& rw : rewriters_) {
@@ -84,14 +81,16 @@ List<Key> CompositeIndex<D>::RangesWithRewriter(Query<D>& q) {
 }
 
 template <size_t D>
-Set<Key> CompositeIndex<D>::RangesWithCorrelation(Query<D>& q) {
+Set<Key> CompositeIndex<D>::RangesWithCorrelation(Query<D>& q, Lookups* lookups) const {
     Set<Key> res;
     bool first_scan = true;
-    for (auto& ci : correlation_indexes_) {
+    for (size_t i = 0; i < correlation_indexes_.size(); i++) {
+        auto& ci = correlation_indexes_[i];
         if (!q.filters[ci->GetMappedColumn()].present) {
             continue;
         }
-        Set<Key> ixs = ci->KeyRanges(q);
+        std::optional<Set<Key>>& planned = lookups->correlation[i];
+        Set<Key> ixs = planned ? std::move(*planned) : ci->KeyRanges(q);
         res = first_scan ? std::move(ixs) : MergeUtils::Intersect<Key>(res, ixs);
         first_scan = false;
     }
@@ -99,98 +98,192 @@ Set<Key> CompositeIndex<D>::RangesWithCorrelation(Query<D>& q) {
 }
 
 template <size_t D>
-List<Key> CompositeIndex<D>::RangesWithSecondary(Query<D>& q) {
+List<Key> CompositeIndex<D>::RangesWithSecondary(Query<D>& q, Lookups* lookups) const {
     // For each secondary index, merge the secondary index matches into it.
     List<Key> matches;
     // This is to make sure we sort the secondary index result only when we absolutely have to.
     bool needs_sort = true;
-    std::cout << "Getting matches from secondary index" << std::endl;
-    for (auto& si : secondary_indexes_) {
+    for (size_t i = 0; i < secondary_indexes_.size(); i++) {
+        auto& si = secondary_indexes_[i];
         if (!q.filters[si->GetColumn()].present) {
             continue;
         }
-        List<Key> next_matches = si->Matches(q);
+        std::optional<List<Key>>& planned = lookups->secondary[i];
+        List<Key> next_matches = planned ? std::move(*planned) : si->Matches(q);
         if (matches.empty()) {
             // Don't sort yet - wait until there other other matches or ranges that need
             // intersecting.
             matches = std::move(next_matches);
         } else {
-            auto start = std::chrono::high_resolution_clock::now();
+            TRACE_SPAN(Merge);
             if (needs_sort) {
                 std::sort(matches.begin(), matches.end());
                 needs_sort = false;
             }
-            auto mid = std::chrono::high_resolution_clock::now();
             std::sort(next_matches.begin(), next_matches.end());
             // Only sort if we absolutely have to
             matches = MergeUtils::Intersect<Key>(matches, next_matches);
-            auto end = std::chrono::high_resolution_clock::now();
-            auto tt1 = std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count();
-            auto tt2 = std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count();
-            std::cout << "Sort time: " << tt1 << "ns, "
-                << "Intersect time: " << tt2 << "ns" << std::endl;
         }
     }
     if (needs_sort) {
         std::sort(matches.begin(), matches.end());
     }
-    std::cout << "Returning matches from secondary index" << std::endl;
     return matches;
 }
 
 template <size_t D>
-Set<PhysicalIndex> CompositeIndex<D>::IndexRanges(Query<D>& q) {
-    // lookups is guaranteed to not have duplicates.
+typename CompositeIndex<D>::Plan CompositeIndex<D>::ChoosePlan(const Query<D>& q,
+        const Set<PhysicalIndex>& primary, Lookups* lookups) const {
+    size_t primary_rows = primary.list.size();
+    for (const auto& r : primary.ranges) {
+        primary_rows += r.end - r.start;
+    }
+    // The intersection of the matches of several indexes is at most as large as the smallest.
+    size_t num_correlation = 0, correlation_rows = data_size_;
+    lookups->correlation.assign(correlation_indexes_.size(), std::nullopt);
+    for (size_t i = 0; i < correlation_indexes_.size(); i++) {
+        auto& ci = correlation_indexes_[i];
+        if (q.filters[ci->GetMappedColumn()].present) {
+            num_correlation++;
+            size_t keys = ci->EstimateKeys(q);
+            if (keys == ci->UNKNOWN_ESTIMATE) {
+                Set<Key>& ixs = lookups->correlation[i].emplace(ci->KeyRanges(q));
+                keys = ixs.list.size();
+                for (const auto& r : ixs.ranges) {
+                    keys += r.end - r.start;
+                }
+            }
+            correlation_rows = std::min(correlation_rows, keys);
+        }
+    }
+    // All the matches of every secondary index are looked up and sorted.
+    size_t num_secondary = 0, secondary_rows = data_size_, secondary_lookups = 0;
+    lookups->secondary.assign(secondary_indexes_.size(), std::nullopt);
+    for (size_t i = 0; i < secondary_indexes_.size(); i++) {
+        auto& si = secondary_indexes_[i];
+        if (q.filters[si->GetColumn()].present) {
+            num_secondary++;
+            size_t matches = si->EstimateMatches(q);
+            if (matches == si->UNKNOWN_ESTIMATE) {
+                matches = lookups->secondary[i].emplace(si->Matches(q)).size();
+            }
+            secondary_rows = std::min(secondary_rows, matches);
+            secondary_lookups += matches;
+        }
+    }
+
+    Plan best = {false, false, false, std::numeric_limits<double>::max()};
+    for (int full_scan = 0; full_scan < 2; full_scan++) {
+        for (int correlation = 0; correlation <= (num_correlation > 0); correlation++) {
+            for (int secondary = 0; secondary <= (num_secondary > 0); secondary++) {
+                size_t rows = full_scan ? data_size_ : primary_rows;
+                double cost = cost_model_.range * (full_scan ? 1 : primary.ranges.size());
+                if (correlation) {
+                    rows = std::min(rows, correlation_rows);
+                    cost += cost_model_.index_lookup * num_correlation;
+                }
+                if (secondary) {
+                    rows = std::min(rows, secondary_rows);
+                    cost += cost_model_.index_lookup * num_secondary
+                        + cost_model_.list_point * secondary_lookups;
+                }
+                // With a secondary index, the remaining rows are visited out of order.
+                cost += secondary ? cost_model_.list_point * rows : rows;
+                // Ties go to the plan that uses fewer indexes.
+                if (cost < best.cost) {
+                    best = {(bool)full_scan, (bool)correlation, (bool)secondary, cost};
+                }
+            }
+        }
+    }
+    return best;
+}
+
+template <size_t D>
+typename CompositeIndex<D>::Plan CompositeIndex<D>::Explain(Query<D> q) const {
+    if (!rewriters_.empty()) {
+        RangesWithRewriter(q);
+    }
+    Set<PhysicalIndex> primary = primary_index_->IndexRanges(q);
+    Lookups lookups;
+    return ChoosePlan(q, primary, &lookups);
+}
+
+template <size_t D>
+Set<PhysicalIndex> CompositeIndex<D>::IndexRanges(Query<D>& q) const {
+    // Rewriters change the query for the primary index, so they run first.
+    List<Key> rewritten;
+    if (!rewriters_.empty()) {
+        rewritten = RangesWithRewriter(q);
+    }
+    Set<PhysicalIndex> result = primary_index_->IndexRanges(q);
+    Lookups planned;
+    Plan plan = ChoosePlan(q, result, &planned);
+    if (plan.full_scan) {
+        TRACE_COUNT(PlannedFullScans, 1);
+        result = Set<PhysicalIndex>({{0, data_size_}}, {});
+    }
+
+    if (plan.use_correlation) {
+        TRACE_COUNT(PlannedCorrelationLookups, 1);
+        Set<Key> lookups = RangesWithCorrelation(q, &planned);
+        Set<PhysicalIndex> aux_matches;
+        {
+            TRACE_SPAN(KeyLookup);
+            aux_matches = dataset_->Lookup(lookups);
+        }
+        TRACE_SPAN(Merge);
+        result = IsFullScan(result) ? std::move(aux_matches)
+            : MergeUtils::Intersect<PhysicalIndex>(result, aux_matches);
+    }
+
+    if (plan.use_secondary) {
+        TRACE_COUNT(PlannedSecondaryLookups, 1);
+        List<Key> lookups = RangesWithSecondary(q, &planned);
+        Set<PhysicalIndex> aux_matches;
+        {
+            TRACE_SPAN(KeyLookup);
+            aux_matches = dataset_->Lookup(Set<Key>({}, lookups));
+        }
+        TRACE_SPAN(Merge);
+        result = IsFullScan(result) ? std::move(aux_matches)
+            : MergeUtils::Intersect<PhysicalIndex>(result, aux_matches);
+    }
+
+    if (!rewriters_.empty()) {
+        // The rewritten query for the primary index misses these, so they're added back whatever
+        // the other indexes said.
+        Set<PhysicalIndex> aux_matches;
+        {
+            TRACE_SPAN(KeyLookup);
+            aux_matches = dataset_->Lookup(Set<Key>({}, rewritten));
+        }
+        AssertWithMessage(aux_matches.ranges.size() == 0, "Got ranges while running rewriter");
+        TRACE_SPAN(Merge);
+        List<PhysicalIndex> list = std::move(result.list);
+        list.insert(list.end(), aux_matches.list.begin(), aux_matches.list.end());
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+        return MergeUtils::Union<PhysicalIndex>(result.ranges, list);
+    }
+    return result;
+}
+
+template <size_t D>
+std::unique_ptr<RangeCursor> CompositeIndex<D>::Cursor(Query<D>& q) const {
+    // Intersecting with the matches of other indexes needs all of the primary index's ranges.
+    if (!correlation_indexes_.empty() || !secondary_indexes_.empty()) {
+        return PrimaryIndexer<D>::Cursor(q);
+    }
     if (!rewriters_.empty()) {
         List<Key> lookups = RangesWithRewriter(q);
-        Set<PhysicalIndex> primary = primary_index_->IndexRanges(q);
+        std::unique_ptr<RangeCursor> primary = primary_index_->Cursor(q);
         Set<PhysicalIndex> aux_matches = dataset_->Lookup(Set<Key>({}, lookups));
         AssertWithMessage(aux_matches.ranges.size() == 0, "Got ranges while running rewriter");
-        return MergeUtils::Union<PhysicalIndex>(primary.ranges, aux_matches.list); 
-    } else if (!correlation_indexes_.empty()) {
-        auto t0 = std::chrono::high_resolution_clock::now();
-        Set<Key> lookups = RangesWithCorrelation(q);
-        auto t1 = std::chrono::high_resolution_clock::now();
-        Set<PhysicalIndex> primary = primary_index_->IndexRanges(q);
-        auto t2 = std::chrono::high_resolution_clock::now();
-        Set<PhysicalIndex> aux_matches = dataset_->Lookup(lookups);
-        auto t3 = std::chrono::high_resolution_clock::now();
-        auto corr_time = std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count();
-        auto primary_time = std::chrono::duration_cast<std::chrono::nanoseconds>(t2-t1).count();
-        auto resolve_time = std::chrono::duration_cast<std::chrono::nanoseconds>(t3-t2).count();
-        std::cout << "Correlation Index Time: " << corr_time / 1e6 << std::endl;
-        std::cout << "Primary Index Lookup Time: " << primary_time / 1e6 << std::endl;
-        std::cout << "Clustered Resolution Time: " << resolve_time / 1e6 << std::endl;
-         
-        std::cout << "Composite: primary index returned " << primary.ranges.size()
-            << " ranges and " << primary.list.size() << " points" << std::endl;
-        std::cout << "Composite after dataset lookup: correlation index returned " << lookups.ranges.size()
-            << " ranges and " << lookups.list.size() << " points" << std::endl;
-        bool full_scan = primary.ranges.size() == 1 &&
-                    primary.ranges[0].end - primary.ranges[0].start == data_size_;
-        if (full_scan) {
-            return aux_matches;
-        } else {
-            return MergeUtils::Intersect<PhysicalIndex>(primary, aux_matches);
-        }
-    } else if (!secondary_indexes_.empty()) {
-        List<Key> lookups = RangesWithSecondary(q);
-        std::cout << "Starting primary index lookup" << std::endl;
-        Set<PhysicalIndex> primary = primary_index_->IndexRanges(q);
-        std::cout << "Got primary index results" << std::endl;
-        bool full_scan = primary.ranges.size() == 1 &&
-                    primary.ranges[0].end - primary.ranges[0].start == data_size_;
-        std::cout << "Starting lookup" << std::endl;
-        Set<PhysicalIndex> aux_matches = dataset_->Lookup(Set<Key>({}, lookups));
-        std::cout << "Lookup finished" << std::endl;
-        if (full_scan) {
-            return aux_matches;
-        } else {
-            return MergeUtils::Intersect<PhysicalIndex>(primary, aux_matches);
-        }
-    } else {
-        return primary_index_->IndexRanges(q);
+        return std::make_unique<UnionCursor>(std::move(primary),
+                std::make_unique<SetCursor>(std::move(aux_matches)));
     }
+    return primary_index_->Cursor(q);
 }
 
 template <size_t D>
@@ -3,30 +3,26 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "simd_kernels.h"
 #include "utils.h"
 
 
 template <size_t D>
 CompressedColumnOrderDataset<D>::CompressedColumnOrderDataset(const std::vector<Point<D>>& data,
         const std::vector<Scalar>& row_ids,
-        const std::vector<Datacube<D>>& cubes) : clustered_index_() {
-    size_ = data.size();
-    std::vector<std::vector<Scalar>> columns(D + 1 + cubes.size());
+        const std::vector<Datacube<D>>& cubes,
+        const std::vector<size_t>& dictionary_dims) : clustered_index_() {
     cubes_ = cubes;
-    AssertWithMessage(cubes_.size() == 0, "Dataset does not support cubes");
-    // Index the datacubes by the columns they will appear in.
-    for (size_t i = 0; i < cubes_.size(); i++) {
-        cubes_[i].index = D+1+i;
-    }
     Key key = 0;
     PhysicalIndex ix = 0; 
     for (size_t i = 0; i < data.size(); i++) {
-        const Point<D> &p = data[i];
-        for (size_t d = 0; d < D; d++) {
-            columns[d].push_back(p[d]);
-        }
-        columns[D].push_back(key);
         clustered_index_.insert(std::make_pair(key, ix));
         key++;
         ix++;
@@ -34,14 +30,7 @@ CompressedColumnOrderDataset<D>::CompressedColumnOrderDataset(const std::vector<
     // Easier book-keeping.
     clustered_index_.insert(std::make_pair(key, ix));
 
-    num_columns_ = D + 1 + cubes.size();
-    blocks_per_column_ = (size_ + COLUMN_COMPRESSION_BLOCK_SIZE_MASK) >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-        
-    cblocks_ = (CompressionBlock *)malloc(sizeof(CompressionBlock) * num_columns_ * blocks_per_column_);
-    column_data_ = (char **)malloc(sizeof(char *) * num_columns_);
-    compressed_column_sizes_.resize(num_columns_);
-
-    Compress(columns);
+    Compress(data, true, dictionary_dims);
     std::cout << "Dataset size: " << SizeInBytes() << " bytes" << std::endl;
 }
 
@@ -51,32 +40,8 @@ CompressedColumnOrderDataset<D>::CompressedColumnOrderDataset(const std::vector<
                                                               const std::vector<Datacube<D>>& cubes,
                                                               bool data_only) {
     assert(data_only);
-    size_ = data.size();
-    std::vector<std::vector<Scalar>> columns(D + cubes.size());
     cubes_ = cubes;
-    // Index the datacubes by the columns they will appear in.
-    for (size_t i = 0; i < cubes_.size(); i++) {
-        cubes_[i].index = D+i;
-    }
-    for (size_t i = 0; i < data.size(); i++) {
-        const Point<D> &p = data[i];
-        for (size_t d = 0; d < D; d++) {
-            columns[d].push_back(p[d]);
-        }
-
-        for (size_t c = 0; c < cubes_.size(); c++) {
-            Datacube<D> dc = cubes_[c];
-            columns[dc.index].push_back(dc.agg->operator()(p));
-        }
-    }
-    num_columns_ = D + cubes.size();
-    blocks_per_column_ = (size_ + COLUMN_COMPRESSION_BLOCK_SIZE_MASK) >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-
-    cblocks_ = (CompressionBlock *)malloc(sizeof(CompressionBlock) * num_columns_ * blocks_per_column_);
-    column_data_ = (char **)malloc(sizeof(char *) * num_columns_);
-    compressed_column_sizes_.resize(num_columns_);
-
-    Compress(columns);
+    Compress(data, false);
     std::cout << "Dataset size: " << SizeInBytes() << " bytes" << std::endl;
 }
 
@@ -85,22 +50,7 @@ template <size_t D>
 CompressedColumnOrderDataset<D>::CompressedColumnOrderDataset(const std::vector<Point<D>>& data,
                                                               bool data_only) {
     assert(data_only);
-    size_ = data.size();
-    std::vector<std::vector<Scalar>> columns(D);
-    for (size_t i = 0; i < data.size(); i++) {
-        const Point<D> &p = data[i];
-        for (size_t d = 0; d < D; d++) {
-            columns[d].push_back(p[d]);
-        }
-    }
-    num_columns_ = D;
-    blocks_per_column_ = (size_ + COLUMN_COMPRESSION_BLOCK_SIZE_MASK) >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-
-    cblocks_ = (CompressionBlock *)malloc(sizeof(CompressionBlock) * num_columns_ * blocks_per_column_);
-    column_data_ = (char **)malloc(sizeof(char *) * num_columns_);
-    compressed_column_sizes_.resize(num_columns_);
-
-    Compress(columns);
+    Compress(data, false);
     std::cout << "Dataset size: " << SizeInBytes() << " bytes" << std::endl;
 }
 
@@ -109,8 +59,43 @@ CompressedColumnOrderDataset<D>::CompressedColumnOrderDataset(const std::vector<
         const std::vector<Datacube<D>>& cubes)
     : CompressedColumnOrderDataset<D>(data, std::vector<Scalar>(), cubes) {}
 
+template <size_t D>
+void CompressedColumnOrderDataset<D>::IndexCubes(size_t first_column) {
+    prefix_sum_column_.assign(first_column + cubes_.size(), -1);
+    for (size_t c = 0; c < cubes_.size(); c++) {
+        Datacube<D>& dc = cubes_[c];
+        // Index the datacubes by the columns they will appear in.
+        dc.index = first_column + c;
+        if (dc.prefix_sum_of >= 0) {
+            AssertWithMessage((size_t)dc.prefix_sum_of < dc.index,
+                    "Prefix sums must be over a data column or an earlier cube");
+            prefix_sum_column_[dc.prefix_sum_of] = dc.index;
+        }
+    }
+}
+
+template <size_t D>
+bool CompressedColumnOrderDataset<D>::GetExactRangeSum(size_t start, size_t end, size_t dim, Scalar* sum) const {
+    if (dim >= prefix_sum_column_.size() || prefix_sum_column_[dim] < 0) {
+        return false;
+    }
+    if (end <= start) {
+        *sum = 0;
+        return true;
+    }
+    size_t cube = prefix_sum_column_[dim];
+    *sum = GetCoord(end - 1, cube) - (start > 0 ? GetCoord(start - 1, cube) : 0);
+    return true;
+}
+
 template <size_t D>
 CompressedColumnOrderDataset<D>::~CompressedColumnOrderDataset() {
+    if (mapping_ != nullptr) {
+        // Everything but the column pointers lives in the mapping.
+        free(column_data_);
+        munmap(mapping_, mapping_size_);
+        return;
+    }
     free(cblocks_);
     for (size_t i = 0; i < num_columns_; i++) {
         free(column_data_[i]);
@@ -119,99 +104,380 @@ CompressedColumnOrderDataset<D>::~CompressedColumnOrderDataset() {
 //    delete dsm_;
 }
 
+inline uint64_t AlignFileOffset(uint64_t offset) {
+    return (offset + COMPRESSED_DATASET_ALIGNMENT - 1) & ~(COMPRESSED_DATASET_ALIGNMENT - 1);
+}
+
 template <size_t D>
-void CompressedColumnOrderDataset<D>::Compress(const std::vector<std::vector<Scalar>>& columns) {
-    for (size_t i = 0; i < columns.size(); i++) {
-        CompressColumn(i, columns[i]);
+void CompressedColumnOrderDataset<D>::Save(const std::string& filename,
+        const std::string& build_info) const {
+    std::vector<Key> keys;
+    std::vector<PhysicalIndex> indexes;
+    if (mapped_keys_ != nullptr) {
+        keys.assign(mapped_keys_, mapped_keys_ + num_mapped_keys_);
+        indexes.assign(mapped_indexes_, mapped_indexes_ + num_mapped_keys_);
+    } else {
+        keys.reserve(clustered_index_.size());
+        indexes.reserve(clustered_index_.size());
+        for (const auto& entry : clustered_index_) {
+            keys.push_back(entry.first);
+            indexes.push_back(entry.second);
+        }
+    }
+    std::vector<int64_t> prefix_sum_column(num_columns_, -1);
+    std::copy(prefix_sum_column_.begin(), prefix_sum_column_.end(), prefix_sum_column.begin());
+
+    CompressedDatasetFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, COMPRESSED_DATASET_MAGIC, sizeof(header.magic));
+    header.version = COMPRESSED_DATASET_VERSION;
+    header.byte_order = COMPRESSED_DATASET_BYTE_ORDER;
+    header.dims = D;
+    header.block_size_pow = COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    header.cblock_size = sizeof(CompressionBlock);
+    header.size = size_;
+    header.num_columns = num_columns_;
+    header.blocks_per_column = blocks_per_column_;
+    header.num_keys = keys.size();
+
+    uint64_t offset = AlignFileOffset(sizeof(header));
+    header.column_table_offset = offset;
+    offset = AlignFileOffset(offset + 2 * sizeof(uint64_t) * num_columns_);
+    header.cblocks_offset = offset;
+    offset = AlignFileOffset(offset + sizeof(CompressionBlock) * num_columns_ * blocks_per_column_);
+    header.prefix_sum_offset = offset;
+    offset = AlignFileOffset(offset + sizeof(int64_t) * num_columns_);
+    header.dictionary_table_offset = offset;
+    offset = AlignFileOffset(offset + 2 * sizeof(uint64_t) * num_columns_);
+    // Offset and size of each column's bits.
+    std::vector<uint64_t> column_table(2 * num_columns_);
+    for (size_t i = 0; i < num_columns_; i++) {
+        column_table[2 * i] = offset;
+        column_table[2 * i + 1] = compressed_column_sizes_[i];
+        offset = AlignFileOffset(offset + compressed_column_sizes_[i]);
+    }
+    // Offset and number of values of each column's dictionary.
+    std::vector<uint64_t> dictionary_table(2 * num_columns_, 0);
+    for (size_t i = 0; i < num_columns_; i++) {
+        if (dictionaries_[i].values != nullptr) {
+            dictionary_table[2 * i] = offset;
+            dictionary_table[2 * i + 1] = dictionaries_[i].size;
+            offset = AlignFileOffset(offset + sizeof(Scalar) * dictionaries_[i].size);
+        }
     }
+    header.keys_offset = offset;
+    offset = AlignFileOffset(offset + sizeof(Key) * keys.size());
+    header.indexes_offset = offset;
+    offset = AlignFileOffset(offset + sizeof(PhysicalIndex) * indexes.size());
+    header.build_info_offset = offset;
+    header.build_info_size = build_info.size();
+    offset = AlignFileOffset(offset + build_info.size());
+    // Leave room for the decoders to read a little past the end of the last section.
+    header.file_size = offset + COMPRESSED_DATASET_ALIGNMENT;
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    AssertWithMessage(out.is_open(), "Could not open " + filename + " for writing");
+    uint64_t position = 0;
+    const std::vector<char> padding(COMPRESSED_DATASET_ALIGNMENT, 0);
+    auto write_at = [&out, &position, &padding](uint64_t at, const void* data, uint64_t bytes) {
+        // The last gap, before the end of the file, can be longer than the padding.
+        while (position < at) {
+            uint64_t gap = std::min<uint64_t>(at - position, padding.size());
+            out.write(padding.data(), gap);
+            position += gap;
+        }
+        out.write((const char*) data, bytes);
+        position = at + bytes;
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.column_table_offset, column_table.data(), column_table.size() * sizeof(uint64_t));
+    write_at(header.cblocks_offset, cblocks_,
+            sizeof(CompressionBlock) * num_columns_ * blocks_per_column_);
+    write_at(header.prefix_sum_offset, prefix_sum_column.data(), num_columns_ * sizeof(int64_t));
+    write_at(header.dictionary_table_offset, dictionary_table.data(),
+            dictionary_table.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < num_columns_; i++) {
+        write_at(column_table[2 * i], column_data_[i], compressed_column_sizes_[i]);
+    }
+    for (size_t i = 0; i < num_columns_; i++) {
+        if (dictionaries_[i].values != nullptr) {
+            write_at(dictionary_table[2 * i], dictionaries_[i].values,
+                    sizeof(Scalar) * dictionaries_[i].size);
+        }
+    }
+    write_at(header.keys_offset, keys.data(), keys.size() * sizeof(Key));
+    write_at(header.indexes_offset, indexes.data(), indexes.size() * sizeof(PhysicalIndex));
+    write_at(header.build_info_offset, build_info.data(), build_info.size());
+    write_at(header.file_size, nullptr, 0);
+    out.close();
+    AssertWithMessage(!out.fail(), "Could not write " + filename);
 }
 
 template <size_t D>
-void CompressedColumnOrderDataset<D>::CompressColumn(size_t dim_idx,
-        const std::vector<Scalar>& column) {
-    size_t delta = 1<<COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-    uint64_t offset = 0;
-    std::vector<char> data_bits;
-    std::vector<CompressionBlock> cblocks;
-    for (size_t i = 0; i < column.size(); i += delta) {
-        size_t end = std::min(column.size(), i + delta);
-        const std::vector<Scalar> block(column.begin() + i, column.begin() + end);
-        offset = CompressBlock(block, &cblocks, &data_bits, offset);
-    }
-    data_bits.shrink_to_fit();
-    cblocks.shrink_to_fit();
-
-    compressed_column_sizes_[dim_idx] = data_bits.size();
-    std::cout << "Compressed column " << dim_idx << " to " << data_bits.size() << " bytes"
-        << " with " << cblocks.size() << " blocks " << std::endl;
-   
-    assert (cblocks.size() == blocks_per_column_);
-    // Store pointers to the underlying arrays (avoids extra vector indirection)
-    std::memcpy(cblocks_ + dim_idx * blocks_per_column_, cblocks.data(), cblocks.size() * sizeof(CompressionBlock));
-    column_data_[dim_idx] = (char *)malloc(data_bits.size());
-    std::memcpy(column_data_[dim_idx], data_bits.data(), data_bits.size());
+std::shared_ptr<CompressedColumnOrderDataset<D>> CompressedColumnOrderDataset<D>::Open(
+        const std::string& filename, const std::string& build_info) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CompressedDatasetFileHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    const char* base = (const char*) mapping;
+    const CompressedDatasetFileHeader& header = *(const CompressedDatasetFileHeader*) mapping;
+    bool compatible = std::memcmp(header.magic, COMPRESSED_DATASET_MAGIC, sizeof(header.magic)) == 0
+        && header.version == COMPRESSED_DATASET_VERSION
+        && header.byte_order == COMPRESSED_DATASET_BYTE_ORDER
+        && header.dims == D
+        && header.block_size_pow == (uint32_t) COLUMN_COMPRESSION_BLOCK_SIZE_POW
+        && header.cblock_size == sizeof(CompressionBlock)
+        && header.file_size == (uint64_t) st.st_size
+        && header.column_table_offset + 2 * sizeof(uint64_t) * header.num_columns <= header.file_size
+        && header.cblocks_offset + header.cblock_size * header.num_columns * header.blocks_per_column
+            <= header.file_size
+        && header.prefix_sum_offset + sizeof(int64_t) * header.num_columns <= header.file_size
+        && header.dictionary_table_offset + 2 * sizeof(uint64_t) * header.num_columns
+            <= header.file_size
+        && header.keys_offset + header.num_keys * sizeof(Key) <= header.file_size
+        && header.indexes_offset + header.num_keys * sizeof(PhysicalIndex) <= header.file_size
+        && header.build_info_offset + header.build_info_size <= header.file_size;
+    const uint64_t* column_table = (const uint64_t*) (base + header.column_table_offset);
+    const uint64_t* dictionary_table = (const uint64_t*) (base + header.dictionary_table_offset);
+    for (size_t i = 0; compatible && i < header.num_columns; i++) {
+        compatible = column_table[2 * i] + column_table[2 * i + 1] <= header.file_size
+            && dictionary_table[2 * i] + sizeof(Scalar) * dictionary_table[2 * i + 1]
+                <= header.file_size;
+    }
+    if (!compatible) {
+        std::cerr << filename << " is not a compatible compressed dataset" << std::endl;
+        munmap(mapping, st.st_size);
+        return nullptr;
+    }
+    if (std::string(base + header.build_info_offset, header.build_info_size) != build_info) {
+        std::cerr << filename << " was built from different data or parameters" << std::endl;
+        munmap(mapping, st.st_size);
+        return nullptr;
+    }
+
+    std::shared_ptr<CompressedColumnOrderDataset<D>> dataset(new CompressedColumnOrderDataset<D>());
+    dataset->mapping_ = mapping;
+    dataset->mapping_size_ = st.st_size;
+    dataset->size_ = header.size;
+    dataset->num_columns_ = header.num_columns;
+    dataset->blocks_per_column_ = header.blocks_per_column;
+    // Never written to, so the read-only mapping is safe.
+    dataset->cblocks_ = (CompressionBlock*) (base + header.cblocks_offset);
+    dataset->column_data_ = (char **)malloc(sizeof(char *) * header.num_columns);
+    dataset->compressed_column_sizes_.resize(header.num_columns);
+    for (size_t i = 0; i < header.num_columns; i++) {
+        dataset->column_data_[i] = (char*) (base + column_table[2 * i]);
+        dataset->compressed_column_sizes_[i] = column_table[2 * i + 1];
+    }
+    const int64_t* prefix_sum_column = (const int64_t*) (base + header.prefix_sum_offset);
+    dataset->prefix_sum_column_.assign(prefix_sum_column, prefix_sum_column + header.num_columns);
+    dataset->dictionaries_.resize(header.num_columns);
+    for (size_t i = 0; i < header.num_columns; i++) {
+        if (dictionary_table[2 * i + 1] > 0) {
+            dataset->dictionaries_[i].values = (const Scalar*) (base + dictionary_table[2 * i]);
+            dataset->dictionaries_[i].size = dictionary_table[2 * i + 1];
+        }
+    }
+    dataset->mapped_keys_ = (const Key*) (base + header.keys_offset);
+    dataset->mapped_indexes_ = (const PhysicalIndex*) (base + header.indexes_offset);
+    dataset->num_mapped_keys_ = header.num_keys;
+    std::cout << "Mapped dataset of " << dataset->SizeInBytes() << " bytes from " << filename
+        << std::endl;
+    return dataset;
 }
 
 template <size_t D>
-uint64_t CompressedColumnOrderDataset<D>::CompressBlock(const std::vector<Scalar>& block,
-        std::vector<CompressionBlock>* cblocks,
-        std::vector<char>* data_bits,
-        uint64_t offset) {
-    Scalar min_val = std::numeric_limits<Scalar>::max();
-    Scalar max_val = std::numeric_limits<Scalar>::lowest();
-    for (Scalar s : block) {
-        min_val = std::min(s, min_val);
-        max_val = std::max(s, max_val);
-    }
-    // base value is min, bit width is the number of bits needed to represent the difference max -
-    // min
-    Scalar diff = max_val - min_val;
-    // TODO(vikram): replace with __builtin_clz or some other single instruction operation.
-    char log2 = 0;
-    while (diff > 0) {
-        diff >>= 1;
-        log2++;
-    }
-    CompressionBlock cblk;
-    cblk.base_value = min_val;
-    cblk.bit_offset = offset;
-    cblk.bit_width = log2;
-    cblk.bit_mask = ((1UL << log2) - 1UL);
-    cblocks->push_back(cblk);
-    //std::cout << "Compression block: base val = " << cblk.base_value << ", offset = " << cblk.bit_offset << ", bit_width = " << (int)cblk.bit_width << std::endl;
-
-    // We need to insert starting at position `offset`.
-    // Always make sure there's at least 64 bits of space when we insert the last element.
-    uint64_t last_insertion = offset + block.size() * log2;
-    size_t new_size_bytes = (last_insertion >> 3) + 1 + 8;
-    // assert (new_size_bytes >= data_bits.size());
-    data_bits->resize(new_size_bytes);
-
-    for (size_t i = 0; i < block.size(); i++) {
-        Scalar s = block[i];
-        // Diff is guaranteed to be at most log2 bits.
-        Scalar diff = s - min_val;
-        size_t byte_ix = offset >> 3;
-        uint64_t *bits = (uint64_t *)(data_bits->data() + byte_ix);
-        char bit_offset = offset - (byte_ix << 3);
-        
-        uint64_t holder;
-#ifdef LITTLE_ENDIAN_ORDER
-        holder = __builtin_bswap64(*bits);
-#endif
-        holder |= (diff << ((sizeof(uint64_t) << 3) - log2 - bit_offset));
-#ifdef LITTLE_ENDIAN_ORDER
-        *bits = __builtin_bswap64(holder);
-#endif
-        offset += log2;
+void CompressedColumnOrderDataset<D>::Compress(const std::vector<Point<D>>& data, bool with_keys,
+        const std::vector<size_t>& dictionary_dims) {
+    const size_t block_size = 1 << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    const size_t first_cube = D + with_keys;
+    size_ = data.size();
+    num_columns_ = first_cube + cubes_.size();
+    blocks_per_column_ = (size_ + COLUMN_COMPRESSION_BLOCK_SIZE_MASK) >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    const size_t num_blocks = num_columns_ * blocks_per_column_;
+    cblocks_ = (CompressionBlock *)calloc(num_blocks, sizeof(CompressionBlock));
+    column_data_ = (char **)malloc(sizeof(char *) * num_columns_);
+    compressed_column_sizes_.assign(num_columns_, 0);
+    IndexCubes(first_cube);
+
+    // Each block of a prefix sum column starts from the sum of its source before the block, so
+    // that the blocks can be computed independently. Sources come before the cubes summing them.
+    std::vector<std::vector<Scalar>> prefix_bases(num_columns_);
+    for (const Datacube<D>& dc : cubes_) {
+        if (dc.prefix_sum_of < 0) {
+            continue;
+        }
+        std::vector<Scalar> sums(blocks_per_column_);
+#pragma omp parallel
+        {
+            std::vector<Scalar> values(block_size);
+#pragma omp for schedule(static)
+            for (size_t b = 0; b < blocks_per_column_; b++) {
+                size_t start = b << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+                size_t end = std::min(size_, start + block_size);
+                ColumnValues(data, first_cube, prefix_bases, dc.prefix_sum_of, start, end, values.data());
+                sums[b] = std::accumulate(values.begin(), values.begin() + (end - start), (Scalar)0);
+            }
+        }
+        std::vector<Scalar>& bases = prefix_bases[dc.index];
+        bases.resize(blocks_per_column_);
+        Scalar sum = 0;
+        for (size_t b = 0; b < blocks_per_column_; b++) {
+            bases[b] = sum;
+            sum += sums[b];
+        }
+    }
+
+    dictionaries_.assign(num_columns_, ColumnDictionary());
+    dictionary_storage_.assign(num_columns_, std::vector<Scalar>());
+    for (size_t dim : dictionary_dims) {
+        AssertWithMessage(dim < D, "Only data columns can be dictionary-encoded");
+        std::vector<Scalar>& dictionary = dictionary_storage_[dim];
+        dictionary.resize(size_);
+        for (size_t i = 0; i < size_; i++) {
+            dictionary[i] = data[i][dim];
+        }
+        std::sort(dictionary.begin(), dictionary.end());
+        dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+        dictionary.shrink_to_fit();
+        dictionaries_[dim].values = dictionary.data();
+        dictionaries_[dim].size = dictionary.size();
+        std::cout << "Dictionary-encoding column " << dim << " with " << dictionary.size()
+            << " distinct values" << std::endl;
+    }
+    // The stored values of block k, which is block k % blocks_per_column_ of column
+    // k / blocks_per_column_, as cblocks_ is laid out.
+    auto read_block = [&](size_t k, std::vector<Scalar>* block) {
+        size_t col = k / blocks_per_column_;
+        size_t start = (k % blocks_per_column_) << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+        block->resize(std::min(size_, start + block_size) - start);
+        ColumnValues(data, first_cube, prefix_bases, col, start, start + block->size(), block->data());
+        const std::vector<Scalar>& dictionary = dictionary_storage_[col];
+        if (!dictionary.empty()) {
+            for (Scalar& v : *block) {
+                v = std::lower_bound(dictionary.begin(), dictionary.end(), v) - dictionary.begin();
+            }
+        }
+    };
+
+    // First pass: choose the encoding of every block.
+    std::vector<BlockStats> stats(num_blocks);
+#pragma omp parallel
+    {
+        std::vector<Scalar> block;
+#pragma omp for schedule(dynamic, 16)
+        for (size_t k = 0; k < num_blocks; k++) {
+            read_block(k, &block);
+            stats[k] = BlockStats::Of(block);
+            cblocks_[k].encoding = BlockCodecs::Choose(stats[k]);
+        }
+    }
+
+    // Lay the blocks out one after the other, and allocate every column at its final size, with
+    // 64 bits of padding after the last value as BitWriter leaves.
+    std::vector<uint64_t> starts(num_blocks);
+    for (size_t col = 0; col < num_columns_; col++) {
+        uint64_t offset = 0;
+        for (size_t k = col * blocks_per_column_; k < (col + 1) * blocks_per_column_; k++) {
+            starts[k] = offset;
+            offset = Codec(cblocks_[k]).EncodedEnd(stats[k], offset);
+        }
+        compressed_column_sizes_[col] = blocks_per_column_ == 0 ? 0 : (offset >> 3) + 1 + 8;
+        column_data_[col] = (char *)calloc(compressed_column_sizes_[col], 1);
+    }
+
+    // Second pass: write every block. Consecutive blocks may share a byte, so every block is
+    // encoded into a buffer that starts at its first byte. It then copies the bytes that start
+    // within it, and the byte it starts in is merged in after all blocks are written.
+    std::vector<char> first_bytes(num_blocks, 0);
+#pragma omp parallel
+    {
+        std::vector<Scalar> block;
+        std::vector<char> bits;
+#pragma omp for schedule(dynamic, 16)
+        for (size_t k = 0; k < num_blocks; k++) {
+            read_block(k, &block);
+            uint64_t start = starts[k];
+            uint64_t first_byte = start >> 3;
+            bits.clear();
+            BitWriter writer(&bits, start & 7);
+            CompressionBlock& cblk = cblocks_[k];
+            cblk.bit_offset = writer.Offset();
+            Codec(cblk).Encode(block, stats[k], &cblk, &writer);
+            cblk.bit_offset += first_byte << 3;
+            uint64_t end = (first_byte << 3) + writer.Offset();
+            assert (end == Codec(cblk).EncodedEnd(stats[k], start));
+
+            uint64_t own_start = (start + 7) >> 3;
+            uint64_t own_end = (end + 7) >> 3;
+            if (own_end > own_start) {
+                std::memcpy(column_data_[k / blocks_per_column_] + own_start,
+                        bits.data() + (own_start - first_byte), own_end - own_start);
+            }
+            if (start & 7) {
+                first_bytes[k] = bits[0];
+            }
+        }
+    }
+    for (size_t k = 0; k < num_blocks; k++) {
+        column_data_[k / blocks_per_column_][starts[k] >> 3] |= first_bytes[k];
+    }
+
+    for (size_t col = 0; col < num_columns_; col++) {
+        std::cout << "Compressed column " << col << " to " << compressed_column_sizes_[col]
+            << " bytes with " << blocks_per_column_ << " blocks " << std::endl;
+    }
+}
+
+template <size_t D>
+void CompressedColumnOrderDataset<D>::ColumnValues(const std::vector<Point<D>>& data,
+        size_t first_cube, const std::vector<std::vector<Scalar>>& prefix_bases, size_t col,
+        size_t start, size_t end, Scalar* out) const {
+    if (col < D) {
+        for (size_t i = start; i < end; i++) {
+            out[i - start] = data[i][col];
+        }
+    } else if (col < first_cube) {
+        // The keys are the row numbers.
+        for (size_t i = start; i < end; i++) {
+            out[i - start] = i;
+        }
+    } else {
+        const Datacube<D>& dc = cubes_[col - first_cube];
+        if (dc.prefix_sum_of >= 0) {
+            ColumnValues(data, first_cube, prefix_bases, dc.prefix_sum_of, start, end, out);
+            Scalar sum = prefix_bases[col][start >> COLUMN_COMPRESSION_BLOCK_SIZE_POW];
+            for (size_t i = 0; i < end - start; i++) {
+                sum += out[i];
+                out[i] = sum;
+            }
+        } else {
+            for (size_t i = start; i < end; i++) {
+                out[i - start] = (*dc.agg)(data[i]);
+            }
+        }
     }
-    return offset;
 }
 
 template <size_t D>
 Scalar CompressedColumnOrderDataset<D>::GetCoord(size_t index, size_t dim) const {
     const CompressionBlock cblk = cblocks_[dim * blocks_per_column_ + (index >> COLUMN_COMPRESSION_BLOCK_SIZE_POW)];
     size_t offset_in_block = index & COLUMN_COMPRESSION_BLOCK_SIZE_MASK;
+    if (cblk.encoding != BLOCK_PACKED) {
+        return FromStored(dim, Codec(cblk).Get(column_data_[dim], cblk, offset_in_block));
+    }
+    // Packed blocks are decoded inline, since this is on the path of every random access.
     uint64_t bit_offset_from_start = cblk.bit_offset + cblk.bit_width * offset_in_block;
     // Get last 3 bits, which tell us which bit we need to start at.
     size_t bit_offset_from_byte_boundary = bit_offset_from_start & 0b111;
@@ -230,105 +496,180 @@ Scalar CompressedColumnOrderDataset<D>::GetCoord(size_t index, size_t dim) const
         << ", shift " << shift
         << ", byteblock " << std::bitset<64>(byte_block)
         << ", mask " << std::bitset<64>(mask) << std::endl;*/
-    return cblk.base_value + ((byte_block >> shift) & cblk.bit_mask);
-} 
+    return FromStored(dim, cblk.base_value + ((byte_block >> shift) & cblk.bit_mask));
+}
 
 template <size_t D>
 uint64_t CompressedColumnOrderDataset<D>::GetCoordRange(size_t start_ix, size_t end_ix, size_t dim, Scalar lower, Scalar upper) const {
+    const ColumnDictionary& dictionary = dictionaries_[dim];
+    if (dictionary.values == nullptr) {
+        return StoredInRange(start_ix, end_ix, dim, lower, upper);
+    }
+    const Scalar* values_end = dictionary.values + dictionary.size;
+    Scalar low_code = std::lower_bound(dictionary.values, values_end, lower) - dictionary.values;
+    Scalar high_code = std::upper_bound(dictionary.values, values_end, upper) - dictionary.values;
+    if (high_code <= low_code) {
+        return 0;
+    }
+    return StoredInRange(start_ix, end_ix, dim, low_code, high_code - 1);
+}
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::StoredInRange(size_t start_ix, size_t end_ix, size_t dim, Scalar lower, Scalar upper) const {
     size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-    const CompressionBlock cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
-    size_t offset_in_block = start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK;
-    // Initialize the offset to be for the first element at or after the current index that is
-    // present. If we shift by 64, the result is undefined (according to the C++ standard), so we
-    // need a special check if offset_in_block = 0.
-    //offset_in_block = offset_in_block == 0 ? 0 : __builtin_popcountll(cblk.present >> (1 + COLUMN_COMPRESSION_BLOCK_SIZE_MASK - offset_in_block));
-    uint64_t bit_offset_from_start = cblk.bit_offset + cblk.bit_width * offset_in_block;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
     size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
-    uint64_t valids = 0; 
-    for (size_t i = start_ix; i < end; i++) {  
-        // Get last 3 bits, which tell us which bit we need to start at.
-        size_t bit_offset_from_byte_boundary = bit_offset_from_start & 0b111;
-        // Extract the bits we need from it.
-        size_t shift = 64 - cblk.bit_width - bit_offset_from_byte_boundary;
-        uint64_t byte_block = *(uint64_t *)(column_data_[dim] + (bit_offset_from_start >> 3));
-#ifdef LITTLE_ENDIAN_ORDER
-        byte_block = __builtin_bswap64(byte_block);
-#endif
-        Scalar val = cblk.base_value + ((byte_block >> shift) & cblk.bit_mask);
-        valids <<= 1;
-        valids |= val >= lower && val <= upper;
-        bit_offset_from_start += cblk.bit_width;
-    }
+    uint64_t valids = Codec(cblk).InRange(column_data_[dim], cblk,
+            start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK, end - start_ix, lower, upper);
     if (end < end_ix) {
         // The range spans at most 2 blocks. Fetch the other block if necessary.
-        uint64_t last_part = GetCoordRange(end, end_ix, dim, lower, upper);
+        uint64_t last_part = StoredInRange(end, end_ix, dim, lower, upper);
         valids = (valids << (end_ix - end)) | last_part;
     }
     return valids;
 }
-    
+
+
 template <size_t D>
-void CompressedColumnOrderDataset<D>::GetRangeValues(size_t start_ix, size_t end_ix, size_t dim, uint64_t valids, std::vector<Scalar> *results) const {
+uint64_t CompressedColumnOrderDataset<D>::GetCoordInRange(size_t start_ix, size_t end_ix, size_t dim, Scalar low, Scalar high) const {
+    if (high <= low) {
+        return 0;
+    }
+    return GetCoordRange(start_ix, end_ix, dim, low, high - 1);
+}
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::GetCoordInRanges(size_t start_ix, size_t end_ix, size_t dim, const RangeSet& rset) const {
+    const ColumnDictionary& dictionary = dictionaries_[dim];
+    if (dictionary.values == nullptr) {
+        return StoredInRanges(start_ix, end_ix, dim, rset);
+    }
+    const RangeSet* codes = rset.Encoded(dictionary.values);
+    if (codes == nullptr) {
+        return StoredInRanges(start_ix, end_ix, dim, rset.Encode(dictionary.values, dictionary.size));
+    }
+    return StoredInRanges(start_ix, end_ix, dim, *codes);
+}
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::StoredInRanges(size_t start_ix, size_t end_ix, size_t dim, const RangeSet& rset) const {
     size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-    const CompressionBlock cblk = cblocks_[dim * blocks_per_column_  + cur_blk_ix];
-    size_t offset_in_block = start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK;
-    uint64_t bit_offset_from_start = cblk.bit_offset + cblk.bit_width * offset_in_block;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
     size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
-    uint64_t mask = 1UL << (end_ix - start_ix - 1);
-    for (size_t i = start_ix; i < end; i++) {  
-        // Get last 3 bits, which tell us which bit we need to start at.
-        size_t bit_offset_from_byte_boundary = bit_offset_from_start & 0b111;
-        // Extract the bits we need from it.
-        size_t shift = 64 - cblk.bit_width - bit_offset_from_byte_boundary;
-        uint64_t byte_block = *(uint64_t *)(column_data_[dim] + (bit_offset_from_start >> 3));
-#ifdef LITTLE_ENDIAN_ORDER
-        byte_block = __builtin_bswap64(byte_block);
-#endif
-        Scalar val = cblk.base_value + ((byte_block >> shift) & cblk.bit_mask);
-        if (valids & mask) {
-            results->push_back(val);    
+    // Only the ranges that overlap the values of this block matter.
+    Scalar min, max;
+    StoredBounds(start_ix, dim, &min, &max);
+    size_t first, last;
+    rset.Overlapping(min, max, &first, &last);
+    uint64_t valids = 0;
+    if (first < last) {
+        valids = Codec(cblk).InRanges(column_data_[dim], cblk,
+                start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK, end - start_ix, rset, first, last);
+    }
+    if (end < end_ix) {
+        // The range spans at most 2 blocks. Fetch the other block if necessary.
+        valids = (valids << (end_ix - end)) | StoredInRanges(end, end_ix, dim, rset);
+    }
+    return valids;
+}
+
+
+template <size_t D>
+void CompressedColumnOrderDataset<D>::DecodeRange(size_t start_ix, size_t end_ix, size_t dim, Scalar* out) const {
+    DecodeStored(start_ix, end_ix, dim, out);
+    const Scalar* dictionary = dictionaries_[dim].values;
+    if (dictionary != nullptr) {
+        for (size_t i = 0; i < end_ix - start_ix; i++) {
+            out[i] = dictionary[out[i]];
         }
-        mask >>= 1;
-        bit_offset_from_start += cblk.bit_width;
     }
+}
+
+template <size_t D>
+void CompressedColumnOrderDataset<D>::DecodeStored(size_t start_ix, size_t end_ix, size_t dim, Scalar* out) const {
+    size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
+    size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
+    Codec(cblk).Decode(column_data_[dim], cblk, start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK,
+            end - start_ix, out);
+    if (end < end_ix) {
+        DecodeStored(end, end_ix, dim, out + (end - start_ix));
+    }
+}
+
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::GetCoordInSet(size_t start_ix, size_t end_ix, size_t dim, const std::unordered_set<Scalar>& vset) const {
+    Scalar vals[64];
+    DecodeRange(start_ix, end_ix, dim, vals);
+    uint64_t valids = 0;
+    for (size_t i = 0; i < end_ix - start_ix; i++) {
+        valids <<= 1;
+        valids |= (vset.find(vals[i]) != vset.end());
+    }
+    return valids;
+}
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::GetCoordInSet(size_t start_ix, size_t end_ix, size_t dim, const ValueSet& vset) const {
+    const ColumnDictionary& dictionary = dictionaries_[dim];
+    if (dictionary.values == nullptr) {
+        return StoredInSet(start_ix, end_ix, dim, vset);
+    }
+    const ValueSet* codes = vset.Encoded(dictionary.values);
+    if (codes == nullptr) {
+        return StoredInSet(start_ix, end_ix, dim, vset.Encode(dictionary.values, dictionary.size));
+    }
+    return StoredInSet(start_ix, end_ix, dim, *codes);
+}
+
+template <size_t D>
+uint64_t CompressedColumnOrderDataset<D>::StoredInSet(size_t start_ix, size_t end_ix, size_t dim, const ValueSet& vset) const {
+    size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
+    size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
+    uint64_t valids = Codec(cblk).InSet(column_data_[dim], cblk,
+            start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK, end - start_ix, vset);
+    if (end < end_ix) {
+        // The range spans at most 2 blocks. Fetch the other block if necessary.
+        valids = (valids << (end_ix - end)) | StoredInSet(end, end_ix, dim, vset);
+    }
+    return valids;
+}
+
+
+template <size_t D>
+void CompressedColumnOrderDataset<D>::GetRangeValues(size_t start_ix, size_t end_ix, size_t dim, uint64_t valids, std::vector<Scalar> *results) const {
+    size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_  + cur_blk_ix];
+    size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
+    // The rows of this block are the highest bits of `valids`.
+    Codec(cblk).Values(column_data_[dim], cblk, start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK,
+            end - start_ix, valids >> (end_ix - end), dictionaries_[dim].values, results);
     if (end < end_ix) {
         // The range spans at most 2 blocks. Fetch the other block if necessary.
         GetRangeValues(end, end_ix, dim, valids, results);
     }
 }
-    
+
+
 template <size_t D>
 Scalar CompressedColumnOrderDataset<D>::GetRangeSum(size_t start_ix, size_t end_ix, size_t dim, uint64_t valids) const {
     size_t cur_blk_ix = start_ix >> COLUMN_COMPRESSION_BLOCK_SIZE_POW;
-    const CompressionBlock cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
-    size_t offset_in_block = start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK;
-    uint64_t bit_offset_from_start = cblk.bit_offset + cblk.bit_width * offset_in_block;
+    const CompressionBlock& cblk = cblocks_[dim * blocks_per_column_ + cur_blk_ix];
     size_t end = std::min(end_ix, (cur_blk_ix+1) << COLUMN_COMPRESSION_BLOCK_SIZE_POW);
-    uint64_t mask = 1UL << (end_ix - start_ix - 1);
-    Scalar sum = 0;
-    for (size_t i = start_ix; i < end; i++) {  
-        if (valids & mask) {
-            // Get last 3 bits, which tell us which bit we need to start at.
-            size_t bit_offset_from_byte_boundary = bit_offset_from_start & 0b111;
-            // Extract the bits we need from it.
-            size_t shift = 64 - cblk.bit_width - bit_offset_from_byte_boundary;
-            uint64_t byte_block = *(uint64_t *)(column_data_[dim] + (bit_offset_from_start >> 3));
-#ifdef LITTLE_ENDIAN_ORDER
-            byte_block = __builtin_bswap64(byte_block);
-#endif
-            Scalar val = cblk.base_value + ((byte_block >> shift) & cblk.bit_mask);
-            sum += val;
-        }
-        mask >>= 1;
-        bit_offset_from_start += cblk.bit_width;
-    }
+    Scalar sum = Codec(cblk).Sum(column_data_[dim], cblk,
+            start_ix & COLUMN_COMPRESSION_BLOCK_SIZE_MASK, end - start_ix,
+            valids >> (end_ix - end), dictionaries_[dim].values);
     if (end < end_ix) {
         // The range spans at most 2 blocks. Fetch the other block if necessary.
-        sum += GetRangeSum(end, end_ix, dim, valids);
+        size_t n = end_ix - start_ix;
+        sum += GetRangeSum(end, end_ix, dim, valids & BlockCodec::RowSpan(n, end - start_ix, n));
     }
     return sum;
 }
 
+
 template <size_t D>
 Point<D> CompressedColumnOrderDataset<D>::Get(size_t ix) const {
     std::array<Scalar, D> pt;
@@ -339,14 +680,28 @@ Point<D> CompressedColumnOrderDataset<D>::Get(size_t ix) const {
 }
 
 template <size_t D>
-Range<PhysicalIndex> CompressedColumnOrderDataset<D>::LookupRange(Range<Key> range) {
-    auto startit = clustered_index_.lower_bound(range.start);
-    auto endit = clustered_index_.lower_bound(range.end);
-    return Range<PhysicalIndex>(startit->second, endit->second);
+std::pair<Key, PhysicalIndex> CompressedColumnOrderDataset<D>::LowerBound(Key key) const {
+    if (mapped_keys_ != nullptr) {
+        const Key* it = std::lower_bound(mapped_keys_, mapped_keys_ + num_mapped_keys_, key);
+        if (it == mapped_keys_ + num_mapped_keys_) {
+            return std::make_pair(std::numeric_limits<Key>::max(), size_);
+        }
+        return std::make_pair(*it, mapped_indexes_[it - mapped_keys_]);
+    }
+    auto it = clustered_index_.lower_bound(key);
+    if (it == clustered_index_.end()) {
+        return std::make_pair(std::numeric_limits<Key>::max(), size_);
+    }
+    return *it;
+}
+
+template <size_t D>
+Range<PhysicalIndex> CompressedColumnOrderDataset<D>::LookupRange(Range<Key> range) const {
+    return Range<PhysicalIndex>(LowerBound(range.start).second, LowerBound(range.end).second);
 }
 
 template <size_t D>
-Set<PhysicalIndex> CompressedColumnOrderDataset<D>::Lookup(Set<Key> keys) {
+Set<PhysicalIndex> CompressedColumnOrderDataset<D>::Lookup(Set<Key> keys) const {
     Set<PhysicalIndex> results;
     results.ranges.reserve(keys.ranges.size());
     results.list.reserve(keys.list.size());
@@ -354,9 +709,9 @@ Set<PhysicalIndex> CompressedColumnOrderDataset<D>::Lookup(Set<Key> keys) {
         results.ranges.push_back(LookupRange(r));
     }
     for (const auto& r : keys.list) {
-        auto loc = clustered_index_.find(r);
-        AssertWithMessage(loc != clustered_index_.end(), "Search for invalid key");
-        results.list.push_back(loc->second);
+        auto loc = LowerBound(r);
+        AssertWithMessage(loc.first == r, "Search for invalid key");
+        results.list.push_back(loc.second);
     }
     return results;
 }
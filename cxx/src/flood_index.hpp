@@ -343,10 +343,146 @@ void FloodIndex<D>::query(const Query<D> &query, Visitor<D> &visitor) {
 #endif
 }*/
 
+// Walks the cells of the grid that overlap the query one row at a time: every refill returns the
+// ranges of all columns of the last queried grid dim, for the current columns of the other dims.
+template <size_t D>
+class FloodIndex<D>::GridCursor : public BufferedRangeCursor {
+ public:
+  GridCursor(const FloodIndex<D>* index, const Query<D>& query,
+          const std::vector<RangeSet>& range_filters, std::vector<int> start_cols,
+          std::vector<int> end_cols)
+      : BufferedRangeCursor(), index_(index), start_cols_(std::move(start_cols)),
+        end_cols_(std::move(end_cols)), cur_cols_(start_cols_), col_match_(start_cols_.size()),
+        last_(start_cols_.size() - 1), cells_per_col_(1), finished_(false) {
+    int depth = start_cols_.size();
+    for (int i = 0; i < depth; i++) {
+      int dim = index->grid_dims_order_[i];
+      const QueryFilter& qf = query.filters[dim];
+      int ncols = end_cols_[i] - start_cols_[i] + 1;
+      if (!qf.present) {
+          col_match_[i].assign(ncols, COL_ALL);
+          continue;
+      }
+      if (!qf.is_range) {
+          col_match_[i].assign(ncols, COL_SOME);
+          continue;
+      }
+      exact_range_dims_ |= 1UL << dim;
+      const RangeSet& rset = range_filters[dim];
+      const std::vector<Scalar>& boundaries = index->partition_boundaries_[dim];
+      col_match_[i].resize(ncols);
+      for (int c = start_cols_[i]; c <= end_cols_[i]; c++) {
+          // Column c holds values in [boundaries[c], boundaries[c+1]), and the last column is
+          // unbounded.
+          Scalar lo = boundaries[c];
+          Scalar hi = c + 1 < (int)boundaries.size() ? boundaries[c+1] - 1 : SCALAR_MAX;
+          char m = COL_NONE;
+          if (hi != SCALAR_MAX && rset.Covers(lo, hi)) {
+              m = COL_ALL;
+          } else if (rset.Intersects(lo, hi)) {
+              m = COL_SOME;
+          }
+          col_match_[i][c - start_cols_[i]] = m;
+      }
+    }
+    for (int i = 0; i < last_; i++) {
+      cur_cols_[i] = NextCol(i, start_cols_[i] - 1);
+      finished_ |= cur_cols_[i] > end_cols_[i];
+    }
+    // All columns of the grid dims after the last queried one are returned with each column of
+    // the last queried dim.
+    for (size_t j = depth; j < index->grid_dims_order_.size(); j++) {
+        cells_per_col_ *= index->partition_boundaries_[index->grid_dims_order_[j]].size();
+    }
+  }
+
+ protected:
+  bool Refill(Ranges<PhysicalIndex>* ranges) override {
+    if (finished_ || cur_cols_[0] > end_cols_[0]) {
+        return false;
+    }
+    int start_cell_ix = index_->get_cell_number(cur_cols_);
+    bool prefix_exact = true;
+    for (int i = 0; i < last_; i++) {
+        prefix_exact &= Match(i, cur_cols_[i]) == COL_ALL;
+    }
+    // Columns of the last dim only match entirely if the columns of all other dims do too.
+    auto last_match = [&](int c) {
+        char m = Match(last_, c);
+        return prefix_exact || m != COL_ALL ? m : (char)COL_SOME;
+    };
+    // Return every run of columns in the last dim that match the same way as one range.
+    const std::vector<PhysicalIndex>& cell_boundaries = index_->cell_boundaries_;
+    int c = start_cols_[last_];
+    while (c <= end_cols_[last_]) {
+        char m = last_match(c);
+        int run_end = c + 1;
+        while (run_end <= end_cols_[last_] && last_match(run_end) == m) {
+            run_end++;
+        }
+        if (m != COL_NONE) {
+            PhysicalIndex start_pix = cell_boundaries[start_cell_ix + (c - start_cols_[last_]) * cells_per_col_];
+            PhysicalIndex end_pix = cell_boundaries[start_cell_ix + (run_end - start_cols_[last_]) * cells_per_col_];
+            if (end_pix > start_pix) {
+                ranges->emplace_back(start_pix, end_pix, m == COL_ALL);
+            }
+        }
+        c = run_end;
+    }
+    if (last_ == 0) {
+        finished_ = true;
+        return true;
+    }
+    // Don't need to increment the last item in cur_cols because they're returned as a group.
+    for (int i = last_ - 1; i >= 0; i--) {
+        cur_cols_[i] = NextCol(i, cur_cols_[i]);
+        if (cur_cols_[i] > end_cols_[i] && i > 0) {
+            cur_cols_[i] = NextCol(i, start_cols_[i] - 1);
+        } else {
+            break;
+        }
+    }
+    return true;
+  }
+
+ private:
+  // How every column in [start_cols_[i], end_cols_[i]] of each grid dim relates to the query's
+  // filter on that dim. Dims without a filter match everywhere; IN-lists are never treated as
+  // exact.
+  enum ColumnMatch : char { COL_NONE, COL_SOME, COL_ALL };
+
+  char Match(int i, int c) const {
+    return col_match_[i][c - start_cols_[i]];
+  }
+
+  // The next column after c that some points in the result may fall in.
+  int NextCol(int i, int c) const {
+    do {
+        c++;
+    } while (c <= end_cols_[i] && Match(i, c) == COL_NONE);
+    return c;
+  }
+
+  const FloodIndex<D>* index_;
+  // Stored in order of grid dimensions, not order of original dataset dims.
+  std::vector<int> start_cols_;
+  std::vector<int> end_cols_;
+  std::vector<int> cur_cols_;
+  std::vector<std::vector<char>> col_match_;
+  int last_;
+  int cells_per_col_;
+  bool finished_;
+};
+
 // Returns completed filled-out range structs.
 // Only returns non-empty query ranges.
 template <size_t D>
-Set<PhysicalIndex> FloodIndex<D>::IndexRanges(Query<D>& query) {
+Set<PhysicalIndex> FloodIndex<D>::IndexRanges(Query<D>& query) const {
+  return Cursor(query)->Drain();
+}
+
+template <size_t D>
+std::unique_ptr<RangeCursor> FloodIndex<D>::Cursor(Query<D>& query) const {
   int num_query_dims = 0;
   int num_query_dims_in_index = 0;
   // Treat trailing dims that aren't selected in the query as effectively
@@ -367,23 +503,32 @@ Set<PhysicalIndex> FloodIndex<D>::IndexRanges(Query<D>& query) {
   bool no_containment = (num_query_dims_in_index == 0);
   if (no_containment) {
       Ranges<PhysicalIndex> r {{0, cell_boundaries_.back()}};
-      Set<PhysicalIndex> full(r, List<PhysicalIndex>());
-      return full;
+      return std::make_unique<SetCursor>(Set<PhysicalIndex>(r, List<PhysicalIndex>()));
   }
 
-  // Translate Cortex queries to Flood queries.
+  // Translate Cortex queries to Flood queries. A filter with several ranges is searched over
+  // their hull; the columns that fall between the ranges are skipped by the cursor.
   Point<D> q_start, q_end;
+  std::vector<RangeSet> range_filters;
+  range_filters.reserve(D);
   for (int i = 0; i < D; i++) {
-    if (!query.filters[i].present) {
+    const QueryFilter& qf = query.filters[i];
+    range_filters.emplace_back(qf.present && qf.is_range ? qf.ranges : std::vector<ScalarRange>());
+    if (!qf.present) {
         q_start[i] = SCALAR_NINF;
         q_end[i] = SCALAR_PINF;
     } else {
-        if (query.filters[i].is_range) {
-            q_start[i] = query.filters[i].ranges[0].first;
-            q_end[i] = query.filters[i].ranges[0].second;
+        if (qf.is_range) {
+            const RangeSet& rset = range_filters.back();
+            if (rset.Size() == 0) {
+                // Nothing can match.
+                return std::make_unique<SetCursor>(Set<PhysicalIndex>());
+            }
+            q_start[i] = rset.At(0).first;
+            q_end[i] = rset.At(rset.Size() - 1).second;
         } else {
-            q_start[i] = query.filters[i].values[0];
-            q_end[i] = query.filters[i].values.back();
+            q_start[i] = qf.values[0];
+            q_end[i] = qf.values.back();
         }
     }
   }
@@ -391,46 +536,13 @@ Set<PhysicalIndex> FloodIndex<D>::IndexRanges(Query<D>& query) {
   // Initialize the range of columns in each *uniform* grid dimension.
   // Non-uniform grid dimensions will be processed per hypercell.
   // Stored in order of grid dimensions, not order of original dataset dims.
-  std::vector<int> cur_cols(effective_grid_depth);
   std::vector<int> start_cols(effective_grid_depth);
   std::vector<int> end_cols(effective_grid_depth);
-  int max_ranges = 1;
   for (int i = 0; i < effective_grid_depth; i++) {
     int dim = grid_dims_order_[i];
-    int start_col = get_column(q_start[dim], dim);
-    int end_col = get_column(q_end[dim], dim);
-    cur_cols[i] = start_col;
-    start_cols[i] = start_col;
-    end_cols[i] = end_col;
-    if (i < effective_grid_depth - 1) {
-        max_ranges *= end_col - start_col + 1;
-    }
-  }
-
-  Set<PhysicalIndex> ranges;
-  ranges.ranges.resize(max_ranges);
-  // Number of cells in the last dimension is the group returned.
-  int cells_per_range = end_cols[effective_grid_depth-1] - start_cols[effective_grid_depth-1] + 1;
-  for (int j = effective_grid_depth; j < grid_dims_order_.size(); j++) {
-      auto nc = partition_boundaries_[grid_dims_order_[j]];
-      cells_per_range *= nc.size();
-  }
-
-  while (cur_cols[0] <= end_cols[0]) {
-    int start_cell_ix = get_cell_number(cur_cols);
-    int end_cell_ix = start_cell_ix + cells_per_range;
-    PhysicalIndex start_pix = cell_boundaries_[start_cell_ix];
-    PhysicalIndex end_pix = cell_boundaries_[end_cell_ix];
-    ranges.ranges.emplace_back(start_pix, end_pix);
-    // Don't need to increment the last item in cur_cols because they're returned as a group.
-    for (int i = effective_grid_depth-2; i >= 0; i--) {
-        cur_cols[i] += 1;
-        if (cur_cols[i] > end_cols[i] && i > 0) {
-            cur_cols[i] = start_cols[i];
-        } else {
-            break;
-        }
-    }
+    // Values below the first boundary can't be in the index, so don't look left of column 0.
+    start_cols[i] = std::max(0, get_column(q_start[dim], dim));
+    end_cols[i] = get_column(q_end[dim], dim);
   }
 /*
   // Loop over all hypercells formed by non-uniform grids
@@ -528,7 +640,9 @@ Set<PhysicalIndex> FloodIndex<D>::IndexRanges(Query<D>& query) {
   LOG("num_projected_ranges", num_ranges);
 #endif
 */
-  return ranges;
+
+  return std::make_unique<GridCursor>(this, query, range_filters, std::move(start_cols),
+          std::move(end_cols));
 }
 
 template <size_t D>
@@ -0,0 +1,254 @@
+#include "group_by_visitor.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "utils.h"
+
+template <size_t D>
+GroupByVisitor<D>::GroupByVisitor(const std::vector<size_t>& key_columns,
+        const std::vector<Aggregate>& aggregates)
+    : key_columns_(key_columns), aggregates_(aggregates), slots_(64, 0),
+      gids_(ColumnBatch<D>::MAX_ROWS), direct_(MAX_DIRECT_SPAN, 0) {
+    AssertWithMessage(!key_columns_.empty() && key_columns_.size() <= D,
+            "GROUP BY needs between 1 and D key columns");
+    for (size_t c : key_columns_) {
+        AssertWithMessage(c < D, "GROUP BY key must be a data column");
+    }
+    for (const Aggregate& a : aggregates_) {
+        AssertWithMessage(a.op == COUNT || a.column < D, "Aggregate must be over a data column");
+    }
+}
+
+template <size_t D>
+uint64_t GroupByVisitor<D>::Hash(const Scalar* key, size_t n) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < n; i++) {
+        // splitmix64 finalizer over the running hash.
+        h ^= (uint64_t)key[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+template <size_t D>
+uint32_t GroupByVisitor<D>::FindOrInsert(const Scalar* key) {
+    const size_t nk = key_columns_.size();
+    const size_t mask = slots_.size() - 1;
+    size_t s = Hash(key, nk) & mask;
+    while (slots_[s] != 0) {
+        uint32_t g = slots_[s] - 1;
+        if (std::equal(key, key + nk, keys_.data() + g * nk)) {
+            return g;
+        }
+        s = (s + 1) & mask;
+    }
+    uint32_t g = num_groups_++;
+    keys_.insert(keys_.end(), key, key + nk);
+    for (const Aggregate& a : aggregates_) {
+        values_.push_back(a.op == MIN ? std::numeric_limits<Scalar>::max()
+                : a.op == MAX ? std::numeric_limits<Scalar>::lowest() : 0);
+    }
+    slots_[s] = g + 1;
+    // Keep the load factor under 1/2.
+    if (2 * num_groups_ > slots_.size()) {
+        Grow();
+    }
+    return g;
+}
+
+template <size_t D>
+void GroupByVisitor<D>::Grow() {
+    const size_t nk = key_columns_.size();
+    slots_.assign(2 * slots_.size(), 0);
+    const size_t mask = slots_.size() - 1;
+    for (uint32_t g = 0; g < num_groups_; g++) {
+        size_t s = Hash(keys_.data() + g * nk, nk) & mask;
+        while (slots_[s] != 0) {
+            s = (s + 1) & mask;
+        }
+        slots_[s] = g + 1;
+    }
+}
+
+template <size_t D>
+void GroupByVisitor<D>::Update(size_t a, const Scalar* vals, const uint16_t* rows, size_t n,
+        const uint32_t* gids, int64_t single_gid) {
+    const size_t na = aggregates_.size();
+    AggregateOp op = aggregates_[a].op;
+    if (single_gid >= 0) {
+        Scalar& v = values_[single_gid * na + a];
+        switch (op) {
+            case COUNT:
+                v += n;
+                break;
+            case SUM:
+                for (size_t i = 0; i < n; i++) {
+                    v += vals[rows[i]];
+                }
+                break;
+            case MIN:
+                for (size_t i = 0; i < n; i++) {
+                    v = std::min(v, vals[rows[i]]);
+                }
+                break;
+            case MAX:
+                for (size_t i = 0; i < n; i++) {
+                    v = std::max(v, vals[rows[i]]);
+                }
+                break;
+        }
+        return;
+    }
+    Scalar* values = values_.data() + a;
+    switch (op) {
+        case COUNT:
+            for (size_t i = 0; i < n; i++) {
+                values[gids[i] * na] += 1;
+            }
+            break;
+        case SUM:
+            for (size_t i = 0; i < n; i++) {
+                values[gids[i] * na] += vals[rows[i]];
+            }
+            break;
+        case MIN:
+            for (size_t i = 0; i < n; i++) {
+                Scalar& v = values[gids[i] * na];
+                v = std::min(v, vals[rows[i]]);
+            }
+            break;
+        case MAX:
+            for (size_t i = 0; i < n; i++) {
+                Scalar& v = values[gids[i] * na];
+                v = std::max(v, vals[rows[i]]);
+            }
+            break;
+    }
+}
+
+template <size_t D>
+void GroupByVisitor<D>::visit(const PointRef<D>& p) {
+    Scalar key[D];
+    for (size_t k = 0; k < key_columns_.size(); k++) {
+        key[k] = p.dataset->GetCoord(p.idx, key_columns_[k]);
+    }
+    uint32_t g = FindOrInsert(key);
+    for (size_t a = 0; a < aggregates_.size(); a++) {
+        uint16_t row = 0;
+        Scalar val = aggregates_[a].op == COUNT ? 0 : p.dataset->GetCoord(p.idx, aggregates_[a].column);
+        Update(a, &val, &row, 1, nullptr, g);
+    }
+}
+
+template <size_t D>
+void GroupByVisitor<D>::visitBatch(ColumnBatch<D>& batch) {
+    this->scanned_points_ += batch.End() - batch.Start();
+    const size_t n = batch.Count();
+    if (n == 0) {
+        return;
+    }
+    const Dataset<D>* dataset = batch.GetDataset();
+    const uint16_t* sel = batch.Selection();
+    const size_t nk = key_columns_.size();
+
+    // Engine batches never span blocks, so the bounds of the first row hold for the whole batch.
+    bool constant = true;
+    Scalar min = 0, max = 0;
+    Scalar key[D];
+    for (size_t k = 0; k < nk; k++) {
+        if (!dataset->BlockBounds(batch.Start(), key_columns_[k], &min, &max) || min != max) {
+            constant = false;
+            break;
+        }
+        key[k] = min;
+    }
+
+    int64_t single_gid = -1;
+    if (constant) {
+        single_gid = FindOrInsert(key);
+    } else if (nk == 1 && dataset->BlockBounds(batch.Start(), key_columns_[0], &min, &max)
+            && (uint64_t)max - (uint64_t)min < (uint64_t)MAX_DIRECT_SPAN) {
+        // Unsigned, since the span of widely spread keys overflows a Scalar.
+        const Scalar* keys = batch.Column(key_columns_[0]);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t& slot = direct_[(uint64_t)keys[sel[i]] - (uint64_t)min];
+            if (slot == 0) {
+                slot = FindOrInsert(&keys[sel[i]]) + 1;
+            }
+            gids_[i] = slot - 1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            direct_[(uint64_t)keys[sel[i]] - (uint64_t)min] = 0;
+        }
+    } else {
+        const Scalar* cols[D];
+        for (size_t k = 0; k < nk; k++) {
+            cols[k] = batch.Column(key_columns_[k]);
+        }
+        for (size_t i = 0; i < n; i++) {
+            for (size_t k = 0; k < nk; k++) {
+                key[k] = cols[k][sel[i]];
+            }
+            gids_[i] = FindOrInsert(key);
+        }
+    }
+
+    for (size_t a = 0; a < aggregates_.size(); a++) {
+        const Scalar* vals = aggregates_[a].op == COUNT ? nullptr : batch.Column(aggregates_[a].column);
+        Update(a, vals, sel, n, gids_.data(), single_gid);
+    }
+}
+
+template <size_t D>
+void GroupByVisitor<D>::Merge(const Visitor<D>& other) {
+    Visitor<D>::Merge(other);
+    const auto& o = static_cast<const GroupByVisitor<D>&>(other);
+    const size_t nk = key_columns_.size();
+    const size_t na = aggregates_.size();
+    for (size_t g = 0; g < o.num_groups_; g++) {
+        uint32_t mine = FindOrInsert(o.keys_.data() + g * nk);
+        for (size_t a = 0; a < na; a++) {
+            Scalar& v = values_[mine * na + a];
+            Scalar w = o.values_[g * na + a];
+            switch (aggregates_[a].op) {
+                case COUNT:
+                case SUM:
+                    v += w;
+                    break;
+                case MIN:
+                    v = std::min(v, w);
+                    break;
+                case MAX:
+                    v = std::max(v, w);
+                    break;
+            }
+        }
+    }
+}
+
+template <size_t D>
+std::string GroupByVisitor<D>::CacheKey() const {
+    std::string key = "groupby";
+    for (size_t c : key_columns_) {
+        key += ":" + std::to_string(c);
+    }
+    for (const Aggregate& a : aggregates_) {
+        key += ":" + std::to_string(a.op) + "." + std::to_string(a.op == COUNT ? 0 : a.column);
+    }
+    return key;
+}
+
+template <size_t D>
+std::map<std::vector<Scalar>, std::vector<Scalar>> GroupByVisitor<D>::Result() const {
+    const size_t nk = key_columns_.size();
+    const size_t na = aggregates_.size();
+    std::map<std::vector<Scalar>, std::vector<Scalar>> result;
+    for (size_t g = 0; g < num_groups_; g++) {
+        result.emplace(std::vector<Scalar>(keys_.begin() + g * nk, keys_.begin() + (g + 1) * nk),
+                std::vector<Scalar>(values_.begin() + g * na, values_.begin() + (g + 1) * na));
+    }
+    return result;
+}
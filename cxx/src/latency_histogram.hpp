@@ -0,0 +1,82 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+inline LatencyHistogram::LatencyHistogram()
+    : buckets_((64 - PRECISION_BITS + 1) * SUB_BUCKETS, 0) {
+    Reset();
+}
+
+inline size_t LatencyHistogram::BucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    // Drop the low bits so that the value falls in [SUB_BUCKETS, 2 * SUB_BUCKETS).
+    size_t shift = 63 - __builtin_clzl(value) - PRECISION_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+}
+
+inline uint64_t LatencyHistogram::BucketTop(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t shift = bucket / SUB_BUCKETS - 1;
+    uint64_t mantissa = bucket % SUB_BUCKETS + SUB_BUCKETS;
+    // Wraps around to the largest uint64_t for the very last bucket.
+    return ((mantissa + 1) << shift) - 1;
+}
+
+inline void LatencyHistogram::Record(uint64_t value) {
+    buckets_[BucketOf(value)]++;
+    count_++;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    sum_ += value;
+}
+
+inline void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < buckets_.size(); i++) {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    sum_ += other.sum_;
+}
+
+inline void LatencyHistogram::Reset() {
+    std::fill(buckets_.begin(), buckets_.end(), 0);
+    count_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+    sum_ = 0;
+}
+
+inline uint64_t LatencyHistogram::Percentile(double percentile) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    percentile = std::min(100.0, std::max(0.0, percentile));
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t) std::ceil(percentile / 100 * count_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets_.size(); i++) {
+        seen += buckets_[i];
+        if (seen >= rank) {
+            return std::min(BucketTop(i), max_);
+        }
+    }
+    return max_;
+}
+
+inline void LatencyHistogram::WriteJson(std::ostream& out) const {
+    out << "{\"count\": " << Count()
+        << ", \"min\": " << Min()
+        << ", \"mean\": " << Mean()
+        << ", \"p50\": " << Percentile(50)
+        << ", \"p90\": " << Percentile(90)
+        << ", \"p99\": " << Percentile(99)
+        << ", \"p999\": " << Percentile(99.9)
+        << ", \"max\": " << Max() << "}";
+}
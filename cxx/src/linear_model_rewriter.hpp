@@ -49,7 +49,7 @@ void LinearModelRewriter<D>::Init(ConstPointIterator<D> start, ConstPointIterato
 }
 
 template <size_t D>
-ScalarRange LinearModelRewriter<D>::RangeFor(Scalar val) {
+ScalarRange LinearModelRewriter<D>::RangeFor(Scalar val) const {
     double offset = linear_coeffs_.second > 0 ? model_offset_ : -model_offset_;
     double tstart = linear_coeffs_.first + linear_coeffs_.second * val - offset;
     double tend = linear_coeffs_.first + linear_coeffs_.second * val + offset;
@@ -61,7 +61,7 @@ ScalarRange LinearModelRewriter<D>::RangeFor(Scalar val) {
 }
 
 template <size_t D>
-List<Key> LinearModelRewriter<D>::Rewrite(Query<D>& q) {
+List<Key> LinearModelRewriter<D>::Rewrite(Query<D>& q) const {
     if (!q.filters[mapped_dim_].present) {
         return {};
     }
@@ -1,5 +1,6 @@
 #include "mapped_correlation_index.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <fstream>
@@ -9,6 +10,7 @@
 #include "types.h"
 #include "file_utils.h"
 #include "merge_utils.h"
+#include "trace.h"
 
 template <size_t D>
 MappedCorrelationIndex<D>::MappedCorrelationIndex(const std::string& mapping_filename,
@@ -155,7 +157,7 @@ Ranges<Key> MappedCorrelationIndex<D>::KeyRanges(const Query<D>& q) const {
     for (auto r : ranges) {
         std::cout << "\t" << r.start << " - " << r.end << std::endl;
     }*/
-    std::cout << "Mapping query to " << range_ixs.size() << " ranges" << std::endl;
+    TRACE_COUNT(MappedTargetBuckets, range_ixs.size());
     // Merge with bucket list.
 
     Ranges<Key> ranges;
@@ -178,6 +180,29 @@ Ranges<Key> MappedCorrelationIndex<D>::KeyRanges(const Query<D>& q) const {
 
 }
 
+template <size_t D>
+size_t MappedCorrelationIndex<D>::EstimateKeys(const Query<D>& q) const {
+    if (!q.filters[column_].present) {
+        return data_size_;
+    }
+    if (target_buckets_.empty()) {
+        return 0;
+    }
+    ScalarRange sr = q.filters[column_].ranges[0];
+    // Same buckets as in KeyRanges. Target buckets reached from more than one mapped bucket are
+    // counted more than once.
+    auto startit = mapping_lst_.upper_bound({sr.first, sr.first});
+    auto endit = mapping_lst_.lower_bound({sr.second, sr.second});
+    if (endit != mapping_lst_.end()) {
+        endit++;
+    }
+    size_t num_targets = 0;
+    for (auto it = startit; it != endit; it++) {
+        num_targets += it->second.size();
+    }
+    return std::min(data_size_, num_targets * data_size_ / target_buckets_.size());
+}
+
 template <size_t D>
 void MappedCorrelationIndex<D>::AddBucket(int32_t map_bucket, int32_t target_bucket) {
     ScalarRange r = mapped_buckets_[map_bucket];
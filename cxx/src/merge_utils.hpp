@@ -6,6 +6,12 @@
 
 template <typename T>
 Ranges<T> MergeUtils::Intersect(const Ranges<T>& first, const Ranges<T>& second) {
+    return Intersect(first, second, false, false);
+}
+
+template <typename T>
+Ranges<T> MergeUtils::Intersect(const Ranges<T>& first, const Ranges<T>& second,
+        bool first_exact, bool second_exact) {
     // Assumes both ranges are already sorted.
     if (first.empty() || second.empty()) {
         return {};
@@ -55,6 +61,8 @@ Ranges<T> MergeUtils::Intersect(const Ranges<T>& first, const Ranges<T>& second)
             assert (!in_range);
             in_range = true;
             cur_range.start = popped;
+            // Both first[i] and second[j] are open here.
+            cur_range.exact = (first_exact || first[i].exact) && (second_exact || second[j].exact);
         } else if (in_range) {
             assert (count == 1);
             cur_range.end = popped;
@@ -181,7 +189,13 @@ Set<T> MergeUtils::Intersect(const Set<T>& set1, const Set<T>& set2) {
         }
     }
     final_list.shrink_to_fit();
-    return { MergeUtils::Intersect(set1.ranges, set2.ranges), final_list };
+    // A set that doesn't use exact ranges shouldn't make the other set's exact ranges inexact.
+    Set<T> result(MergeUtils::Intersect(set1.ranges, set2.ranges,
+                set1.exact_range_dims == 0, set2.exact_range_dims == 0), final_list);
+    // Points in both sets match the filters guaranteed by either of them.
+    result.guaranteed_dims = set1.guaranteed_dims | set2.guaranteed_dims;
+    result.exact_range_dims = set1.exact_range_dims | set2.exact_range_dims;
+    return result;
 }
 
 template <typename T>
@@ -265,7 +279,9 @@ std::vector<ScalarRange> MergeUtils::Coalesce(ForwardIterator begin, ForwardIter
             cur_range = {it->first, it->second};
         }
     }
-    ranges.push_back(cur_range);
+    if (cur_range.second > cur_range.first) {
+        ranges.push_back(cur_range);
+    }
     return ranges;
 }
 
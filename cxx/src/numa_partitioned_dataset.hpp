@@ -0,0 +1,174 @@
+#include "numa_partitioned_dataset.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "numa_utils.h"
+
+template <size_t D>
+NumaPartitionedDataset<D>::NumaPartitionedDataset(const std::vector<Point<D>>& data,
+        const std::vector<Datacube<D>>& cubes, size_t num_nodes) {
+    if (num_nodes == 0) {
+        num_nodes = NumaUtils::NumNodes();
+    }
+    const size_t block = 1UL << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+    size_t blocks = (data.size() + block - 1) / block;
+    slice_rows_ = std::max((size_t)1, (blocks + num_nodes - 1) / num_nodes) * block;
+    for (size_t start = 0; start < data.size() || starts_.empty(); start += slice_rows_) {
+        starts_.push_back(start);
+        nodes_.push_back((starts_.size() - 1) % NumaUtils::NumNodes());
+    }
+    starts_.push_back(data.size());
+    slices_.resize(nodes_.size());
+
+    // Pages are placed on the node of the thread that touches them first, so every slice is
+    // copied, encoded and compressed on its own node.
+    std::vector<std::thread> builders;
+    for (size_t s = 0; s < slices_.size(); s++) {
+        builders.emplace_back([this, s, &data, &cubes] {
+            NumaUtils::BindToNode(nodes_[s]);
+            std::vector<Point<D>> slice(data.begin() + starts_[s], data.begin() + starts_[s + 1]);
+            slices_[s] = std::make_unique<CompressedColumnOrderDataset<D>>(slice, cubes);
+        });
+    }
+    for (auto& b : builders) {
+        b.join();
+    }
+    std::cout << "Partitioned " << data.size() << " points over " << slices_.size()
+        << " NUMA nodes" << std::endl;
+}
+
+template <size_t D>
+template <typename F>
+uint64_t NumaPartitionedDataset<D>::SplitMask(size_t start, size_t end, F f) const {
+    size_t s = SliceOf(start);
+    size_t boundary = starts_[s + 1];
+    if (end <= boundary) {
+        return f(*slices_[s], start - starts_[s], end - starts_[s]);
+    }
+    // Bits are in order from the most significant one, so the first slice's bits go on top.
+    uint64_t first = f(*slices_[s], start - starts_[s], boundary - starts_[s]);
+    uint64_t second = f(*slices_[s + 1], 0, end - boundary);
+    return (first << (end - boundary)) | second;
+}
+
+template <size_t D>
+Point<D> NumaPartitionedDataset<D>::Get(size_t i) const {
+    size_t s = SliceOf(i);
+    return slices_[s]->Get(i - starts_[s]);
+}
+
+template <size_t D>
+Scalar NumaPartitionedDataset<D>::GetCoord(size_t index, size_t dim) const {
+    size_t s = SliceOf(index);
+    return slices_[s]->GetCoord(index - starts_[s], dim);
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::GetCoordRange(size_t start, size_t end, size_t dim,
+        Scalar lower, Scalar upper) const {
+    return SplitMask(start, end, [=](const CompressedColumnOrderDataset<D>& slice, size_t s, size_t e) {
+        return slice.GetCoordRange(s, e, dim, lower, upper);
+    });
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::GetCoordInRange(size_t start, size_t end, size_t dim,
+        Scalar low, Scalar high) const {
+    return SplitMask(start, end, [=](const CompressedColumnOrderDataset<D>& slice, size_t s, size_t e) {
+        return slice.GetCoordInRange(s, e, dim, low, high);
+    });
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::GetCoordInRanges(size_t start, size_t end, size_t dim,
+        const RangeSet& rset) const {
+    return SplitMask(start, end, [&](const CompressedColumnOrderDataset<D>& slice, size_t s, size_t e) {
+        return slice.GetCoordInRanges(s, e, dim, rset);
+    });
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::GetCoordInSet(size_t start, size_t end, size_t dim,
+        const std::unordered_set<Scalar>& vset) const {
+    return SplitMask(start, end, [&](const CompressedColumnOrderDataset<D>& slice, size_t s, size_t e) {
+        return slice.GetCoordInSet(s, e, dim, vset);
+    });
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::GetCoordInSet(size_t start, size_t end, size_t dim,
+        const ValueSet& vset) const {
+    return SplitMask(start, end, [&](const CompressedColumnOrderDataset<D>& slice, size_t s, size_t e) {
+        return slice.GetCoordInSet(s, e, dim, vset);
+    });
+}
+
+template <size_t D>
+void NumaPartitionedDataset<D>::DecodeRange(size_t start, size_t end, size_t dim,
+        Scalar* out) const {
+    size_t s = SliceOf(start);
+    size_t boundary = std::min(end, starts_[s + 1]);
+    slices_[s]->DecodeRange(start - starts_[s], boundary - starts_[s], dim, out);
+    if (boundary < end) {
+        slices_[s + 1]->DecodeRange(0, end - boundary, dim, out + (boundary - start));
+    }
+}
+
+template <size_t D>
+void NumaPartitionedDataset<D>::GetRangeValues(size_t start, size_t end, size_t dim,
+        uint64_t valids, std::vector<Scalar> *results) const {
+    size_t s = SliceOf(start);
+    size_t boundary = std::min(end, starts_[s + 1]);
+    size_t rest = end - boundary;
+    if (boundary > start) {
+        slices_[s]->GetRangeValues(start - starts_[s], boundary - starts_[s], dim,
+                rest == 0 ? valids : valids >> rest, results);
+    }
+    if (rest > 0) {
+        slices_[s + 1]->GetRangeValues(0, rest, dim, valids & ((1UL << rest) - 1), results);
+    }
+}
+
+template <size_t D>
+Scalar NumaPartitionedDataset<D>::GetRangeSum(size_t start, size_t end, size_t dim,
+        uint64_t valids) const {
+    size_t s = SliceOf(start);
+    size_t boundary = std::min(end, starts_[s + 1]);
+    size_t rest = end - boundary;
+    Scalar sum = 0;
+    if (boundary > start) {
+        sum += slices_[s]->GetRangeSum(start - starts_[s], boundary - starts_[s], dim,
+                rest == 0 ? valids : valids >> rest);
+    }
+    if (rest > 0) {
+        sum += slices_[s + 1]->GetRangeSum(0, rest, dim, valids & ((1UL << rest) - 1));
+    }
+    return sum;
+}
+
+template <size_t D>
+bool NumaPartitionedDataset<D>::GetExactRangeSum(size_t start, size_t end, size_t dim,
+        Scalar* sum) const {
+    *sum = 0;
+    for (size_t s = SliceOf(start); s < slices_.size() && starts_[s] < end; s++) {
+        Scalar part;
+        size_t lo = std::max(start, starts_[s]);
+        size_t hi = std::min(end, starts_[s + 1]);
+        if (!slices_[s]->GetExactRangeSum(lo - starts_[s], hi - starts_[s], dim, &part)) {
+            return false;
+        }
+        *sum += part;
+    }
+    return true;
+}
+
+template <size_t D>
+uint64_t NumaPartitionedDataset<D>::SizeInBytes() const {
+    uint64_t size = 0;
+    for (const auto& slice : slices_) {
+        size += slice->SizeInBytes();
+    }
+    return size;
+}
@@ -0,0 +1,51 @@
+#include "numa_utils.h"
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+
+inline thread_local int NumaUtils::bound_node_ = -1;
+
+inline size_t NumaUtils::NumNodes() {
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        return numa_num_configured_nodes();
+    }
+#endif
+    return 1;
+}
+
+inline void NumaUtils::BindToNode(int node) {
+    if (node == bound_node_) {
+        return;
+    }
+    bound_node_ = node;
+#ifdef HAVE_LIBNUMA
+    if (numa_available() < 0) {
+        return;
+    }
+    // -1 lets the thread run anywhere again.
+    numa_run_on_node(node);
+    numa_set_localalloc();
+#endif
+}
+
+inline void NumaUtils::InterleaveAllocations() {
+    // Not a binding to a single node, so the next BindToNode always takes effect.
+    bound_node_ = -2;
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        numa_set_interleave_mask(numa_all_nodes_ptr);
+    }
+#endif
+}
+
+inline int NumaUtils::CurrentNode() {
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0) {
+        return numa_node_of_cpu(sched_getcpu());
+    }
+#endif
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <set>
 #include <stack>
 #include "octree_index.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -202,62 +203,105 @@ bool OctreeIndex<D>::Init(PointIterator<D> data_start, PointIterator<D> data_end
 }
 
 template <size_t D>
-bool OctreeIndex<D>::is_relevant_node(std::shared_ptr<Node> node, const Query<D>& query) const {
+bool OctreeIndex<D>::is_relevant_node(std::shared_ptr<Node> node, const Query<D>& query,
+        const std::vector<RangeSet>& filters) const {
     for (size_t i = 0; i < index_dims_.size(); i++) {
-        QueryFilter qf = query.filters[index_dims_[i]];
+        const QueryFilter& qf = query.filters[index_dims_[i]];
         if (!qf.present) {
             continue;
         }
         assert (qf.is_range);
-        // This means that the range on this dimension is empty.
-        if (qf.ranges.size() == 0 || qf.ranges[0].first > qf.ranges[0].second) {
+        // Also false if the filter on this dimension is empty.
+        if (!filters[i].Intersects(node->mins[i], node->maxs[i])) {
             return false;
         }
-        if (qf.ranges[0].first > node->maxs[i] || qf.ranges[0].second < node->mins[i]) {
+    }
+    return true;
+}
+
+template <size_t D>
+bool OctreeIndex<D>::is_contained_node(std::shared_ptr<Node> node, const Query<D>& query,
+        const std::vector<RangeSet>& filters) const {
+    for (size_t i = 0; i < index_dims_.size(); i++) {
+        if (query.filters[index_dims_[i]].present && !filters[i].Covers(node->mins[i], node->maxs[i])) {
             return false;
         }
     }
     return true;
 }
 
-
 template <size_t D>
-Set<PhysicalIndex> OctreeIndex<D>::IndexRanges(Query<D> &query) {
-    Ranges<PhysicalIndex> ranges;
-    bool index_relevant = false;
-    for (size_t dim : index_dims_) {
-        index_relevant |= query.filters[dim].present;
-    }
-    if (!index_relevant) {
-        std::cout << "Index is not relevant...returning full scan" << std::endl;
-        return {{{0, data_size_}}, {}};
-    }
-    std::cout << "Index is relevant" << std::endl;
-    std::stack<std::shared_ptr<Node>> node_stack;
-    node_stack.push(root_node);
-    size_t indexes_scanned = 0;
-    while (!node_stack.empty()) {
-        std::shared_ptr<Node> cur = node_stack.top();
-        node_stack.pop();
-        if (!is_relevant_node(cur, query)) {
-            continue;
+class OctreeIndex<D>::TreeCursor : public BufferedRangeCursor {
+  public:
+    TreeCursor(const OctreeIndex<D>* index, const Query<D>& query)
+        : BufferedRangeCursor(), index_(index), query_(query), filters_(), node_stack_() {
+        filters_.reserve(index->index_dims_.size());
+        for (size_t dim : index->index_dims_) {
+            const QueryFilter& qf = query.filters[dim];
+            filters_.emplace_back(qf.present ? qf.ranges : std::vector<ScalarRange>());
+            if (qf.present) {
+                exact_range_dims_ |= 1UL << dim;
+            }
         }
-        if (cur->children.empty()) {
-            // this node is a leaf
-            // TODO: add code here if we're sorting.
-            if (cur->end_offset > cur->start_offset) {
-                ranges.emplace_back(cur->start_offset, cur->end_offset);
+        node_stack_.push(index->root_node);
+    }
+
+  protected:
+    // Descends until the next node whose points are returned.
+    bool Refill(Ranges<PhysicalIndex>* ranges) override {
+        while (!node_stack_.empty()) {
+            std::shared_ptr<Node> cur = node_stack_.top();
+            node_stack_.pop();
+            if (!index_->is_relevant_node(cur, query_, filters_)) {
+                continue;
+            }
+            bool contained = index_->is_contained_node(cur, query_, filters_);
+            if (cur->children.empty() || contained) {
+                // This node is a leaf, or all of its points match: the points under a node are
+                // contiguous, so there's no need to descend.
+                // TODO: add code here if we're sorting.
+                if (cur->end_offset > cur->start_offset) {
+                    if (!ranges->empty() && ranges->back().end == cur->start_offset
+                            && ranges->back().exact == contained) {
+                        ranges->back().end = cur->end_offset;
+                    } else {
+                        ranges->emplace_back(cur->start_offset, cur->end_offset, contained);
+                    }
+                }
+                return true;
             }
-            indexes_scanned += cur->end_offset - cur->start_offset;
-        } else {
             for (auto it = cur->children.rbegin(); it != cur->children.rend(); it++) {
                 if (*it != nullptr) {
-                    node_stack.push(*it);
+                    node_stack_.push(*it);
                 }
             }
         }
+        return false;
+    }
+
+  private:
+    const OctreeIndex<D>* index_;
+    const Query<D>& query_;
+    std::vector<RangeSet> filters_;
+    std::stack<std::shared_ptr<Node>> node_stack_;
+};
+
+template <size_t D>
+std::unique_ptr<RangeCursor> OctreeIndex<D>::Cursor(Query<D> &query) const {
+    bool index_relevant = false;
+    for (size_t dim : index_dims_) {
+        index_relevant |= query.filters[dim].present;
     }
-    return {ranges, {}};
+    if (!index_relevant) {
+        TRACE_COUNT(FullScanFallbacks, 1);
+        return std::make_unique<SetCursor>(Set<PhysicalIndex>({{0, data_size_}}, {}));
+    }
+    return std::make_unique<TreeCursor>(this, query);
+}
+
+template <size_t D>
+Set<PhysicalIndex> OctreeIndex<D>::IndexRanges(Query<D> &query) const {
+    return Cursor(query)->Drain();
 }
 
 template <size_t D>
@@ -7,6 +7,7 @@
 #include <string>
 #include <iostream>
 
+#include "trace.h"
 #include "types.h"
 
 template <size_t D>
@@ -26,7 +27,7 @@ void OutlierIndex<D>::SetOutlierIndexer(std::unique_ptr<PrimaryIndexer<D>> index
 }
 
 template <size_t D>
-Set<PhysicalIndex> OutlierIndex<D>::IndexRanges(Query<D>& q) {
+Set<PhysicalIndex> OutlierIndex<D>::IndexRanges(Query<D>& q) const {
     bool relevant = false;
     for (size_t col : this->columns_) {
         relevant |= q.filters[col].present;
@@ -34,7 +35,7 @@ Set<PhysicalIndex> OutlierIndex<D>::IndexRanges(Query<D>& q) {
     // If the primary indexer is useless, just return the full range. Since outliers are small,
     // there's not much the outlier index will be able to do.
     if (!relevant) {
-        std::cout << "Outlier index not relevant" << std::endl;
+        TRACE_COUNT(FullScanFallbacks, 1);
         return Set<PhysicalIndex>({{0, data_size_}}, List<PhysicalIndex>());
     }
     auto ix_set = main_indexer_->IndexRanges(q);
@@ -56,6 +57,32 @@ Set<PhysicalIndex> OutlierIndex<D>::IndexRanges(Query<D>& q) {
     return ix_set;
 }
 
+template <size_t D>
+std::unique_ptr<RangeCursor> OutlierIndex<D>::Cursor(Query<D>& q) const {
+    bool relevant = false;
+    for (size_t col : this->columns_) {
+        relevant |= q.filters[col].present;
+    }
+    if (!relevant) {
+        TRACE_COUNT(FullScanFallbacks, 1);
+        return std::make_unique<SetCursor>(
+                Set<PhysicalIndex>({{0, data_size_}}, List<PhysicalIndex>()));
+    }
+    std::unique_ptr<RangeCursor> main = main_indexer_->Cursor(q);
+    std::unique_ptr<RangeCursor> outliers;
+    if (outlier_indexer_) {
+        outliers = std::make_unique<OffsetCursor>(outlier_indexer_->Cursor(q), outlier_start_ix_);
+    } else if (outlier_start_ix_ < data_size_) {
+        outliers = std::make_unique<SetCursor>(
+                Set<PhysicalIndex>({{outlier_start_ix_, data_size_}}, List<PhysicalIndex>()));
+    } else {
+        return main;
+    }
+    // The outliers are stored after all other points, so this returns the ranges of the main
+    // index first.
+    return std::make_unique<UnionCursor>(std::move(main), std::move(outliers));
+}
+
 template <size_t D>
 bool OutlierIndex<D>::Init(PointIterator<D> start, PointIterator<D> end) {
     std::sort(outlier_list_.begin(), outlier_list_.end());
@@ -30,44 +30,108 @@ Range<PhysicalIndex> PrimaryBTreeIndex<D>::PageRangeFor(Scalar start, Scalar end
         // Otherwise, include the whole page.
         r.start = p.index_range.first;
     }
-    r.end = pages_.upper_bound(end)->second.index_range.first; 
+    auto endit = pages_.upper_bound(end);
+    // Past the last page, the range extends to the end of the data.
+    r.end = endit == pages_.end() ? data_size_ : endit->second.index_range.first;
     return r;
 }
 
 template <size_t D>
-Set<PhysicalIndex> PrimaryBTreeIndex<D>::IndexRanges(Query<D>& q) {
-    auto accessed = q.filters[column_];
-    if (!accessed.present || pages_.empty()) {
-        // No actionable filter on the data, so scan everything.
-        return Set<PhysicalIndex>({{0, data_size_}}, List<PhysicalIndex>());
+Range<PhysicalIndex> PrimaryBTreeIndex<D>::ExactPageRangeFor(Scalar start, Scalar end) const {
+    if (end <= start) {
+        return Range<PhysicalIndex>();
     }
-    Ranges<PhysicalIndex> ranges;
-    if (accessed.is_range) {
-        ranges.reserve(accessed.ranges.size());
-        size_t added = 0;
-        for (ScalarRange r : accessed.ranges) {
-            const Range<PhysicalIndex> pr = PageRangeFor(r.first, r.second);
-            if (added > 0 && pr.start == ranges[added-1].end) {
-                ranges[added-1].end = pr.end;
-            } else if (pr.end > pr.start) {
-                ranges.push_back(pr);
-                added++;
-            }
+    // First page that starts at or after `start`.
+    auto firstit = pages_.lower_bound(start);
+    // Last page that starts before `end`.
+    auto lastit = pages_.lower_bound(end);
+    if (firstit == pages_.end() || lastit == pages_.begin()) {
+        return Range<PhysicalIndex>();
+    }
+    lastit--;
+    PhysicalIndex r_start = firstit->second.index_range.first;
+    PhysicalIndex r_end = lastit->second.value_range.second < end
+        ? lastit->second.index_range.second : lastit->second.index_range.first;
+    if (r_end <= r_start) {
+        return Range<PhysicalIndex>();
+    }
+    return Range<PhysicalIndex>(r_start, r_end, true);
+}
+
+template <size_t D>
+void PrimaryBTreeIndex<D>::AddRangesFor(const Range<PhysicalIndex>& pr, Scalar start, Scalar end,
+        Ranges<PhysicalIndex>* ranges) const {
+    auto add = [ranges](PhysicalIndex s, PhysicalIndex e, bool exact) {
+        // Neighboring filter ranges can share a page; don't return it twice.
+        if (!ranges->empty()) {
+            s = std::max(s, ranges->back().end);
         }
-    } else {
-        ranges.reserve(accessed.values.size());
-        size_t added = 0;
-        for (Scalar val : accessed.values) {
-            const Range<PhysicalIndex> pr = PageRangeFor(val, val);
-            if (added > 0 && pr.start == ranges[added-1].end) {
-                ranges[added-1].end = pr.end;
-            } else if (pr.end > pr.start) {
-                ranges.push_back(pr);
-                added++;
+        if (e <= s) {
+            return;
+        }
+        if (!ranges->empty() && ranges->back().end == s && ranges->back().exact == exact) {
+            ranges->back().end = e;
+        } else {
+            ranges->emplace_back(s, e, exact);
+        }
+    };
+    const Range<PhysicalIndex> exact = ExactPageRangeFor(start, end);
+    if (exact.end <= exact.start) {
+        add(pr.start, pr.end, false);
+        return;
+    }
+    add(pr.start, exact.start, false);
+    add(exact.start, exact.end, true);
+    add(exact.end, pr.end, false);
+}
+
+template <size_t D>
+class PrimaryBTreeIndex<D>::PageCursor : public BufferedRangeCursor {
+  public:
+    PageCursor(const PrimaryBTreeIndex<D>* index, const QueryFilter* filter)
+        : BufferedRangeCursor(), index_(index), filter_(filter), next_(0) {
+        exact_range_dims_ = 1UL << index->column_;
+    }
+
+  protected:
+    bool Refill(Ranges<PhysicalIndex>* ranges) override {
+        if (filter_->is_range) {
+            if (next_ == filter_->ranges.size()) {
+                return false;
+            }
+            const ScalarRange& r = filter_->ranges[next_++];
+            index_->AddRangesFor(index_->PageRangeFor(r.first, r.second), r.first, r.second, ranges);
+        } else {
+            if (next_ == filter_->values.size()) {
+                return false;
             }
+            Scalar val = filter_->values[next_++];
+            index_->AddRangesFor(index_->PageRangeFor(val, val), val, val + 1, ranges);
         }
+        return true;
     }
-    return Set<PhysicalIndex>(ranges, List<PhysicalIndex>());
+
+  private:
+    const PrimaryBTreeIndex<D>* index_;
+    const QueryFilter* filter_;
+    // The position of the next filter range (or value) to look up.
+    size_t next_;
+};
+
+template <size_t D>
+std::unique_ptr<RangeCursor> PrimaryBTreeIndex<D>::Cursor(Query<D>& q) const {
+    const QueryFilter& accessed = q.filters[column_];
+    if (!accessed.present || pages_.empty()) {
+        // No actionable filter on the data, so scan everything.
+        return std::make_unique<SetCursor>(
+                Set<PhysicalIndex>({{0, data_size_}}, List<PhysicalIndex>()));
+    }
+    return std::make_unique<PageCursor>(this, &accessed);
+}
+
+template <size_t D>
+Set<PhysicalIndex> PrimaryBTreeIndex<D>::IndexRanges(Query<D>& q) const {
+    return Cursor(q)->Drain();
 }
 
 template <size_t D>
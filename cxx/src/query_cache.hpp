@@ -0,0 +1,86 @@
+#include "query_cache.h"
+
+template <typename V>
+QueryCache<V>::QueryCache(size_t budget_bytes)
+    : budget_(budget_bytes), bytes_(0), hits_(0), misses_(0) {}
+
+template <typename V>
+bool QueryCache<V>::Get(const std::string& key, V* value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        misses_++;
+        return false;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *value = it->second->value;
+    return true;
+}
+
+template <typename V>
+void QueryCache<V>::Put(const std::string& key, const V& value, size_t bytes) {
+    bytes += sizeof(Entry) + key.size();
+    if (bytes > budget_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        // Another query computed the same result concurrently.
+        bytes_ -= it->second->bytes;
+        entries_.erase(it->second);
+        index_.erase(it);
+    }
+    while (bytes_ + bytes > budget_) {
+        bytes_ -= entries_.back().bytes;
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+    entries_.push_front({key, value, bytes});
+    index_[key] = entries_.begin();
+    bytes_ += bytes;
+}
+
+template <typename V>
+void QueryCache<V>::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+template <typename V>
+template <size_t D>
+std::string QueryCache<V>::Key(const Query<D>& q, const std::vector<size_t>& dims) {
+    // Fixed-width binary fields, so that different filters can't produce the same key.
+    std::string key;
+    auto append = [&key](int64_t v) {
+        key.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    for (size_t d : dims) {
+        const QueryFilter& f = q.filters[d];
+        if (!f.present) {
+            continue;
+        }
+        append(d);
+        append(f.is_range);
+        if (f.is_range) {
+            append(f.ranges.size());
+            for (const ScalarRange& r : f.ranges) {
+                append(r.first);
+                append(r.second);
+            }
+        } else {
+            // IN-lists are sets: the same values in another order or repeated are the same filter.
+            std::vector<Scalar> values = f.values;
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end()), values.end());
+            append(values.size());
+            for (Scalar v : values) {
+                append(v);
+            }
+        }
+    }
+    return key;
+}
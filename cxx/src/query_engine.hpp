@@ -1,11 +1,29 @@
+
 #include "query_engine.h"
 
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <thread>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 #include <unordered_set>
+#include <omp.h>
 
 #include "types.h"
+#include "merge_utils.h"
+#include "numa_utils.h"
+#include "trace.h"
+#include "utils.h"
 #include "visitor.h"
 
+// Each thread gets about this many morsels, so that threads that finish early don't sit idle.
+const size_t MORSELS_PER_THREAD = 8;
+// Runs of at least this many consecutive indexes in a list are scanned as ranges, which can skip
+// or accept whole blocks.
+const size_t MIN_LIST_RUN = 128;
+
 template <size_t D>
 QueryEngine<D>::QueryEngine(
         std::shared_ptr<Dataset<D>> dataset,
@@ -13,80 +31,879 @@ QueryEngine<D>::QueryEngine(
     : dataset_(dataset),
       indexer_(indexer),
       columns_(indexer_->GetColumns()),
-      scanned_range_points_(0),
-      scanned_list_points_(0),
-      range_scan_time_(0),
-      indexing_time_(0),
-      list_scan_time_(0),
-      num_queries_(0) {}
+      stats_(std::max(1, omp_get_max_threads())),
+      num_threads_(1) {}
 
 template <size_t D>
-void QueryEngine<D>::Execute(Query<D>& q, Visitor<D>& visitor) {
-    std::vector<size_t> categorical_query_dimensions;
-    std::vector<size_t> range_query_dimensions;
-    std::vector<std::unordered_set<Scalar>> value_sets;
+void QueryEngine<D>::SetNumThreads(size_t num_threads) {
+    num_threads_ = std::max<size_t>(1, num_threads);
+    if (stats_.size() < num_threads_) {
+        stats_.resize(num_threads_);
+    }
+}
+
+template <size_t D>
+typename QueryEngine<D>::ScanStats QueryEngine<D>::TotalStats() const {
+    ScanStats total;
+    for (const auto& s : stats_) {
+        total.scanned_range_points += s.scanned_range_points;
+        total.scanned_list_points += s.scanned_list_points;
+        total.range_scan_time += s.range_scan_time;
+        total.indexing_time += s.indexing_time;
+        total.list_scan_time += s.list_scan_time;
+        total.skipped_points += s.skipped_points;
+        total.exact_points += s.exact_points;
+        total.num_queries += s.num_queries;
+    }
+    return total;
+}
+
+template <size_t D>
+typename QueryEngine<D>::ScanStats& QueryEngine<D>::LocalStats() {
+    size_t t = omp_get_thread_num();
+    AssertWithMessage(t < stats_.size(), "More threads than stats shards");
+    return stats_[t];
+}
+
+template <size_t D>
+typename QueryEngine<D>::ScanFilters QueryEngine<D>::BuildFilters(const Query<D>& q) const {
+    ScanFilters filters;
     for (size_t i = 0; i < dataset_->NumDims(); i++) {
         if (q.filters[i].present) {
+            filters.dims |= 1UL << i;
             // If the filtered dimension isn't indexed, this isn't an exact query anymore.
+            // Filters on dictionary-encoded columns are translated to codes here, once per query.
+            size_t dictionary_size = 0;
+            const Scalar* dictionary = dataset_->Dictionary(i, &dictionary_size);
             if (q.filters[i].is_range) {
-                assert (q.filters[i].ranges.size() == 1);
-                range_query_dimensions.push_back(i);
+                filters.range_dims.push_back(i);
+                filters.range_sets.emplace_back(q.filters[i].ranges, dictionary, dictionary_size);
             } else {
-                categorical_query_dimensions.push_back(i);
-                value_sets.emplace_back(q.filters[i].values.begin(),
-                        q.filters[i].values.end());
+                filters.categorical_dims.push_back(i);
+                // The membership test is picked here, once per query.
+                filters.value_sets.emplace_back(q.filters[i].values, dictionary, dictionary_size);
             }
         }
     }
-    auto preindex = std::chrono::high_resolution_clock::now();
-    std::cout << "Starting indexer" << std::endl;
-    Set<PhysicalIndex> indexes_to_scan = indexer_->IndexRanges(q);
-    auto start = std::chrono::high_resolution_clock::now();
-    for (Range<PhysicalIndex> range : indexes_to_scan.ranges) {
-        scanned_range_points_ += range.end - range.start;
-        for (PhysicalIndex p = range.start; p < range.end; p += 64UL) {
-            size_t true_end = std::min(range.end, p + 64UL);
-            // A way to get the last true_end - p bits set to 1.
-            uint64_t valids = 1ULL + (((1ULL << (true_end - p - 1)) - 1ULL) << 1);
-            for (size_t i = 0; i < categorical_query_dimensions.size(); i++) {
-                valids &= dataset_->GetCoordInSet(p, true_end,
-                        categorical_query_dimensions[i], value_sets[i]);
+    AssertWithMessage(filters.categorical_dims.size() <= 64 && filters.range_dims.size() <= 64,
+            "Too many filters for block matching");
+    return filters;
+}
+
+template <size_t D>
+void QueryEngine<D>::NormalizeFilters(Query<D>& q) {
+    for (QueryFilter& qf : q.filters) {
+        if (!qf.present) {
+            continue;
+        }
+        if (qf.is_range) {
+            std::sort(qf.ranges.begin(), qf.ranges.end(), ScalarRangeStartComp{});
+            qf.ranges = MergeUtils::Coalesce(qf.ranges.begin(), qf.ranges.end());
+        } else {
+            std::sort(qf.values.begin(), qf.values.end());
+            qf.values.erase(std::unique(qf.values.begin(), qf.values.end()), qf.values.end());
+        }
+    }
+}
+
+template <size_t D>
+typename QueryEngine<D>::BlockMatch QueryEngine<D>::MatchBlock(const ScanFilters& filters,
+        PhysicalIndex ix, uint64_t skip_dims, uint64_t* cat_needed, uint64_t* range_needed) const {
+    *cat_needed = 0;
+    *range_needed = 0;
+    Scalar min, max;
+    for (size_t i = 0; i < filters.categorical_dims.size(); i++) {
+        if (skip_dims & (1UL << filters.categorical_dims[i])) {
+            continue;
+        }
+        if (!dataset_->BlockBounds(ix, filters.categorical_dims[i], &min, &max)) {
+            *cat_needed |= 1UL << i;
+            continue;
+        }
+        const ValueSet& vset = filters.value_sets[i];
+        if (!vset.Intersects(min, max)) {
+            return BLOCK_NONE;
+        }
+        if (min != max || !vset.Contains(min)) {
+            *cat_needed |= 1UL << i;
+        }
+    }
+    for (size_t i = 0; i < filters.range_dims.size(); i++) {
+        size_t d = filters.range_dims[i];
+        if (skip_dims & (1UL << d)) {
+            continue;
+        }
+        if (!dataset_->BlockBounds(ix, d, &min, &max)) {
+            *range_needed |= 1UL << i;
+            continue;
+        }
+        const RangeSet& rset = filters.range_sets[i];
+        if (!rset.Intersects(min, max)) {
+            return BLOCK_NONE;
+        }
+        if (!rset.Covers(min, max)) {
+            *range_needed |= 1UL << i;
+        }
+    }
+    return (*cat_needed | *range_needed) ? BLOCK_SOME : BLOCK_ALL;
+}
+
+template <size_t D>
+uint64_t QueryEngine<D>::ChunkMatches(const ScanFilters& filters, PhysicalIndex start,
+        PhysicalIndex end, uint64_t cat_needed, uint64_t range_needed) const {
+    // A way to get the last end - start bits set to 1.
+    uint64_t valids = 1ULL + (((1ULL << (end - start - 1)) - 1ULL) << 1);
+    for (size_t i = 0; i < filters.categorical_dims.size(); i++) {
+        if (cat_needed & (1UL << i)) {
+            valids &= dataset_->GetCoordInSet(start, end,
+                    filters.categorical_dims[i], filters.value_sets[i]);
+        }
+    }
+    for (size_t i = 0; i < filters.range_dims.size(); i++) {
+        if (range_needed & (1UL << i)) {
+            valids &= dataset_->GetCoordInRanges(start, end,
+                    filters.range_dims[i], filters.range_sets[i]);
+        }
+    }
+    return valids;
+}
+
+template <size_t D>
+void QueryEngine<D>::ScanRange(const ScanFilters& filters, PhysicalIndex start,
+        PhysicalIndex end, uint64_t skip_dims, Visitor<D>& visitor, ColumnBatch<D>* batch,
+        long* skipped, long* exact) const {
+    // The index guarantees every filter on the whole range: a visitor that can aggregate it
+    // without looking at the rows (e.g. from a prefix-sum cube) does so in one call.
+    if ((skip_dims & filters.dims) == filters.dims &&
+            visitor.tryVisitExactRange(dataset_.get(), start, end)) {
+        *exact += end - start;
+        return;
+    }
+    const size_t block = dataset_->BlockSize();
+    PhysicalIndex block_start = start;
+    while (block_start < end && !visitor.IsSaturated()) {
+        PhysicalIndex block_end = std::min(end, (block_start / block + 1) * block);
+        if (batch != nullptr) {
+            block_end = std::min(block_end, block_start + ColumnBatch<D>::MAX_ROWS);
+        }
+        uint64_t cat_needed, range_needed;
+        BlockMatch match = visitor.CanSkipBlock(dataset_.get(), block_start) ? BLOCK_NONE
+            : MatchBlock(filters, block_start, skip_dims, &cat_needed, &range_needed);
+        if (match == BLOCK_NONE) {
+            *skipped += block_end - block_start;
+        } else if (match == BLOCK_ALL) {
+            *exact += block_end - block_start;
+            if (visitor.tryVisitExactRange(dataset_.get(), block_start, block_end)) {
+                // Aggregated without looking at the rows.
+            } else if (batch != nullptr) {
+                batch->Reset(dataset_.get(), block_start, block_end);
+                batch->SelectAll();
+                visitor.visitBatch(*batch);
+            } else {
+                visitor.visitExactRange(dataset_.get(), block_start, block_end);
+            }
+        } else {
+            if (batch != nullptr) {
+                batch->Reset(dataset_.get(), block_start, block_end);
             }
-            for (size_t d : range_query_dimensions) {
-                auto r = q.filters[d].ranges[0];
-                valids &= dataset_->GetCoordInRange(p, true_end,
-                        d, r.first, r.second);
+            for (PhysicalIndex p = block_start; p < block_end; p += 64UL) {
+                size_t true_end = std::min(block_end, p + 64UL);
+                uint64_t valids = ChunkMatches(filters, p, true_end, cat_needed, range_needed);
+                if (batch != nullptr) {
+                    batch->Select(p, true_end - p, valids);
+                } else if (valids == 1ULL + (((1ULL << (true_end - p - 1)) - 1ULL) << 1)) {
+                    // Every row matched, as when the chunk lies in a single run of a run-length
+                    // encoded column, so hand it over as an exact range.
+                    if (!visitor.tryVisitExactRange(dataset_.get(), p, true_end)) {
+                        visitor.visitExactRange(dataset_.get(), p, true_end);
+                    }
+                } else {
+                    visitor.visitRange(dataset_.get(), p, true_end, valids);
+                }
             }
-            visitor.visitRange(dataset_.get(), p, true_end, valids); 
+            if (batch != nullptr) {
+                visitor.visitBatch(*batch);
+            }
+        }
+        block_start = block_end;
+    }
+}
+
+template <size_t D>
+template <typename DatasetT, typename VisitorT, int NR, int NC>
+void QueryEngine<D>::ScanRangeTyped(const DatasetT& dataset, const ScanFilters& filters,
+        PhysicalIndex start, PhysicalIndex end, uint64_t skip_dims, VisitorT& visitor,
+        ColumnBatch<D>* batch, long* skipped, long* exact) const {
+    // Same as ScanRange. With the filter counts known at compile time the loops over the filters
+    // are unrolled, and the qualified calls below are neither virtual nor opaque to the compiler.
+    const size_t nr = NR >= 0 ? NR : filters.range_dims.size();
+    const size_t nc = NC >= 0 ? NC : filters.categorical_dims.size();
+    if ((skip_dims & filters.dims) == filters.dims &&
+            visitor.VisitorT::tryVisitExactRange(&dataset, start, end)) {
+        *exact += end - start;
+        return;
+    }
+    const size_t block = dataset.DatasetT::BlockSize();
+    PhysicalIndex block_start = start;
+    while (block_start < end && !visitor.VisitorT::IsSaturated()) {
+        PhysicalIndex block_end = std::min(end, (block_start / block + 1) * block);
+        if (batch != nullptr) {
+            block_end = std::min(block_end, block_start + ColumnBatch<D>::MAX_ROWS);
+        }
+        uint64_t cat_needed, range_needed;
+        BlockMatch match = visitor.VisitorT::CanSkipBlock(&dataset, block_start) ? BLOCK_NONE
+            : MatchBlock(filters, block_start, skip_dims, &cat_needed, &range_needed);
+        if (match == BLOCK_NONE) {
+            *skipped += block_end - block_start;
+        } else if (match == BLOCK_ALL) {
+            *exact += block_end - block_start;
+            if (visitor.VisitorT::tryVisitExactRange(&dataset, block_start, block_end)) {
+                // Aggregated without looking at the rows.
+            } else if (batch != nullptr) {
+                batch->Reset(&dataset, block_start, block_end);
+                batch->SelectAll();
+                visitor.VisitorT::visitBatch(*batch);
+            } else {
+                visitor.VisitorT::visitExactRange(&dataset, block_start, block_end);
+            }
+        } else {
+            if (batch != nullptr) {
+                batch->Reset(&dataset, block_start, block_end);
+            }
+            for (PhysicalIndex p = block_start; p < block_end; p += 64UL) {
+                size_t true_end = std::min(block_end, p + 64UL);
+                const uint64_t all = 1ULL + (((1ULL << (true_end - p - 1)) - 1ULL) << 1);
+                uint64_t valids = all;
+                for (size_t i = 0; i < nc; i++) {
+                    if (cat_needed & (1UL << i)) {
+                        valids &= dataset.DatasetT::GetCoordInSet(p, true_end,
+                                filters.categorical_dims[i], filters.value_sets[i]);
+                    }
+                }
+                for (size_t i = 0; i < nr; i++) {
+                    if (range_needed & (1UL << i)) {
+                        valids &= dataset.DatasetT::GetCoordInRanges(p, true_end,
+                                filters.range_dims[i], filters.range_sets[i]);
+                    }
+                }
+                if (batch != nullptr) {
+                    batch->Select(p, true_end - p, valids);
+                } else if (valids == all) {
+                    if (!visitor.VisitorT::tryVisitExactRange(&dataset, p, true_end)) {
+                        visitor.VisitorT::visitExactRange(&dataset, p, true_end);
+                    }
+                } else {
+                    visitor.VisitorT::visitRange(&dataset, p, true_end, valids);
+                }
+            }
+            if (batch != nullptr) {
+                visitor.VisitorT::visitBatch(*batch);
+            }
+        }
+        block_start = block_end;
+    }
+}
+
+template <size_t D>
+void QueryEngine<D>::ScanList(const ScanFilters& filters,
+        List<PhysicalIndex>::const_iterator begin, List<PhysicalIndex>::const_iterator end,
+        uint64_t skip_dims, Visitor<D>& visitor, ColumnBatch<D>* batch,
+        const RangeScanner& scan_range, long* skipped, long* exact) const {
+    const size_t block = dataset_->BlockSize();
+    auto it = begin;
+    while (it != end && !visitor.IsSaturated()) {
+        PhysicalIndex first = *it;
+        if ((size_t)(end - it) >= MIN_LIST_RUN && it[MIN_LIST_RUN - 1] == first + MIN_LIST_RUN - 1) {
+            auto run_end = it + MIN_LIST_RUN;
+            while (run_end != end && *run_end == run_end[-1] + 1) {
+                run_end++;
+            }
+            scan_range(filters, first, run_end[-1] + 1, skip_dims, visitor, batch, skipped, exact);
+            it = run_end;
+            continue;
+        }
+        // The entries in the block of `first`, all checked against the same block bounds.
+        PhysicalIndex group_limit = (first / block + 1) * block;
+        if (batch != nullptr) {
+            group_limit = std::min(group_limit, first + ColumnBatch<D>::MAX_ROWS);
+        }
+        auto group_end = std::lower_bound(it, end, group_limit);
+        uint64_t cat_needed, range_needed;
+        BlockMatch match = visitor.CanSkipBlock(dataset_.get(), first) ? BLOCK_NONE
+            : MatchBlock(filters, first, skip_dims, &cat_needed, &range_needed);
+        if (match == BLOCK_NONE) {
+            it = group_end;
+            continue;
+        }
+        if (batch != nullptr) {
+            batch->Reset(dataset_.get(), first, group_end[-1] + 1);
+        }
+        while (it != group_end) {
+            // Entries less than 64 rows apart are checked together, decoding the rows from the
+            // first to the last of them once per column.
+            PhysicalIndex lo = *it;
+            auto chunk_end = it + 1;
+            while (chunk_end != group_end && *chunk_end < lo + 64) {
+                chunk_end++;
+            }
+            PhysicalIndex hi = chunk_end[-1] + 1;
+            uint64_t members = 0;
+            for (auto e = it; e != chunk_end; e++) {
+                members |= 1UL << (hi - 1 - *e);
+            }
+            uint64_t valids = match == BLOCK_ALL ? members
+                : members & ChunkMatches(filters, lo, hi, cat_needed, range_needed);
+            if (batch != nullptr) {
+                batch->Select(lo, hi - lo, valids);
+            } else if (valids) {
+                visitor.visitRange(dataset_.get(), lo, hi, valids);
+            }
+            it = chunk_end;
+        }
+        if (batch != nullptr) {
+            visitor.visitBatch(*batch);
+        }
+    }
+}
+
+template <size_t D>
+Ranges<PhysicalIndex> QueryEngine<D>::MakeMorsels(const Ranges<PhysicalIndex>& ranges) const {
+    size_t total = 0;
+    for (const auto& r : ranges) {
+        total += r.end - r.start;
+    }
+    size_t block = dataset_->BlockSize();
+    size_t target = total / (num_threads_ * MORSELS_PER_THREAD);
+    // Round up to a whole number of blocks.
+    size_t morsel_size = std::max(block, ((target + block - 1) / block) * block);
+
+    Ranges<PhysicalIndex> morsels;
+    morsels.reserve(total / morsel_size + ranges.size());
+    size_t partition = 0;
+    for (const auto& r : ranges) {
+        PhysicalIndex s = r.start;
+        while (s < r.end) {
+            // Cut at the next multiple of morsel_size, so cuts line up with block boundaries,
+            // and where the next partition starts.
+            while (partition > 0 && dataset_->PartitionStart(partition) > s) {
+                partition--;
+            }
+            while (partition + 1 < dataset_->NumPartitions()
+                    && dataset_->PartitionStart(partition + 1) <= s) {
+                partition++;
+            }
+            PhysicalIndex e = std::min(std::min(r.end, (s / morsel_size + 1) * morsel_size),
+                    dataset_->PartitionStart(partition + 1));
+            morsels.emplace_back(s, e, r.exact);
+            s = e;
+        }
+    }
+    return morsels;
+}
+
+template <size_t D>
+void QueryEngine<D>::ScheduleMorsels(const Ranges<PhysicalIndex>& morsels,
+        std::vector<size_t>* first, std::vector<int>* nodes) const {
+    size_t total = 0;
+    for (const auto& m : morsels) {
+        total += m.end - m.start;
+    }
+    // Every thread gets one contiguous run of morsels, of about the same number of rows.
+    first->assign(num_threads_ + 1, morsels.size());
+    (*first)[0] = 0;
+    size_t t = 0, seen = 0;
+    for (size_t m = 0; m < morsels.size(); m++) {
+        size_t owner = std::min(num_threads_ - 1, seen * num_threads_ / total);
+        while (t < owner) {
+            (*first)[++t] = m;
+        }
+        seen += morsels[m].end - morsels[m].start;
+    }
+
+    nodes->assign(num_threads_, -1);
+    size_t num_partitions = dataset_->NumPartitions();
+    if (num_partitions == 1) {
+        return;
+    }
+    // A thread runs on the node of the partition its run starts in. A node gets at most its
+    // share of the threads, so that a query over a single partition doesn't crowd all of them
+    // onto the CPUs of one node; the others run anywhere.
+    std::unordered_set<int> distinct;
+    for (size_t p = 0; p < num_partitions; p++) {
+        distinct.insert(dataset_->PartitionNode(p));
+    }
+    size_t share = (num_threads_ + distinct.size() - 1) / distinct.size();
+    std::unordered_map<int, size_t> threads_on_node;
+    size_t p = 0;
+    for (size_t t = 0; t < num_threads_; t++) {
+        if ((*first)[t] == (*first)[t + 1]) {
+            continue;
+        }
+        while (p + 1 < num_partitions
+                && dataset_->PartitionStart(p + 1) <= morsels[(*first)[t]].start) {
+            p++;
+        }
+        int node = dataset_->PartitionNode(p);
+        if (node >= 0 && threads_on_node[node]++ < share) {
+            (*nodes)[t] = node;
         }
     }
+}
+
+template <size_t D>
+void QueryEngine<D>::ParallelScan(const ScanFilters& filters,
+        const Set<PhysicalIndex>& indexes_to_scan, Visitor<D>& visitor,
+        const RangeScanner& scan_range, long* ranges_t, long* list_t, long* skipped,
+        long* exact) const {
+    auto start = std::chrono::high_resolution_clock::now();
+    const Ranges<PhysicalIndex> morsels = MakeMorsels(indexes_to_scan.ranges);
+    std::vector<std::unique_ptr<Visitor<D>>> partials(num_threads_);
+    for (auto& p : partials) {
+        p = visitor.Clone();
+    }
+    std::vector<ColumnBatch<D>> batches(visitor.UsesBatches() ? num_threads_ : 0);
+    // Every thread scans one contiguous run of morsels, so merging the partial visitors in thread
+    // order preserves the physical order of the range results.
+    std::vector<size_t> first;
+    std::vector<int> nodes;
+    ScheduleMorsels(morsels, &first, &nodes);
+    long total_skipped = 0, total_exact = 0;
+#pragma omp parallel for schedule(static, 1) num_threads(num_threads_) reduction(+:total_skipped, total_exact)
+    for (size_t t = 0; t < num_threads_; t++) {
+        NumaUtils::BindToNode(nodes[t]);
+        for (size_t m = first[t]; m < first[t + 1] && !partials[t]->IsSaturated(); m++) {
+            scan_range(filters, morsels[m].start, morsels[m].end,
+                    SkipDims(indexes_to_scan, morsels[m]), *partials[t],
+                    batches.empty() ? nullptr : &batches[t], &total_skipped, &total_exact);
+        }
+    }
+    *skipped += total_skipped;
+    *exact += total_exact;
     auto mid = std::chrono::high_resolution_clock::now();
-    scanned_list_points_ += indexes_to_scan.list.size();
-    for (PhysicalIndex p : indexes_to_scan.list) {
-        // Can't really do a bitmap for this.
-        size_t valid = 1;
-        for (size_t i = 0; i < categorical_query_dimensions.size(); i++) {
-            valid &= dataset_->GetCoordInSet(p, p+1,
-                    categorical_query_dimensions[i], value_sets[i]);
+
+    // The list is scanned into the same partial visitors, so that they keep pruning with what
+    // the morsels gave them. It isn't scanned at all if the morsels saturated the visitor.
+    const List<PhysicalIndex>& list = indexes_to_scan.list;
+    bool saturated = false;
+    if (!list.empty()) {
+        std::unique_ptr<Visitor<D>> merged = visitor.Clone();
+        for (const auto& p : partials) {
+            merged->Merge(*p);
         }
-        for (size_t d : range_query_dimensions) {
-            auto r = q.filters[d].ranges[0];
-            valid &= dataset_->GetCoordInRange(p, p+1,
-                    d, r.first, r.second);
+        saturated = merged->IsSaturated();
+    }
+    size_t per_thread = (list.size() + num_threads_ - 1) / num_threads_;
+    total_skipped = 0;
+    total_exact = 0;
+#pragma omp parallel for schedule(static) num_threads(num_threads_) reduction(+:total_skipped, total_exact)
+    for (size_t t = 0; t < num_threads_; t++) {
+        if (saturated || partials[t]->IsSaturated()) {
+            continue;
         }
-        if (valid > 0) {
-            visitor.visit(PointRef<D>(dataset_.get(), p));
+        size_t lo = std::min(list.size(), t * per_thread);
+        size_t hi = std::min(list.size(), lo + per_thread);
+        ScanList(filters, list.begin() + lo, list.begin() + hi,
+                indexes_to_scan.guaranteed_dims, *partials[t],
+                batches.empty() ? nullptr : &batches[t], scan_range, &total_skipped, &total_exact);
+    }
+    *skipped += total_skipped;
+    *exact += total_exact;
+    for (auto& p : partials) {
+        visitor.Merge(*p);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    *ranges_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid-start).count();
+    *list_t = std::chrono::duration_cast<std::chrono::nanoseconds>(end-mid).count();
+}
+
+template <size_t D>
+void QueryEngine<D>::Execute(Query<D>& q, Visitor<D>& visitor) {
+    Run(q, visitor, [this](const ScanFilters& filters, PhysicalIndex start, PhysicalIndex end,
+            uint64_t skip_dims, Visitor<D>& v, ColumnBatch<D>* batch, long* skipped, long* exact) {
+        ScanRange(filters, start, end, skip_dims, v, batch, skipped, exact);
+    });
+}
+
+template <size_t D>
+template <typename DatasetT, typename VisitorT>
+void QueryEngine<D>::ExecuteTyped(Query<D>& q, VisitorT& visitor) {
+    // The kernels call DatasetT's and VisitorT's methods non-virtually, which would skip the
+    // overrides of derived types.
+    if (typeid(*dataset_) != typeid(DatasetT) || typeid(visitor) != typeid(VisitorT)) {
+        Execute(q, visitor);
+        return;
+    }
+    const DatasetT* dataset = static_cast<const DatasetT*>(dataset_.get());
+    using Kernel = void (QueryEngine<D>::*)(const DatasetT&, const ScanFilters&,
+            PhysicalIndex, PhysicalIndex, uint64_t, VisitorT&, ColumnBatch<D>*, long*, long*) const;
+    // Indexed by the number of range filters, then the number of IN-list filters.
+    static const Kernel kernels[4][2] = {
+        {&QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 0, 0>,
+         &QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 0, 1>},
+        {&QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 1, 0>,
+         &QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 1, 1>},
+        {&QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 2, 0>,
+         &QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 2, 1>},
+        {&QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 3, 0>,
+         &QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, 3, 1>},
+    };
+    Run(q, visitor, [this, dataset](const ScanFilters& filters, PhysicalIndex start,
+            PhysicalIndex end, uint64_t skip_dims, Visitor<D>& v, ColumnBatch<D>* batch,
+            long* skipped, long* exact) {
+        // The partial visitors of a parallel scan come from Clone(), which may not return a
+        // VisitorT.
+        if (typeid(v) != typeid(VisitorT)) {
+            ScanRange(filters, start, end, skip_dims, v, batch, skipped, exact);
+            return;
         }
+        size_t nr = filters.range_dims.size();
+        size_t nc = filters.categorical_dims.size();
+        Kernel kernel = nr < 4 && nc < 2 ? kernels[nr][nc]
+            : &QueryEngine<D>::template ScanRangeTyped<DatasetT, VisitorT, -1, -1>;
+        (this->*kernel)(*dataset, filters, start, end, skip_dims, static_cast<VisitorT&>(v),
+                batch, skipped, exact);
+    });
+}
+
+template <size_t D>
+void QueryEngine<D>::EnableResultCache(size_t budget_bytes) {
+    result_cache_ = std::make_unique<ResultCache>(budget_bytes);
+}
+
+template <size_t D>
+void QueryEngine<D>::InvalidateResultCache() {
+    if (result_cache_ != nullptr) {
+        result_cache_->Clear();
+    }
+}
+
+template <size_t D>
+void QueryEngine<D>::Run(Query<D>& q, Visitor<D>& visitor, const RangeScanner& scan_range) {
+    TracedQuery traced;
+    NormalizeFilters(q);
+    std::string cache_key = ResultCacheKey(q, visitor);
+    if (cache_key.empty()) {
+        Scan(q, visitor, scan_range);
+        return;
+    }
+    std::shared_ptr<const Visitor<D>> result;
+    if (result_cache_->Get(cache_key, &result)) {
+        LocalStats().num_queries += 1;
+        visitor.Merge(*result);
+        return;
+    }
+    ScanAndCache(cache_key, visitor, [&](Visitor<D>& fresh) {
+        Scan(q, fresh, scan_range);
+    });
+}
+
+template <size_t D>
+std::string QueryEngine<D>::ResultCacheKey(const Query<D>& q, const Visitor<D>& visitor) const {
+    std::string cache_key = result_cache_ != nullptr ? visitor.CacheKey() : "";
+    if (cache_key.empty()) {
+        return cache_key;
+    }
+    std::vector<size_t> dims(dataset_->NumDims());
+    std::iota(dims.begin(), dims.end(), 0);
+    // Visitor keys are text, so the separator can't be part of one. The dataset's size versions
+    // the entries against inserts that didn't go through the engine.
+    return cache_key + '\0' + std::to_string(dataset_->Size()) + '\0' + ResultCache::Key(q, dims);
+}
+
+template <size_t D>
+void QueryEngine<D>::ScanAndCache(const std::string& cache_key, Visitor<D>& visitor,
+        const std::function<void(Visitor<D>&)>& scan) {
+    std::shared_ptr<Visitor<D>> fresh = visitor.Clone();
+    AssertWithMessage(fresh != nullptr, "Visitors with a cache key must support Clone()");
+    scan(*fresh);
+    result_cache_->Put(cache_key, fresh, fresh->MemoryBytes());
+    visitor.Merge(*fresh);
+}
+
+template <size_t D>
+Set<PhysicalIndex> QueryEngine<D>::Index(Query<D>& q, long* index_t) const {
+    auto start = std::chrono::high_resolution_clock::now();
+    Set<PhysicalIndex> indexes_to_scan = indexer_->IndexRanges(q);
+    List<PhysicalIndex>& list = indexes_to_scan.list;
+    SortList(&list);
+    if (!list.empty() && !indexes_to_scan.ranges.empty()) {
+        List<PhysicalIndex> outside;
+        outside.reserve(list.size());
+        size_t pos = 0;
+        for (const Range<PhysicalIndex>& range : indexes_to_scan.ranges) {
+            size_t before, inside;
+            SplitList(list, pos, range, &before, &inside);
+            outside.insert(outside.end(), list.begin() + pos, list.begin() + before);
+            pos = inside;
+        }
+        outside.insert(outside.end(), list.begin() + pos, list.end());
+        list = std::move(outside);
     }
     auto end = std::chrono::high_resolution_clock::now();
-    auto ranges_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid-start).count();
-    auto list_t = std::chrono::duration_cast<std::chrono::nanoseconds>(end-mid).count();
-    auto index_t = std::chrono::duration_cast<std::chrono::nanoseconds>(start-preindex).count();
-    std::cout << "Scan time (us): ranges = " << ranges_t / 1e3
-        << ", list = " << list_t / 1e3 << ", total = " << (ranges_t + list_t) / 1e3 << std::endl;
-    num_queries_ += 1;
-    range_scan_time_ += ranges_t;
-    list_scan_time_ += list_t;
-    indexing_time_ += index_t;
+    *index_t = std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count();
+    TRACE_COUNT(IndexRanges, indexes_to_scan.ranges.size());
+    TRACE_COUNT(IndexListPoints, list.size());
+    return indexes_to_scan;
 }
 
+template <size_t D>
+void QueryEngine<D>::SortList(List<PhysicalIndex>* list) {
+    // Indexes usually report lists in increasing order without duplicates already.
+    if (!std::is_sorted(list->begin(), list->end(), std::less_equal<PhysicalIndex>())) {
+        std::sort(list->begin(), list->end());
+        list->erase(std::unique(list->begin(), list->end()), list->end());
+    }
+}
+
+template <size_t D>
+void QueryEngine<D>::SplitList(const List<PhysicalIndex>& list, size_t pos,
+        const Range<PhysicalIndex>& range, size_t* before, size_t* inside) {
+    auto it = std::lower_bound(list.begin() + pos, list.end(), range.start);
+    *before = it - list.begin();
+    *inside = std::lower_bound(it, list.end(), range.end) - list.begin();
+}
+
+template <size_t D>
+void QueryEngine<D>::Scan(Query<D>& q, Visitor<D>& visitor, const RangeScanner& scan_range) {
+    // Morsels are cut from all of the ranges at once, so a parallel scan needs the whole output
+    // of the index.
+    if (!ScansInParallel(visitor)) {
+        StreamScan(q, visitor, scan_range);
+        return;
+    }
+    // Filters come from the query as given: indexes may rewrite it, e.g. narrowing a filter to
+    // the inliers of a model and listing the outliers, whose rows the scan must still accept.
+    const ScanFilters filters = BuildFilters(q);
+    long index_t;
+    Set<PhysicalIndex> indexes_to_scan = Index(q, &index_t);
+    ScanIndexes(filters, indexes_to_scan, index_t, visitor, scan_range);
+}
+
+template <size_t D>
+bool QueryEngine<D>::ScansInParallel(const Visitor<D>& visitor) const {
+    // Inside a batch every thread already runs its own query, so scan serially.
+    return num_threads_ > 1 && !omp_in_parallel() && visitor.Clone() != nullptr;
+}
+
+template <size_t D>
+void QueryEngine<D>::StreamScan(Query<D>& q, Visitor<D>& visitor,
+        const RangeScanner& scan_range) {
+    // As in Scan, before the indexer can rewrite the query.
+    const ScanFilters filters = BuildFilters(q);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<RangeCursor> cursor = indexer_->Cursor(q);
+    List<PhysicalIndex> list = cursor->GetList();
+    SortList(&list);
+    const uint64_t guaranteed_dims = cursor->GuaranteedDims();
+    const uint64_t exact_range_dims = cursor->ExactRangeDims();
+    auto ranges_start = std::chrono::high_resolution_clock::now();
+    long index_t = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            ranges_start-start).count();
+
+    ScanStats& stats = LocalStats();
+    long skipped = 0, exact = 0;
+    ColumnBatch<D> batch;
+    ColumnBatch<D>* batch_ptr = visitor.UsesBatches() ? &batch : nullptr;
+    // List points are visited between the ranges around them, and those inside a range with it.
+    size_t list_pos = 0, list_points = 0;
+    long next_t = 0, list_t = 0;
+    Range<PhysicalIndex> range;
+    // Ranges come in physical order, so a saturated visitor has seen a prefix of the result, and
+    // the index doesn't have to look for the rest.
+    while (!visitor.IsSaturated()) {
+        auto next_start = std::chrono::high_resolution_clock::now();
+        bool more = cursor->Next(&range);
+        next_t += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::high_resolution_clock::now()-next_start).count();
+        if (!more) {
+            break;
+        }
+        size_t before, inside;
+        SplitList(list, list_pos, range, &before, &inside);
+        if (before > list_pos) {
+            auto list_start = std::chrono::high_resolution_clock::now();
+            ScanList(filters, list.cbegin() + list_pos, list.cbegin() + before,
+                    guaranteed_dims, visitor, batch_ptr, scan_range, &skipped, &exact);
+            list_t += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::high_resolution_clock::now()-list_start).count();
+            list_points += before - list_pos;
+        }
+        list_pos = inside;
+        stats.scanned_range_points += range.end - range.start;
+        TRACE_COUNT(IndexRanges, 1);
+        scan_range(filters, range.start, range.end,
+                SkipDims(guaranteed_dims, exact_range_dims, range), visitor, batch_ptr,
+                &skipped, &exact);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    list_points += list.size() - list_pos;
+    TRACE_COUNT(IndexListPoints, list_points);
+    stats.scanned_list_points += list_points;
+    ScanList(filters, list.cbegin() + list_pos, list.cend(), guaranteed_dims, visitor,
+            batch_ptr, scan_range, &skipped, &exact);
+    auto end = std::chrono::high_resolution_clock::now();
+    index_t += next_t;
+    long ranges_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid-ranges_start).count()
+        - next_t - list_t;
+    list_t += std::chrono::duration_cast<std::chrono::nanoseconds>(end-mid).count();
+    RecordScan(index_t, ranges_t, list_t, skipped, exact);
+}
+
+template <size_t D>
+void QueryEngine<D>::ScanIndexes(const ScanFilters& filters,
+        const Set<PhysicalIndex>& indexes_to_scan, long index_t, Visitor<D>& visitor,
+        const RangeScanner& scan_range) {
+    auto start = std::chrono::high_resolution_clock::now();
+    ScanStats& stats = LocalStats();
+    for (const Range<PhysicalIndex>& range : indexes_to_scan.ranges) {
+        stats.scanned_range_points += range.end - range.start;
+    }
+    stats.scanned_list_points += indexes_to_scan.list.size();
+
+    long ranges_t, list_t;
+    long skipped = 0, exact = 0;
+    if (ScansInParallel(visitor)) {
+        ParallelScan(filters, indexes_to_scan, visitor, scan_range,
+                &ranges_t, &list_t, &skipped, &exact);
+    } else {
+        ColumnBatch<D> batch;
+        ColumnBatch<D>* batch_ptr = visitor.UsesBatches() ? &batch : nullptr;
+        const List<PhysicalIndex>& list = indexes_to_scan.list;
+        // Ranges come in physical order, so a saturated visitor has seen a prefix of the result,
+        // as long as the list points are visited between the ranges around them.
+        size_t list_pos = 0;
+        list_t = 0;
+        for (const Range<PhysicalIndex>& range : indexes_to_scan.ranges) {
+            if (visitor.IsSaturated()) {
+                break;
+            }
+            size_t before, inside;
+            SplitList(list, list_pos, range, &before, &inside);
+            if (before > list_pos) {
+                auto list_start = std::chrono::high_resolution_clock::now();
+                ScanList(filters, list.cbegin() + list_pos, list.cbegin() + before,
+                        indexes_to_scan.guaranteed_dims, visitor, batch_ptr, scan_range,
+                        &skipped, &exact);
+                list_t += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::high_resolution_clock::now()-list_start).count();
+            }
+            list_pos = inside;
+            scan_range(filters, range.start, range.end, SkipDims(indexes_to_scan, range),
+                    visitor, batch_ptr, &skipped, &exact);
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        ScanList(filters, list.cbegin() + list_pos, list.cend(),
+                indexes_to_scan.guaranteed_dims, visitor, batch_ptr, scan_range, &skipped, &exact);
+        auto end = std::chrono::high_resolution_clock::now();
+        ranges_t = std::chrono::duration_cast<std::chrono::nanoseconds>(mid-start).count()
+            - list_t;
+        list_t += std::chrono::duration_cast<std::chrono::nanoseconds>(end-mid).count();
+    }
+    RecordScan(index_t, ranges_t, list_t, skipped, exact);
+}
+
+template <size_t D>
+void QueryEngine<D>::RecordScan(long index_t, long ranges_t, long list_t, long skipped,
+        long exact) {
+    // Spans that were timed anyway for the stats.
+    Trace::RecordSpan(TraceSpan::IndexProbe, index_t);
+    Trace::RecordSpan(TraceSpan::RangeScan, ranges_t);
+    Trace::RecordSpan(TraceSpan::ListScan, list_t);
+    ScanStats& stats = LocalStats();
+    stats.num_queries += 1;
+    stats.range_scan_time += ranges_t;
+    stats.list_scan_time += list_t;
+    stats.indexing_time += index_t;
+    stats.skipped_points += skipped;
+    stats.exact_points += exact;
+}
+
+template <size_t D>
+std::vector<std::unique_ptr<Visitor<D>>> QueryEngine<D>::ExecuteBatch(
+        std::vector<Query<D>>& queries, VisitorFactory factory, std::vector<long>* query_times_ns) {
+    std::vector<std::unique_ptr<Visitor<D>>> visitors(queries.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+        visitors[i] = factory(i);
+    }
+    if (query_times_ns != nullptr) {
+        query_times_ns->assign(queries.size(), 0);
+    }
+    // Within a batch, parallelism comes from running queries side by side; the scan of each
+    // query stays on the thread that runs it (nested parallel regions are serialized).
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads_)
+    for (size_t i = 0; i < queries.size(); i++) {
+        if (query_times_ns == nullptr) {
+            Execute(queries[i], *visitors[i]);
+            continue;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        Execute(queries[i], *visitors[i]);
+        auto finish = std::chrono::high_resolution_clock::now();
+        (*query_times_ns)[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                finish - start).count();
+    }
+    return visitors;
+}
+
+template <size_t D>
+std::vector<std::unique_ptr<Visitor<D>>> QueryEngine<D>::ExecutePipelined(
+        std::vector<Query<D>>& queries, VisitorFactory factory, size_t depth) {
+    std::vector<std::unique_ptr<Visitor<D>>> visitors(queries.size());
+    for (size_t i = 0; i < queries.size(); i++) {
+        visitors[i] = factory(i);
+    }
+    struct Indexed {
+        size_t query;
+        // Set if the query can be cached, and `cached` on a hit, in which case it isn't indexed.
+        std::string cache_key;
+        std::shared_ptr<const Visitor<D>> cached;
+        ScanFilters filters;
+        Set<PhysicalIndex> indexes;
+        long index_t;
+        // The query's trace, handed over from the producer to the scan.
+        QueryTrace trace;
+    };
+    BoundedQueue<Indexed> queue(depth);
+    // The producer only touches the indexer and the result cache, so it can't race with the
+    // scan on the stats.
+    std::thread producer([this, &queries, &visitors, &queue] {
+        for (size_t i = 0; i < queries.size(); i++) {
+            Indexed item;
+            item.query = i;
+            Trace::BeginQuery();
+            NormalizeFilters(queries[i]);
+            item.cache_key = ResultCacheKey(queries[i], *visitors[i]);
+            if (item.cache_key.empty() || !result_cache_->Get(item.cache_key, &item.cached)) {
+                item.filters = BuildFilters(queries[i]);
+                item.indexes = Index(queries[i], &item.index_t);
+            }
+            item.trace = Trace::Suspend();
+            queue.Push(std::move(item));
+        }
+        queue.Close();
+    });
+    Indexed item;
+    while (queue.Pop(&item)) {
+        Visitor<D>& visitor = *visitors[item.query];
+        Trace::Resume(item.trace);
+        auto scan = [this, &item](Visitor<D>& v) {
+            ScanIndexes(item.filters, item.indexes, item.index_t, v,
+                    [this](const ScanFilters& filters, PhysicalIndex start, PhysicalIndex end,
+                            uint64_t skip_dims, Visitor<D>& v, ColumnBatch<D>* batch,
+                            long* skipped, long* exact) {
+                ScanRange(filters, start, end, skip_dims, v, batch, skipped, exact);
+            });
+        };
+        if (item.cached != nullptr) {
+            LocalStats().num_queries += 1;
+            visitor.Merge(*item.cached);
+        } else if (!item.cache_key.empty()) {
+            ScanAndCache(item.cache_key, visitor, scan);
+        } else {
+            scan(visitor);
+        }
+        Trace::EndQuery();
+    }
+    producer.join();
+    return visitors;
+}
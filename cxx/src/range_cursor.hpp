@@ -0,0 +1,145 @@
+#include "range_cursor.h"
+
+#include <algorithm>
+
+#include "merge_utils.h"
+#include "utils.h"
+
+inline Set<PhysicalIndex> RangeCursor::Drain() {
+    Ranges<PhysicalIndex> ranges;
+    Range<PhysicalIndex> range;
+    while (Next(&range)) {
+        ranges.push_back(range);
+    }
+    List<PhysicalIndex> list = list_;
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+    Set<PhysicalIndex> result = MergeUtils::Union(ranges, list);
+    result.guaranteed_dims = guaranteed_dims_;
+    result.exact_range_dims = exact_range_dims_;
+    return result;
+}
+
+inline SetCursor::SetCursor(Set<PhysicalIndex> set)
+    : RangeCursor(), ranges_(std::move(set.ranges)), pos_(0) {
+    list_ = std::move(set.list);
+    guaranteed_dims_ = set.guaranteed_dims;
+    exact_range_dims_ = set.exact_range_dims;
+}
+
+inline bool SetCursor::Next(Range<PhysicalIndex>* range) {
+    if (pos_ == ranges_.size()) {
+        return false;
+    }
+    *range = ranges_[pos_++];
+    return true;
+}
+
+inline bool BufferedRangeCursor::Next(Range<PhysicalIndex>* range) {
+    while (pos_ + 1 >= buffer_.size() && !done_) {
+        // Keep the last range, which hasn't been returned yet, for Refill to extend.
+        buffer_.erase(buffer_.begin(), buffer_.begin() + pos_);
+        pos_ = 0;
+        done_ = !Refill(&buffer_);
+    }
+    if (pos_ == buffer_.size()) {
+        return false;
+    }
+    *range = buffer_[pos_++];
+    return true;
+}
+
+inline OffsetCursor::OffsetCursor(std::unique_ptr<RangeCursor> cursor, PhysicalIndex offset)
+    : RangeCursor(), cursor_(std::move(cursor)), offset_(offset) {
+    list_ = cursor_->GetList();
+    for (PhysicalIndex& p : list_) {
+        p += offset_;
+    }
+    guaranteed_dims_ = cursor_->GuaranteedDims();
+    exact_range_dims_ = cursor_->ExactRangeDims();
+}
+
+inline bool OffsetCursor::Next(Range<PhysicalIndex>* range) {
+    if (!cursor_->Next(range)) {
+        return false;
+    }
+    range->start += offset_;
+    range->end += offset_;
+    return true;
+}
+
+inline UnionCursor::UnionCursor(std::unique_ptr<RangeCursor> first,
+        std::unique_ptr<RangeCursor> second) : RangeCursor() {
+    cursors_[0] = std::move(first);
+    cursors_[1] = std::move(second);
+    const List<PhysicalIndex>& l1 = cursors_[0]->GetList();
+    const List<PhysicalIndex>& l2 = cursors_[1]->GetList();
+    list_.reserve(l1.size() + l2.size());
+    list_.insert(list_.end(), l1.begin(), l1.end());
+    list_.insert(list_.end(), l2.begin(), l2.end());
+    std::sort(list_.begin(), list_.end());
+    list_.erase(std::unique(list_.begin(), list_.end()), list_.end());
+    // A point is only known to match what both sides guarantee.
+    guaranteed_dims_ = cursors_[0]->GuaranteedDims() & cursors_[1]->GuaranteedDims();
+    exact_range_dims_ = cursors_[0]->ExactRangeDims() & cursors_[1]->ExactRangeDims();
+    for (int i = 0; i < 2; i++) {
+        has_head_[i] = cursors_[i]->Next(&heads_[i]);
+    }
+}
+
+inline bool UnionCursor::Absorb(Range<PhysicalIndex>* range, int cursor) {
+    const Range<PhysicalIndex>& head = heads_[cursor];
+    if (!has_head_[cursor] || head.start > range->end
+            || (head.start == range->end && head.exact != range->exact)) {
+        return false;
+    }
+    if (head.start < range->end) {
+        range->exact &= head.exact;
+    }
+    range->end = std::max(range->end, head.end);
+    has_head_[cursor] = cursors_[cursor]->Next(&heads_[cursor]);
+    return true;
+}
+
+inline bool UnionCursor::Next(Range<PhysicalIndex>* range) {
+    if (!has_head_[0] && !has_head_[1]) {
+        return false;
+    }
+    int first = !has_head_[1] || (has_head_[0] && heads_[0].start <= heads_[1].start) ? 0 : 1;
+    *range = heads_[first];
+    has_head_[first] = cursors_[first]->Next(&heads_[first]);
+    while (Absorb(range, 0) || Absorb(range, 1)) {}
+    return true;
+}
+
+inline IntersectCursor::IntersectCursor(std::unique_ptr<RangeCursor> first,
+        std::unique_ptr<RangeCursor> second) : RangeCursor() {
+    cursors_[0] = std::move(first);
+    cursors_[1] = std::move(second);
+    AssertWithMessage(cursors_[0]->GetList().empty() && cursors_[1]->GetList().empty(),
+            "Can't intersect cursors with lists");
+    // Exact ranges of the result come from exact ranges of both sides.
+    guaranteed_dims_ = cursors_[0]->GuaranteedDims() | cursors_[1]->GuaranteedDims();
+    exact_range_dims_ = cursors_[0]->ExactRangeDims() | cursors_[1]->ExactRangeDims();
+    for (int i = 0; i < 2; i++) {
+        has_head_[i] = cursors_[i]->Next(&heads_[i]);
+    }
+}
+
+inline bool IntersectCursor::Next(Range<PhysicalIndex>* range) {
+    while (has_head_[0] && has_head_[1]) {
+        PhysicalIndex start = std::max(heads_[0].start, heads_[1].start);
+        PhysicalIndex end = std::min(heads_[0].end, heads_[1].end);
+        bool exact = heads_[0].exact && heads_[1].exact;
+        for (int i = 0; i < 2; i++) {
+            if (heads_[i].end == end) {
+                has_head_[i] = cursors_[i]->Next(&heads_[i]);
+            }
+        }
+        if (start < end) {
+            *range = Range<PhysicalIndex>(start, end, exact);
+            return true;
+        }
+    }
+    return false;
+}
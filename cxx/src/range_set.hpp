@@ -0,0 +1,87 @@
+#include "range_set.h"
+
+#include <algorithm>
+
+#include "merge_utils.h"
+
+inline RangeSet::RangeSet(const std::vector<ScalarRange>& ranges) : ranges_(ranges) {
+    std::sort(ranges_.begin(), ranges_.end(), ScalarRangeStartComp{});
+    ranges_ = MergeUtils::Coalesce(ranges_.begin(), ranges_.end());
+}
+
+inline RangeSet::RangeSet(const std::vector<ScalarRange>& ranges, const Scalar* dictionary,
+        size_t dictionary_size) : RangeSet(ranges) {
+    if (dictionary != nullptr) {
+        dictionary_ = dictionary;
+        encoded_ = std::make_shared<const RangeSet>(Encode(dictionary, dictionary_size));
+    }
+}
+
+inline RangeSet RangeSet::Encode(const Scalar* dictionary, size_t dictionary_size) const {
+    std::vector<ScalarRange> codes;
+    codes.reserve(ranges_.size());
+    const Scalar* end = dictionary + dictionary_size;
+    for (const ScalarRange& r : ranges_) {
+        Scalar first = std::lower_bound(dictionary, end, r.first) - dictionary;
+        Scalar second = std::lower_bound(dictionary, end, r.second) - dictionary;
+        if (first < second) {
+            codes.emplace_back(first, second);
+        }
+    }
+    return RangeSet(codes);
+}
+
+inline const ScalarRange* RangeSet::Floor(Scalar v, size_t begin, size_t end) const {
+    const ScalarRange* base = ranges_.data() + begin;
+    size_t len = end - begin;
+    while (len > 1) {
+        size_t half = len >> 1;
+        base = base[half].first <= v ? base + half : base;
+        len -= half;
+    }
+    return base;
+}
+
+inline bool RangeSet::Contains(Scalar v) const {
+    if (ranges_.empty()) {
+        return false;
+    }
+    const ScalarRange* r = Floor(v, 0, ranges_.size());
+    return r->first <= v && v < r->second;
+}
+
+inline void RangeSet::Overlapping(Scalar lo, Scalar hi, size_t* begin, size_t* end) const {
+    // The ranges are disjoint, so both their starts and their ends are increasing.
+    auto first = std::partition_point(ranges_.begin(), ranges_.end(),
+            [lo](const ScalarRange& r) { return r.second <= lo; });
+    auto last = std::partition_point(first, ranges_.end(),
+            [hi](const ScalarRange& r) { return r.first <= hi; });
+    *begin = first - ranges_.begin();
+    *end = last - ranges_.begin();
+}
+
+inline bool RangeSet::Intersects(Scalar lo, Scalar hi) const {
+    size_t begin, end;
+    Overlapping(lo, hi, &begin, &end);
+    return begin < end;
+}
+
+inline bool RangeSet::Covers(Scalar lo, Scalar hi) const {
+    if (ranges_.empty()) {
+        return false;
+    }
+    const ScalarRange* r = Floor(lo, 0, ranges_.size());
+    return r->first <= lo && hi < r->second;
+}
+
+inline uint64_t RangeSet::Matches(const Scalar* vals, size_t n, size_t begin, size_t end) const {
+    if (end <= begin) {
+        return 0;
+    }
+    uint64_t matches = 0;
+    for (size_t i = 0; i < n; i++) {
+        const ScalarRange* r = Floor(vals[i], begin, end);
+        matches |= (uint64_t)(r->first <= vals[i] && vals[i] < r->second) << i;
+    }
+    return matches;
+}
@@ -1,7 +1,10 @@
 #include "secondary_btree_index.h"
 
+#include <algorithm>
 #include <iostream>
 
+#include "trace.h"
+
 template <size_t D>
 SecondaryBTreeIndex<D>::SecondaryBTreeIndex(size_t dim)
     : SecondaryIndexer<D>(dim), use_index_subset_(false), btree_() {}
@@ -29,11 +32,34 @@ List<Key> SecondaryBTreeIndex<D>::Matches(const Query<D>& q) const {
             }
         }
     }
-    std::cout << "Returning " << idxs.size() << " indexes from secondary B+ tree" << std::endl;
+    TRACE_COUNT(SecondaryMatches, idxs.size());
     // Leave these unsorted for now. Anyone using them can sort if necessary.
     return idxs;
 }
 
+template <size_t D>
+size_t SecondaryBTreeIndex<D>::EstimateMatches(const Query<D>& q) const {
+    const QueryFilter& filter = q.filters[this->column_];
+    size_t sampled = 0;
+    if (filter.is_range) {
+        for (ScalarRange r : filter.ranges) {
+            // Range ends are inclusive, as in Matches.
+            sampled += std::upper_bound(sample_.begin(), sample_.end(), r.second)
+                - std::lower_bound(sample_.begin(), sample_.end(), r.first);
+        }
+    } else {
+        for (Scalar val : filter.values) {
+            auto range = std::equal_range(sample_.begin(), sample_.end(), val);
+            sampled += range.second - range.first;
+        }
+    }
+    if (sample_.empty()) {
+        return btree_.size();
+    }
+    // Scale by the current size, which includes any inserts since Init.
+    return sampled * btree_.size() / sample_.size();
+}
+
 template <size_t D>
 void SecondaryBTreeIndex<D>::Init(ConstPointIterator<D> start, ConstPointIterator<D> end) {
     data_size_ = std::distance(start, end);
@@ -50,6 +76,14 @@ void SecondaryBTreeIndex<D>::Init(ConstPointIterator<D> start, ConstPointIterato
         }
         index_subset_.clear();
     }
+    sample_.clear();
+    sample_.reserve(btree_.size() / SAMPLE_RATE + 1);
+    size_t i = 0;
+    for (auto it = btree_.begin(); it != btree_.end(); it++, i++) {
+        if (i % SAMPLE_RATE == 0) {
+            sample_.push_back(it->first);
+        }
+    }
     std::cout << "SecondaryBTreeIndex on " << this->column_ << " loaded " << btree_.size() << " points"
         << " and total size " << Size() << std::endl;
 }
@@ -0,0 +1,378 @@
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+inline SimdLevel SimdKernels::DetectLevel() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+inline SimdLevel& SimdKernels::CurrentLevel() {
+    static SimdLevel level = DetectLevel();
+    return level;
+}
+
+inline SimdLevel SimdKernels::Level() {
+    return CurrentLevel();
+}
+
+inline void SimdKernels::SetLevel(SimdLevel level) {
+    CurrentLevel() = std::min(level, DetectLevel());
+}
+
+inline uint64_t SimdKernels::ReverseBits(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555UL) | ((x & 0x5555555555555555UL) << 1);
+    x = ((x >> 2) & 0x3333333333333333UL) | ((x & 0x3333333333333333UL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FUL) | ((x & 0x0F0F0F0F0F0F0F0FUL) << 4);
+    return __builtin_bswap64(x);
+}
+
+inline void SimdKernels::Decode(const char* data, uint64_t bit_offset, char bit_width,
+        Scalar base, size_t n, Scalar* out) {
+    if (bit_width == 0) {
+        std::fill(out, out + n, base);
+        return;
+    }
+#if defined(__x86_64__)
+    if (bit_width <= MAX_BIT_WIDTH) {
+        switch (Level()) {
+            case SimdLevel::AVX512:
+                DecodeAVX512(data, bit_offset, bit_width, base, n, out);
+                return;
+            case SimdLevel::AVX2:
+                DecodeAVX2(data, bit_offset, bit_width, base, n, out);
+                return;
+            default:
+                break;
+        }
+    }
+#endif
+    DecodeScalar(data, bit_offset, bit_width, base, n, out);
+}
+
+inline uint64_t SimdKernels::InRange(const char* data, uint64_t bit_offset, char bit_width,
+        Scalar base, size_t n, Scalar lower, Scalar upper) {
+    if (n == 0 || upper < lower || upper < base) {
+        return 0;
+    }
+    const uint64_t all = n == 64 ? ~0UL : (1UL << n) - 1;
+    // Compare against the packed deltas instead of the decoded values. Both bounds are clamped to
+    // [0, INT64_MAX], which all deltas fall into.
+    int64_t lo = 0, hi = 0;
+    if (lower > base && __builtin_sub_overflow(lower, base, &lo)) {
+        return 0;
+    }
+    if (__builtin_sub_overflow(upper, base, &hi)) {
+        hi = std::numeric_limits<int64_t>::max();
+    }
+    const uint64_t max_delta = bit_width == 0 ? 0 : (~0UL >> (64 - bit_width));
+    if ((uint64_t)lo > max_delta) {
+        return 0;
+    }
+    if (lo == 0 && (uint64_t)hi >= max_delta) {
+        // Every value in the block satisfies the predicate.
+        return all;
+    }
+    uint64_t in_order;
+#if defined(__x86_64__)
+    if (bit_width <= MAX_BIT_WIDTH && Level() == SimdLevel::AVX512) {
+        in_order = InRangeAVX512(data, bit_offset, bit_width, n, lo, hi);
+    } else if (bit_width <= MAX_BIT_WIDTH && Level() == SimdLevel::AVX2) {
+        in_order = InRangeAVX2(data, bit_offset, bit_width, n, lo, hi);
+    } else {
+        in_order = InRangeScalar(data, bit_offset, bit_width, n, lo, hi);
+    }
+#else
+    in_order = InRangeScalar(data, bit_offset, bit_width, n, lo, hi);
+#endif
+    return ReverseBits(in_order) >> (64 - n);
+}
+
+inline void SimdKernels::DecodeScalar(const char* data, uint64_t bit_offset, char bit_width,
+        Scalar base, size_t n, Scalar* out) {
+    const uint64_t mask = ~0UL >> (64 - bit_width);
+    for (size_t i = 0; i < n; i++) {
+        size_t shift = 64 - bit_width - (bit_offset & 0b111);
+        uint64_t byte_block = *(const uint64_t *)(data + (bit_offset >> 3));
+#ifdef LITTLE_ENDIAN_ORDER
+        byte_block = __builtin_bswap64(byte_block);
+#endif
+        out[i] = base + ((byte_block >> shift) & mask);
+        bit_offset += bit_width;
+    }
+}
+
+inline uint64_t SimdKernels::InRangeScalar(const char* data, uint64_t bit_offset, char bit_width,
+        size_t n, int64_t lo, int64_t hi) {
+    const uint64_t mask = ~0UL >> (64 - bit_width);
+    uint64_t valids = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t shift = 64 - bit_width - (bit_offset & 0b111);
+        uint64_t byte_block = *(const uint64_t *)(data + (bit_offset >> 3));
+#ifdef LITTLE_ENDIAN_ORDER
+        byte_block = __builtin_bswap64(byte_block);
+#endif
+        int64_t delta = (byte_block >> shift) & mask;
+        valids |= (uint64_t)(delta >= lo && delta <= hi) << i;
+        bit_offset += bit_width;
+    }
+    return valids;
+}
+
+inline uint64_t SimdKernels::InList(const Scalar* vals, size_t n, const Scalar* list, size_t k) {
+#if defined(__x86_64__)
+    switch (Level()) {
+        case SimdLevel::AVX512:
+            return InListAVX512(vals, n, list, k);
+        case SimdLevel::AVX2:
+            return InListAVX2(vals, n, list, k);
+        default:
+            break;
+    }
+#endif
+    return InListScalar(vals, n, list, k);
+}
+
+inline uint64_t SimdKernels::InListScalar(const Scalar* vals, size_t n, const Scalar* list, size_t k) {
+    uint64_t matches = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool found = false;
+        for (size_t j = 0; j < k; j++) {
+            found |= vals[i] == list[j];
+        }
+        matches |= (uint64_t)found << i;
+    }
+    return matches;
+}
+
+inline Scalar SimdKernels::MaskedSum(const Scalar* vals, size_t n, uint64_t mask) {
+#if defined(__x86_64__)
+    switch (Level()) {
+        case SimdLevel::AVX512:
+            return MaskedSumAVX512(vals, n, mask);
+        case SimdLevel::AVX2:
+            return MaskedSumAVX2(vals, n, mask);
+        default:
+            break;
+    }
+#endif
+    return MaskedSumScalar(vals, n, mask);
+}
+
+inline Scalar SimdKernels::MaskedSumScalar(const Scalar* vals, size_t n, uint64_t mask) {
+    Scalar sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        // All ones if bit i is set, so there is no branch.
+        sum += vals[i] & -(Scalar)((mask >> i) & 1);
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+
+// Load the 64-bit big-endian words holding the values at the given bit positions and extract
+// the values, one per lane.
+__attribute__((target("avx2")))
+static inline __m256i UnpackLanesAVX2(const char* data, __m256i positions, __m256i width,
+        __m256i mask) {
+    const __m256i bswap = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m256i bytes = _mm256_srli_epi64(positions, 3);
+    __m256i words = _mm256_i64gather_epi64((const long long *)data, bytes, 1);
+#ifdef LITTLE_ENDIAN_ORDER
+    words = _mm256_shuffle_epi8(words, bswap);
+#endif
+    __m256i shift = _mm256_sub_epi64(_mm256_sub_epi64(_mm256_set1_epi64x(64), width),
+            _mm256_and_si256(positions, _mm256_set1_epi64x(0b111)));
+    return _mm256_and_si256(_mm256_srlv_epi64(words, shift), mask);
+}
+
+__attribute__((target("avx2")))
+inline void SimdKernels::DecodeAVX2(const char* data, uint64_t bit_offset, char bit_width,
+        Scalar base, size_t n, Scalar* out) {
+    const __m256i width = _mm256_set1_epi64x(bit_width);
+    const __m256i mask = _mm256_set1_epi64x(~0UL >> (64 - bit_width));
+    const __m256i step = _mm256_set1_epi64x(4 * bit_width);
+    const __m256i vbase = _mm256_set1_epi64x(base);
+    __m256i positions = _mm256_add_epi64(_mm256_set1_epi64x(bit_offset),
+            _mm256_setr_epi64x(0, bit_width, 2 * bit_width, 3 * bit_width));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i vals = _mm256_add_epi64(UnpackLanesAVX2(data, positions, width, mask), vbase);
+        _mm256_storeu_si256((__m256i *)(out + i), vals);
+        positions = _mm256_add_epi64(positions, step);
+    }
+    // Don't load past the last value: the data is only padded by 8 bytes.
+    DecodeScalar(data, bit_offset + i * bit_width, bit_width, base, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t SimdKernels::InRangeAVX2(const char* data, uint64_t bit_offset, char bit_width,
+        size_t n, int64_t lo, int64_t hi) {
+    const __m256i width = _mm256_set1_epi64x(bit_width);
+    const __m256i mask = _mm256_set1_epi64x(~0UL >> (64 - bit_width));
+    const __m256i step = _mm256_set1_epi64x(4 * bit_width);
+    const __m256i vlo = _mm256_set1_epi64x(lo);
+    const __m256i vhi = _mm256_set1_epi64x(hi);
+    __m256i positions = _mm256_add_epi64(_mm256_set1_epi64x(bit_offset),
+            _mm256_setr_epi64x(0, bit_width, 2 * bit_width, 3 * bit_width));
+    uint64_t valids = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i deltas = UnpackLanesAVX2(data, positions, width, mask);
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, deltas),
+                _mm256_cmpgt_epi64(deltas, vhi));
+        uint64_t bits = ~_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xF;
+        valids |= bits << i;
+        positions = _mm256_add_epi64(positions, step);
+    }
+    if (i < n) {
+        valids |= InRangeScalar(data, bit_offset + i * bit_width, bit_width, n - i, lo, hi) << i;
+    }
+    return valids;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i UnpackLanesAVX512(const char* data, __m512i positions, __m512i width,
+        __m512i mask) {
+    const __m512i bswap = _mm512_set_epi64(
+            0x08090a0b0c0d0e0fL, 0x0001020304050607L, 0x08090a0b0c0d0e0fL, 0x0001020304050607L,
+            0x08090a0b0c0d0e0fL, 0x0001020304050607L, 0x08090a0b0c0d0e0fL, 0x0001020304050607L);
+    __m512i bytes = _mm512_srli_epi64(positions, 3);
+    __m512i words = _mm512_i64gather_epi64(bytes, (const void *)data, 1);
+#ifdef LITTLE_ENDIAN_ORDER
+    words = _mm512_shuffle_epi8(words, bswap);
+#endif
+    __m512i shift = _mm512_sub_epi64(_mm512_sub_epi64(_mm512_set1_epi64(64), width),
+            _mm512_and_si512(positions, _mm512_set1_epi64(0b111)));
+    return _mm512_and_si512(_mm512_srlv_epi64(words, shift), mask);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void SimdKernels::DecodeAVX512(const char* data, uint64_t bit_offset, char bit_width,
+        Scalar base, size_t n, Scalar* out) {
+    const __m512i width = _mm512_set1_epi64(bit_width);
+    const __m512i mask = _mm512_set1_epi64(~0UL >> (64 - bit_width));
+    const __m512i step = _mm512_set1_epi64(8 * bit_width);
+    const __m512i vbase = _mm512_set1_epi64(base);
+    __m512i positions = _mm512_add_epi64(_mm512_set1_epi64(bit_offset),
+            _mm512_setr_epi64(0, bit_width, 2 * bit_width, 3 * bit_width,
+                4 * bit_width, 5 * bit_width, 6 * bit_width, 7 * bit_width));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i vals = _mm512_add_epi64(UnpackLanesAVX512(data, positions, width, mask), vbase);
+        _mm512_storeu_si512((void *)(out + i), vals);
+        positions = _mm512_add_epi64(positions, step);
+    }
+    DecodeScalar(data, bit_offset + i * bit_width, bit_width, base, n - i, out + i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline uint64_t SimdKernels::InRangeAVX512(const char* data, uint64_t bit_offset, char bit_width,
+        size_t n, int64_t lo, int64_t hi) {
+    const __m512i width = _mm512_set1_epi64(bit_width);
+    const __m512i mask = _mm512_set1_epi64(~0UL >> (64 - bit_width));
+    const __m512i step = _mm512_set1_epi64(8 * bit_width);
+    const __m512i vlo = _mm512_set1_epi64(lo);
+    const __m512i vhi = _mm512_set1_epi64(hi);
+    __m512i positions = _mm512_add_epi64(_mm512_set1_epi64(bit_offset),
+            _mm512_setr_epi64(0, bit_width, 2 * bit_width, 3 * bit_width,
+                4 * bit_width, 5 * bit_width, 6 * bit_width, 7 * bit_width));
+    uint64_t valids = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i deltas = UnpackLanesAVX512(data, positions, width, mask);
+        __mmask8 bits = _mm512_cmp_epi64_mask(deltas, vlo, _MM_CMPINT_NLT)
+            & _mm512_cmp_epi64_mask(deltas, vhi, _MM_CMPINT_LE);
+        valids |= (uint64_t)bits << i;
+        positions = _mm512_add_epi64(positions, step);
+    }
+    if (i < n) {
+        valids |= InRangeScalar(data, bit_offset + i * bit_width, bit_width, n - i, lo, hi) << i;
+    }
+    return valids;
+}
+
+__attribute__((target("avx2")))
+inline uint64_t SimdKernels::InListAVX2(const Scalar* vals, size_t n, const Scalar* list, size_t k) {
+    uint64_t matches = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(vals + i));
+        __m256i found = _mm256_setzero_si256();
+        for (size_t j = 0; j < k; j++) {
+            found = _mm256_or_si256(found, _mm256_cmpeq_epi64(v, _mm256_set1_epi64x(list[j])));
+        }
+        matches |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(found)) << i;
+    }
+    if (i < n) {
+        matches |= InListScalar(vals + i, n - i, list, k) << i;
+    }
+    return matches;
+}
+
+__attribute__((target("avx2")))
+inline Scalar SimdKernels::MaskedSumAVX2(const Scalar* vals, size_t n, uint64_t mask) {
+    // Lane j of a group of 4 values keeps its value if bit j of the group's mask is set.
+    const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(vals + i));
+        __m256i bits = _mm256_and_si256(_mm256_set1_epi64x((mask >> i) & 0xF), lane_bits);
+        __m256i keep = _mm256_cmpeq_epi64(bits, lane_bits);
+        acc = _mm256_add_epi64(acc, _mm256_and_si256(v, keep));
+    }
+    alignas(32) Scalar lanes[4];
+    _mm256_store_si256((__m256i *)lanes, acc);
+    Scalar sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    if (i < n) {
+        sum += MaskedSumScalar(vals + i, n - i, mask >> i);
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline Scalar SimdKernels::MaskedSumAVX512(const Scalar* vals, size_t n, uint64_t mask) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 8) {
+        // Lanes past n are neither loaded nor added.
+        __mmask8 lanes = (__mmask8)(mask >> i) & (__mmask8)((1U << std::min<size_t>(8, n - i)) - 1);
+        acc = _mm512_add_epi64(acc, _mm512_maskz_loadu_epi64(lanes, vals + i));
+    }
+    return _mm512_reduce_add_epi64(acc);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline uint64_t SimdKernels::InListAVX512(const Scalar* vals, size_t n, const Scalar* list, size_t k) {
+    uint64_t matches = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_loadu_si512((const void *)(vals + i));
+        __mmask8 found = 0;
+        for (size_t j = 0; j < k; j++) {
+            found |= _mm512_cmpeq_epi64_mask(v, _mm512_set1_epi64(list[j]));
+        }
+        matches |= (uint64_t)found << i;
+    }
+    if (i < n) {
+        matches |= InListScalar(vals + i, n - i, list, k) << i;
+    }
+    return matches;
+}
+
+#endif
@@ -329,7 +329,7 @@ QueryFilter SingleColumnRewriter<D>::RewriteValueFilter(const QueryFilter& qf_ma
 }
 
 template <size_t D>
-List<Key> SingleColumnRewriter<D>::Rewrite(Query<D>& q) {
+List<Key> SingleColumnRewriter<D>::Rewrite(Query<D>& q) const {
     // Deep copy the query filters.
     /*for (int i = 0; i < D; i++) {
         rewritten.filters[i] = q.filters[i];
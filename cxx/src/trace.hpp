@@ -0,0 +1,231 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+inline std::mutex Trace::registry_mutex_;
+inline std::vector<std::unique_ptr<Trace::ThreadTrace>> Trace::registry_;
+inline std::atomic<size_t> Trace::sampling_(1);
+inline std::atomic<uint64_t> Trace::next_query_(0);
+inline thread_local Trace::ShardHandle Trace::local_;
+
+inline uint64_t TraceNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline Trace::ShardHandle::~ShardHandle() {
+    if (shard != nullptr) {
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        shard->in_use = false;
+        shard->open = false;
+    }
+}
+
+inline Trace::ThreadTrace& Trace::Local() {
+    if (local_.shard == nullptr) {
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        for (auto& shard : registry_) {
+            if (!shard->in_use) {
+                local_.shard = shard.get();
+                break;
+            }
+        }
+        if (local_.shard == nullptr) {
+            registry_.push_back(std::make_unique<ThreadTrace>());
+            local_.shard = registry_.back().get();
+        }
+        local_.shard->in_use = true;
+    }
+    return *local_.shard;
+}
+
+inline void Trace::SetSampling(size_t every) {
+    sampling_.store(every, std::memory_order_relaxed);
+}
+
+inline size_t Trace::Sampling() {
+    return sampling_.load(std::memory_order_relaxed);
+}
+
+inline void Trace::BeginQuery() {
+#if TRACING
+    ThreadTrace& t = Local();
+    t.current = QueryTrace();
+    t.current.id = next_query_.fetch_add(1, std::memory_order_relaxed);
+    size_t every = Sampling();
+    t.current.sampled = every > 0 && t.current.id % every == 0;
+    t.open = true;
+    Add(t.counters[static_cast<size_t>(TraceCounter::Queries)], 1);
+    if (t.current.sampled) {
+        Add(t.counters[static_cast<size_t>(TraceCounter::SampledQueries)], 1);
+    }
+#endif
+}
+
+inline void Trace::EndQuery() {
+#if TRACING
+    ThreadTrace& t = Local();
+    if (t.open && t.current.sampled) {
+        std::lock_guard<std::mutex> lock(t.recent_mutex);
+        if (t.recent.size() == MAX_RECENT) {
+            t.recent.pop_front();
+        }
+        t.recent.push_back(t.current);
+    }
+    t.open = false;
+#endif
+}
+
+inline QueryTrace Trace::Suspend() {
+#if TRACING
+    ThreadTrace& t = Local();
+    t.open = false;
+    return t.current;
+#else
+    return QueryTrace();
+#endif
+}
+
+inline void Trace::Resume(const QueryTrace& query) {
+#if TRACING
+    ThreadTrace& t = Local();
+    t.current = query;
+    t.open = true;
+#endif
+}
+
+inline bool Trace::Sampled() {
+#if TRACING
+    const ThreadTrace& t = Local();
+    return t.open && t.current.sampled;
+#else
+    return false;
+#endif
+}
+
+inline void Trace::Count(TraceCounter counter, uint64_t n) {
+#if TRACING
+    Add(Local().counters[static_cast<size_t>(counter)], n);
+#endif
+}
+
+inline void Trace::RecordSpan(TraceSpan span, uint64_t ns) {
+#if TRACING
+    ThreadTrace& t = Local();
+    if (!t.open || !t.current.sampled) {
+        return;
+    }
+    size_t s = static_cast<size_t>(span);
+    t.current.span_ns[s] += ns;
+    Add(t.span_count[s], 1);
+    Add(t.span_ns[s], ns);
+    if (ns > t.span_max_ns[s].load(std::memory_order_relaxed)) {
+        t.span_max_ns[s].store(ns, std::memory_order_relaxed);
+    }
+#endif
+}
+
+inline TraceSnapshot Trace::Snapshot() {
+    TraceSnapshot snapshot;
+    snapshot.sampling = Sampling();
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (const auto& t : registry_) {
+        for (size_t c = 0; c < NUM_TRACE_COUNTERS; c++) {
+            snapshot.counters[c] += t->counters[c].load(std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+            snapshot.span_count[s] += t->span_count[s].load(std::memory_order_relaxed);
+            snapshot.span_ns[s] += t->span_ns[s].load(std::memory_order_relaxed);
+            snapshot.span_max_ns[s] = std::max(snapshot.span_max_ns[s],
+                    t->span_max_ns[s].load(std::memory_order_relaxed));
+        }
+        std::lock_guard<std::mutex> recent_lock(t->recent_mutex);
+        snapshot.recent.insert(snapshot.recent.end(), t->recent.begin(), t->recent.end());
+    }
+    std::sort(snapshot.recent.begin(), snapshot.recent.end(),
+            [](const QueryTrace& a, const QueryTrace& b) { return a.id < b.id; });
+    return snapshot;
+}
+
+inline void Trace::Reset() {
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (auto& t : registry_) {
+        for (auto& c : t->counters) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+            t->span_count[s].store(0, std::memory_order_relaxed);
+            t->span_ns[s].store(0, std::memory_order_relaxed);
+            t->span_max_ns[s].store(0, std::memory_order_relaxed);
+        }
+        std::lock_guard<std::mutex> recent_lock(t->recent_mutex);
+        t->recent.clear();
+    }
+}
+
+inline void Trace::WriteJson(std::ostream& out) {
+    TraceSnapshot snapshot = Snapshot();
+    out << "{\n  \"sampling\": " << snapshot.sampling << ",\n  \"counters\": {";
+    for (size_t c = 0; c < NUM_TRACE_COUNTERS; c++) {
+        out << (c == 0 ? "\n" : ",\n") << "    \"" << Name(static_cast<TraceCounter>(c))
+            << "\": " << snapshot.counters[c];
+    }
+    out << "\n  },\n  \"spans\": {";
+    for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+        out << (s == 0 ? "\n" : ",\n") << "    \"" << Name(static_cast<TraceSpan>(s))
+            << "\": {\"count\": " << snapshot.span_count[s]
+            << ", \"total_ns\": " << snapshot.span_ns[s]
+            << ", \"max_ns\": " << snapshot.span_max_ns[s] << "}";
+    }
+    out << "\n  },\n  \"recent_queries\": [";
+    for (size_t i = 0; i < snapshot.recent.size(); i++) {
+        const QueryTrace& q = snapshot.recent[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"id\": " << q.id;
+        for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+            out << ", \"" << Name(static_cast<TraceSpan>(s)) << "_ns\": " << q.span_ns[s];
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+inline void Trace::WriteCsv(std::ostream& out) {
+    TraceSnapshot snapshot = Snapshot();
+    out << "query_id";
+    for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+        out << "," << Name(static_cast<TraceSpan>(s)) << "_ns";
+    }
+    out << "\n";
+    for (const QueryTrace& q : snapshot.recent) {
+        out << q.id;
+        for (size_t s = 0; s < NUM_TRACE_SPANS; s++) {
+            out << "," << q.span_ns[s];
+        }
+        out << "\n";
+    }
+    out.flush();
+}
+
+inline const char* Trace::Name(TraceSpan span) {
+    static const char* names[] = {"index_probe", "key_lookup", "merge", "range_scan",
+        "list_scan"};
+    return names[static_cast<size_t>(span)];
+}
+
+inline const char* Trace::Name(TraceCounter counter) {
+    static const char* names[] = {"queries", "sampled_queries", "index_ranges",
+        "index_list_points", "full_scan_fallbacks", "secondary_matches", "mapped_target_buckets",
+        "correlation_ranges", "correlation_list_points", "rewritten_ranges", "planned_full_scans",
+        "planned_correlation_lookups", "planned_secondary_lookups"};
+    return names[static_cast<size_t>(counter)];
+}
+
+inline ScopedSpan::ScopedSpan(TraceSpan span)
+    : span_(span), active_(Trace::Sampled()), start_ns_(active_ ? TraceNowNs() : 0) {}
+
+inline ScopedSpan::~ScopedSpan() {
+    if (active_) {
+        Trace::RecordSpan(span_, TraceNowNs() - start_ns_);
+    }
+}
@@ -79,7 +79,7 @@ void TRSTreeRewriter<D>::WriteOutliers(const List<Key>& outliers) {
 }
 
 template <size_t D>
-List<Key> TRSTreeRewriter<D>::Rewrite(Query<D>& q) {
+List<Key> TRSTreeRewriter<D>::Rewrite(Query<D>& q) const {
     if (!q.filters[mapped_dim_].present) {
         return {};
     }
@@ -0,0 +1,103 @@
+#include "value_set.h"
+
+#include <algorithm>
+
+#include "simd_kernels.h"
+
+inline ValueSet::ValueSet(const std::vector<Scalar>& values)
+    : values_(values), min_(0), max_(-1), bitmap_() {
+    std::sort(values_.begin(), values_.end());
+    values_.erase(std::unique(values_.begin(), values_.end()), values_.end());
+    if (!values_.empty()) {
+        min_ = values_.front();
+        max_ = values_.back();
+    }
+    Scalar span;
+    if (values_.size() <= MAX_LINEAR_VALUES) {
+        strategy_ = LINEAR;
+    } else if (!__builtin_sub_overflow(max_, min_, &span) && span < MAX_BITMAP_SPAN) {
+        strategy_ = BITMAP;
+        bitmap_.resize((span >> 6) + 1, 0);
+        for (Scalar v : values_) {
+            uint64_t off = v - min_;
+            bitmap_[off >> 6] |= 1UL << (off & 63);
+        }
+    } else {
+        strategy_ = SORTED;
+    }
+}
+
+inline ValueSet::ValueSet(const std::vector<Scalar>& values, const Scalar* dictionary,
+        size_t dictionary_size) : ValueSet(values) {
+    if (dictionary != nullptr) {
+        dictionary_ = dictionary;
+        encoded_ = std::make_shared<const ValueSet>(Encode(dictionary, dictionary_size));
+    }
+}
+
+inline ValueSet ValueSet::Encode(const Scalar* dictionary, size_t dictionary_size) const {
+    std::vector<Scalar> codes;
+    const Scalar* end = dictionary + dictionary_size;
+    for (Scalar v : values_) {
+        const Scalar* it = std::lower_bound(dictionary, end, v);
+        if (it != end && *it == v) {
+            codes.push_back(it - dictionary);
+        }
+    }
+    return ValueSet(codes);
+}
+
+inline bool ValueSet::SortedContains(Scalar v) const {
+    // Branchless binary search: base ends up at the last value <= v (or the first value).
+    const Scalar* base = values_.data();
+    size_t len = values_.size();
+    while (len > 1) {
+        size_t half = len >> 1;
+        base = base[half] <= v ? base + half : base;
+        len -= half;
+    }
+    return *base == v;
+}
+
+inline bool ValueSet::Contains(Scalar v) const {
+    switch (strategy_) {
+        case BITMAP: {
+            uint64_t off = (uint64_t)v - (uint64_t)min_;
+            return off <= (uint64_t)(max_ - min_) && ((bitmap_[off >> 6] >> (off & 63)) & 1);
+        }
+        case SORTED:
+            return SortedContains(v);
+        default:
+            return std::find(values_.begin(), values_.end(), v) != values_.end();
+    }
+}
+
+inline bool ValueSet::Intersects(Scalar lo, Scalar hi) const {
+    auto it = std::lower_bound(values_.begin(), values_.end(), lo);
+    return it != values_.end() && *it <= hi;
+}
+
+inline uint64_t ValueSet::Matches(const Scalar* vals, size_t n) const {
+    uint64_t matches = 0;
+    switch (strategy_) {
+        case LINEAR:
+            return SimdKernels::InList(vals, n, values_.data(), values_.size());
+        case BITMAP: {
+            const uint64_t span = max_ - min_;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t off = (uint64_t)vals[i] - (uint64_t)min_;
+                bool in_span = off <= span;
+                // Look at word 0 for values outside the span, so there is no branch.
+                off = in_span ? off : 0;
+                matches |= (uint64_t)(in_span & ((bitmap_[off >> 6] >> (off & 63)) & 1)) << i;
+            }
+            return matches;
+        }
+        case SORTED:
+            for (size_t i = 0; i < n; i++) {
+                matches |= (uint64_t)SortedContains(vals[i]) << i;
+            }
+            return matches;
+    }
+    return matches;
+}
@@ -0,0 +1,158 @@
+#include "gtest/gtest.h"
+#include "block_codec.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+namespace test {
+
+    const size_t BLOCK_SIZE = 1 << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+
+    class BlockCodecTest : public ::testing::Test {
+      protected:
+        void TearDown() override {
+            BlockCodecs::SetAllowed(BlockCodecs::ALL);
+            BlockCodecs::SetCostWeight(BlockCodecs::DEFAULT_COST_WEIGHT);
+        }
+
+        std::vector<Scalar> Random(Scalar offset, Scalar max_diff) {
+            std::vector<Scalar> block;
+            for (size_t i = 0; i < BLOCK_SIZE; i++) {
+                block.push_back(offset + rand() % max_diff);
+            }
+            return block;
+        }
+
+        // Blocks that each codec is good at, and some that some of them can't encode.
+        std::vector<std::vector<Scalar>> Blocks() {
+            std::vector<std::vector<Scalar>> blocks;
+            blocks.push_back(Random(-1000, 1000));
+            std::vector<Scalar> sorted = Random(1L << 40, 1L << 30);
+            std::sort(sorted.begin(), sorted.end());
+            blocks.push_back(sorted);
+            std::vector<Scalar> runs;
+            for (Scalar v = 7; runs.size() < BLOCK_SIZE; v += 1 + rand() % 100) {
+                runs.insert(runs.end(), std::min<size_t>(1 + rand() % 60, BLOCK_SIZE - runs.size()), v);
+            }
+            blocks.push_back(runs);
+            std::vector<Scalar> few = {-(1L << 45), 3, 1L << 20, 1L << 50};
+            std::vector<Scalar> categorical;
+            for (size_t i = 0; i < BLOCK_SIZE; i++) {
+                categorical.push_back(few[rand() % few.size()]);
+            }
+            blocks.push_back(categorical);
+            blocks.push_back(std::vector<Scalar>(BLOCK_SIZE, -42));
+            std::vector<Scalar> wide = Random(0, 1000);
+            wide[10] = std::numeric_limits<Scalar>::min();
+            wide[300] = std::numeric_limits<Scalar>::max();
+            blocks.push_back(wide);
+            // A partial last block.
+            blocks.push_back(Random(5, 17));
+            blocks.back().resize(100);
+            return blocks;
+        }
+    };
+
+    TEST_F(BlockCodecTest, TestCodecsAgainstDecodedValues) {
+        size_t encoded = 0;
+        for (const std::vector<Scalar>& block : Blocks()) {
+            BlockStats stats = BlockStats::Of(block);
+            std::vector<Scalar> distinct(block);
+            std::sort(distinct.begin(), distinct.end());
+            ASSERT_EQ(std::unique(distinct.begin(), distinct.end()) - distinct.begin(),
+                    stats.num_distinct);
+            RangeSet rset({{-2000, -900}, {-50, 10}, {1L << 20, (1L << 40) + (1L << 29)}});
+            ValueSet vset({block[0], block[block.size() / 2], 3, -42});
+            for (size_t e = 0; e < NUM_BLOCK_ENCODINGS; e++) {
+                const BlockCodec& codec = BlockCodecs::Get(e);
+                uint64_t bits = codec.EncodedBits(stats);
+                if (bits == BlockCodec::NOT_APPLICABLE) {
+                    continue;
+                }
+                encoded++;
+                // Start at an odd bit, after some other block.
+                std::vector<char> data;
+                BitWriter writer(&data, 0);
+                writer.Append(5, 3);
+                CompressionBlock cblk;
+                cblk.encoding = e;
+                cblk.bit_offset = writer.Offset();
+                codec.Encode(block, stats, &cblk, &writer);
+                // The sizes the codecs are chosen by are exact, but for aligning raw blocks.
+                if (e == BLOCK_RAW) {
+                    EXPECT_GE(bits, writer.Offset() - 3);
+                } else {
+                    EXPECT_EQ(bits, writer.Offset() - 3) << codec.Name();
+                }
+                EXPECT_GE(data.size() * 8, writer.Offset() + 64);
+                for (size_t i = 0; i < block.size(); i++) {
+                    ASSERT_EQ(block[i], codec.Get(data.data(), cblk, i)) << codec.Name() << " " << i;
+                    ASSERT_LE((uint64_t) block[i] - (uint64_t) cblk.base_value, cblk.bit_mask);
+                }
+                for (size_t offset = 0; offset < block.size(); offset += 37) {
+                    size_t n = std::min<size_t>(block.size() - offset, 1 + offset % 64);
+                    uint64_t valids = ((uint64_t) rand() << 32) ^ rand();
+                    Scalar vals[64];
+                    codec.Decode(data.data(), cblk, offset, n, vals);
+                    uint64_t want_range = 0, want_ranges = 0, want_set = 0;
+                    Scalar want_sum = 0;
+                    std::vector<Scalar> want_values, values;
+                    for (size_t i = 0; i < n; i++) {
+                        Scalar v = block[offset + i];
+                        ASSERT_EQ(v, vals[i]) << codec.Name();
+                        want_range = (want_range << 1) | (v >= -10 && v <= 1000000);
+                        want_ranges = (want_ranges << 1) | rset.Contains(v);
+                        want_set = (want_set << 1) | vset.Contains(v);
+                        if (valids & (1UL << (n - 1 - i))) {
+                            want_sum += v;
+                            want_values.push_back(v);
+                        }
+                    }
+                    EXPECT_EQ(want_range, codec.InRange(data.data(), cblk, offset, n, -10, 1000000))
+                        << codec.Name();
+                    EXPECT_EQ(0, codec.InRange(data.data(), cblk, offset, n, 10, -10));
+                    EXPECT_EQ(want_ranges, codec.InRanges(data.data(), cblk, offset, n, rset, 0,
+                                rset.Size())) << codec.Name();
+                    EXPECT_EQ(want_set, codec.InSet(data.data(), cblk, offset, n, vset))
+                        << codec.Name();
+                    EXPECT_EQ(want_sum, codec.Sum(data.data(), cblk, offset, n, valids, nullptr))
+                        << codec.Name();
+                    codec.Values(data.data(), cblk, offset, n, valids, nullptr, &values);
+                    EXPECT_EQ(want_values, values) << codec.Name();
+                }
+            }
+        }
+        EXPECT_LT(20, encoded);
+    }
+
+    TEST_F(BlockCodecTest, TestChoose) {
+        std::vector<std::vector<Scalar>> blocks = Blocks();
+        EXPECT_EQ(BLOCK_PACKED, BlockCodecs::Choose(BlockStats::Of(blocks[0])));
+        EXPECT_EQ(BLOCK_RLE, BlockCodecs::Choose(BlockStats::Of(blocks[2])));
+        EXPECT_EQ(BLOCK_DICTIONARY, BlockCodecs::Choose(BlockStats::Of(blocks[3])));
+        EXPECT_EQ(BLOCK_CONSTANT, BlockCodecs::Choose(BlockStats::Of(blocks[4])));
+        EXPECT_EQ(BLOCK_RAW, BlockCodecs::Choose(BlockStats::Of(blocks[5])));
+        // Delta encoding is smaller, but not by enough to make up for decoding it.
+        BlockStats sorted = BlockStats::Of(blocks[1]);
+        EXPECT_LT(BlockCodecs::Get(BLOCK_DELTA).EncodedBits(sorted),
+                BlockCodecs::Get(BLOCK_PACKED).EncodedBits(sorted));
+        EXPECT_EQ(BLOCK_PACKED, BlockCodecs::Choose(sorted));
+        BlockCodecs::SetCostWeight(0);
+        EXPECT_EQ(BLOCK_DELTA, BlockCodecs::Choose(sorted));
+
+        // Raw encoding is always allowed.
+        BlockCodecs::SetAllowed(1u << BLOCK_PACKED);
+        EXPECT_EQ(BLOCK_PACKED, BlockCodecs::Choose(BlockStats::Of(blocks[2])));
+        EXPECT_EQ(BLOCK_PACKED, BlockCodecs::Choose(BlockStats::Of(blocks[4])));
+        EXPECT_EQ(BLOCK_RAW, BlockCodecs::Choose(BlockStats::Of(blocks[5])));
+    }
+
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
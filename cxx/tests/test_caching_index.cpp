@@ -0,0 +1,148 @@
+#include "gtest/gtest.h"
+#include "caching_index.h"
+#include "primary_btree_index.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+namespace test {
+
+    const size_t TESTD = 2;
+
+    // Answers every query with a single range over the dim 0 filter, turns IN-lists on dim 1 into
+    // ranges, and counts how often it was asked.
+    class FakeIndex : public PrimaryIndexer<TESTD> {
+      public:
+        FakeIndex(size_t* calls) : PrimaryIndexer<TESTD>(0), calls_(calls) {}
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>& q) const override {
+            (*calls_)++;
+            if (q.filters[1].present && !q.filters[1].is_range) {
+                q.filters[1] = {.present = true, .is_range = true,
+                    .ranges = {{q.filters[1].values.front(), q.filters[1].values.back() + 1}},
+                    .values = {}};
+            }
+            const ScalarRange& r = q.filters[0].ranges[0];
+            return Set<PhysicalIndex>({{(PhysicalIndex)r.first, (PhysicalIndex)r.second}}, {});
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+        std::vector<InsertRecord<TESTD>> Insert(const std::vector<Point<TESTD>>&) override {
+            return {};
+        }
+
+      private:
+        size_t* calls_;
+    };
+
+    class CachingIndexTest : public ::testing::Test {
+      protected:
+        Query<TESTD> MakeQuery(Scalar lo, Scalar hi) {
+            Query<TESTD> q;
+            q.filters[0] = {.present = true, .is_range = true, .ranges = {{lo, hi}}, .values = {}};
+            q.filters[1] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+            return q;
+        }
+
+        vector<Point<TESTD>> pts;
+    };
+
+    TEST_F(CachingIndexTest, TestHitsAndMisses) {
+        for (Scalar i = 0; i < 10000; i++) {
+            pts.push_back({(i * 7919) % 10000, i % 13});
+        }
+        PrimaryBTreeIndex<TESTD> uncached(0, 64);
+        vector<Point<TESTD>> uncached_pts = pts;
+        uncached.Init(uncached_pts.begin(), uncached_pts.end());
+        CachingIndex<TESTD> index(std::make_unique<PrimaryBTreeIndex<TESTD>>(0, 64), 1 << 20);
+        index.Init(pts.begin(), pts.end());
+
+        Query<TESTD> q = MakeQuery(100, 2000);
+        Query<TESTD> want_q = q;
+        Set<PhysicalIndex> want = uncached.IndexRanges(want_q);
+        for (size_t i = 0; i < 3; i++) {
+            Query<TESTD> copy = q;
+            // Filters on dims the index doesn't read aren't part of the key.
+            copy.filters[1] = {.present = true, .is_range = false, .ranges = {}, .values = {(Scalar)i}};
+            Set<PhysicalIndex> got = index.IndexRanges(copy);
+            ASSERT_EQ(want.ranges.size(), got.ranges.size());
+            for (size_t r = 0; r < want.ranges.size(); r++) {
+                EXPECT_EQ(want.ranges[r].start, got.ranges[r].start);
+                EXPECT_EQ(want.ranges[r].end, got.ranges[r].end);
+            }
+        }
+        EXPECT_EQ(1, index.Misses());
+        EXPECT_EQ(2, index.Hits());
+
+        Query<TESTD> other = MakeQuery(100, 2001);
+        index.IndexRanges(other);
+        EXPECT_EQ(2, index.Misses());
+    }
+
+    TEST_F(CachingIndexTest, TestRewritesEvictionAndInserts) {
+        size_t calls = 0;
+        // Only room for a few entries.
+        CachingIndex<TESTD> index(std::make_unique<FakeIndex>(&calls), 400, {1});
+        index.Init(pts.begin(), pts.end());
+
+        Query<TESTD> q = MakeQuery(10, 20);
+        q.filters[1] = {.present = true, .is_range = false, .ranges = {}, .values = {3, 5}};
+        Query<TESTD> first = q;
+        index.IndexRanges(first);
+        Query<TESTD> second = q;
+        Set<PhysicalIndex> got = index.IndexRanges(second);
+        EXPECT_EQ(1, calls);
+        EXPECT_EQ(10, got.ranges[0].start);
+        // The rewrite of dim 1 is replayed on a hit.
+        EXPECT_TRUE(second.filters[1].is_range);
+        EXPECT_EQ(first.filters[1].ranges, second.filters[1].ranges);
+
+        // The key doesn't depend on the order of IN values or on duplicates.
+        Query<TESTD> shuffled = q;
+        shuffled.filters[1].values = {5, 3, 5};
+        got = index.IndexRanges(shuffled);
+        EXPECT_EQ(1, calls);
+        EXPECT_EQ(first.filters[1].ranges, shuffled.filters[1].ranges);
+
+        // dim 1 was declared as read by the index, so it's part of the key.
+        q.filters[1].values = {4};
+        Query<TESTD> copy = q;
+        index.IndexRanges(copy);
+        EXPECT_EQ(2, calls);
+
+        // Older entries are evicted once the budget is full.
+        for (Scalar i = 0; i < 10; i++) {
+            Query<TESTD> fill = MakeQuery(100 + i, 200);
+            index.IndexRanges(fill);
+        }
+        copy = q;
+        copy.filters[1].values = {3, 5};
+        index.IndexRanges(copy);
+        EXPECT_EQ(13, calls);
+
+        // Inserts clear the cache.
+        copy = q;
+        copy.filters[1].values = {3, 5};
+        index.IndexRanges(copy);
+        EXPECT_EQ(13, calls);
+        index.Insert({});
+        copy = q;
+        copy.filters[1].values = {3, 5};
+        index.IndexRanges(copy);
+        EXPECT_EQ(14, calls);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,8 +1,11 @@
 #include "gtest/gtest.h"
 #include "composite_index.h"
 
+#include "compressed_column_order_dataset.h"
 #include "secondary_btree_index.h"
 #include "primary_btree_index.h"
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 using namespace std;
@@ -48,6 +51,103 @@ namespace test {
         }
     }
     
+    const size_t PLAND = 3;
+
+    // Maps a range on dim 2, which is dim 0 divided by 10, to the keys with those values, and
+    // counts the lookups. It can't estimate their size.
+    class DividedCorrelationIndex : public CorrelationIndexer<PLAND> {
+      public:
+        explicit DividedCorrelationIndex(size_t* lookups)
+            : CorrelationIndexer<PLAND>(2), lookups_(lookups) {}
+
+        Set<Key> KeyRanges(const Query<PLAND>& q) const override {
+            (*lookups_)++;
+            const ScalarRange& r = q.filters[2].ranges[0];
+            return Set<Key>({{(Key)(r.first * 10), (Key)(r.second * 10)}}, {});
+        }
+
+        void Init(ConstPointIterator<PLAND>, ConstPointIterator<PLAND>) override {}
+
+        size_t Size() const override {
+            return 0;
+        }
+
+      private:
+        size_t* lookups_;
+    };
+
+    // Defined before TestInitWithSecondary, which aborts the binary.
+    TEST_F(CompositeIndexTest, TestPlanChoosesCheapestPath) {
+        std::vector<Point<PLAND>> pts;
+        srand(42);
+        for (Scalar i = 0; i < 20000; i++) {
+            pts.push_back({i, rand() % 1000, i / 10});
+        }
+        CompositeIndex<PLAND> index(1);
+        index.SetPrimaryIndex(std::make_unique<PrimaryBTreeIndex<PLAND>>(0, 64));
+        index.AddSecondaryIndex(std::make_unique<SecondaryBTreeIndex<PLAND>>(1));
+        // Mixing correlation and secondary indexes is allowed.
+        size_t lookups = 0;
+        index.AddCorrelationIndex(std::make_unique<DividedCorrelationIndex>(&lookups));
+        index.Init(pts.begin(), pts.end());
+        index.SetDataset(std::make_shared<CompressedColumnOrderDataset<PLAND>>(pts));
+
+        auto check = [&](Query<PLAND> q) {
+            Query<PLAND> copy = q;
+            Set<PhysicalIndex> got = index.IndexRanges(copy);
+            for (size_t i = 0; i < pts.size(); i++) {
+                bool match = true;
+                for (size_t d = 0; d < PLAND; d++) {
+                    const QueryFilter& f = q.filters[d];
+                    if (f.present && f.is_range) {
+                        match &= pts[i][d] >= f.ranges[0].first && pts[i][d] < f.ranges[0].second;
+                    } else if (f.present) {
+                        match &= std::find(f.values.begin(), f.values.end(), pts[i][d]) != f.values.end();
+                    }
+                }
+                if (!match) {
+                    continue;
+                }
+                bool found = std::binary_search(got.list.begin(), got.list.end(), i);
+                for (const auto& r : got.ranges) {
+                    found |= i >= r.start && i < r.end;
+                }
+                EXPECT_TRUE(found) << "Missing index " << i;
+            }
+        };
+
+        // The primary index narrows the query down enough on its own.
+        Query<PLAND> q;
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{100, 200}}, .values = {}};
+        q.filters[1] = {.present = true, .is_range = false, .ranges = {}, .values = {5, 6}};
+        q.filters[2] = {.present = false};
+        auto plan = index.Explain(q);
+        EXPECT_FALSE(plan.full_scan);
+        EXPECT_FALSE(plan.use_secondary);
+        EXPECT_FALSE(plan.use_correlation);
+        check(q);
+
+        // Only the secondary index is selective.
+        q.filters[0] = {.present = false};
+        plan = index.Explain(q);
+        EXPECT_TRUE(plan.use_secondary);
+        EXPECT_FALSE(plan.use_correlation);
+        check(q);
+
+        // The correlation index is more selective than the secondary index.
+        q.filters[1] = {.present = true, .is_range = true, .ranges = {{0, 500}}, .values = {}};
+        q.filters[2] = {.present = true, .is_range = true, .ranges = {{50, 60}}, .values = {}};
+        plan = index.Explain(q);
+        EXPECT_TRUE(plan.use_correlation);
+        EXPECT_FALSE(plan.use_secondary);
+        check(q);
+        // The lookup the plan needed for its estimate is reused.
+        lookups = 0;
+        Query<PLAND> copy = q;
+        index.IndexRanges(copy);
+        EXPECT_EQ(1, lookups);
+    }
+
     TEST_F(CompositeIndexTest, TestInitWithSecondary) {
         auto pts = ValuesToPoints({10, 6, 6, 7, 8, 2, 3, 5, 1, 2, 9, 4});
         auto sindex = std::make_unique<SecondaryBTreeIndex<TESTD>>(0);
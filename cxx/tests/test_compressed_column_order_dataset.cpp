@@ -1,8 +1,13 @@
 #include "gtest/gtest.h"
 #include "compressed_column_order_dataset.h"
+#include "simd_kernels.h"
 #include <vector>
 #include <array>
 #include <bitset>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <omp.h>
 
 using namespace std;
 
@@ -12,6 +17,11 @@ namespace test {
     const size_t TEST_DIM = 1;
     class CompressedColumnDatasetTest : public ::testing::Test {
       protected:
+        // A scratch file in the temporary directory, so that test runs leave the tree alone.
+        std::string TempFile(const std::string& name) {
+            return (std::filesystem::temp_directory_path() / name).string();
+        }
+
         Column GenBlockData(Scalar offset, Scalar max_diff, size_t n) {
             std::vector<Point<TEST_DIM>> data;
             for(size_t i = 0; i < n; i++) {
@@ -201,6 +211,481 @@ namespace test {
         EXPECT_EQ(want, got);
     }
 
+    TEST_F(CompressedColumnDatasetTest, TestPredicatesAllSimdLevels) {
+        // Blocks with different bit widths, including a constant block.
+        Column data = GenBlockData(1000, 1000, 512);
+        Column wide = GenBlockData(-5000000, 40000000, 512);
+        Column narrow = GenBlockData(7, 3, 512);
+        Column constant = GenBlockData(42, 1, 300);
+        data.insert(data.end(), wide.begin(), wide.end());
+        data.insert(data.end(), narrow.begin(), narrow.end());
+        data.insert(data.end(), constant.begin(), constant.end());
+        CompressedColumnOrderDataset<TEST_DIM> dset(data);
+
+        const std::vector<std::pair<Scalar, Scalar>> bounds = {
+            {1200, 1500}, {-1000000, 20000000}, {8, 9}, {42, 43}, {0, 2000}, {5000, 4000}};
+        const std::unordered_set<Scalar> vset = {1003, 1500, 7, 9, 42};
+        for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            SimdKernels::SetLevel(level);
+            // Runs of different lengths, some of which cross a block boundary.
+            for (size_t start = 0; start < data.size(); start += 37) {
+                size_t end = std::min(data.size(), start + 1 + (start % 64));
+                for (const auto& b : bounds) {
+                    uint64_t want_closed = 0, want_open = 0, want_set = 0;
+                    for (size_t i = start; i < end; i++) {
+                        Scalar val = data[i][0];
+                        want_closed = (want_closed << 1) | (val >= b.first && val <= b.second);
+                        want_open = (want_open << 1) | (val >= b.first && val < b.second);
+                        want_set = (want_set << 1) | (vset.count(val) > 0);
+                    }
+                    EXPECT_EQ(want_closed, dset.GetCoordRange(start, end, 0, b.first, b.second));
+                    EXPECT_EQ(want_open, dset.GetCoordInRange(start, end, 0, b.first, b.second));
+                    EXPECT_EQ(want_set, dset.GetCoordInSet(start, end, 0, vset));
+                }
+            }
+        }
+        SimdKernels::SetLevel(SimdKernels::DetectLevel());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestGetCoordInValueSet) {
+        Column data = GenBlockData(1000, 40, 700);
+        Column sparse = GenBlockData(-300000, 1000000, 400);
+        data.insert(data.end(), sparse.begin(), sparse.end());
+        CompressedColumnOrderDataset<TEST_DIM> dset(data);
+
+        std::vector<Scalar> small = {1003, 1017, 1039, 1003};
+        std::vector<Scalar> compact, spread;
+        for (Scalar v = 1000; v < 1040; v += 3) {
+            compact.push_back(v);
+        }
+        for (size_t i = 1000; i < 1100; i += 4) {
+            spread.push_back(data[i][0]);
+        }
+        spread.push_back(1021);
+        ValueSet small_set(small), compact_set(compact), spread_set(spread);
+        EXPECT_EQ(ValueSet::LINEAR, small_set.GetStrategy());
+        EXPECT_EQ(3, small_set.Size());
+        EXPECT_EQ(ValueSet::BITMAP, compact_set.GetStrategy());
+        EXPECT_EQ(ValueSet::SORTED, spread_set.GetStrategy());
+
+        for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            SimdKernels::SetLevel(level);
+            for (const ValueSet* vset : {&small_set, &compact_set, &spread_set}) {
+                for (size_t start = 0; start < data.size(); start += 29) {
+                    size_t end = std::min(data.size(), start + 1 + (start % 64));
+                    uint64_t want = 0;
+                    for (size_t i = start; i < end; i++) {
+                        want = (want << 1) | vset->Contains(data[i][0]);
+                    }
+                    EXPECT_EQ(want, dset.GetCoordInSet(start, end, 0, *vset));
+                }
+            }
+        }
+        SimdKernels::SetLevel(SimdKernels::DetectLevel());
+
+        for (Scalar v = 990; v < 1050; v++) {
+            bool in_compact = v >= 1000 && v < 1040 && (v - 1000) % 3 == 0;
+            EXPECT_EQ(in_compact, compact_set.Contains(v));
+            EXPECT_EQ(std::find(small.begin(), small.end(), v) != small.end(), small_set.Contains(v));
+            EXPECT_EQ(std::find(spread.begin(), spread.end(), v) != spread.end(), spread_set.Contains(v));
+        }
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestGetCoordInRanges) {
+        Column data = GenBlockData(1000, 400, 700);
+        Column sparse = GenBlockData(-300000, 1000000, 400);
+        data.insert(data.end(), sparse.begin(), sparse.end());
+        CompressedColumnOrderDataset<TEST_DIM> dset(data);
+
+        // Unsorted and overlapping; coalesced into [1010, 1050), [1100, 1101), [1200, 1300).
+        RangeSet few({{1200, 1300}, {1010, 1030}, {1020, 1050}, {1100, 1101}, {1400, 1400}});
+        EXPECT_EQ(3, few.Size());
+        std::vector<ScalarRange> stripes;
+        for (Scalar v = -300000; v < 700000; v += 10000) {
+            stripes.emplace_back(v, v + 3000);
+        }
+        stripes.emplace_back(1000, 1100);
+        RangeSet many(stripes);
+
+        for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            SimdKernels::SetLevel(level);
+            for (const RangeSet* rset : {&few, &many}) {
+                for (size_t start = 0; start < data.size(); start += 29) {
+                    size_t end = std::min(data.size(), start + 1 + (start % 64));
+                    uint64_t want = 0;
+                    for (size_t i = start; i < end; i++) {
+                        want = (want << 1) | rset->Contains(data[i][0]);
+                    }
+                    EXPECT_EQ(want, dset.GetCoordInRanges(start, end, 0, *rset));
+                }
+            }
+        }
+        SimdKernels::SetLevel(SimdKernels::DetectLevel());
+
+        for (Scalar v = 990; v < 1450; v++) {
+            bool in_few = (v >= 1010 && v < 1050) || v == 1100 || (v >= 1200 && v < 1300);
+            EXPECT_EQ(in_few, few.Contains(v));
+        }
+        EXPECT_TRUE(few.Covers(1010, 1049));
+        EXPECT_FALSE(few.Covers(1010, 1050));
+        EXPECT_TRUE(few.Intersects(1050, 1100));
+        EXPECT_FALSE(few.Intersects(1101, 1199));
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestDatacubes) {
+        size_t size = 1500;
+        Column data = GenBlockData(-500, 1000, size);
+        // Column 1 is the key, so the cubes are columns 2, 3 and 4.
+        std::vector<Datacube<TEST_DIM>> cubes = {
+            Datacube<TEST_DIM>::Materialize([](const Point<TEST_DIM>& p) { return 3 * p[0]; }),
+            Datacube<TEST_DIM>::PrefixSum(0),
+            Datacube<TEST_DIM>::PrefixSum(2),
+        };
+        CompressedColumnOrderDataset<TEST_DIM> dset(data, cubes);
+
+        for (size_t i = 0; i < size; i += 97) {
+            EXPECT_EQ(3 * data[i][0], dset.GetCoord(i, 2));
+        }
+        Scalar sum;
+        // The key column has no prefix sums.
+        EXPECT_FALSE(dset.GetExactRangeSum(0, 10, 1, &sum));
+        for (size_t start = 0; start < size; start += 131) {
+            for (size_t end : {start, start + 1, start + 500, size}) {
+                end = std::min(end, size);
+                Scalar want = 0;
+                for (size_t i = start; i < end; i++) {
+                    want += data[i][0];
+                }
+                ASSERT_TRUE(dset.GetExactRangeSum(start, end, 0, &sum));
+                EXPECT_EQ(want, sum);
+                ASSERT_TRUE(dset.GetExactRangeSum(start, end, 2, &sum));
+                EXPECT_EQ(3 * want, sum);
+            }
+        }
+
+        for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            SimdKernels::SetLevel(level);
+            for (size_t start = 0; start < size; start += 37) {
+                size_t end = std::min(size, start + 1 + (start % 64));
+                uint64_t valids = ((uint64_t)rand() << 32) ^ rand();
+                Scalar want = 0;
+                for (size_t i = start; i < end; i++) {
+                    if (valids & (1UL << (end - 1 - i))) {
+                        want += 3 * data[i][0];
+                    }
+                }
+                EXPECT_EQ(want, dset.GetRangeSum(start, end, 2, valids));
+            }
+        }
+        SimdKernels::SetLevel(SimdKernels::DetectLevel());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestSaveAndOpen) {
+        size_t size = 3000;
+        Column data = GenBlockData(-5000, 100000, size);
+        std::vector<Datacube<TEST_DIM>> cubes = {Datacube<TEST_DIM>::PrefixSum(0)};
+        CompressedColumnOrderDataset<TEST_DIM> dset(data, cubes);
+        std::string filename = TempFile("testing_dataset.tmp");
+        dset.Save(filename);
+
+        auto mapped = CompressedColumnOrderDataset<TEST_DIM>::Open(filename);
+        ASSERT_NE(nullptr, mapped);
+        EXPECT_EQ(size, mapped->Size());
+        EXPECT_EQ(dset.SizeInBytes(), mapped->SizeInBytes());
+        // Sections are aligned for in-place use.
+        EXPECT_EQ(0, (uintptr_t) mapped->cblocks_ % 64);
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_EQ(data[i][0], mapped->GetCoord(i, 0));
+        }
+        EXPECT_EQ(dset.GetCoordInRange(100, 2900, 0, 0, 50000),
+                mapped->GetCoordInRange(100, 2900, 0, 0, 50000));
+        Scalar sum, want;
+        ASSERT_TRUE(mapped->GetExactRangeSum(10, 2000, 0, &sum));
+        ASSERT_TRUE(dset.GetExactRangeSum(10, 2000, 0, &want));
+        EXPECT_EQ(want, sum);
+
+        Set<Key> keys({{5, 700}, {2999, 3000}}, {42, 2999});
+        Set<PhysicalIndex> want_ixs = dset.Lookup(keys);
+        Set<PhysicalIndex> ixs = mapped->Lookup(keys);
+        ASSERT_EQ(want_ixs.ranges.size(), ixs.ranges.size());
+        for (size_t i = 0; i < ixs.ranges.size(); i++) {
+            EXPECT_EQ(want_ixs.ranges[i].start, ixs.ranges[i].start);
+            EXPECT_EQ(want_ixs.ranges[i].end, ixs.ranges[i].end);
+        }
+        EXPECT_EQ(want_ixs.list, ixs.list);
+
+        // A mapped dataset can be saved again.
+        mapped->Save(filename + "2", "spec=a");
+        auto remapped = CompressedColumnOrderDataset<TEST_DIM>::Open(filename + "2", "spec=a");
+        ASSERT_NE(nullptr, remapped);
+        EXPECT_EQ(data[1234][0], remapped->GetCoord(1234, 0));
+        // Files built from other data or parameters are rejected.
+        EXPECT_EQ(nullptr, CompressedColumnOrderDataset<TEST_DIM>::Open(filename + "2", "spec=b"));
+        EXPECT_EQ(nullptr, CompressedColumnOrderDataset<TEST_DIM>::Open(filename + "2"));
+        // So are files whose sections don't fit in them.
+        {
+            std::fstream f(filename + "2", std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(offsetof(CompressedDatasetFileHeader, keys_offset));
+            uint64_t keys_offset = std::filesystem::file_size(filename + "2");
+            f.write((const char*) &keys_offset, sizeof(keys_offset));
+        }
+        EXPECT_EQ(nullptr, CompressedColumnOrderDataset<TEST_DIM>::Open(filename + "2", "spec=a"));
+        std::remove((filename + "2").c_str());
+
+        // Files from other versions or dimensions are rejected.
+        EXPECT_EQ(nullptr, CompressedColumnOrderDataset<2>::Open(filename));
+        {
+            std::fstream f(filename, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(8);
+            uint32_t version = COMPRESSED_DATASET_VERSION + 1;
+            f.write((const char*) &version, sizeof(version));
+        }
+        EXPECT_EQ(nullptr, CompressedColumnOrderDataset<TEST_DIM>::Open(filename));
+        EXPECT_EQ(nullptr,
+                CompressedColumnOrderDataset<TEST_DIM>::Open(TempFile("does_not_exist.tmp")));
+        std::remove(filename.c_str());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestDictionaryEncoding) {
+        // A few widely spread values, as with hashed categorical ids.
+        std::vector<Scalar> categories = {-(1L << 50), 17, 1L << 40, (1L << 40) + 1, 1L << 54};
+        size_t size = 2000;
+        Column data;
+        for (size_t i = 0; i < size; i++) {
+            data.push_back({categories[rand() % categories.size()]});
+        }
+        CompressedColumnOrderDataset<TEST_DIM> plain(data);
+        CompressedColumnOrderDataset<TEST_DIM> dset(data, std::vector<Scalar>(),
+                std::vector<Datacube<TEST_DIM>>(), {0});
+        // Codes take 3 bits instead of the 55 the values span.
+        EXPECT_EQ(3, dset.cblocks_[0].bit_width);
+        EXPECT_LT(dset.SizeInBytes(), plain.SizeInBytes());
+        size_t dictionary_size;
+        const Scalar* dictionary = dset.Dictionary(0, &dictionary_size);
+        ASSERT_NE(nullptr, dictionary);
+        EXPECT_EQ(std::vector<Scalar>(categories.begin(), categories.end()),
+                std::vector<Scalar>(dictionary, dictionary + dictionary_size));
+        size_t key_dictionary_size;
+        EXPECT_EQ(nullptr, dset.Dictionary(1, &key_dictionary_size));
+
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_EQ(data[i][0], dset.GetCoord(i, 0));
+        }
+        Scalar min, max;
+        dset.BlockBounds(700, 0, &min, &max);
+        EXPECT_EQ(categories.front(), min);
+        EXPECT_EQ(categories.back(), max);
+
+        std::vector<ScalarRange> ranges = {{0, 1L << 40}, {(1L << 40) + 1, 1L << 59}};
+        RangeSet rset(ranges);
+        RangeSet encoded_rset(ranges, dictionary, dictionary_size);
+        ASSERT_NE(nullptr, encoded_rset.Encoded(dictionary));
+        EXPECT_EQ(nullptr, rset.Encoded(dictionary));
+        ValueSet vset({17, 1L << 54, 5});
+        ValueSet encoded_vset({17, 1L << 54, 5}, dictionary, dictionary_size);
+        for (size_t start = 0; start + 64 <= size; start += 50) {
+            size_t end = start + 1 + start % 64;
+            uint64_t want = plain.GetCoordInRanges(start, end, 0, rset);
+            EXPECT_EQ(want, dset.GetCoordInRanges(start, end, 0, rset));
+            EXPECT_EQ(want, dset.GetCoordInRanges(start, end, 0, encoded_rset));
+            want = plain.GetCoordInSet(start, end, 0, vset);
+            EXPECT_EQ(want, dset.GetCoordInSet(start, end, 0, vset));
+            EXPECT_EQ(want, dset.GetCoordInSet(start, end, 0, encoded_vset));
+            EXPECT_EQ(plain.GetCoordRange(start, end, 0, 17, 1L << 40),
+                    dset.GetCoordRange(start, end, 0, 17, 1L << 40));
+            EXPECT_EQ(0, dset.GetCoordInRange(start, end, 0, 18, 1L << 40));
+            uint64_t valids = ((uint64_t)rand() << 32) ^ rand();
+            EXPECT_EQ(plain.GetRangeSum(start, end, 0, valids), dset.GetRangeSum(start, end, 0, valids));
+            std::vector<Scalar> want_values, values;
+            plain.GetRangeValues(start, end, 0, valids, &want_values);
+            dset.GetRangeValues(start, end, 0, valids, &values);
+            EXPECT_EQ(want_values, values);
+        }
+
+        // Dictionaries are saved and mapped with the rest of the dataset.
+        std::string filename = TempFile("testing_dataset.tmp");
+        dset.Save(filename);
+        auto mapped = CompressedColumnOrderDataset<TEST_DIM>::Open(filename);
+        ASSERT_NE(nullptr, mapped);
+        ASSERT_NE(nullptr, mapped->Dictionary(0, &dictionary_size));
+        EXPECT_EQ(categories.size(), dictionary_size);
+        for (size_t i = 0; i < size; i += 7) {
+            ASSERT_EQ(data[i][0], mapped->GetCoord(i, 0));
+        }
+        EXPECT_EQ(plain.GetCoordInRanges(64, 128, 0, rset), mapped->GetCoordInRanges(64, 128, 0, rset));
+        std::remove(filename.c_str());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestRunLengthEncoding) {
+        // Sorted runs of 1 to 40 equal values, as in a column the data is sorted by, followed by
+        // a block of unsorted values.
+        Column data;
+        Scalar v = -1000;
+        while (data.size() < 1100) {
+            size_t run = 1 + rand() % 40;
+            for (size_t i = 0; i < run && data.size() < 1100; i++) {
+                data.push_back({v});
+            }
+            v += 1 + rand() % 300;
+        }
+        Column tail = GenBlockData(0, 1000, 500);
+        data.insert(data.end(), tail.begin(), tail.end());
+        size_t size = data.size();
+        CompressedColumnOrderDataset<TEST_DIM> dset(data);
+        CompressedColumnOrderDataset<TEST_DIM> dict(data, std::vector<Scalar>(),
+                std::vector<Datacube<TEST_DIM>>(), {0});
+        EXPECT_EQ(BLOCK_RLE, dset.cblocks_[0].encoding);
+        EXPECT_EQ(BLOCK_RLE, dict.cblocks_[1].encoding);
+        EXPECT_EQ(BLOCK_PACKED, dset.cblocks_[3].encoding);
+
+        RangeSet rset({{-900, -500}, {0, 2000}, {3000, 3001}});
+        ValueSet vset({data[3][0], data[700][0], data[1099][0], 17});
+        for (const CompressedColumnOrderDataset<TEST_DIM>* d : {&dset, &dict}) {
+            for (size_t i = 0; i < size; i++) {
+                ASSERT_EQ(data[i][0], d->GetCoord(i, 0));
+            }
+            for (size_t start = 0; start < size; start += 13) {
+                size_t end = std::min(size, start + 1 + (start % 64));
+                uint64_t want_range = 0, want_ranges = 0, want_set = 0;
+                uint64_t valids = ((uint64_t)rand() << 32) ^ rand();
+                Scalar want_sum = 0;
+                std::vector<Scalar> want_values, values;
+                for (size_t i = start; i < end; i++) {
+                    Scalar x = data[i][0];
+                    want_range = (want_range << 1) | (x >= 0 && x <= 5000);
+                    want_ranges = (want_ranges << 1) | rset.Contains(x);
+                    want_set = (want_set << 1) | vset.Contains(x);
+                    if (valids & (1UL << (end - i - 1))) {
+                        want_sum += x;
+                        want_values.push_back(x);
+                    }
+                }
+                EXPECT_EQ(want_range, d->GetCoordRange(start, end, 0, 0, 5000));
+                EXPECT_EQ(want_ranges, d->GetCoordInRanges(start, end, 0, rset));
+                EXPECT_EQ(want_set, d->GetCoordInSet(start, end, 0, vset));
+                EXPECT_EQ(want_sum, d->GetRangeSum(start, end, 0, valids));
+                d->GetRangeValues(start, end, 0, valids, &values);
+                EXPECT_EQ(want_values, values);
+                Scalar decoded[64];
+                d->DecodeRange(start, end, 0, decoded);
+                for (size_t i = start; i < end; i++) {
+                    ASSERT_EQ(data[i][0], decoded[i - start]);
+                }
+            }
+        }
+
+        // The encoding is saved with the blocks.
+        std::string filename = TempFile("testing_dataset.tmp");
+        dset.Save(filename);
+        auto mapped = CompressedColumnOrderDataset<TEST_DIM>::Open(filename);
+        ASSERT_NE(nullptr, mapped);
+        for (size_t i = 0; i < size; i++) {
+            ASSERT_EQ(data[i][0], mapped->GetCoord(i, 0));
+        }
+        std::remove(filename.c_str());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestAdaptiveEncodings) {
+        size_t block = 1 << COLUMN_COMPRESSION_BLOCK_SIZE_POW;
+        // A constant block, one spanning all 64 bits, one with a few spread values, and one of
+        // small random values.
+        Column data(block, {-7});
+        Column wide = GenBlockData(0, 1000, block);
+        wide[5][0] = std::numeric_limits<Scalar>::min();
+        wide[400][0] = std::numeric_limits<Scalar>::max();
+        data.insert(data.end(), wide.begin(), wide.end());
+        for (size_t i = 0; i < block; i++) {
+            data.push_back({(Scalar)(rand() % 4) << 40});
+        }
+        Column small = GenBlockData(100, 50, 300);
+        data.insert(data.end(), small.begin(), small.end());
+        CompressedColumnOrderDataset<TEST_DIM> dset(data);
+        std::vector<size_t> encodings = dset.ColumnEncodings(0);
+        EXPECT_EQ(1, encodings[BLOCK_CONSTANT]);
+        EXPECT_EQ(1, encodings[BLOCK_RAW]);
+        EXPECT_EQ(1, encodings[BLOCK_DICTIONARY]);
+        EXPECT_EQ(1, encodings[BLOCK_PACKED]);
+        // The key column.
+        EXPECT_EQ(4, dset.ColumnEncodings(1)[BLOCK_PACKED]);
+
+        for (size_t i = 0; i < data.size(); i++) {
+            ASSERT_EQ(data[i][0], dset.GetCoord(i, 0));
+        }
+        Scalar min, max;
+        dset.BlockBounds(block, 0, &min, &max);
+        EXPECT_EQ(std::numeric_limits<Scalar>::min(), min);
+        EXPECT_EQ(std::numeric_limits<Scalar>::max(), max);
+        for (size_t start = 0; start < data.size(); start += 41) {
+            size_t end = std::min(data.size(), start + 1 + (start % 64));
+            uint64_t want = 0;
+            Scalar want_sum = 0;
+            for (size_t i = start; i < end; i++) {
+                want = (want << 1) | (data[i][0] >= -7 && data[i][0] <= (1L << 40));
+                want_sum += data[i][0];
+            }
+            EXPECT_EQ(want, dset.GetCoordRange(start, end, 0, -7, 1L << 40));
+            EXPECT_EQ(want_sum, dset.GetRangeSum(start, end, 0, ~0UL));
+        }
+
+        std::string filename = TempFile("testing_dataset.tmp");
+        dset.Save(filename);
+        auto mapped = CompressedColumnOrderDataset<TEST_DIM>::Open(filename);
+        ASSERT_NE(nullptr, mapped);
+        EXPECT_EQ(encodings, mapped->ColumnEncodings(0));
+        for (size_t i = 0; i < data.size(); i++) {
+            ASSERT_EQ(data[i][0], mapped->GetCoord(i, 0));
+        }
+        std::remove(filename.c_str());
+    }
+
+    TEST_F(CompressedColumnDatasetTest, TestParallelConstruction) {
+        // Blocks of different encodings, so that most blocks start in the middle of a byte.
+        Column data;
+        for (size_t b = 0; b < 40; b++) {
+            Column block = GenBlockData(-(Scalar)b * 1000, 1 + b * 37, 512);
+            if (b % 5 == 1) {
+                block[b] = {std::numeric_limits<Scalar>::max() / 3};
+            } else if (b % 5 == 2) {
+                for (size_t i = 0; i < block.size(); i++) {
+                    block[i] = {(Scalar)(i / 100)};
+                }
+            }
+            data.insert(data.end(), block.begin(), block.end());
+        }
+        data.resize(data.size() - 123);
+        std::vector<Datacube<TEST_DIM>> cubes = {
+            Datacube<TEST_DIM>::PrefixSum(0),
+            Datacube<TEST_DIM>::Materialize([](const Point<TEST_DIM>& p) { return p[0] % 7; }),
+            Datacube<TEST_DIM>::PrefixSum(2),
+            Datacube<TEST_DIM>::PrefixSum(3),
+        };
+
+        // The result doesn't depend on how many threads build it.
+        std::vector<std::string> files;
+        for (int threads : {1, 3, 8}) {
+            omp_set_num_threads(threads);
+            CompressedColumnOrderDataset<TEST_DIM> dset(data, std::vector<Scalar>(), cubes);
+            Scalar sum = 0, sum_of_sums = 0;
+            for (size_t i = 0; i < data.size(); i++) {
+                sum += data[i][0];
+                sum_of_sums += sum;
+                ASSERT_EQ(data[i][0], dset.GetCoord(i, 0)) << i;
+                ASSERT_EQ((Scalar)i, dset.GetCoord(i, 1));
+                ASSERT_EQ(sum, dset.GetCoord(i, 2));
+                ASSERT_EQ(data[i][0] % 7, dset.GetCoord(i, 3));
+                ASSERT_EQ(sum_of_sums, dset.GetCoord(i, 4));
+            }
+            std::string filename = TempFile("testing_dataset.tmp");
+            dset.Save(filename);
+            std::ifstream file(filename, std::ios::binary);
+            files.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            std::remove(filename.c_str());
+        }
+        omp_set_num_threads(omp_get_num_procs());
+        EXPECT_EQ(files[0], files[1]);
+        EXPECT_EQ(files[0], files[2]);
+    }
+
 }
 
 int main(int argc, char **argv) {
@@ -0,0 +1,81 @@
+#include "gtest/gtest.h"
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace test {
+
+    class LatencyHistogramTest : public ::testing::Test {};
+
+    TEST_F(LatencyHistogramTest, TestSmallValuesAreExact) {
+        LatencyHistogram h;
+        EXPECT_EQ(0, h.Percentile(50));
+        for (uint64_t v = 1; v <= 100; v++) {
+            h.Record(v);
+        }
+        EXPECT_EQ(100, h.Count());
+        EXPECT_EQ(1, h.Min());
+        EXPECT_EQ(100, h.Max());
+        EXPECT_DOUBLE_EQ(50.5, h.Mean());
+        EXPECT_EQ(1, h.Percentile(0));
+        EXPECT_EQ(50, h.Percentile(50));
+        EXPECT_EQ(90, h.Percentile(90));
+        EXPECT_EQ(99, h.Percentile(99));
+        EXPECT_EQ(100, h.Percentile(100));
+    }
+
+    TEST_F(LatencyHistogramTest, TestPercentilesWithinPrecision) {
+        std::mt19937_64 gen(7);
+        std::lognormal_distribution<double> dist(13, 2);
+        vector<uint64_t> values;
+        LatencyHistogram h;
+        for (size_t i = 0; i < 100000; i++) {
+            uint64_t v = (uint64_t) dist(gen);
+            values.push_back(v);
+            h.Record(v);
+        }
+        sort(values.begin(), values.end());
+        for (double p : {1.0, 50.0, 90.0, 99.0, 99.9}) {
+            uint64_t exact = values[(size_t) std::ceil(p / 100 * values.size()) - 1];
+            uint64_t approx = h.Percentile(p);
+            EXPECT_GE(approx, exact);
+            EXPECT_LE(approx, exact + exact / LatencyHistogram::SUB_BUCKETS + 1);
+        }
+        EXPECT_EQ(values.back(), h.Max());
+        EXPECT_EQ(values.back(), h.Percentile(100));
+    }
+
+    TEST_F(LatencyHistogramTest, TestMergeAndExtremes) {
+        LatencyHistogram a, b;
+        a.Record(0);
+        b.Record(~0UL);
+        b.Record(1UL << 40);
+        a.Merge(b);
+        EXPECT_EQ(3, a.Count());
+        EXPECT_EQ(0, a.Min());
+        EXPECT_EQ(~0UL, a.Max());
+        EXPECT_EQ(0, a.Percentile(33));
+        uint64_t mid = a.Percentile(50);
+        EXPECT_GE(mid, 1UL << 40);
+        EXPECT_LE(mid, (1UL << 40) + (1UL << 33));
+        EXPECT_EQ(~0UL, a.Percentile(100));
+
+        std::ostringstream json;
+        a.WriteJson(json);
+        EXPECT_EQ(0, json.str().find("{\"count\": 3, \"min\": 0"));
+        a.Reset();
+        EXPECT_EQ(0, a.Count());
+        EXPECT_EQ(0, a.Max());
+    }
+
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include "merge_utils.h"
+#include "range_cursor.h"
 
 #include <random>
 #include <chrono>
@@ -68,6 +69,31 @@ namespace test {
         EXPECT_TRUE(ArrayEqual(got_set.list, want_list));
     }
 
+    TEST_F(MergeUtilsTest, TestIntersectKeepsExactness) {
+        Set<PhysicalIndex> s1({{5, 10, true}, {15, 20, false}, {50, 60, true}}, {});
+        s1.exact_range_dims = 0b01;
+        Set<PhysicalIndex> s2({{8, 18, true}, {25, 30, false}, {50, 55, false}}, {});
+        s2.exact_range_dims = 0b10;
+        s2.guaranteed_dims = 0b100;
+
+        auto got = MergeUtils::Intersect<PhysicalIndex>(s1, s2);
+        ASSERT_TRUE(ArrayEqual(got.ranges, Ranges<PhysicalIndex>({{8, 10}, {15, 18}, {50, 55}})));
+        EXPECT_TRUE(got.ranges[0].exact);
+        EXPECT_FALSE(got.ranges[1].exact);
+        EXPECT_FALSE(got.ranges[2].exact);
+        EXPECT_EQ(got.exact_range_dims, 0b11UL);
+        EXPECT_EQ(got.guaranteed_dims, 0b100UL);
+
+        // A set without exact ranges doesn't take away the other one's.
+        Set<PhysicalIndex> s3({{0, 100}}, {});
+        auto got13 = MergeUtils::Intersect<PhysicalIndex>(s1, s3);
+        ASSERT_EQ(got13.ranges.size(), 3);
+        EXPECT_TRUE(got13.ranges[0].exact);
+        EXPECT_FALSE(got13.ranges[1].exact);
+        EXPECT_TRUE(got13.ranges[2].exact);
+        EXPECT_EQ(got13.exact_range_dims, 0b01UL);
+    }
+
     TEST_F(MergeUtilsTest, TestUnionHeap) {
         List<PhysicalIndex> l1 = {1, 3, 5, 7};
         List<PhysicalIndex> l2 = {4, 6, 9, 19, 20};
@@ -85,6 +111,36 @@ namespace test {
         EXPECT_TRUE(ArrayEqual(got, want));
     }
 
+    TEST_F(MergeUtilsTest, TestCursors) {
+        auto cursor = [](const Ranges<PhysicalIndex>& ranges, const List<PhysicalIndex>& list) {
+            return std::make_unique<SetCursor>(Set<PhysicalIndex>(ranges, list));
+        };
+
+        UnionCursor u(cursor({{0, 10, true}, {20, 30}}, {15, 40}),
+                cursor({{5, 12}, {30, 35}, {50, 60, true}}, {12, 15, 55}));
+        Set<PhysicalIndex> got = u.Drain();
+        Ranges<PhysicalIndex> want_union = {{0, 12}, {20, 35}, {50, 60}};
+        ASSERT_TRUE(ArrayEqual(got.ranges, want_union));
+        EXPECT_FALSE(got.ranges[0].exact);
+        EXPECT_TRUE(got.ranges[2].exact);
+        // Points inside the ranges are dropped from the list.
+        ASSERT_TRUE(ArrayEqual(got.list, {12, 15, 40}));
+
+        IntersectCursor i(cursor({{0, 10, true}, {20, 30, true}}, {}),
+                cursor({{5, 25, true}, {28, 40}}, {}));
+        got = i.Drain();
+        Ranges<PhysicalIndex> want_intersect = {{5, 10}, {20, 25}, {28, 30}};
+        ASSERT_TRUE(ArrayEqual(got.ranges, want_intersect));
+        EXPECT_TRUE(got.ranges[1].exact);
+        EXPECT_FALSE(got.ranges[2].exact);
+
+        OffsetCursor o(cursor({{0, 5}}, {7}), 100);
+        got = o.Drain();
+        Ranges<PhysicalIndex> want_offset = {{100, 105}};
+        ASSERT_TRUE(ArrayEqual(got.ranges, want_offset));
+        ASSERT_TRUE(ArrayEqual(got.list, {107}));
+    }
+
     TEST_F(MergeUtilsTest, TimedTest) {
         std::default_random_engine gen;
         std::uniform_int_distribution<int> dist(1,1<<30);
@@ -61,6 +61,25 @@ namespace test {
         }
     }
     
+    TEST_F(PrimaryBTreeIndexTest, TestExactRanges) {
+        auto pts = ValuesToPoints({10, 6, 7, 8, 2, 3, 5, 1, 11, 12, 9, 4});
+        // Pages are {1, 2, 3}, {4, 5, 6}, {7, 8, 9}, {10, 11, 12}
+        PrimaryBTreeIndex<TESTD> index(0, 3);
+        index.Init(pts.begin(), pts.end());
+        Query<TESTD> q;
+        q.filters[1] = {.present = false};
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{2, 11}}, .values = {}};
+        Set<PhysicalIndex> result = index.IndexRanges(q);
+        std::vector<Range<PhysicalIndex>> want = {{0, 3, false}, {3, 9, true}, {9, 12, false}};
+        ASSERT_EQ(result.ranges.size(), want.size());
+        for (size_t i = 0; i < want.size(); i++) {
+            EXPECT_EQ(result.ranges[i], want[i]);
+            EXPECT_EQ(result.ranges[i].exact, want[i].exact);
+        }
+        EXPECT_EQ(result.exact_range_dims, 1UL);
+        EXPECT_EQ(result.guaranteed_dims, 0UL);
+    }
+
     TEST_F(PrimaryBTreeIndexTest, TestAdjacentRanges) {
         auto pts = ValuesToPoints({10, 6, 6, 7, 8, 2, 3, 5, 1, 2, 9, 4});
         PrimaryBTreeIndex<TESTD> index(0, 1);
@@ -0,0 +1,1140 @@
+#include "gtest/gtest.h"
+#include "query_engine.h"
+
+#include "compressed_column_order_dataset.h"
+#include "group_by_visitor.h"
+#include "inmemory_column_order_dataset.h"
+#include "numa_partitioned_dataset.h"
+#include "primary_btree_index.h"
+#include "visitor.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+namespace test {
+
+    const size_t TESTD = 3;
+
+    // Reports a fixed list of indexes for every query, like a secondary index would.
+    class ListIndex : public PrimaryIndexer<TESTD> {
+      public:
+        explicit ListIndex(List<PhysicalIndex> list) : list_(list) {}
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>&) const override {
+            return Set<PhysicalIndex>({}, list_);
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+      private:
+        List<PhysicalIndex> list_;
+    };
+    // Every other run of 1000 points, found one at a time, and a list that overlaps them. Counts
+    // how often it had to look for more ranges.
+    class StridedCursor : public BufferedRangeCursor {
+      public:
+        StridedCursor(size_t size, size_t* refills) : size_(size), next_(0), refills_(refills) {
+            list_ = {3000, 500, 1500, 1501, 2999};
+        }
+
+      protected:
+        bool Refill(Ranges<PhysicalIndex>* ranges) override {
+            if (next_ >= size_) {
+                return false;
+            }
+            (*refills_)++;
+            ranges->emplace_back(next_, std::min(size_, next_ + 1000));
+            next_ += 2000;
+            return true;
+        }
+
+      private:
+        size_t size_;
+        size_t next_;
+        size_t* refills_;
+    };
+
+    class StridedIndex : public PrimaryIndexer<TESTD> {
+      public:
+        StridedIndex(size_t size, size_t* refills) : size_(size), refills_(refills) {}
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>& q) const override {
+            return Cursor(q)->Drain();
+        }
+
+        std::unique_ptr<RangeCursor> Cursor(Query<TESTD>&) const override {
+            return std::make_unique<StridedCursor>(size_, refills_);
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+      private:
+        size_t size_;
+        size_t* refills_;
+    };
+
+    // Every other run of 1000 points, materialized at once, and a list that overlaps them.
+    class OverlappingIndex : public PrimaryIndexer<TESTD> {
+      public:
+        explicit OverlappingIndex(size_t size, bool with_list = true) {
+            for (size_t start = 0; start < size; start += 2000) {
+                ranges_.emplace_back(start, std::min(size, start + 1000));
+            }
+            if (with_list) {
+                list_ = {5500, 3000, 500, 1500, 1501, 2999, 2000};
+            }
+        }
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>&) const override {
+            return Set<PhysicalIndex>(ranges_, list_);
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+      private:
+        Ranges<PhysicalIndex> ranges_;
+        List<PhysicalIndex> list_;
+    };
+
+    // Works like a rewriter with an outlier index: narrows the filter on column 2 to the inliers
+    // in [lower, upper) before running the primary index, and lists the points outside it, which
+    // the scan has to check against the filters of the original query.
+    class OutlierRewritingIndex : public PrimaryIndexer<TESTD> {
+      public:
+        OutlierRewritingIndex(std::shared_ptr<PrimaryIndexer<TESTD>> primary,
+                const vector<Point<TESTD>>& pts, Scalar lower, Scalar upper)
+            : primary_(primary), lower_(lower), upper_(upper) {
+            for (size_t i = 0; i < pts.size(); i++) {
+                if (pts[i][2] < lower || pts[i][2] >= upper) {
+                    outliers_.push_back(i);
+                }
+            }
+        }
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>& q) const override {
+            q.filters[2] = {.present = true, .is_range = true, .ranges = {{lower_, upper_}}, .values = {}};
+            Set<PhysicalIndex> indexes(primary_->IndexRanges(q).ranges, outliers_);
+            return indexes;
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+      private:
+        std::shared_ptr<PrimaryIndexer<TESTD>> primary_;
+        Scalar lower_;
+        Scalar upper_;
+        List<PhysicalIndex> outliers_;
+    };
+
+    // Scans the whole dataset for every query, and appends inserted points to its end.
+    class AppendingIndex : public PrimaryIndexer<TESTD> {
+      public:
+        explicit AppendingIndex(std::shared_ptr<Dataset<TESTD>> dataset) : dataset_(dataset) {}
+
+        Set<PhysicalIndex> IndexRanges(Query<TESTD>&) const override {
+            return Set<PhysicalIndex>({{0, dataset_->Size()}}, {});
+        }
+
+        bool Init(PointIterator<TESTD>, PointIterator<TESTD>) override {
+            return false;
+        }
+
+        size_t Size() const override {
+            return 0;
+        }
+
+        std::vector<InsertRecord<TESTD>> Insert(const std::vector<Point<TESTD>>& points) override {
+            InsertData<TESTD> locations;
+            for (const Point<TESTD>& p : points) {
+                locations.emplace_back(p, dataset_->Size());
+            }
+            dataset_->Insert(locations);
+            return {};
+        }
+
+      private:
+        std::shared_ptr<Dataset<TESTD>> dataset_;
+    };
+
+    class QueryEngineTest : public ::testing::Test {
+        protected:
+        void SetUp() override {
+            srand(42);
+            for (size_t i = 0; i < 20000; i++) {
+                pts.push_back({(Scalar)(rand() % 1000), (Scalar)(rand() % 50), (Scalar)(rand() % 100000)});
+            }
+            indexer = std::make_shared<PrimaryBTreeIndex<TESTD>>(0, 64);
+            indexer->Init(pts.begin(), pts.end());
+            dataset = std::make_shared<CompressedColumnOrderDataset<TESTD>>(pts);
+        }
+
+        Query<TESTD> MakeQuery() {
+            Query<TESTD> q;
+            q.filters[0] = {.present = true, .is_range = true, .ranges = {{100, 700}}, .values = {}};
+            q.filters[1] = {.present = true, .is_range = false, .ranges = {}, .values = {3, 7, 11, 20}};
+            q.filters[2] = {.present = true, .is_range = true, .ranges = {{5000, 90000}}, .values = {}};
+            return q;
+        }
+
+        // The matching physical indexes, computed by brute force.
+        vector<size_t> Matches(const Query<TESTD>& q) {
+            vector<size_t> matches;
+            for (size_t i = 0; i < pts.size(); i++) {
+                bool match = true;
+                for (size_t d = 0; d < TESTD; d++) {
+                    const QueryFilter& f = q.filters[d];
+                    if (!f.present) {
+                        continue;
+                    }
+                    if (f.is_range) {
+                        bool in_range = false;
+                        for (const ScalarRange& r : f.ranges) {
+                            in_range |= pts[i][d] >= r.first && pts[i][d] < r.second;
+                        }
+                        match &= in_range;
+                    } else {
+                        match &= std::find(f.values.begin(), f.values.end(), pts[i][d]) != f.values.end();
+                    }
+                }
+                if (match) {
+                    matches.push_back(i);
+                }
+            }
+            return matches;
+        }
+
+        vector<Point<TESTD>> pts;
+        std::shared_ptr<PrimaryBTreeIndex<TESTD>> indexer;
+        std::shared_ptr<CompressedColumnOrderDataset<TESTD>> dataset;
+    };
+
+    TEST_F(QueryEngineTest, TestSerialScan) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        Query<TESTD> q = MakeQuery();
+        IndexVisitor<TESTD> visitor;
+        engine.Execute(q, visitor);
+        EXPECT_EQ(Matches(q), visitor.indexes);
+    }
+
+    TEST_F(QueryEngineTest, TestParallelScanMatchesSerial) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        engine.SetNumThreads(4);
+        Query<TESTD> q = MakeQuery();
+        auto want = Matches(q);
+
+        IndexVisitor<TESTD> index_visitor;
+        engine.Execute(q, index_visitor);
+        // Results must come back in physical order.
+        EXPECT_EQ(want, index_visitor.indexes);
+
+        CountVisitor<TESTD> count_visitor;
+        engine.Execute(q, count_visitor);
+        EXPECT_EQ(want.size(), count_visitor.count);
+
+        SumVisitor<TESTD> sum_visitor(2);
+        engine.Execute(q, sum_visitor);
+        Scalar want_sum = 0;
+        for (size_t i : want) {
+            want_sum += pts[i][2];
+        }
+        EXPECT_EQ(want_sum, sum_visitor.sum);
+
+        CollectVisitor<TESTD> collect_visitor;
+        engine.Execute(q, collect_visitor);
+        ASSERT_EQ(want.size(), collect_visitor.result_set.size());
+        for (size_t i = 0; i < want.size(); i++) {
+            EXPECT_EQ(pts[want[i]], collect_visitor.result_set[i]);
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestNumaPartitionedDataset) {
+        // More slices than this machine likely has nodes, so some share a node.
+        auto partitioned = std::make_shared<NumaPartitionedDataset<TESTD>>(pts,
+                std::vector<Datacube<TESTD>>(), 3);
+        ASSERT_EQ(3, partitioned->NumPartitions());
+        size_t boundary = partitioned->PartitionStart(1);
+        EXPECT_EQ(0, boundary % partitioned->BlockSize());
+        // Bitmask calls that cross a slice boundary.
+        EXPECT_EQ(dataset->GetCoordRange(boundary - 20, boundary + 20, 0, 100, 700),
+                partitioned->GetCoordRange(boundary - 20, boundary + 20, 0, 100, 700));
+        EXPECT_EQ(dataset->GetRangeSum(boundary - 32, boundary + 32, 2, 0xf0f0f0f0f0f0f0f0ULL),
+                partitioned->GetRangeSum(boundary - 32, boundary + 32, 2, 0xf0f0f0f0f0f0f0f0ULL));
+
+        Query<TESTD> q = MakeQuery();
+        auto want = Matches(q);
+        Scalar want_sum = 0;
+        for (size_t i : want) {
+            want_sum += pts[i][2];
+        }
+        for (size_t threads : {1, 4}) {
+            QueryEngine<TESTD> engine(partitioned, indexer);
+            engine.SetNumThreads(threads);
+            Query<TESTD> copy = q;
+            IndexVisitor<TESTD> index_visitor;
+            engine.Execute(copy, index_visitor);
+            EXPECT_EQ(want, index_visitor.indexes);
+
+            copy = q;
+            SumVisitor<TESTD> sum_visitor(2);
+            engine.Execute(copy, sum_visitor);
+            EXPECT_EQ(want_sum, sum_visitor.sum);
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestBlockSkipping) {
+        // Sorted on dim 0, with dim 1 and dim 2 correlated to it, so the compression blocks of
+        // the unindexed dims have narrow bounds.
+        pts.clear();
+        for (size_t i = 0; i < 20000; i++) {
+            Scalar v = i / 20;
+            pts.push_back({v, v / 100, v * 100 + rand() % 50});
+        }
+        indexer->Init(pts.begin(), pts.end());
+        dataset = std::make_shared<CompressedColumnOrderDataset<TESTD>>(pts);
+        QueryEngine<TESTD> engine(dataset, indexer);
+
+        Query<TESTD> q;
+        q.filters[0] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        q.filters[1] = {.present = true, .is_range = false, .ranges = {}, .values = {2, 3, 4}};
+        q.filters[2] = {.present = true, .is_range = true, .ranges = {{21000, 38000}}, .values = {}};
+        IndexVisitor<TESTD> visitor;
+        engine.Execute(q, visitor);
+        EXPECT_EQ(Matches(q), visitor.indexes);
+        EXPECT_GT(engine.SkippedPoints(), 0);
+        EXPECT_GT(engine.ExactPoints(), 0);
+
+        CountVisitor<TESTD> count_visitor;
+        engine.SetNumThreads(4);
+        engine.Execute(q, count_visitor);
+        EXPECT_EQ(visitor.indexes.size(), count_visitor.count);
+    }
+
+    TEST_F(QueryEngineTest, TestExactRangesFromIndex) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        Query<TESTD> q;
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{100, 700}}, .values = {}};
+        q.filters[1] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        q.filters[2] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        Query<TESTD> copy = q;
+        Set<PhysicalIndex> ranges = indexer->IndexRanges(copy);
+        size_t exact_points = 0;
+        for (const auto& r : ranges.ranges) {
+            exact_points += r.exact ? r.end - r.start : 0;
+        }
+        EXPECT_GT(exact_points, 0);
+
+        CountVisitor<TESTD> visitor;
+        engine.Execute(q, visitor);
+        EXPECT_EQ(Matches(q).size(), visitor.count);
+        // Exact ranges are handed to the visitor without evaluating the filter.
+        EXPECT_GE(engine.ExactPoints(), exact_points);
+
+        // Mixing exact ranges with other filters still evaluates those filters.
+        q = MakeQuery();
+        IndexVisitor<TESTD> index_visitor;
+        engine.Execute(q, index_visitor);
+        EXPECT_EQ(Matches(q), index_visitor.indexes);
+    }
+
+    TEST_F(QueryEngineTest, TestCountExactRanges) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        // Only the indexed dim is filtered, so most of the range is counted without decoding.
+        Query<TESTD> q;
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{100, 700}}, .values = {}};
+        q.filters[1] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        q.filters[2] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        Query<TESTD> copy = q;
+        CountVisitor<TESTD> count;
+        engine.Execute(copy, count);
+        EXPECT_EQ(Matches(q).size(), count.count);
+        EXPECT_GT(engine.ExactPoints(), 0);
+        // Points counted as a whole range are scanned points all the same.
+        copy = q;
+        IndexVisitor<TESTD> index_visitor;
+        engine.Execute(copy, index_visitor);
+        EXPECT_EQ(index_visitor.ScannedPoints(), count.ScannedPoints());
+        EXPECT_GE(count.ScannedPoints(), (long)count.count);
+    }
+
+    TEST_F(QueryEngineTest, TestPrefixSumCubes) {
+        // Column 3 is the key: the cubes are p[1] * p[2] (column 4) and the prefix sums of
+        // columns 2 and 4.
+        std::vector<Datacube<TESTD>> cubes = {
+            Datacube<TESTD>::Materialize([](const Point<TESTD>& p) { return p[1] * p[2]; }),
+            Datacube<TESTD>::PrefixSum(2),
+            Datacube<TESTD>::PrefixSum(4),
+        };
+        auto cube_dataset = std::make_shared<CompressedColumnOrderDataset<TESTD>>(pts, cubes);
+        QueryEngine<TESTD> engine(cube_dataset, indexer);
+
+        Query<TESTD> q;
+        q.filters[0] = {.present = true, .is_range = true, .ranges = {{100, 700}}, .values = {}};
+        q.filters[1] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        q.filters[2] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        Scalar want = 0;
+        for (size_t i : Matches(q)) {
+            want += pts[i][2];
+        }
+        SumVisitor<TESTD> visitor(2);
+        engine.Execute(q, visitor);
+        EXPECT_EQ(want, visitor.sum);
+        // Exact ranges are summed from the cube, and their points count as scanned as they do
+        // for COUNT.
+        EXPECT_GT(engine.ExactPoints(), 0);
+        Query<TESTD> copy = q;
+        CountVisitor<TESTD> count;
+        engine.Execute(copy, count);
+        EXPECT_EQ(count.ScannedPoints(), visitor.ScannedPoints());
+        SumVisitor<TESTD> typed_visitor(2);
+        engine.ExecuteTyped<CompressedColumnOrderDataset<TESTD>, SumVisitor<TESTD>>(q, typed_visitor);
+        EXPECT_EQ(want, typed_visitor.sum);
+
+        // Other filters are still evaluated on the materialized cube.
+        for (Query<TESTD> query : {q, MakeQuery()}) {
+            Scalar want_product = 0;
+            for (size_t i : Matches(query)) {
+                want_product += pts[i][1] * pts[i][2];
+            }
+            AggregateWithCubesVisitor<TESTD> cube_visitor(4);
+            engine.Execute(query, cube_visitor);
+            EXPECT_EQ(want_product, cube_visitor.aggregate);
+            Query<TESTD> copy = query;
+            CountVisitor<TESTD> count;
+            engine.Execute(copy, count);
+            EXPECT_EQ(count.ScannedPoints(), cube_visitor.ScannedPoints());
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestListScan) {
+        // Sparse entries, a dense run that is scanned as a range, and a run too short for that.
+        List<PhysicalIndex> list;
+        for (size_t i = 0; i < 5000; i += 7) {
+            list.push_back(i);
+        }
+        for (size_t i = 6000; i < 9000; i++) {
+            list.push_back(i);
+        }
+        for (size_t i = 12000; i < 12100; i++) {
+            list.push_back(i);
+        }
+        list.push_back(pts.size() - 1);
+
+        Query<TESTD> q = MakeQuery();
+        std::vector<size_t> want;
+        for (size_t i : Matches(q)) {
+            if (std::binary_search(list.begin(), list.end(), i)) {
+                want.push_back(i);
+            }
+        }
+        Scalar want_sum = 0;
+        for (size_t i : want) {
+            want_sum += pts[i][2];
+        }
+
+        // Unsorted lists with duplicates are sorted first.
+        List<PhysicalIndex> shuffled = list;
+        shuffled.insert(shuffled.end(), list.begin(), list.begin() + 100);
+        std::random_shuffle(shuffled.begin(), shuffled.end());
+        for (const List<PhysicalIndex>& l : {list, shuffled}) {
+            for (size_t threads : {1, 4}) {
+                QueryEngine<TESTD> engine(dataset, std::make_shared<ListIndex>(l));
+                engine.SetNumThreads(threads);
+                q = MakeQuery();
+                IndexVisitor<TESTD> index_visitor;
+                engine.Execute(q, index_visitor);
+                EXPECT_EQ(want, index_visitor.indexes);
+                CountVisitor<TESTD> count_visitor;
+                engine.Execute(q, count_visitor);
+                EXPECT_EQ(want.size(), count_visitor.count);
+                SumVisitor<TESTD> sum_visitor(2);
+                engine.Execute(q, sum_visitor);
+                EXPECT_EQ(want_sum, sum_visitor.sum);
+            }
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestStreamingCursor) {
+        size_t refills = 0;
+        auto index = std::make_shared<StridedIndex>(pts.size(), &refills);
+        Query<TESTD> q = MakeQuery();
+        std::vector<size_t> want;
+        for (size_t i : Matches(q)) {
+            if (i % 2000 < 1000 || i == 1500 || i == 1501 || i == 3000) {
+                want.push_back(i);
+            }
+        }
+        // List points inside the ranges are only visited once, whether the ranges are streamed
+        // (serial scans) or drained first (parallel scans).
+        for (size_t threads : {1, 4}) {
+            QueryEngine<TESTD> engine(dataset, index);
+            engine.SetNumThreads(threads);
+            q = MakeQuery();
+            IndexVisitor<TESTD> visitor;
+            engine.Execute(q, visitor);
+            EXPECT_EQ(want, visitor.indexes);
+            EXPECT_EQ(3, engine.ScannedListPoints());
+        }
+
+        // Once the limit is reached, the index isn't asked for the remaining ranges.
+        QueryEngine<TESTD> engine(dataset, index);
+        refills = 0;
+        q = MakeQuery();
+        LimitVisitor<TESTD> visitor(10);
+        engine.Execute(q, visitor);
+        ASSERT_EQ(10, visitor.indexes.size());
+        EXPECT_EQ(std::vector<size_t>(want.begin(), want.begin() + 10), visitor.indexes);
+        // The cursor looks one range ahead.
+        EXPECT_EQ(want[9] / 2000 + 2, refills);
+        EXPECT_LT(refills, pts.size() / 2000);
+    }
+
+    TEST_F(QueryEngineTest, TestListOverlappingRanges) {
+        auto index = std::make_shared<OverlappingIndex>(pts.size());
+        Query<TESTD> q;
+        for (size_t d = 0; d < TESTD; d++) {
+            q.filters[d] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        }
+        std::vector<size_t> want;
+        for (size_t i = 0; i < pts.size(); i++) {
+            if (i % 2000 < 1000 || i == 1500 || i == 1501 || i == 3000 || i == 5500) {
+                want.push_back(i);
+            }
+        }
+        // List points inside the ranges are visited once, whether the query is streamed (serial
+        // scans), indexed up front and scanned in parallel, or pipelined.
+        for (size_t threads : {1, 4}) {
+            QueryEngine<TESTD> engine(dataset, index);
+            engine.SetNumThreads(threads);
+            Query<TESTD> copy = q;
+            IndexVisitor<TESTD> visitor;
+            engine.Execute(copy, visitor);
+            std::vector<size_t> got = visitor.indexes;
+            std::sort(got.begin(), got.end());
+            EXPECT_EQ(want, got);
+            EXPECT_EQ(4, engine.ScannedListPoints());
+            copy = q;
+            CountVisitor<TESTD> count;
+            engine.Execute(copy, count);
+            EXPECT_EQ(want.size(), count.count);
+
+            // The list points between ranges come in physical order.
+            copy = q;
+            LimitVisitor<TESTD> limit(1003);
+            engine.Execute(copy, limit);
+            EXPECT_EQ(std::vector<size_t>(want.begin(), want.begin() + 1003), limit.indexes);
+        }
+        QueryEngine<TESTD> engine(dataset, index);
+        std::vector<Query<TESTD>> queries = {q, q};
+        auto visitors = engine.ExecutePipelined(queries, [](size_t i) {
+            return i == 0 ? std::unique_ptr<Visitor<TESTD>>(new CountVisitor<TESTD>())
+                : std::unique_ptr<Visitor<TESTD>>(new LimitVisitor<TESTD>(1003));
+        });
+        EXPECT_EQ(want.size(), static_cast<CountVisitor<TESTD>*>(visitors[0].get())->count);
+        EXPECT_EQ(std::vector<size_t>(want.begin(), want.begin() + 1003),
+                static_cast<LimitVisitor<TESTD>*>(visitors[1].get())->indexes);
+    }
+
+    // Counts matches until it has seen `limit` of them. Unlike LimitVisitor, it doesn't care which
+    // ones, so it can be scanned in parallel.
+    class SaturatingCountVisitor : public CountVisitor<TESTD> {
+      public:
+        explicit SaturatingCountVisitor(size_t limit) : limit_(limit) {}
+
+        bool IsSaturated() const override {
+            return count >= limit_;
+        }
+
+        std::unique_ptr<Visitor<TESTD>> Clone() const override {
+            return std::make_unique<SaturatingCountVisitor>(limit_);
+        }
+
+      private:
+        const size_t limit_;
+    };
+
+    TEST_F(QueryEngineTest, TestParallelListScanAfterMorsels) {
+        Query<TESTD> q;
+        for (size_t d = 0; d < TESTD; d++) {
+            q.filters[d] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+        }
+        QueryEngine<TESTD> engine(dataset, std::make_shared<OverlappingIndex>(pts.size()));
+        engine.SetNumThreads(4);
+        QueryEngine<TESTD> ranges_engine(dataset,
+                std::make_shared<OverlappingIndex>(pts.size(), false));
+        ranges_engine.SetNumThreads(4);
+
+        // The morsels saturate the visitor, so the list isn't scanned.
+        Query<TESTD> copy = q;
+        SaturatingCountVisitor saturating(10);
+        engine.Execute(copy, saturating);
+        copy = q;
+        SaturatingCountVisitor ranges_saturating(10);
+        ranges_engine.Execute(copy, ranges_saturating);
+        EXPECT_GE(saturating.count, 10);
+        EXPECT_EQ(ranges_saturating.count, saturating.count);
+        EXPECT_EQ(ranges_saturating.ScannedPoints(), saturating.ScannedPoints());
+
+        // Points are sorted on column 0 and the list points are early on, so every thread's
+        // top 20 from its morsels prunes the list's blocks.
+        copy = q;
+        TopKVisitor<TESTD> topk(0, 20);
+        engine.Execute(copy, topk);
+        copy = q;
+        TopKVisitor<TESTD> ranges_topk(0, 20);
+        ranges_engine.Execute(copy, ranges_topk);
+        EXPECT_EQ(ranges_topk.Result(), topk.Result());
+        EXPECT_EQ(ranges_topk.ScannedPoints(), topk.ScannedPoints());
+    }
+
+    TEST_F(QueryEngineTest, TestLimitAndTopK) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        Query<TESTD> q = MakeQuery();
+        auto want = Matches(q);
+        ASSERT_GT(want.size(), 50);
+
+        LimitVisitor<TESTD> limit_visitor(50);
+        engine.Execute(q, limit_visitor);
+        EXPECT_EQ(vector<size_t>(want.begin(), want.begin() + 50), limit_visitor.indexes);
+        // The scan stops soon after the 50th match.
+        EXPECT_LT(limit_visitor.ScannedPoints(), (long)pts.size() / 4);
+
+        // Points are sorted on column 0, so once the heap is full every later block is pruned.
+        q.filters[0].present = false;
+        q.filters[2].present = false;
+        for (size_t threads : {1, 4}) {
+            engine.SetNumThreads(threads);
+            for (size_t column : {0, 2}) {
+                for (bool largest : {true, false}) {
+                    vector<Scalar> values;
+                    for (size_t i : Matches(q)) {
+                        values.push_back(pts[i][column]);
+                    }
+                    std::sort(values.begin(), values.end());
+                    if (largest) {
+                        std::reverse(values.begin(), values.end());
+                    }
+                    values.resize(20);
+
+                    engine.Reset();
+                    TopKVisitor<TESTD> topk(column, 20, largest);
+                    engine.Execute(q, topk);
+                    vector<Scalar> got;
+                    for (const auto& e : topk.Result()) {
+                        EXPECT_EQ(pts[e.second][column], e.first);
+                        got.push_back(e.first);
+                    }
+                    EXPECT_EQ(values, got);
+                    if (column == 0 && !largest) {
+                        EXPECT_GT(engine.SkippedPoints(), (long)pts.size() / 2);
+                    }
+                }
+            }
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestGroupBy) {
+        using GroupBy = GroupByVisitor<TESTD>;
+        std::vector<GroupBy::Aggregate> aggs = {
+            {GroupBy::COUNT, 0}, {GroupBy::SUM, 2}, {GroupBy::MIN, 2}, {GroupBy::MAX, 0}};
+        auto brute_force = [&aggs](const vector<Point<TESTD>>& points, const vector<size_t>& matches,
+                const vector<size_t>& keys) {
+            std::map<vector<Scalar>, vector<Scalar>> want;
+            for (size_t i : matches) {
+                vector<Scalar> key;
+                for (size_t k : keys) {
+                    key.push_back(points[i][k]);
+                }
+                auto it = want.find(key);
+                if (it == want.end()) {
+                    it = want.emplace(key, vector<Scalar>{0, 0, points[i][2], points[i][0]}).first;
+                }
+                it->second[0] += 1;
+                it->second[1] += points[i][2];
+                it->second[2] = std::min(it->second[2], points[i][2]);
+                it->second[3] = std::max(it->second[3], points[i][0]);
+            }
+            return want;
+        };
+
+        // Keys from a narrow domain ({0} and {1}), and a wide one ({1, 2}).
+        Query<TESTD> q = MakeQuery();
+        auto matches = Matches(q);
+        for (size_t threads : {1, 4}) {
+            QueryEngine<TESTD> engine(dataset, indexer);
+            engine.SetNumThreads(threads);
+            for (const vector<size_t>& keys : vector<vector<size_t>>{{0}, {1}, {1, 2}}) {
+                q = MakeQuery();
+                GroupBy visitor(keys, aggs);
+                engine.Execute(q, visitor);
+                EXPECT_EQ(brute_force(pts, matches, keys), visitor.Result());
+            }
+        }
+
+        // Long runs of the same key in the sort column.
+        vector<Point<TESTD>> runs;
+        for (size_t i = 0; i < 20000; i++) {
+            runs.push_back({(Scalar)(i / 3000), (Scalar)(rand() % 50), (Scalar)(rand() % 100000)});
+        }
+        auto run_indexer = std::make_shared<PrimaryBTreeIndex<TESTD>>(0, 64);
+        run_indexer->Init(runs.begin(), runs.end());
+        QueryEngine<TESTD> engine(std::make_shared<CompressedColumnOrderDataset<TESTD>>(runs), run_indexer);
+        q = MakeQuery();
+        q.filters[0].ranges = {{1, 5}};
+        vector<size_t> run_matches;
+        std::swap(pts, runs);
+        run_matches = Matches(q);
+        std::swap(pts, runs);
+        GroupBy visitor({0}, aggs);
+        engine.Execute(q, visitor);
+        EXPECT_EQ(4, visitor.NumGroups());
+        EXPECT_EQ(brute_force(runs, run_matches, {0}), visitor.Result());
+
+        // Hash-like keys spread over most of the Scalar domain, so that the span of a block
+        // overflows a Scalar.
+        vector<Scalar> ids = {-6000000000000000000L, -3, 5, 1L << 40, 6000000000000000000L};
+        vector<Point<TESTD>> wide;
+        for (size_t i = 0; i < 20000; i++) {
+            wide.push_back({(Scalar)(i / 3000), ids[rand() % ids.size()], (Scalar)(rand() % 100000)});
+        }
+        auto wide_indexer = std::make_shared<PrimaryBTreeIndex<TESTD>>(0, 64);
+        wide_indexer->Init(wide.begin(), wide.end());
+        QueryEngine<TESTD> wide_engine(std::make_shared<CompressedColumnOrderDataset<TESTD>>(wide),
+                wide_indexer);
+        q = MakeQuery();
+        q.filters[0].ranges = {{1, 5}};
+        q.filters[1].present = false;
+        std::swap(pts, wide);
+        vector<size_t> wide_matches = Matches(q);
+        std::swap(pts, wide);
+        GroupBy wide_visitor({1}, aggs);
+        wide_engine.Execute(q, wide_visitor);
+        EXPECT_EQ(ids.size(), wide_visitor.NumGroups());
+        EXPECT_EQ(brute_force(wide, wide_matches, {1}), wide_visitor.Result());
+    }
+
+    TEST_F(QueryEngineTest, TestResultCache) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        engine.EnableResultCache(1 << 20);
+        Query<TESTD> q = MakeQuery();
+        Scalar want = 0;
+        for (size_t i : Matches(q)) {
+            want += pts[i][2];
+        }
+        SumVisitor<TESTD> first(2);
+        Query<TESTD> copy = q;
+        engine.Execute(copy, first);
+        long scanned = engine.ScannedPoints();
+        EXPECT_EQ(want, first.sum);
+
+        // Answered from the cache, whatever state the visitor starts in.
+        SumVisitor<TESTD> second(2);
+        second.sum = 5;
+        copy = q;
+        engine.Execute(copy, second);
+        EXPECT_EQ(want + 5, second.sum);
+        EXPECT_EQ(scanned, engine.ScannedPoints());
+
+        // Other columns and other queries are computed.
+        SumVisitor<TESTD> other_column(0);
+        copy = q;
+        engine.Execute(copy, other_column);
+        EXPECT_GT(engine.ScannedPoints(), scanned);
+        scanned = engine.ScannedPoints();
+
+        engine.InvalidateResultCache();
+        SumVisitor<TESTD> third(2);
+        copy = q;
+        engine.Execute(copy, third);
+        EXPECT_EQ(want, third.sum);
+        EXPECT_GT(engine.ScannedPoints(), scanned);
+
+        // Visitors without a cache key are always scanned.
+        IndexVisitor<TESTD> index_visitor;
+        copy = q;
+        engine.Execute(copy, index_visitor);
+        EXPECT_EQ(Matches(q), index_visitor.indexes);
+    }
+
+    TEST_F(QueryEngineTest, TestResultCacheChargesResultSize) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        engine.EnableResultCache(8 << 10);
+        Query<TESTD> q = MakeQuery();
+        size_t matches = Matches(q).size();
+
+        // A count fits in the budget.
+        CountVisitor<TESTD> count;
+        Query<TESTD> copy = q;
+        engine.Execute(copy, count);
+        long scanned = engine.ScannedPoints();
+        CountVisitor<TESTD> cached_count;
+        copy = q;
+        engine.Execute(copy, cached_count);
+        EXPECT_EQ(matches, cached_count.count);
+        EXPECT_EQ(scanned, engine.ScannedPoints());
+
+        // A group per distinct value of the last column doesn't.
+        using GroupBy = GroupByVisitor<TESTD>;
+        GroupBy groups({2}, {{GroupBy::COUNT, 0}});
+        copy = q;
+        engine.Execute(copy, groups);
+        EXPECT_GT(groups.MemoryBytes(), (size_t) 8 << 10);
+        scanned = engine.ScannedPoints();
+        GroupBy again({2}, {{GroupBy::COUNT, 0}});
+        copy = q;
+        engine.Execute(copy, again);
+        EXPECT_EQ(groups.Result(), again.Result());
+        EXPECT_GT(engine.ScannedPoints(), scanned);
+    }
+
+    TEST_F(QueryEngineTest, TestResultCacheInserts) {
+        auto mem_dataset = std::make_shared<InMemoryColumnOrderDataset<TESTD>>(pts);
+        auto appending = std::make_shared<AppendingIndex>(mem_dataset);
+        QueryEngine<TESTD> engine(mem_dataset, appending);
+        engine.EnableResultCache(1 << 20);
+        Query<TESTD> q = MakeQuery();
+        size_t matches = Matches(q).size();
+        CountVisitor<TESTD> before;
+        Query<TESTD> copy = q;
+        engine.Execute(copy, before);
+        EXPECT_EQ(matches, before.count);
+
+        // Inserts through the engine and past it are both seen.
+        engine.Insert({{150, 3, 6000}, {150, 4, 6000}});
+        CountVisitor<TESTD> after_engine;
+        copy = q;
+        engine.Execute(copy, after_engine);
+        EXPECT_EQ(matches + 1, after_engine.count);
+
+        appending->Insert({{699, 20, 89999}});
+        CountVisitor<TESTD> after_indexer;
+        copy = q;
+        engine.Execute(copy, after_indexer);
+        EXPECT_EQ(matches + 2, after_indexer.count);
+    }
+
+    TEST_F(QueryEngineTest, TestResultCachePipelined) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        engine.EnableResultCache(1 << 20);
+        vector<Query<TESTD>> queries;
+        for (Scalar lo = 0; lo < 1000; lo += 100) {
+            Query<TESTD> q = MakeQuery();
+            q.filters[0].ranges = {{lo, lo + 150}};
+            queries.push_back(q);
+        }
+        auto sums = [](size_t) {
+            return std::unique_ptr<Visitor<TESTD>>(new SumVisitor<TESTD>(2));
+        };
+        vector<Query<TESTD>> copies = queries;
+        auto first = engine.ExecutePipelined(copies, sums);
+        long scanned = engine.ScannedPoints();
+        EXPECT_GT(scanned, 0);
+
+        // Pipelined and single queries share the cache both ways.
+        copies = queries;
+        auto second = engine.ExecutePipelined(copies, sums);
+        Query<TESTD> copy = queries[3];
+        SumVisitor<TESTD> single(2);
+        engine.Execute(copy, single);
+        EXPECT_EQ(scanned, engine.ScannedPoints());
+        for (size_t i = 0; i < queries.size(); i++) {
+            Scalar want = 0;
+            for (size_t j : Matches(queries[i])) {
+                want += pts[j][2];
+            }
+            EXPECT_EQ(want, static_cast<SumVisitor<TESTD>*>(first[i].get())->sum);
+            EXPECT_EQ(want, static_cast<SumVisitor<TESTD>*>(second[i].get())->sum);
+        }
+        EXPECT_EQ(static_cast<SumVisitor<TESTD>*>(first[3].get())->sum, single.sum);
+
+        copy = MakeQuery();
+        copy.filters[0].ranges = {{50, 60}};
+        SumVisitor<TESTD> other(2);
+        engine.Execute(copy, other);
+        scanned = engine.ScannedPoints();
+        copies = {copy};
+        engine.ExecutePipelined(copies, sums);
+        EXPECT_EQ(scanned, engine.ScannedPoints());
+    }
+
+    TEST_F(QueryEngineTest, TestMultiRangeFilters) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        // A few ranges on the indexed dim, given out of order and overlapping.
+        Query<TESTD> q = MakeQuery();
+        q.filters[0].ranges = {{600, 650}, {100, 200}, {150, 300}, {990, 2000}};
+        Query<TESTD> original = q;
+        IndexVisitor<TESTD> visitor;
+        engine.Execute(q, visitor);
+        EXPECT_EQ(Matches(original), visitor.indexes);
+        ASSERT_EQ(3, q.filters[0].ranges.size());
+        EXPECT_EQ(ScalarRange(100, 300), q.filters[0].ranges[0]);
+
+        // Many narrow ranges on an unindexed dim take the binary search path.
+        q = MakeQuery();
+        q.filters[2].ranges.clear();
+        for (Scalar v = 0; v < 100000; v += 1000) {
+            q.filters[2].ranges.emplace_back(v, v + 100);
+        }
+        original = q;
+        for (size_t threads : {1, 4}) {
+            engine.SetNumThreads(threads);
+            IndexVisitor<TESTD> many_visitor;
+            engine.Execute(q, many_visitor);
+            EXPECT_EQ(Matches(original), many_visitor.indexes);
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestDictionaryEncodedColumns) {
+        // Dim 1 holds a few widely spread ids.
+        for (auto& p : pts) {
+            p[1] = p[1] * (1L << 40) + 12345;
+        }
+        auto encoded = std::make_shared<CompressedColumnOrderDataset<TESTD>>(pts,
+                std::vector<Scalar>(), std::vector<Datacube<TESTD>>(), std::vector<size_t>{1, 2});
+        QueryEngine<TESTD> engine(encoded, indexer);
+
+        vector<Query<TESTD>> queries;
+        Query<TESTD> q = MakeQuery();
+        q.filters[1].values = {3 * (1L << 40) + 12345, 20 * (1L << 40) + 12345, 5};
+        queries.push_back(q);
+        // Ranges on the dictionary-encoded dims, including bounds that aren't in the dictionary.
+        q.filters[1] = {.present = true, .is_range = true,
+            .ranges = {{0, 10 * (1L << 40)}, {30 * (1L << 40) + 12345, 30 * (1L << 40) + 12346}},
+            .values = {}};
+        q.filters[2].ranges = {{500, 600}, {1000, 1001}, {50000, 90000}};
+        queries.push_back(q);
+        for (size_t threads : {1, 4}) {
+            engine.SetNumThreads(threads);
+            for (const Query<TESTD>& query : queries) {
+                auto want = Matches(query);
+                Scalar want_sum = 0;
+                for (size_t i : want) {
+                    want_sum += pts[i][1];
+                }
+                Query<TESTD> copy = query;
+                IndexVisitor<TESTD> index_visitor;
+                engine.Execute(copy, index_visitor);
+                EXPECT_EQ(want, index_visitor.indexes);
+                copy = query;
+                SumVisitor<TESTD> sum(1);
+                engine.ExecuteTyped<CompressedColumnOrderDataset<TESTD>>(copy, sum);
+                EXPECT_EQ(want_sum, sum.sum);
+            }
+        }
+    }
+
+    // Sums a column through the per-row interface, for comparison with the batched visitors.
+    class RowSumVisitor : public SumVisitor<TESTD> {
+      public:
+        RowSumVisitor(size_t col) : SumVisitor<TESTD>(col) {}
+        bool UsesBatches() const override {
+            return false;
+        }
+    };
+
+    TEST_F(QueryEngineTest, TestBatchVisitors) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        for (size_t threads : {1, 4}) {
+            engine.SetNumThreads(threads);
+            Query<TESTD> q = MakeQuery();
+            auto want = Matches(q);
+
+            CollectVisitor<TESTD> collect;
+            engine.Execute(q, collect);
+            ASSERT_EQ(want.size(), collect.result_set.size());
+            for (size_t i = 0; i < want.size(); i++) {
+                EXPECT_EQ(pts[want[i]], collect.result_set[i]);
+            }
+
+            IndexVisitor<TESTD> index_visitor;
+            engine.Execute(q, index_visitor);
+            EXPECT_EQ(want, index_visitor.indexes);
+
+            SumVisitor<TESTD> sum(2);
+            RowSumVisitor row_sum(2);
+            SumProductVisitor<TESTD> sum_product(0, 2);
+            engine.Execute(q, sum);
+            engine.Execute(q, row_sum);
+            engine.Execute(q, sum_product);
+            Scalar want_sum = 0, want_sum_product = 0;
+            for (size_t i : want) {
+                want_sum += pts[i][2];
+                want_sum_product += pts[i][0] * pts[i][2];
+            }
+            EXPECT_EQ(want_sum, sum.sum);
+            EXPECT_EQ(want_sum, row_sum.sum);
+            EXPECT_EQ(want_sum_product, sum_product.sum);
+        }
+    }
+
+    // Counts the range filter calls.
+    class CountingDataset : public CompressedColumnOrderDataset<TESTD> {
+      public:
+        explicit CountingDataset(const vector<Point<TESTD>>& pts)
+            : CompressedColumnOrderDataset<TESTD>(pts) {}
+
+        uint64_t GetCoordInRanges(size_t start, size_t end, size_t dim,
+                const RangeSet& rset) const override {
+            range_calls++;
+            return CompressedColumnOrderDataset<TESTD>::GetCoordInRanges(start, end, dim, rset);
+        }
+
+        mutable size_t range_calls = 0;
+    };
+
+    TEST_F(QueryEngineTest, TestExecuteTyped) {
+        using Dataset = CompressedColumnOrderDataset<TESTD>;
+        QueryEngine<TESTD> engine(dataset, indexer);
+        // Every combination of filters, including two IN-lists, which has no specialized kernel.
+        vector<Query<TESTD>> queries;
+        for (int mask = 0; mask < 8; mask++) {
+            for (bool in_list : {false, true}) {
+                Query<TESTD> q = MakeQuery();
+                for (size_t d = 0; d < TESTD; d++) {
+                    q.filters[d].present = mask & (1 << d);
+                }
+                if (in_list) {
+                    q.filters[0] = {.present = true, .is_range = false, .ranges = {}, .values = {150, 151, 152, 400}};
+                }
+                queries.push_back(q);
+            }
+        }
+        for (size_t threads : {1, 4}) {
+            engine.SetNumThreads(threads);
+            for (Query<TESTD> q : queries) {
+                auto want = Matches(q);
+                Scalar want_sum = 0;
+                for (size_t i : want) {
+                    want_sum += pts[i][2];
+                }
+                IndexVisitor<TESTD> index_visitor;
+                engine.ExecuteTyped<Dataset>(q, index_visitor);
+                EXPECT_EQ(want, index_visitor.indexes);
+                CountVisitor<TESTD> count;
+                engine.ExecuteTyped<Dataset>(q, count);
+                EXPECT_EQ(want.size(), count.count);
+                SumVisitor<TESTD> sum(2);
+                engine.ExecuteTyped<Dataset>(q, sum);
+                EXPECT_EQ(want_sum, sum.sum);
+                // Falls back to the generic path, since the visitor derives from SumVisitor.
+                RowSumVisitor row_sum(2);
+                engine.ExecuteTyped<Dataset, SumVisitor<TESTD>>(q, row_sum);
+                EXPECT_EQ(want_sum, row_sum.sum);
+            }
+        }
+
+        // Same for datasets derived from DatasetT, whose overrides the kernels would skip.
+        auto counting = std::make_shared<CountingDataset>(pts);
+        QueryEngine<TESTD> counting_engine(counting, indexer);
+        Query<TESTD> q = MakeQuery();
+        CountVisitor<TESTD> count;
+        counting_engine.ExecuteTyped<Dataset>(q, count);
+        EXPECT_EQ(Matches(MakeQuery()).size(), count.count);
+        EXPECT_GT(counting->range_calls, 0);
+    }
+
+    TEST_F(QueryEngineTest, TestUnsortedInList) {
+        // The indexed column is filtered with values in no particular order, and a duplicate.
+        for (size_t threads : {1, 4}) {
+            QueryEngine<TESTD> engine(dataset, indexer);
+            engine.SetNumThreads(threads);
+            for (size_t i = 0; i < 20; i++) {
+                Query<TESTD> q = MakeQuery();
+                q.filters[0] = {.present = true, .is_range = false, .ranges = {}, .values = {}};
+                for (size_t v = 0; v < 5; v++) {
+                    q.filters[0].values.push_back(rand() % 1000);
+                }
+                q.filters[0].values.push_back(q.filters[0].values[0]);
+                auto want = Matches(q);
+                IndexVisitor<TESTD> visitor;
+                engine.Execute(q, visitor);
+                EXPECT_EQ(want, visitor.indexes);
+            }
+        }
+    }
+
+    TEST_F(QueryEngineTest, TestRewriterWithOutliers) {
+        auto rewriter = std::make_shared<OutlierRewritingIndex>(indexer, pts, 20000, 60000);
+        QueryEngine<TESTD> engine(dataset, rewriter);
+        Query<TESTD> q = MakeQuery();
+        auto want = Matches(q);
+        size_t outliers = std::count_if(want.begin(), want.end(),
+                [this](size_t i) { return pts[i][2] < 20000 || pts[i][2] >= 60000; });
+        ASSERT_GT(outliers, 0);
+
+        IndexVisitor<TESTD> visitor;
+        engine.Execute(q, visitor);
+        EXPECT_EQ(want, visitor.indexes);
+        q = MakeQuery();
+        CountVisitor<TESTD> counter;
+        engine.Execute(q, counter);
+        EXPECT_EQ(want.size(), counter.count);
+    }
+
+    TEST_F(QueryEngineTest, TestExecuteBatch) {
+        QueryEngine<TESTD> engine(dataset, indexer);
+        engine.SetNumThreads(4);
+        vector<Query<TESTD>> queries;
+        for (Scalar lo = 0; lo < 1000; lo += 50) {
+            Query<TESTD> q = MakeQuery();
+            q.filters[0].ranges = {{lo, lo + 150}};
+            queries.push_back(q);
+        }
+        auto visitors = engine.ExecuteBatch(queries, [](size_t) {
+            return std::unique_ptr<Visitor<TESTD>>(new IndexVisitor<TESTD>());
+        });
+        ASSERT_EQ(queries.size(), visitors.size());
+        size_t total = 0;
+        for (size_t i = 0; i < queries.size(); i++) {
+            auto want = Matches(queries[i]);
+            total += want.size();
+            EXPECT_EQ(want, static_cast<IndexVisitor<TESTD>*>(visitors[i].get())->indexes);
+        }
+        EXPECT_GT(total, 0);
+        // The per-thread counters are summed across shards.
+        EXPECT_GE(engine.ScannedPoints(), total);
+
+        // Pipelined execution gives the same results, whatever the queue depth.
+        for (size_t depth : {1, 3}) {
+            vector<Query<TESTD>> copies = queries;
+            auto pipelined = engine.ExecutePipelined(copies, [](size_t) {
+                return std::unique_ptr<Visitor<TESTD>>(new IndexVisitor<TESTD>());
+            }, depth);
+            ASSERT_EQ(queries.size(), pipelined.size());
+            for (size_t i = 0; i < queries.size(); i++) {
+                EXPECT_EQ(static_cast<IndexVisitor<TESTD>*>(visitors[i].get())->indexes,
+                        static_cast<IndexVisitor<TESTD>*>(pipelined[i].get())->indexes);
+            }
+        }
+    }
+
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -4,6 +4,7 @@
 #include "utils.h"
 #include "types.h"
 #include <vector>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 
@@ -14,9 +15,14 @@ namespace test {
     class SingleColumnRewriterTest : public ::testing::Test {
         
         public:
+
+        // A scratch file in the temporary directory, so that test runs leave the tree alone.
+        std::string TempFile(const std::string& name) {
+            return (std::filesystem::temp_directory_path() / name).string();
+        }
         
         std::string TestingFile() {
-            std::string fname = "testing.tmp";
+            std::string fname = TempFile("testing.tmp");
             std::ofstream file;
             file.open(fname, std::ios::trunc | std::ios::out);
             file << "testing" << std::endl;
@@ -26,7 +32,7 @@ namespace test {
 
         // Takes in a vector of pairs of (mapped bucket range) --> (lists of target ranges)
         std::string ContinuousFile(std::vector<std::pair<ScalarRange, std::vector<ScalarRange>>>& spec) {
-            std::string fname = "testing.tmp";
+            std::string fname = TempFile("testing.tmp");
             std::ofstream file;
             file.open(fname, std::ios::trunc | std::ios::out);
             file << "continuous" << std::endl << "0 1" << std::endl;
@@ -43,7 +49,7 @@ namespace test {
         }
 
         std::string CategoricalFile(std::vector<std::pair<Scalar, std::vector<Scalar>>>& spec) {
-            std::string fname = "testing.tmp";
+            std::string fname = TempFile("testing.tmp");
             std::ofstream file;
             file.open(fname, std::ios::trunc | std::ios::out);
             file << "categorical" << std::endl << "0 1" << std::endl;
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+#include "trace.h"
+
+#include "compressed_column_order_dataset.h"
+#include "primary_btree_index.h"
+#include "query_engine.h"
+#include "visitor.h"
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace test {
+
+    const size_t TESTD = 2;
+
+    class TraceTest : public ::testing::Test {
+      protected:
+        void SetUp() override {
+            Trace::Reset();
+            Trace::SetSampling(1);
+        }
+
+        void TearDown() override {
+            Trace::SetSampling(1);
+        }
+    };
+
+    TEST_F(TraceTest, TestCountersAcrossThreads) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; t++) {
+            threads.emplace_back([] {
+                for (size_t i = 0; i < 1000; i++) {
+                    TRACE_COUNT(SecondaryMatches, 2);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        // Counts of threads that exited are kept.
+        EXPECT_EQ(8000, Trace::Snapshot().Counter(TraceCounter::SecondaryMatches));
+        Trace::Reset();
+        EXPECT_EQ(0, Trace::Snapshot().Counter(TraceCounter::SecondaryMatches));
+    }
+
+    TEST_F(TraceTest, TestSampledSpans) {
+        Trace::SetSampling(4);
+        for (size_t i = 0; i < 20; i++) {
+            TracedQuery query;
+            TRACE_COUNT(IndexRanges, 1);
+            Trace::RecordSpan(TraceSpan::RangeScan, 100);
+        }
+        // Spans outside of a query aren't recorded.
+        Trace::RecordSpan(TraceSpan::RangeScan, 100);
+
+        TraceSnapshot snapshot = Trace::Snapshot();
+        EXPECT_EQ(20, snapshot.Counter(TraceCounter::Queries));
+        EXPECT_EQ(20, snapshot.Counter(TraceCounter::IndexRanges));
+        size_t sampled = snapshot.Counter(TraceCounter::SampledQueries);
+        EXPECT_EQ(5, sampled);
+        size_t range_scan = static_cast<size_t>(TraceSpan::RangeScan);
+        EXPECT_EQ(sampled, snapshot.span_count[range_scan]);
+        EXPECT_EQ(100 * sampled, snapshot.span_ns[range_scan]);
+        ASSERT_EQ(sampled, snapshot.recent.size());
+        for (const auto& q : snapshot.recent) {
+            EXPECT_EQ(0, q.id % 4);
+            EXPECT_EQ(100, q.span_ns[range_scan]);
+        }
+
+        Trace::SetSampling(0);
+        {
+            TracedQuery query;
+            EXPECT_FALSE(Trace::Sampled());
+        }
+        EXPECT_EQ(sampled, Trace::Snapshot().recent.size());
+    }
+
+    TEST_F(TraceTest, TestSuspendAndResume) {
+        Trace::BeginQuery();
+        Trace::RecordSpan(TraceSpan::IndexProbe, 10);
+        QueryTrace suspended = Trace::Suspend();
+        EXPECT_FALSE(Trace::Sampled());
+        std::thread scanner([&suspended] {
+            Trace::Resume(suspended);
+            Trace::RecordSpan(TraceSpan::ListScan, 20);
+            Trace::EndQuery();
+        });
+        scanner.join();
+
+        TraceSnapshot snapshot = Trace::Snapshot();
+        EXPECT_EQ(1, snapshot.Counter(TraceCounter::Queries));
+        ASSERT_EQ(1, snapshot.recent.size());
+        EXPECT_EQ(10, snapshot.recent[0].span_ns[static_cast<size_t>(TraceSpan::IndexProbe)]);
+        EXPECT_EQ(20, snapshot.recent[0].span_ns[static_cast<size_t>(TraceSpan::ListScan)]);
+    }
+
+    TEST_F(TraceTest, TestQueryEngineAndExport) {
+        vector<Point<TESTD>> pts;
+        for (Scalar i = 0; i < 5000; i++) {
+            pts.push_back({i % 100, i});
+        }
+        auto indexer = std::make_shared<PrimaryBTreeIndex<TESTD>>(0, 64);
+        indexer->Init(pts.begin(), pts.end());
+        auto dataset = std::make_shared<CompressedColumnOrderDataset<TESTD>>(pts);
+        QueryEngine<TESTD> engine(dataset, indexer);
+        for (size_t i = 0; i < 3; i++) {
+            Query<TESTD> q;
+            q.filters[0] = {.present = true, .is_range = true, .ranges = {{10, 20}}, .values = {}};
+            q.filters[1] = {.present = false, .is_range = false, .ranges = {}, .values = {}};
+            CountVisitor<TESTD> visitor;
+            engine.Execute(q, visitor);
+        }
+        TraceSnapshot snapshot = Trace::Snapshot();
+        EXPECT_EQ(3, snapshot.Counter(TraceCounter::Queries));
+        EXPECT_LE(3, snapshot.Counter(TraceCounter::IndexRanges));
+        EXPECT_EQ(3, snapshot.span_count[static_cast<size_t>(TraceSpan::IndexProbe)]);
+        EXPECT_EQ(3, snapshot.span_count[static_cast<size_t>(TraceSpan::RangeScan)]);
+
+        std::ostringstream json;
+        Trace::WriteJson(json);
+        EXPECT_NE(std::string::npos, json.str().find("\"queries\": 3"));
+        EXPECT_NE(std::string::npos, json.str().find("\"index_probe\": {\"count\": 3"));
+
+        std::ostringstream csv;
+        Trace::WriteCsv(csv);
+        std::istringstream lines(csv.str());
+        std::string line;
+        std::getline(lines, line);
+        EXPECT_EQ("query_id,index_probe_ns,key_lookup_ns,merge_ns,range_scan_ns,list_scan_ns", line);
+        size_t rows = 0;
+        while (std::getline(lines, line)) {
+            rows++;
+        }
+        EXPECT_EQ(3, rows);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}